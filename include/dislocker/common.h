@@ -62,6 +62,14 @@
 
 
 
+/*
+ * Alignment of the buffers, offsets and sizes of the I/O on a volume opened
+ * with O_DIRECT, which covers the logical block size of the usual devices
+ */
+#define DIS_DIRECT_ALIGN 4096
+
+
+
 /*
  * Prototypes of functions from common.c
  */
@@ -50,6 +50,12 @@ typedef enum {
 	DIS_OPT_VOLUME_OFFSET,
 	DIS_OPT_READ_ONLY,
 	DIS_OPT_DONT_CHECK_VOLUME_STATE,
+	DIS_OPT_NB_THREADS,
+	DIS_OPT_CACHE_SIZE,
+	DIS_OPT_DIRECT_IO,
+	DIS_OPT_IDLE_THREADS,
+	DIS_OPT_NTFS_HOLES,
+	DIS_OPT_DISCARD,
 
 	/* Below are options for users of the library (i.e: developers) */
 	DIS_OPT_INITIALIZE_STATE
@@ -53,6 +53,12 @@ typedef enum {
 	 * if mounted using fuse
 	 */
 	DIS_FLAG_DONT_CHECK_VOLUME_STATE = (1 << 1),
+	/* Open the volume with O_DIRECT, not to fill the page cache with it */
+	DIS_FLAG_DIRECT_IO               = (1 << 2),
+	/* Report the NTFS unallocated clusters as holes, see dis_seek() */
+	DIS_FLAG_NTFS_HOLES              = (1 << 3),
+	/* Deallocate the discarded ranges, read all-zero sectors as zeroes */
+	DIS_FLAG_DISCARD                 = (1 << 4),
 } dis_flags_e;
 
 
@@ -99,6 +105,21 @@ typedef struct _dis_cfg {
 	 */
 	dis_flags_e   flags;
 
+	/*
+	 * Number of threads used to dec/encrypt large requests, 0 meaning as many
+	 * as there are online processors
+	 */
+	unsigned int  nb_threads;
+
+	/* Memory, in MiB, used to cache decrypted sectors, 0 meaning no cache */
+	unsigned int  cache_size;
+
+	/*
+	 * Number of idle threads FUSE keeps waiting for requests, 0 meaning as many
+	 * as there are online processors
+	 */
+	unsigned int  idle_threads;
+
 	/* Where dis_initialize() should stop */
 	dis_state_e   init_stop_at;
 } dis_config_t;
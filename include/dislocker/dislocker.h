@@ -35,6 +35,21 @@
  */
 typedef struct _dis_ctx* dis_context_t;
 
+/**
+ * Sequential reader of the decrypted volume, see dis_stream_open() below.
+ */
+typedef struct _dis_stream* dis_stream_t;
+
+/**
+ * One range of a scatter-gather request, see dis_readv() and dis_writev().
+ */
+typedef struct _dis_iovec
+{
+	off_t    offset;
+	size_t   size;
+	uint8_t* buffer;
+} dis_iovec_t;
+
 
 
 /**
@@ -66,6 +81,8 @@ int dis_initialize(dis_context_t dis_ctx);
 /**
  * Once dis_initialize() has been called, this function is able to decrypt the
  * BitLocker-encrypted volume.
+ * This function, enlock(), dis_readv() and dis_writev() may be called by
+ * several threads at once on the same context.
  *
  * @param dis_ctx The same parameter passed to dis_initialize.
  * @param offset The offset from where to start decrypting.
@@ -77,6 +94,8 @@ int dislock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size);
 /**
  * Once dis_initialize() has been called, this function is able to encrypt data
  * to the BitLocker-encrypted volume.
+ * Writes on the same sectors are run one after the other, so that none of them
+ * is lost when they only write parts of these sectors.
  *
  * @param dis_ctx The same parameter passed to dis_initialize.
  * @param offset The offset where to put the data.
@@ -85,6 +104,65 @@ int dislock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size);
  */
 int enlock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size);
 
+/**
+ * Deallocate a range of the volume, as fallocate(2)'s FALLOC_FL_PUNCH_HOLE
+ * does: the range is read as zeroes afterward and the storage behind the
+ * volume can reclaim its whole sectors. The parts of sectors at both ends are
+ * written as zeroes. The metadata is never deallocated.
+ * As deallocated sectors are told apart by being all zeroes on the disk, this
+ * is only done if the DIS_OPT_DISCARD option is set, any all-zero sector of
+ * the volume being then read as zeroes.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param offset The offset where the range begins.
+ * @param size The size of the range.
+ * @return 0 on success, or a negative errno value on failure, -EOPNOTSUPP if
+ * the DIS_OPT_DISCARD option isn't set or the volume can't deallocate sectors
+ */
+int dis_discard(dis_context_t dis_ctx, off_t offset, off_t size);
+
+/**
+ * Find data or a hole in the volume, as lseek(2)'s SEEK_DATA and SEEK_HOLE do.
+ * The metadata, which is read as zeroes, is a hole. So are the clusters the
+ * NTFS filesystem doesn't use if the DIS_OPT_NTFS_HOLES option is set, even if
+ * they aren't read as zeroes.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param offset The offset to start looking from.
+ * @param whence SEEK_DATA to find the next data, SEEK_HOLE the next hole. The
+ * volume's end counts as a hole.
+ * @return The offset found, or a negative errno value on failure, -ENXIO if
+ * offset is past the volume's end or if there's no data after it
+ */
+off_t dis_seek(dis_context_t dis_ctx, off_t offset, int whence);
+
+/**
+ * Decrypt several ranges of the volume at once. The ranges are sorted and
+ * the sectors they need are merged, so that each sector is read once and all
+ * the reads are submitted together. The decryption is shared between the
+ * worker threads.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param iov The ranges to decrypt, each one with its own buffer.
+ * @param nb_iov The number of ranges.
+ * @return The total number of bytes decrypted, or a negative errno value on
+ * failure
+ */
+ssize_t dis_readv(dis_context_t dis_ctx, const dis_iovec_t* iov, size_t nb_iov);
+
+/**
+ * Encrypt several ranges to the volume at once. The sectors of the ranges are
+ * merged and written together. When ranges overlap, the last one in the list
+ * wins, as if they were written one after the other.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param iov The ranges to encrypt, each one with its own buffer.
+ * @param nb_iov The number of ranges.
+ * @return The total number of bytes encrypted, or a negative errno value on
+ * failure
+ */
+ssize_t dis_writev(dis_context_t dis_ctx, const dis_iovec_t* iov, size_t nb_iov);
+
 /**
  * Destroy dislocker structures. This is important to call this function after
  * dislocker is not needed -- if dis_initialize() has been called -- in order
@@ -100,5 +178,81 @@ int dis_destroy(dis_context_t dis_ctx);
  */
 int get_fvevol_fd(dis_context_t dis_ctx);
 
+/**
+ * Retrieve the number of sectors found, or not found, in the cache of
+ * decrypted sectors since dis_initialize(). Both are 0 if the cache is not
+ * used, see the DIS_OPT_CACHE_SIZE option.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param hits Where to put the number of sectors found in the cache.
+ * @param misses Where to put the number of sectors not found in the cache.
+ */
+void dis_get_cache_stats(dis_context_t dis_ctx, uint64_t* hits, uint64_t* misses);
+
+/**
+ * Run a function on one of the threads dislock() and enlock() share large
+ * requests with, and return without waiting for it. The function usually calls
+ * dislock() or enlock() itself and hands their result over to whoever waits
+ * for it. Without such threads, see the DIS_OPT_NB_THREADS option, the
+ * function is run before returning.
+ * dis_destroy() waits for the functions queued to be over.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param fn The function to run.
+ * @param arg The argument given to fn.
+ * @return 0 once the function is queued, or a negative errno value on failure
+ */
+int dis_run_async(dis_context_t dis_ctx, void (*fn)(void* arg), void* arg);
+
+/**
+ * Wait for all the functions given to dis_run_async() to be over.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ */
+void dis_wait_async(dis_context_t dis_ctx);
+
+/**
+ * Open a stream to read the decrypted volume sequentially, from the given
+ * offset up to the end of the volume. A background thread decrypts the next
+ * chunks while the caller consumes the current one, and the kernel is asked
+ * to read ahead the chunks after it.
+ * The memory used is bounded by nb_chunks * chunk_size. As the stream calls
+ * dislock() from its own thread, the context has to stay valid until
+ * dis_stream_close() is called.
+ *
+ * @param dis_ctx The same parameter passed to dis_initialize.
+ * @param offset The offset from where to start decrypting.
+ * @param chunk_size The size of each chunk, rounded up to a sector size. 0 to
+ * use the default one (1MiB).
+ * @param nb_chunks The number of chunks in flight. 0 to use the default (4),
+ * 2 or more for the decryption to overlap with the caller's work.
+ * @return The stream or NULL on failure
+ */
+dis_stream_t dis_stream_open(
+	dis_context_t dis_ctx,
+	off_t offset,
+	size_t chunk_size,
+	unsigned int nb_chunks
+);
+
+/**
+ * Get the next chunk of decrypted data. The chunk is owned by the stream and
+ * remains valid until the next call to dis_stream_next() or
+ * dis_stream_close().
+ *
+ * @param stream The stream returned by dis_stream_open().
+ * @param chunk Where to put the address of the decrypted data.
+ * @return The size of the chunk, 0 at the end of the volume, or a negative
+ * errno value on failure
+ */
+ssize_t dis_stream_next(dis_stream_t stream, const uint8_t** chunk);
+
+/**
+ * Stop a stream and free its memory, whether or not its end has been reached.
+ *
+ * @param stream The stream returned by dis_stream_open().
+ */
+void dis_stream_close(dis_stream_t stream);
+
 
 #endif /* DISLOCKER_MAIN_H */
@@ -29,6 +29,7 @@
 #include "dislocker/config.priv.h"
 #include "dislocker/inouts/inouts.priv.h"
 #include "dislocker/metadata/metadata.priv.h"
+#include "dislocker/ntfs/bitmap.h"
 
 
 
@@ -73,6 +74,9 @@ struct _dis_ctx {
 
 	/* The file descriptor to the encrypted volume */
 	int fve_fd;
+
+	/* The filesystem's free clusters, if they're reported as holes */
+	dis_ntfs_bitmap_t ntfs_bitmap;
 };
 
 
@@ -0,0 +1,102 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_AES_NI_H
+#define DIS_AES_NI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * The AES-NI kernels are built on x86 with compilers knowing about the target
+ * attribute, whether or not the CPU running them has the instructions: see
+ * dis_aesni_available()
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define DIS_HAVE_AESNI 1
+#else
+#  define DIS_HAVE_AESNI 0
+#endif
+
+
+/* Round keys of AES-256, the largest one */
+#define DIS_AESNI_MAX_ROUND_KEYS 15
+
+
+/**
+ * An expanded key, as used by the AES-NI instructions
+ */
+typedef struct _dis_aesni_key
+{
+	uint8_t      round_keys[DIS_AESNI_MAX_ROUND_KEYS * 16];
+	unsigned int nb_rounds;
+} dis_aesni_key_t;
+
+
+
+/*
+ * Prototypes
+ */
+int dis_aesni_available(void);
+
+int dis_aesni_set_key(
+	dis_aesni_key_t* enc_key,
+	dis_aesni_key_t* dec_key,
+	const uint8_t* key,
+	unsigned int key_bits
+);
+
+void dis_aesni_crypt_xts(
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	size_t length,
+	const uint8_t* iv,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+void dis_aesni_crypt_block(
+	const dis_aesni_key_t* key,
+	int encrypt,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+void dis_aesni_crypt_ecb(
+	const dis_aesni_key_t* key,
+	int encrypt,
+	size_t nb_blocks,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+void dis_aesni_decrypt_cbc(
+	const dis_aesni_key_t* dec_key,
+	size_t length,
+	const uint8_t* iv,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+#endif /* DIS_AES_NI_H */
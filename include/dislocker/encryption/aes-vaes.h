@@ -0,0 +1,94 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_AES_VAES_H
+#define DIS_AES_VAES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dislocker/encryption/aes-ni.h"
+
+
+/*
+ * The VAES kernels need a compiler knowing about the vaes and vpclmulqdq
+ * targets (GCC 8 and clang 6 onward). Whether the CPU running them has the
+ * instructions is told by dis_vaes_width().
+ */
+#if DIS_HAVE_AESNI && \
+    ((defined(__clang__) && __clang_major__ >= 6) || \
+     (!defined(__clang__) && __GNUC__ >= 8))
+#  define DIS_HAVE_VAES 1
+#else
+#  define DIS_HAVE_VAES 0
+#endif
+
+
+/* Width, in bits, of the vectors the kernels run on */
+#define DIS_VAES_NONE 0
+#define DIS_VAES_256  256
+#define DIS_VAES_512  512
+
+/* Sector sizes have to be a multiple of this for the kernels to be used */
+#define DIS_VAES_SECTOR_ALIGN 64
+
+
+
+/*
+ * Prototypes
+ */
+unsigned int dis_vaes_width(void);
+
+void dis_vaes_crypt_xts_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_tweak,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+void dis_vaes_decrypt_cbc_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* dec_key,
+	const dis_aesni_key_t* iv_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+void dis_vaes_encrypt_cbc_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* enc_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output
+);
+
+#endif /* DIS_AES_VAES_H */
@@ -0,0 +1,124 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef SSL_BINDINGS_H
+#define SSL_BINDINGS_H
+
+/*
+ * Here stand the bindings for the Linux kernel's crypto API, reached through
+ * AF_ALG sockets. SHA-256 isn't worth a round trip to the kernel, dislocker's
+ * own is used.
+ */
+#include <stddef.h>
+
+#define DIS_AFALG_MAX_KEY_BYTES 32
+
+#define DIS_AFALG_CIPHER_ECB 0
+#define DIS_AFALG_CIPHER_CBC 1
+#define DIS_AFALG_CIPHER_XTS 2
+#define DIS_AFALG_NB_CIPHERS 3
+
+
+typedef struct _dis_afalg_aes_ctx
+{
+	unsigned char key[DIS_AFALG_MAX_KEY_BYTES];
+	size_t        key_len;
+
+	/*
+	 * One operation socket per cipher, opened and keyed on its first use and
+	 * kept until the key changes: bit i of opened tells whether ops[i] is
+	 */
+	int           ops[DIS_AFALG_NB_CIPHERS];
+	unsigned int  opened;
+
+	/* The pipe the data is spliced through, once pipe_opened */
+	int           pipe[2];
+	int           pipe_opened;
+
+	/* The tweak key the XTS socket was keyed with */
+	unsigned char xts_tweak[DIS_AFALG_MAX_KEY_BYTES];
+	size_t        xts_tweak_len;
+} dis_afalg_aes_ctx;
+
+
+/*
+ * Prototypes
+ */
+int dis_afalg_set_key(dis_afalg_aes_ctx* ctx, const unsigned char* key, unsigned int key_bits);
+
+void dis_afalg_free(dis_afalg_aes_ctx* ctx);
+
+int dis_afalg_crypt(
+	dis_afalg_aes_ctx* ctx,
+	int cipher,
+	int mode,
+	size_t length,
+	const unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output
+);
+
+int dis_afalg_crypt_xts(
+	dis_afalg_aes_ctx* crypt_ctx,
+	dis_afalg_aes_ctx* tweak_ctx,
+	int mode,
+	size_t length,
+	const unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output
+);
+
+void dis_sha256(const unsigned char* input, size_t length, unsigned char* output);
+
+
+#define SHA256(input, len, output)        dis_sha256(input, len, output)
+
+/* Here stand the bindings for AES functions and contexts */
+#  define AES_CONTEXT                     dis_afalg_aes_ctx
+/*
+ * An operation socket deals with a request at a time, so a context can't be
+ * used by several threads at once
+ */
+#  define AES_CONTEXT_IS_REENTRANT        0
+/* The kernel does the AES, dislocker's AES-NI/VAES kernels don't take over */
+#  define AES_ALLOW_CPU_KERNELS           0
+#  define AES_ENCRYPT                     1
+#  define AES_DECRYPT                     0
+#  define AES_SETENC_KEY(ctx, key, size)  dis_afalg_set_key(ctx, key, size)
+#  define AES_SETDEC_KEY(ctx, key, size)  dis_afalg_set_key(ctx, key, size)
+#  define AES_FREE(ctx)                   dis_afalg_free(ctx)
+#  define AES_ECB_ENC(ctx, mode, in, out) \
+                                          dis_afalg_crypt(ctx, DIS_AFALG_CIPHER_ECB, mode, 16, NULL, in, out)
+/* Several blocks go in a single request */
+#  define AES_ECB_BLOCKS(ctx, mode, nb_blocks, in, out) \
+                                          dis_afalg_crypt(ctx, DIS_AFALG_CIPHER_ECB, mode, 16 * (nb_blocks), NULL, in, out)
+#  define AES_CBC(ctx, mode, size, iv, in, out) \
+                                          dis_afalg_crypt(ctx, DIS_AFALG_CIPHER_CBC, mode, size, iv, in, out)
+
+#include "dislocker/encryption/aes-xts.h"
+#  define AES_XEX(ctx1, ctx2, mode, size, iv, in, out) \
+                                          dis_aes_crypt_xex(ctx1, ctx2, mode, size, iv, in, out)
+#  define AES_XTS(ctx1, ctx2, mode, size, iv, in, out) \
+                                          dis_afalg_crypt_xts(ctx1, ctx2, mode, size, iv, in, out)
+
+
+#endif /* SSL_BINDINGS_H */
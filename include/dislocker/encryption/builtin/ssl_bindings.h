@@ -0,0 +1,127 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef SSL_BINDINGS_H
+#define SSL_BINDINGS_H
+
+/*
+ * Here stand the bindings for dislocker's own AES and SHA-256, for builds which
+ * don't depend on any crypto library
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dislocker/encryption/aes-ni.h"
+
+
+/* Round keys of AES-256, the largest one */
+#define DIS_BUILTIN_MAX_ROUND_KEYS 15
+
+/* Blocks the portable code works on at once, see aes-builtin.c */
+#define DIS_BUILTIN_LANES 4
+
+/*
+ * Setting this variable to "portable" keeps the AES-NI and VAES kernels out,
+ * to test the portable code on CPUs which have the instructions
+ */
+#define DIS_BUILTIN_AES_ENV "DISLOCKER_BUILTIN_AES"
+
+
+typedef struct _dis_builtin_aes_ctx
+{
+	/*
+	 * Round keys of the portable code, bitsliced: one 64 bits word per bit of
+	 * the bytes, holding the round key once per lane
+	 */
+	uint64_t     round_keys[DIS_BUILTIN_MAX_ROUND_KEYS][8];
+	unsigned int nb_rounds;
+
+	/*
+	 * Schedule of the direction the key was set for, for the AES-NI kernels;
+	 * nb_rounds is 0 if they can't be used
+	 */
+	dis_aesni_key_t ni;
+
+	/* Width of the VAES kernels, DIS_VAES_NONE if there's none */
+	unsigned int vaes_width;
+} dis_builtin_aes_ctx;
+
+
+/*
+ * Prototypes
+ */
+int dis_builtin_aes_set_key(dis_builtin_aes_ctx* ctx, const unsigned char* key, unsigned int key_bits, int mode);
+
+void dis_builtin_aes_free(dis_builtin_aes_ctx* ctx);
+
+int dis_builtin_aes_crypt_ecb(
+	dis_builtin_aes_ctx* ctx,
+	int mode,
+	const unsigned char* input,
+	unsigned char* output
+);
+
+int dis_builtin_aes_crypt_cbc(
+	dis_builtin_aes_ctx* ctx,
+	int mode,
+	size_t length,
+	const unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output
+);
+
+int dis_builtin_aes_crypt_xts(
+	dis_builtin_aes_ctx* crypt_ctx,
+	dis_builtin_aes_ctx* tweak_ctx,
+	int mode,
+	size_t length,
+	unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output
+);
+
+void dis_sha256(const unsigned char* input, size_t length, unsigned char* output);
+
+
+#define SHA256(input, len, output)        dis_sha256(input, len, output)
+
+/* Here stand the bindings for AES functions and contexts */
+#  define AES_CONTEXT                     dis_builtin_aes_ctx
+/* Contexts are only read once the keys are set, threads can share them */
+#  define AES_CONTEXT_IS_REENTRANT        1
+#  define AES_ENCRYPT                     1
+#  define AES_DECRYPT                     0
+#  define AES_SETENC_KEY(ctx, key, size)  dis_builtin_aes_set_key(ctx, key, size, AES_ENCRYPT)
+#  define AES_SETDEC_KEY(ctx, key, size)  dis_builtin_aes_set_key(ctx, key, size, AES_DECRYPT)
+#  define AES_FREE(ctx)                   dis_builtin_aes_free(ctx)
+#  define AES_ECB_ENC(ctx, mode, in, out) dis_builtin_aes_crypt_ecb(ctx, mode, in, out)
+#  define AES_CBC(ctx, mode, size, iv, in, out) \
+                                          dis_builtin_aes_crypt_cbc(ctx, mode, size, iv, in, out)
+
+#include "dislocker/encryption/aes-xts.h"
+#  define AES_XEX(ctx1, ctx2, mode, size, iv, in, out) \
+                                          dis_aes_crypt_xex(ctx1, ctx2, mode, size, iv, in, out)
+#  define AES_XTS(ctx1, ctx2, mode, size, iv, in, out) \
+                                          dis_builtin_aes_crypt_xts(ctx1, ctx2, mode, size, iv, in, out)
+
+
+#endif /* SSL_BINDINGS_H */
@@ -47,7 +47,7 @@ int decrypt_key(
 	void** output
 );
 
-void decrypt_cbc_without_diffuser(
+int decrypt_cbc_without_diffuser(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -55,7 +55,7 @@ void decrypt_cbc_without_diffuser(
 	uint8_t* buffer
 );
 
-void decrypt_cbc_with_diffuser(
+int decrypt_cbc_with_diffuser(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -63,7 +63,7 @@ void decrypt_cbc_with_diffuser(
 	uint8_t* buffer
 );
 
-void decrypt_xts(
+int decrypt_cbc_without_diffuser_aesni(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -71,8 +71,103 @@ void decrypt_xts(
 	uint8_t* buffer
 );
 
+int decrypt_cbc_with_diffuser_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_xts(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_xts_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_cbc_without_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_cbc_with_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_cbc_without_diffuser_sectors_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_cbc_with_diffuser_sectors_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_xts_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_cbc_without_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int decrypt_cbc_with_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
 int decrypt_sector(dis_crypt_t crypt, uint8_t* sector, off_t sector_address, uint8_t* buffer);
 
+int decrypt_sectors(
+	dis_crypt_t crypt,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
 
 
 #endif /* DECRYPT_H */
@@ -24,9 +24,14 @@
 #define DIFFUSER_H
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 
+/* Number of sectors the batched diffusers work on at once */
+#define DIS_DIFFUSER_LANES 8
+
+
 /*
  * Prototypes
  */
@@ -38,6 +43,10 @@ void diffuserA_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer);
 
 void diffuserB_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer);
 
+void diffuser_decrypt_sectors(uint8_t* sectors, uint16_t sector_size, size_t nb_sectors);
+
+void diffuser_encrypt_sectors(uint8_t* sectors, uint16_t sector_size, size_t nb_sectors);
+
 
 
 
@@ -23,8 +23,12 @@
 #ifndef ENCOMMON_PRIV_H
 #define ENCOMMON_PRIV_H
 
+#include <pthread.h>
 
 #include "dislocker/encryption/encommon.h"
+#include "dislocker/encryption/aes-ni.h"
+#include "dislocker/encryption/aes-vaes.h"
+#include "dislocker/encryption/diffuser.h"
 
 #include "ssl_bindings.h"
 
@@ -41,37 +45,144 @@ struct _aes_contexts {
 
 	AES_CONTEXT TWEAK_E_ctx;
 	AES_CONTEXT TWEAK_D_ctx; /* useless, never used */
+
+	/*
+	 * The same keys for the AES-NI kernels, only set if the CPU has them: their
+	 * nb_rounds is 0 otherwise
+	 */
+	dis_aesni_key_t FVEK_E_ni;
+	dis_aesni_key_t FVEK_D_ni;
+	dis_aesni_key_t TWEAK_E_ni;
+
+	/* Width of the VAES kernels the *_sectors_fn use, see dis_vaes_width() */
+	unsigned int vaes_width;
 };
 
 
 
+/*
+ * Batches of sectors of CBC volumes are worked on this many sectors at a time:
+ * their IVs and sector keys are computed at once, then with the diffuser they
+ * go through each stage while they stay in the cache
+ */
+#define DIS_CBC_CHUNK_SECTORS (2 * DIS_DIFFUSER_LANES)
+
+/*
+ * The threads' own contexts are aligned on, and span whole, cache lines so
+ * that two threads never write on the same line
+ */
+#define DIS_CACHE_LINE_SIZE 64
+
+/* Largest FVEK there is: two 256-bit keys */
+#define DIS_FVEK_MAX_SIZE 64
+
+
+/**
+ * Contexts of a thread, for the backends whose contexts can't be used by two
+ * threads at once. They're keyed on the first request of the thread, and
+ * reused by another one once it exits.
+ */
+typedef struct _aes_replica {
+	struct _aes_contexts ctx;
+
+	/* The crypt structure it's a replica of, for the thread's exit */
+	struct _dis_crypt*   crypt;
+	int                  in_use;
+
+	struct _aes_replica* next;
+} dis_aes_replica_t;
+
+
 typedef enum {
 	DIS_ENC_FLAG_USE_DIFFUSER = (1 << 0)
 } dis_enc_flags_e;
 
 struct _dis_crypt {
+	/*
+	 * Keyed by dis_crypt_set_fvekey(), then only read: threads share it if the
+	 * backend's contexts are reentrant, they use their replica otherwise
+	 */
 	struct _aes_contexts ctx;
 
 	dis_enc_flags_e flags;
 
 	uint16_t sector_size;
 
-	void (*decrypt_fn)(
+	/* En/decrypt a sector, returning FALSE if the backend failed to */
+	int (*decrypt_fn)(
 		dis_aes_contexts_t* ctx,
 		uint16_t sector_size,
 		uint8_t* sector,
 		off_t sector_address,
 		uint8_t* buffer
 	);
-	void (*encrypt_fn)(
+	int (*encrypt_fn)(
 		dis_aes_contexts_t* ctx,
 		uint16_t sector_size,
 		uint8_t* sector,
 		off_t sector_address,
 		uint8_t* buffer
 	);
+
+	/*
+	 * Same as above, on consecutive sectors at once, so that kernels can work
+	 * on several sectors in parallel and the IVs of CBC volumes can be
+	 * computed at once. NULL when there's no such kernel, the functions above
+	 * being called for each sector then.
+	 */
+	int (*decrypt_sectors_fn)(
+		dis_aes_contexts_t* ctx,
+		uint16_t sector_size,
+		size_t nb_sectors,
+		uint8_t* sectors,
+		off_t sector_address,
+		uint8_t* buffer
+	);
+	int (*encrypt_sectors_fn)(
+		dis_aes_contexts_t* ctx,
+		uint16_t sector_size,
+		size_t nb_sectors,
+		uint8_t* sectors,
+		off_t sector_address,
+		uint8_t* buffer
+	);
+
+	/* What the replicas are keyed with */
+	uint16_t algorithm;
+	uint8_t  fvekey[DIS_FVEK_MAX_SIZE];
+
+	/* Each thread's replica, when the backend needs them */
+	int                has_replicas;
+	pthread_key_t      replica_key;
+	pthread_mutex_t    replicas_lock;
+	dis_aes_replica_t* replicas;
 };
 
 
 
+/*
+ * Prototypes
+ */
+dis_aes_contexts_t* dis_crypt_context(dis_crypt_t crypt);
+
+int dis_crypt_sector_ivs(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	off_t first_address,
+	uint8_t* ivs
+);
+
+int dis_crypt_sector_keys(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	off_t first_address,
+	uint8_t* sector_keys
+);
+
+void dis_crypt_xor_sector_key(uint8_t* buffer, uint16_t sector_size, const uint8_t* sector_key);
+
+
+
 #endif /* ENCOMMON_PRIV_H */
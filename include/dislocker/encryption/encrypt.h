@@ -32,7 +32,7 @@
 /*
  * Prototypes
  */
-void encrypt_cbc_without_diffuser(
+int encrypt_cbc_without_diffuser(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -40,7 +40,7 @@ void encrypt_cbc_without_diffuser(
 	uint8_t* buffer
 );
 
-void encrypt_cbc_with_diffuser(
+int encrypt_cbc_with_diffuser(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -48,7 +48,7 @@ void encrypt_cbc_with_diffuser(
 	uint8_t* buffer
 );
 
-void encrypt_xts(
+int encrypt_xts(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -56,7 +56,68 @@ void encrypt_xts(
 	uint8_t* buffer
 );
 
+int encrypt_xts_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int encrypt_cbc_without_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int encrypt_cbc_with_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int encrypt_xts_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int encrypt_cbc_without_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
+int encrypt_cbc_with_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
 int encrypt_sector(dis_crypt_t crypt, uint8_t* sector, off_t sector_address, uint8_t* buffer);
 
+int encrypt_sectors(
+	dis_crypt_t crypt,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer
+);
+
 
 #endif /* ENCRYPT_H */
@@ -33,12 +33,14 @@
 
 /* Here stand the bindings for AES functions and contexts */
 #  define AES_CONTEXT                     mbedtls_aes_context
+/* Contexts are only read once the keys are set, threads can share them */
+#  define AES_CONTEXT_IS_REENTRANT        1
 #  define AES_SETENC_KEY(ctx, key, size)  mbedtls_aes_setkey_enc(ctx, key, size)
 #  define AES_SETDEC_KEY(ctx, key, size)  mbedtls_aes_setkey_dec(ctx, key, size)
 #  define AES_FREE(ctx)                   mbedtls_aes_free(ctx)
 #  define AES_ECB_ENC(ctx, mode, in, out) mbedtls_aes_crypt_ecb(ctx, mode, in, out)
 #  define AES_CBC(ctx, mode, size, iv, in, out) \
-                                          mbedtls_aes_crypt_cbc(ctx, mode, size, iv, in, out);
+                                          mbedtls_aes_crypt_cbc(ctx, mode, size, iv, in, out)
 #  define AES_ENCRYPT                     MBEDTLS_AES_ENCRYPT
 #  define AES_DECRYPT                     MBEDTLS_AES_DECRYPT
 
@@ -23,6 +23,7 @@
 #ifndef SSL_BINDINGS_H
 #define SSL_BINDINGS_H
 
+#include <stdio.h>
 #include <string.h>
 
 #include <openssl/aes.h>
@@ -32,31 +33,51 @@
 
 #define DIS_OSSL_MAX_AES_KEY_BYTES 512/8
 
+#define DIS_OSSL_CIPHER_ECB 0
+#define DIS_OSSL_CIPHER_CBC 1
+#define DIS_OSSL_CIPHER_XTS 2
+#define DIS_OSSL_NB_CIPHERS 3
+
+/* OpenSSL 3 fetches ciphers from its providers, the EVP_aes_*() are legacy */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  define DIS_OSSL_FETCH_CIPHERS 1
+#else
+#  define DIS_OSSL_FETCH_CIPHERS 0
+#endif
+
 typedef struct dis_ossl_aes_ctx dis_ossl_aes_ctx;
 struct dis_ossl_aes_ctx {
 	unsigned char key[DIS_OSSL_MAX_AES_KEY_BYTES];
 	size_t len;
-	int enc_dec;
-	EVP_CIPHER_CTX *ossl_ctx;
+	/*
+	 * One context per mode and direction, keyed on its first use and kept
+	 * until the key changes, so that a call only sets the IV
+	 */
+	EVP_CIPHER_CTX *ossl_ctx[DIS_OSSL_NB_CIPHERS][2];
+	/* The tweak key the XTS contexts were keyed with */
+	unsigned char xts_tweak[DIS_OSSL_MAX_AES_KEY_BYTES];
+	size_t xts_tweak_len;
 };
 
 #define AES_CONTEXT                     dis_ossl_aes_ctx
 
-#define DIS_OSSL_CIPHER_ECB 0
-#define DIS_OSSL_CIPHER_CBC 1
+/*
+ * The EVP contexts carry the IV and the chaining state of the call going on,
+ * so a context can't be used by several threads at once
+ */
+#define AES_CONTEXT_IS_REENTRANT        0
 
-#if defined(EVP_CIPH_XTS_MODE)
-static inline const EVP_CIPHER *dis_ossl_get_xts_cipher(size_t key_len)
+#if DIS_OSSL_FETCH_CIPHERS
+static inline EVP_CIPHER *dis_ossl_fetch_cipher(size_t key_len, int ossl_mode)
 {
-	switch (key_len)
-	{
-		case 16: return EVP_aes_128_xts();
-		case 32: return EVP_aes_256_xts();
-		default: return NULL;
-	}
-}
-#endif
+	static const char *modes[DIS_OSSL_NB_CIPHERS] = { "ECB", "CBC", "XTS" };
+	char name[16];
+
+	snprintf(name, sizeof(name), "AES-%u-%s", (unsigned int)(key_len * 8), modes[ossl_mode]);
 
+	return EVP_CIPHER_fetch(NULL, name, NULL);
+}
+#else
 static inline const EVP_CIPHER *dis_ossl_get_cipher(size_t key_len, int ossl_mode)
 {
 	if (ossl_mode == DIS_OSSL_CIPHER_ECB)
@@ -79,36 +100,109 @@ static inline const EVP_CIPHER *dis_ossl_get_cipher(size_t key_len, int ossl_mod
 			default: return NULL;
 		}
 	}
+#if defined(EVP_CIPH_XTS_MODE)
+	else if (ossl_mode == DIS_OSSL_CIPHER_XTS)
+	{
+		switch (key_len)
+		{
+			case 16: return EVP_aes_128_xts();
+			case 32: return EVP_aes_256_xts();
+			default: return NULL;
+		}
+	}
+#endif
 	return NULL;
 }
+#endif
+
+/*
+ * Free the contexts of a mode, in both directions, so that they're keyed again
+ * on their next use
+ */
+static inline void dis_ossl_reset_mode(AES_CONTEXT *ctx, int ossl_mode)
+{
+	EVP_CIPHER_CTX_free(ctx->ossl_ctx[ossl_mode][0]);
+	EVP_CIPHER_CTX_free(ctx->ossl_ctx[ossl_mode][1]);
+	ctx->ossl_ctx[ossl_mode][0] = NULL;
+	ctx->ossl_ctx[ossl_mode][1] = NULL;
+}
 
-static inline int dis_ossl_set_key(AES_CONTEXT *ctx, const unsigned char *key, size_t key_bits, int enc_dec)
+/*
+ * Get the context of a mode and direction, creating and keying it if it's its
+ * first use. key_len is the size of the AES key, the one given being twice as
+ * large for XTS.
+ */
+static inline EVP_CIPHER_CTX *dis_ossl_keyed_ctx(
+	AES_CONTEXT *ctx,
+	int ossl_mode,
+	int encrypt,
+	const unsigned char *key,
+	size_t key_len)
+{
+	EVP_CIPHER_CTX **slot = &ctx->ossl_ctx[ossl_mode][encrypt ? 1 : 0];
+	int ok = 0;
+
+	if (*slot)
+		return *slot;
+
+#if DIS_OSSL_FETCH_CIPHERS
+	EVP_CIPHER *ossl_cipher = dis_ossl_fetch_cipher(key_len, ossl_mode);
+#else
+	const EVP_CIPHER *ossl_cipher = dis_ossl_get_cipher(key_len, ossl_mode);
+#endif
+	if (!ossl_cipher)
+		return NULL;
+
+	*slot = EVP_CIPHER_CTX_new();
+	if (*slot)
+		ok = EVP_CipherInit_ex(*slot, ossl_cipher, NULL, key, NULL, encrypt) &&
+		     EVP_CIPHER_CTX_set_padding(*slot, 0);
+
+#if DIS_OSSL_FETCH_CIPHERS
+	/* The context holds its own reference */
+	EVP_CIPHER_free(ossl_cipher);
+#endif
+
+	if (!ok)
+	{
+		EVP_CIPHER_CTX_free(*slot);
+		*slot = NULL;
+	}
+
+	return *slot;
+}
+
+static inline int dis_ossl_set_key(AES_CONTEXT *ctx, const unsigned char *key, size_t key_bits)
 {
 	size_t key_len = key_bits / 8;
+	int    loop    = 0;
+
 	if (key_len > sizeof(ctx->key))
 		return 1;
-	if (!ctx->ossl_ctx)
-	{
-		ctx->ossl_ctx = EVP_CIPHER_CTX_new();
-		if (!ctx->ossl_ctx)
-			return 1;
-	}
+
+	/* The contexts keyed with the previous key are useless now */
+	for (loop = 0; loop < DIS_OSSL_NB_CIPHERS; loop++)
+		dis_ossl_reset_mode(ctx, loop);
 
 	memcpy(ctx->key, key, key_len);
 	ctx->len = key_len;
-	ctx->enc_dec = enc_dec;
 
 	return 0;
 }
 
 static inline void dis_ossl_free(AES_CONTEXT *ctx)
 {
+	int loop = 0;
+
 	if (!ctx)
 		return;
 
-	EVP_CIPHER_CTX_free(ctx->ossl_ctx);
-	ctx->ossl_ctx = NULL;
+	for (loop = 0; loop < DIS_OSSL_NB_CIPHERS; loop++)
+		dis_ossl_reset_mode(ctx, loop);
+
 	OPENSSL_cleanse(ctx->key, sizeof(ctx->key));
+	OPENSSL_cleanse(ctx->xts_tweak, sizeof(ctx->xts_tweak));
+	ctx->xts_tweak_len = 0;
 }
 
 static inline int dis_ossl_aes_crypt(
@@ -122,21 +216,18 @@ static inline int dis_ossl_aes_crypt(
 {
 	int out_len = 0;
 
-	const EVP_CIPHER *ossl_cipher = dis_ossl_get_cipher(ctx->len, cipher);
-	if (!ossl_cipher)
-		return 1;
-
-	EVP_CIPHER_CTX *ossl_ctx = ctx->ossl_ctx;
+	EVP_CIPHER_CTX *ossl_ctx = dis_ossl_keyed_ctx(
+		ctx, cipher, mode == AES_ENCRYPT, ctx->key, ctx->len
+	);
 	if (!ossl_ctx)
 		return 1;
 
-	if (!EVP_CIPHER_CTX_reset(ossl_ctx))
-		return 1;
-
-	if (!EVP_CipherInit_ex(ossl_ctx, ossl_cipher, NULL, ctx->key, iv, mode == AES_ENCRYPT)) return 1;
-	if (!EVP_CIPHER_CTX_set_padding(ossl_ctx, 0)) return 1;
+	/*
+	 * Only the IV changes from a call to another, the key schedule is kept.
+	 * Without padding nor partial blocks, there's nothing left to finalize.
+	 */
+	if (iv && !EVP_CipherInit_ex(ossl_ctx, NULL, NULL, NULL, iv, -1)) return 1;
 	if (!EVP_CipherUpdate(ossl_ctx, output, &out_len, input, size)) return 1;
-	if (!EVP_CipherFinal_ex(ossl_ctx, &output[out_len], &out_len)) return 1;
 
 	return 0;
 }
@@ -152,33 +243,44 @@ static inline int dis_ossl_aes_crypt_xts(
 	unsigned char *output)
 {
 	int out_len = 0;
-	unsigned char xts_key[DIS_OSSL_MAX_AES_KEY_BYTES] = {0};
+	int encrypt = mode == AES_ENCRYPT;
+	unsigned char xts_key[2 * DIS_OSSL_MAX_AES_KEY_BYTES];
 
-	const EVP_CIPHER *ossl_cipher = dis_ossl_get_xts_cipher(crypt_ctx->len);
-	if (!ossl_cipher)
-		return 1;
+	/* The XTS contexts hold both keys, they're keyed again if the tweak changed */
+	if (crypt_ctx->xts_tweak_len != tweak_ctx->len ||
+	    memcmp(crypt_ctx->xts_tweak, tweak_ctx->key, tweak_ctx->len) != 0)
+	{
+		dis_ossl_reset_mode(crypt_ctx, DIS_OSSL_CIPHER_XTS);
+		memcpy(crypt_ctx->xts_tweak, tweak_ctx->key, tweak_ctx->len);
+		crypt_ctx->xts_tweak_len = tweak_ctx->len;
+	}
 
-	EVP_CIPHER_CTX *ossl_ctx = crypt_ctx->ossl_ctx;
+	EVP_CIPHER_CTX *ossl_ctx = crypt_ctx->ossl_ctx[DIS_OSSL_CIPHER_XTS][encrypt];
 	if (!ossl_ctx)
-		return 1;
+	{
+		memcpy(xts_key, crypt_ctx->key, crypt_ctx->len);
+		memcpy(xts_key + crypt_ctx->len, tweak_ctx->key, tweak_ctx->len);
 
-	memcpy(xts_key, crypt_ctx->key, crypt_ctx->len);
-	memcpy(xts_key + crypt_ctx->len, tweak_ctx->key, tweak_ctx->len);
+		ossl_ctx = dis_ossl_keyed_ctx(
+			crypt_ctx, DIS_OSSL_CIPHER_XTS, encrypt, xts_key, crypt_ctx->len
+		);
 
-	if (!EVP_CIPHER_CTX_reset(ossl_ctx))
-		return 1;
+		OPENSSL_cleanse(xts_key, sizeof(xts_key));
+		if (!ossl_ctx)
+			return 1;
+	}
 
-	if (!EVP_CipherInit_ex(ossl_ctx, ossl_cipher, NULL, xts_key, iv, mode == AES_ENCRYPT)) return 1;
-	if (!EVP_CIPHER_CTX_set_padding(ossl_ctx, 0)) return 1;
+	/* XTS takes a single update per IV */
+	if (!EVP_CipherInit_ex(ossl_ctx, NULL, NULL, NULL, iv, -1)) return 1;
 	if (!EVP_CipherUpdate(ossl_ctx, output, &out_len, input, (int)size)) return 1;
-	if (!EVP_CipherFinal_ex(ossl_ctx, &output[out_len], &out_len)) return 1;
 
 	return 0;
 }
 #endif
 
-#define AES_SETENC_KEY(ctx, key, size)  dis_ossl_set_key(ctx, key, size, AES_ENCRYPT)
-#define AES_SETDEC_KEY(ctx, key, size)  dis_ossl_set_key(ctx, key, size, AES_DECRYPT)
+/* The direction is chosen by each call, the same key serves both */
+#define AES_SETENC_KEY(ctx, key, size)  dis_ossl_set_key(ctx, key, size)
+#define AES_SETDEC_KEY(ctx, key, size)  dis_ossl_set_key(ctx, key, size)
 #define AES_FREE(ctx)	dis_ossl_free(ctx)
 #define AES_ECB_ENC(ctx, mode, in, out) dis_ossl_aes_crypt(ctx, mode, 16, NULL, in, out, DIS_OSSL_CIPHER_ECB)
 #define AES_CBC(ctx, mode, size, iv, in, out) dis_ossl_aes_crypt(ctx, mode, size, iv, in, out, DIS_OSSL_CIPHER_CBC)
@@ -0,0 +1,66 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_CACHE_H
+#define DIS_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* Number of independently locked parts of the cache, a power of 2 */
+#define DIS_CACHE_SHARDS 16
+
+/*
+ * Requests bigger than this number of sectors are likely to be sequential
+ * reads, their sectors are the first ones to be evicted
+ */
+#define DIS_CACHE_HOT_REQUEST 64
+
+
+typedef struct _dis_cache* dis_cache_t;
+
+struct _data;
+
+
+
+/*
+ * Functions prototypes
+ */
+dis_cache_t dis_cache_new(uint16_t sector_size, size_t max_size);
+
+int dis_cache_decrypt_region(
+	dis_cache_t cache,
+	struct _data* io_data,
+	size_t nb_read_sector,
+	uint16_t sector_size,
+	off_t sector_start,
+	uint8_t* output
+);
+
+void dis_cache_invalidate(dis_cache_t cache, off_t offset, size_t size);
+
+void dis_cache_stats(dis_cache_t cache, uint64_t* hits, uint64_t* misses);
+
+void dis_cache_destroy(dis_cache_t cache);
+
+#endif /* DIS_CACHE_H */
@@ -0,0 +1,61 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_DIRECT_H
+#define DIS_DIRECT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dislocker/common.h"
+#include "dislocker/inouts/uring.h"
+
+
+/* Size of the pool's buffers, enough for the biggest I/O once aligned */
+#define DIS_DIRECT_BUFFER_SIZE (DIS_URING_MAX_IO_SIZE + 2 * DIS_DIRECT_ALIGN)
+
+/* Number of free buffers kept in the pool at most */
+#define DIS_DIRECT_POOL_SIZE DIS_URING_DEPTH
+
+
+typedef struct _dis_direct* dis_direct_t;
+
+
+
+/*
+ * Functions prototypes
+ */
+dis_direct_t dis_direct_new(int fd);
+
+int dis_direct_run(
+	dis_direct_t direct,
+	dis_uring_t uring,
+	int fd,
+	dis_uring_io_t* ios,
+	size_t nb_ios,
+	dis_uring_fn_t fn,
+	void* arg
+);
+
+void dis_direct_destroy(dis_direct_t direct);
+
+#endif /* DIS_DIRECT_H */
@@ -29,6 +29,12 @@
 #include "dislocker/metadata/datums.h"
 #include "dislocker/metadata/metadata.h"
 #include "dislocker/encryption/encommon.h"
+#include "dislocker/inouts/workers.h"
+#include "dislocker/inouts/uring.h"
+#include "dislocker/inouts/readahead.h"
+#include "dislocker/inouts/cache.h"
+#include "dislocker/inouts/direct.h"
+#include "dislocker/inouts/rangelock.h"
 
 
 
@@ -72,6 +78,27 @@ struct _data {
 	/* Volume's state is kept here */
 	int            volume_state;
 
+	/* Whether sectors are deallocated on discard, see discard_sectors() */
+	int            discard;
+
+	/* Threads sharing the dec/encryption of large requests */
+	dis_workers_t  workers;
+
+	/* Ring used to submit the I/O of a request at once, if supported */
+	dis_uring_t    uring;
+
+	/* Aligned buffers, if the volume is opened with O_DIRECT */
+	dis_direct_t   direct;
+
+	/* Windows decrypted ahead of sequential or strided dislock() callers */
+	dis_readahead_t readahead;
+
+	/* Recently decrypted sectors, if the user asked for it */
+	dis_cache_t    cache;
+
+	/* Sectors being written, partly written ones being read-modify-written */
+	dis_rangelock_t write_lock;
+
 	/* Function to decrypt a region of the volume */
 	int(*decrypt_region)(
 		struct _data* io_data,
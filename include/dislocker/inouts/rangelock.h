@@ -0,0 +1,63 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_RANGELOCK_H
+#define DIS_RANGELOCK_H
+
+#include <sys/types.h>
+
+
+/**
+ * Lock on ranges of the volume, so that writes touching the same sectors are
+ * run one after the other. Writes on other sectors, and reads, go on.
+ */
+typedef struct _dis_rangelock* dis_rangelock_t;
+
+/**
+ * A range being locked, kept by the caller until it unlocks it
+ */
+typedef struct _dis_range
+{
+	off_t              start;
+	off_t              end;
+	struct _dis_range* next;
+} dis_range_t;
+
+
+
+/*
+ * Functions prototypes
+ */
+dis_rangelock_t dis_rangelock_new(void);
+
+void dis_rangelock_lock(
+	dis_rangelock_t rangelock,
+	dis_range_t* range,
+	off_t start,
+	off_t end
+);
+
+void dis_rangelock_unlock(dis_rangelock_t rangelock, dis_range_t* range);
+
+void dis_rangelock_destroy(dis_rangelock_t rangelock);
+
+#endif /* DIS_RANGELOCK_H */
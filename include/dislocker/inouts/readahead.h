@@ -0,0 +1,74 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_READAHEAD_H
+#define DIS_READAHEAD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* Size of a read-ahead window, two of them are staged at most */
+#define DIS_READAHEAD_WINDOW (1024 * 1024)
+
+/* Number of requests following the same pattern before reading ahead */
+#define DIS_READAHEAD_TRIGGER 2
+
+/* Maximum number of strided pieces read in a window */
+#define DIS_READAHEAD_MAX_EXTENTS 64
+
+
+typedef struct _dis_readahead* dis_readahead_t;
+
+struct _data;
+
+
+
+/*
+ * Functions prototypes
+ */
+dis_readahead_t dis_readahead_new(struct _data* io_data);
+
+int dis_readahead_read(
+	dis_readahead_t readahead,
+	uint8_t* buffer,
+	off_t offset,
+	size_t size
+);
+
+void dis_readahead_done(dis_readahead_t readahead, off_t offset, size_t size);
+
+void dis_readahead_wait(dis_readahead_t readahead);
+
+void dis_readahead_begin_write(
+	dis_readahead_t readahead,
+	off_t offset,
+	size_t size
+);
+
+void dis_readahead_end_write(dis_readahead_t readahead);
+
+void dis_readahead_advise(struct _data* io_data, off_t offset, off_t size);
+
+void dis_readahead_destroy(dis_readahead_t readahead);
+
+#endif /* DIS_READAHEAD_H */
@@ -0,0 +1,94 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_RUNS_H
+#define DIS_RUNS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dislocker/inouts/inouts.h"
+
+
+/*
+ * Maximum number of runs computed at once; a request crossing more boundaries
+ * than that is classified in several passes
+ */
+#define DIS_RUNS_MAX 32
+
+
+/**
+ * What has to be done with the sectors of a run
+ */
+typedef enum {
+	/* Virtualized (metadata) sectors, presented as zeroes and never read */
+	DIS_RUN_ZEROED = 0,
+	/* Sectors which aren't encrypted, copied as is */
+	DIS_RUN_PLAINTEXT,
+	/* Vista's boot sectors, which need their NTFS fields fixed */
+	DIS_RUN_VISTA_VBR,
+	/* Sectors to dec/encrypt */
+	DIS_RUN_ENCRYPTED
+} dis_run_type_e;
+
+
+/**
+ * A run is a set of contiguous sectors sharing the same treatment and which are
+ * contiguous on the disk too
+ */
+typedef struct _dis_run
+{
+	dis_run_type_e type;
+
+	/* Offset of the first sector, as presented to the user */
+	off_t          offset;
+	/*
+	 * Where the first sector really is on the disk, relatively to the
+	 * partition's start. This is also the address used by the dec/encryption.
+	 */
+	off_t          disk_offset;
+
+	size_t         nb_sectors;
+} dis_run_t;
+
+
+
+/*
+ * Functions prototypes
+ */
+size_t dis_runs_classify_read(
+	dis_iodata_t* io_data,
+	off_t sector_start,
+	size_t nb_sectors,
+	dis_run_t* runs,
+	size_t max_runs
+);
+size_t dis_runs_classify_write(
+	dis_iodata_t* io_data,
+	off_t sector_start,
+	size_t nb_sectors,
+	dis_run_t* runs,
+	size_t max_runs
+);
+off_t dis_runs_seek_zeroed(dis_iodata_t* io_data, off_t offset, int zeroed);
+
+#endif /* DIS_RUNS_H */
@@ -29,6 +29,18 @@
 
 
 
+/*
+ * A region of sectors and its buffer, for requests on several regions at once
+ */
+typedef struct _dis_sector_region
+{
+	off_t    sector_start;
+	size_t   nb_sectors;
+	uint8_t* buffer;
+} dis_sector_region_t;
+
+
+
 /*
  * Functions prototypes
  */
@@ -46,5 +58,23 @@ int encrypt_write_sectors(
 	off_t sector_start,
 	uint8_t* input
 );
+int discard_sectors(
+	dis_iodata_t* io_data,
+	size_t nb_sectors,
+	uint16_t sector_size,
+	off_t sector_start
+);
+int read_decrypt_regions(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_sector_region_t* regions,
+	size_t nb_regions
+);
+int encrypt_write_regions(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_sector_region_t* regions,
+	size_t nb_regions
+);
 
 #endif /* SECTORS_H */
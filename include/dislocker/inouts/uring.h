@@ -0,0 +1,83 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_URING_H
+#define DIS_URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* Number of I/O kept in flight at most by a ring */
+#define DIS_URING_DEPTH 64
+
+/* Biggest I/O submitted at once, bigger ones are split */
+#define DIS_URING_MAX_IO_SIZE (256 * 1024)
+
+
+typedef struct _dis_uring* dis_uring_t;
+
+
+/**
+ * One read or write on the volume
+ */
+typedef struct _dis_uring_io
+{
+	/* TRUE to write the buffer, FALSE to read into it */
+	int      write;
+
+	uint8_t* buffer;
+	size_t   size;
+	off_t    offset;
+
+	/* Number of bytes transferred, or -errno, once completed */
+	ssize_t  result;
+} dis_uring_io_t;
+
+
+/**
+ * Function called when an I/O is completed
+ *
+ * @param arg The argument given to dis_uring_run()
+ * @param io The completed I/O, its result field being set
+ */
+typedef void (*dis_uring_fn_t)(void* arg, dis_uring_io_t* io);
+
+
+
+/*
+ * Functions prototypes
+ */
+dis_uring_t dis_uring_new(unsigned int depth);
+
+int dis_uring_run(
+	dis_uring_t uring,
+	int fd,
+	dis_uring_io_t* ios,
+	size_t nb_ios,
+	dis_uring_fn_t fn,
+	void* arg
+);
+
+void dis_uring_destroy(dis_uring_t uring);
+
+#endif /* DIS_URING_H */
@@ -0,0 +1,87 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef DIS_WORKERS_H
+#define DIS_WORKERS_H
+
+#include <stddef.h>
+
+
+/*
+ * Upper limit of threads the pool can be made of, whatever the user asks for
+ */
+#define DIS_WORKERS_MAX 64
+
+/*
+ * Requests smaller than this (in bytes) per thread are not worth being split,
+ * they are run on the calling thread
+ */
+#define DIS_WORKERS_MIN_JOB_SIZE (16 * 1024)
+
+
+/**
+ * Pool of threads created once, used to dec/encrypt large requests on
+ * several cores
+ */
+typedef struct _dis_workers* dis_workers_t;
+
+/**
+ * Function run for each job of a batch. The job parameter is the index of the
+ * job, from 0 to the number of jobs of the batch (excluded)
+ */
+typedef void (*dis_workers_fn_t)(void* arg, size_t job);
+
+/**
+ * Function queued on its own by dis_workers_post(), nobody waiting for it
+ */
+typedef void (*dis_workers_post_fn_t)(void* arg);
+
+
+
+/*
+ * Functions prototypes
+ */
+dis_workers_t dis_workers_new(unsigned int nb_threads);
+
+unsigned int dis_workers_count(dis_workers_t workers);
+
+size_t dis_workers_jobs_for(dis_workers_t workers, size_t size);
+
+void dis_workers_run(
+	dis_workers_t workers,
+	size_t nb_jobs,
+	dis_workers_fn_t fn,
+	void* arg
+);
+
+void dis_workers_post(
+	dis_workers_t workers,
+	dis_workers_post_fn_t fn,
+	void* arg
+);
+
+void dis_workers_wait(dis_workers_t workers);
+
+void dis_workers_destroy(dis_workers_t workers);
+
+
+#endif /* DIS_WORKERS_H */
@@ -69,6 +69,8 @@ int dis_metadata_is_overwritten(
 	size_t size
 );
 
+off_t dis_metadata_next_region_edge(dis_metadata_t dis_meta, off_t offset);
+
 uint64_t dis_metadata_volume_size_from_vbr(dis_metadata_t dis_meta);
 
 void* dis_metadata_set_dataset(
@@ -92,6 +94,8 @@ uint64_t dis_metadata_mftmirror(dis_metadata_t dis_meta);
 
 uint32_t dis_metadata_backup_sectors_count(dis_metadata_t dis_meta);
 
+off_t dis_metadata_virtualized_size(dis_metadata_t dis_meta);
+
 int dis_metadata_is_decrypted_state(dis_metadata_t dis_meta);
 
 #endif // METADATA_H
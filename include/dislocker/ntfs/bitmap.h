@@ -0,0 +1,51 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#ifndef NTFS_BITMAP_H
+#define NTFS_BITMAP_H
+
+#include <sys/types.h>
+
+#include "dislocker/dislocker.h"
+
+
+/**
+ * The allocation bitmap ($Bitmap) of the NTFS filesystem inside the decrypted
+ * volume, read on the first search and again after the volume is written
+ */
+typedef struct _dis_ntfs_bitmap* dis_ntfs_bitmap_t;
+
+
+
+/*
+ * Prototypes of functions from bitmap.c
+ */
+dis_ntfs_bitmap_t dis_ntfs_bitmap_new(dis_context_t dis_ctx);
+
+off_t dis_ntfs_bitmap_seek(dis_ntfs_bitmap_t bitmap, off_t offset, int allocated);
+
+void dis_ntfs_bitmap_invalidate(dis_ntfs_bitmap_t bitmap);
+
+void dis_ntfs_bitmap_destroy(dis_ntfs_bitmap_t bitmap);
+
+
+#endif /* NTFS_BITMAP_H */
@@ -30,9 +30,9 @@
  * DIS_RET_SUCCESS.
  * Returns (listed below) are for `high-level' errors, returned by dislocker,
  * whereas dis_errno is for `low-levels' ones, the reason why dislocker returned
- * an error.
+ * an error. As errno, each thread has its own.
  */
-extern int dis_errno;
+extern __thread int dis_errno;
 
 
 #define DIS_RET_SUCCESS 0
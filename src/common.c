@@ -21,6 +21,8 @@
  * USA.
  */
 
+#define _GNU_SOURCE 1
+
 #include <unistd.h>
 
 #include <sys/types.h>
@@ -109,6 +111,37 @@ int dis_close(int fd)
 }
 
 
+/**
+ * Get the alignment the reads on a file descriptor have to respect
+ *
+ * @param fd The file to read from
+ * @return The alignment, in bytes, or 0 if there's none to respect
+ */
+static size_t read_alignment(int fd)
+{
+	size_t alignment = 0;
+
+#ifdef __FREEBSD
+	/*
+	 * FreeBSD's devices are character devices which are to be accessed one
+	 * block at a time. Exactly what one block is remains a mystery atm, so we
+	 * assume it's a sector, and that a sector is 512-bytes long.
+	 */
+	alignment = 512;
+#endif
+
+#ifdef O_DIRECT
+	/* Volumes opened with O_DIRECT need aligned buffers, offsets and sizes */
+	int flags = fcntl(fd, F_GETFL);
+	if(flags >= 0 && (flags & O_DIRECT) && alignment < DIS_DIRECT_ALIGN)
+		alignment = DIS_DIRECT_ALIGN;
+#endif
+
+	(void) fd;
+	return alignment;
+}
+
+
 /**
  * read syscall wrapper
  *
@@ -122,55 +155,49 @@ int dis_close(int fd)
 ssize_t dis_read(int fd, void* buf, size_t count)
 {
 	ssize_t res = -1;
+	size_t alignment = read_alignment(fd);
+	off_t offset = 0;
+	off_t new_offset = -1;
+	size_t old_count = count;
+	void* old_buf = buf;
 
 	dis_printf(L_DEBUG, "Reading %# " F_SIZE_T " bytes from #%d into %p\n", count, fd, buf);
 
-#ifdef __FREEBSD
 	/*
-	 * FreeBSD's devices are character devices which are to be accessed one
-	 * block at a time. Exactly what one block is remains a mystery atm, so we
-	 * assume it's a sector, and that a sector is 512-bytes long.
-	 * So we count the number of sectors the requested read is on, read them all
-	 * and copy to the user only the requested data.
+	 * If the device can only be read by blocks, we count the number of blocks
+	 * the requested read is on, read them all and copy to the user only the
+	 * requested data.
 	 */
-	uint16_t sector_size = 512;
-	off_t offset = lseek(fd, 0, SEEK_CUR);
-	unsigned int sector_to_add = 0;
-	off_t new_offset = -1;
-	size_t old_count = count;
-	void* old_buf = buf;
-
-	if((offset % sector_size) != 0)
-		sector_to_add += 1;
-	if(((offset + (off_t)count) % sector_size) != 0)
-		sector_to_add += 1;
+	if(alignment)
+	{
+		offset = lseek(fd, 0, SEEK_CUR);
 
-	new_offset = (offset / sector_size) * sector_size;
-	count = ((count / sector_size) + sector_to_add) * sector_size;
+		new_offset = offset / (off_t)alignment * (off_t)alignment;
+		count = (size_t)(offset + (off_t)count - new_offset + (off_t)alignment - 1)
+		        / alignment * alignment;
 
-	if(lseek(fd, new_offset, SEEK_SET) != new_offset)
-	{
-		dis_printf(
-			L_ERROR,
-			"Cannot lseek(2) to boundary %#" F_OFF_T "\n",
-			new_offset
-		);
-		errno = EIO;
-		return -1;
-	}
+		if(lseek(fd, new_offset, SEEK_SET) != new_offset)
+		{
+			dis_printf(
+				L_ERROR,
+				"Cannot lseek(2) to boundary %#" F_OFF_T "\n",
+				new_offset
+			);
+			errno = EIO;
+			return -1;
+		}
 
-	buf = dis_malloc(count * sizeof(char));
-	if(buf == NULL)
-	{
-		dis_printf(
-			L_ERROR,
-			"Cannot malloc %" F_SIZE_T " bytes\n",
-			count * sizeof(char)
-		);
-		errno = EIO;
-		return -1;
+		if(posix_memalign(&buf, alignment, count) != 0)
+		{
+			dis_printf(
+				L_ERROR,
+				"Cannot malloc %" F_SIZE_T " bytes\n",
+				count * sizeof(char)
+			);
+			errno = EIO;
+			return -1;
+		}
 	}
-#endif
 
 	if((res = read(fd, buf, count)) < 0)
 	{
@@ -178,25 +205,32 @@ ssize_t dis_read(int fd, void* buf, size_t count)
 		dis_printf(L_ERROR, DIS_XREAD_FAIL_STR " #%d: %s\n", fd, strerror(errno));
 	}
 
-#ifdef __FREEBSD
-	/* What is remaining is just to copy actual data */
-	memcpy(old_buf, (char*) buf + (offset - new_offset), old_count);
-	dis_free(buf);
-
-	if(lseek(fd, offset + (off_t)old_count, SEEK_SET) == -1)
+	if(alignment)
 	{
-		dis_printf(
-			L_ERROR,
-			"Cannot lseek(2) for restore to %#" F_OFF_T "\n",
-			offset + (off_t)old_count
-		);
-		errno = EIO;
-		return -1;
-	}
+		/* What is remaining is just to copy actual data */
+		if(res > offset - new_offset)
+		{
+			res -= offset - new_offset;
+			if((size_t)res > old_count)
+				res = (ssize_t) old_count;
+			memcpy(old_buf, (char*) buf + (offset - new_offset), (size_t)res);
+		}
+		else if(res >= 0)
+			res = 0;
 
-	/* Fake the return value */
-	res = (ssize_t) old_count;
-#endif
+		free(buf);
+
+		if(lseek(fd, offset + (res > 0 ? res : 0), SEEK_SET) == -1)
+		{
+			dis_printf(
+				L_ERROR,
+				"Cannot lseek(2) for restore to %#" F_OFF_T "\n",
+				offset + (res > 0 ? res : 0)
+			);
+			errno = EIO;
+			return -1;
+		}
+	}
 
 	return res;
 }
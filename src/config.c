@@ -59,6 +59,25 @@ static void setclearkey(dis_context_t dis_ctx, char* optarg)
 	int trueval = TRUE;
 	dis_setopt(dis_ctx, DIS_OPT_USE_CLEAR_KEY, &trueval);
 }
+static void setcachesize(dis_context_t dis_ctx, char* optarg)
+{
+	unsigned int cache_size = 0;
+	if(optarg)
+		cache_size = (unsigned int) strtoul(optarg, NULL, 10);
+	dis_setopt(dis_ctx, DIS_OPT_CACHE_SIZE, &cache_size);
+}
+static void setdiscard(dis_context_t dis_ctx, char* optarg)
+{
+	(void) optarg;
+	int trueval = TRUE;
+	dis_setopt(dis_ctx, DIS_OPT_DISCARD, &trueval);
+}
+static void setdirectio(dis_context_t dis_ctx, char* optarg)
+{
+	(void) optarg;
+	int trueval = TRUE;
+	dis_setopt(dis_ctx, DIS_OPT_DIRECT_IO, &trueval);
+}
 static void setbekfile(dis_context_t dis_ctx, char* optarg)
 {
 	int trueval = TRUE;
@@ -90,6 +109,12 @@ static void setlogfile(dis_context_t dis_ctx, char* optarg)
 {
 	dis_setopt(dis_ctx, DIS_OPT_LOG_FILE_PATH, optarg);
 }
+static void setntfsholes(dis_context_t dis_ctx, char* optarg)
+{
+	(void) optarg;
+	int trueval = TRUE;
+	dis_setopt(dis_ctx, DIS_OPT_NTFS_HOLES, &trueval);
+}
 static void setoffset(dis_context_t dis_ctx, char* optarg)
 {
 	off_t offset = (off_t) strtoll(optarg, NULL, 10);
@@ -120,6 +145,20 @@ static void setstateok(dis_context_t dis_ctx, char* optarg)
 	int trueval = TRUE;
 	dis_setopt(dis_ctx, DIS_OPT_DONT_CHECK_VOLUME_STATE, &trueval);
 }
+static void setidlethreads(dis_context_t dis_ctx, char* optarg)
+{
+	unsigned int idle_threads = 0;
+	if(optarg)
+		idle_threads = (unsigned int) strtoul(optarg, NULL, 10);
+	dis_setopt(dis_ctx, DIS_OPT_IDLE_THREADS, &idle_threads);
+}
+static void setthreads(dis_context_t dis_ctx, char* optarg)
+{
+	unsigned int nb_threads = 0;
+	if(optarg)
+		nb_threads = (unsigned int) strtoul(optarg, NULL, 10);
+	dis_setopt(dis_ctx, DIS_OPT_NB_THREADS, &nb_threads);
+}
 static void setuserpassword(dis_context_t dis_ctx, char* optarg)
 {
 	int trueval = TRUE;
@@ -141,12 +180,17 @@ struct _dis_options {
 
 static struct _dis_options dis_opt[] = {
 	{ {"clearkey",          no_argument,       NULL, 'c'}, setclearkey },
+	{ {"cache",             required_argument, NULL, 'C'}, setcachesize },
+	{ {"discard",           no_argument,       NULL, 'd'}, setdiscard },
+	{ {"direct-io",         no_argument,       NULL, 'D'}, setdirectio },
 	{ {"bekfile",           required_argument, NULL, 'f'}, setbekfile },
 	{ {"force-block",       optional_argument, NULL, 'F'}, setforceblock },
 	{ {"help",              no_argument,       NULL, 'h'}, NULL },
+	{ {"idle-threads",      required_argument, NULL, 'i'}, setidlethreads },
 	{ {"fvek",              required_argument, NULL, 'k'}, setfvek },
 	{ {"vmk",               required_argument, NULL, 'K'}, setvmk },
 	{ {"logfile",           required_argument, NULL, 'l'}, setlogfile },
+	{ {"ntfs-holes",        no_argument,       NULL, 'N'}, setntfsholes },
 	{ {"offset",            required_argument, NULL, 'O'}, setoffset },
 	{ {"options",           required_argument, NULL, 'o'}, NULL },
 	{ {"recovery-password", optional_argument, NULL, 'p'}, setrecoverypwd },
@@ -154,6 +198,7 @@ static struct _dis_options dis_opt[] = {
 	{ {"readonly",          no_argument,       NULL, 'r'}, setro },
 	{ {"ro",                no_argument,       NULL, 'r'}, setro },
 	{ {"stateok",           no_argument,       NULL, 's'}, setstateok },
+	{ {"threads",           required_argument, NULL, 't'}, setthreads },
 	{ {"user-password",     optional_argument, NULL, 'u'}, setuserpassword },
 	{ {"verbosity",         no_argument,       NULL, 'v'}, setverbosity },
 	{ {"volume",            required_argument, NULL, 'V'}, NULL }
@@ -172,25 +217,37 @@ PROGNAME " by " AUTHOR ", v" VERSION " (compiled for " __OS "/" __ARCH ")\n"
 "Compiled version: " VERSION_DBG "\n"
 #endif
 "\n"
-"Usage: " PROGNAME " [-hqrsv] [-l LOG_FILE] [-O OFFSET] [-V VOLUME DECRYPTMETHOD -F[N]] [-- ARGS...]\n"
+"Usage: " PROGNAME " [-dDhNqrsv] [-C SIZE] [-i THREADS] [-l LOG_FILE] [-O OFFSET] [-t THREADS] [-V VOLUME DECRYPTMETHOD -F[N]] [-- ARGS...]\n"
 "    with DECRYPTMETHOD = -p[RECOVERY_PASSWORD]|-f BEK_FILE|-u[USER_PASSWORD]|-k FVEK_FILE|-K VMK_FILE|-c\n"
 "\n"
 "Options:\n"
 "    -c, --clearkey        decrypt volume using a clear key (default)\n"
+"    -C, --cache SIZE      keep up to SIZE MiB of decrypted sectors in memory\n"
+"                          (default is 0, no cache)\n"
+"    -d, --discard         deallocate the ranges punched in the virtual partition,\n"
+"                          reading any all-zero sector of the volume as zeroes\n"
+"    -D, --direct-io       access the volume with O_DIRECT, bypassing the page cache\n"
 "    -f, --bekfile BEKFILE\n"
 "                          decrypt volume using the bek file (on USB key)\n"
 "    -F, --force-block=[N] force use of metadata block number N (1, 2 or 3)\n"
 "    -h, --help            print this help and exit\n"
+"    -i, --idle-threads THREADS\n"
+"                          number of idle threads FUSE keeps to serve requests in\n"
+"                          parallel (default is the number of online processors)\n"
 "    -k, --fvek FVEK_FILE  decrypt volume using the FVEK directly\n"
 "    -K, --vmk VMK_FILE    decrypt volume using the VMK directly\n"
 "    -l, --logfile LOG_FILE\n"
 "                          put messages into this file (stdout by default)\n"
+"    -N, --ntfs-holes      report the NTFS free clusters as holes to SEEK_HOLE, even\n"
+"                          though they're not read as zeroes\n"
 "    -O, --offset OFFSET   BitLocker partition offset, in bytes (default is 0)\n"
 "    -p, --recovery-password=[RECOVERY_PASSWORD]\n"
 "                          decrypt volume using the recovery password method\n"
 "    -q, --quiet           do NOT display anything\n"
 "    -r, --readonly        do not allow one to write on the BitLocker volume\n"
 "    -s, --stateok         do not check the volume's state, assume it's ok to mount it\n"
+"    -t, --threads THREADS number of threads used to decrypt/encrypt large requests\n"
+"                          (default is the number of online processors)\n"
 "    -u, --user-password=[USER_PASSWORD]\n"
 "                          decrypt volume using the user password method\n"
 "    -v, --verbosity       increase verbosity (CRITICAL errors are displayed by default)\n"
@@ -259,7 +316,7 @@ int dis_getopts(dis_context_t dis_ctx, int argc, char** argv)
 
 
 	/* Options which could be passed as argument */
-	const char short_opts[] = "cf:F::hk:K:l:O:o:p::qrsu::vV:";
+	const char short_opts[] = "cC:dDf:F::hi:k:K:l:NO:o:p::qrst:u::vV:";
 	struct option* long_opts;
 
 	if(!dis_ctx || !argv)
@@ -289,6 +346,22 @@ int dis_getopts(dis_context_t dis_ctx, int argc, char** argv)
 				dis_setopt(dis_ctx, DIS_OPT_USE_CLEAR_KEY, &trueval);
 				break;
 			}
+			case 'C':
+			{
+				unsigned int cache_size = (unsigned int) strtoul(optarg, NULL, 10);
+				dis_setopt(dis_ctx, DIS_OPT_CACHE_SIZE, &cache_size);
+				break;
+			}
+			case 'd':
+			{
+				dis_setopt(dis_ctx, DIS_OPT_DISCARD, &trueval);
+				break;
+			}
+			case 'D':
+			{
+				dis_setopt(dis_ctx, DIS_OPT_DIRECT_IO, &trueval);
+				break;
+			}
 			case 'f':
 			{
 				dis_setopt(dis_ctx, DIS_OPT_USE_BEK_FILE, &trueval);
@@ -311,6 +384,12 @@ int dis_getopts(dis_context_t dis_ctx, int argc, char** argv)
 				dis_free_args(dis_ctx);
 				exit(EXIT_SUCCESS);
 			}
+			case 'i':
+			{
+				unsigned int idle_threads = (unsigned int) strtoul(optarg, NULL, 10);
+				dis_setopt(dis_ctx, DIS_OPT_IDLE_THREADS, &idle_threads);
+				break;
+			}
 			case 'k':
 			{
 				dis_setopt(dis_ctx, DIS_OPT_USE_FVEK_FILE, &trueval);
@@ -328,6 +407,11 @@ int dis_getopts(dis_context_t dis_ctx, int argc, char** argv)
 				dis_setopt(dis_ctx, DIS_OPT_LOG_FILE_PATH, optarg);
 				break;
 			}
+			case 'N':
+			{
+				dis_setopt(dis_ctx, DIS_OPT_NTFS_HOLES, &trueval);
+				break;
+			}
 			case 'O':
 			{
 				off_t offset = (off_t) strtoll(optarg, NULL, 10);
@@ -362,6 +446,12 @@ int dis_getopts(dis_context_t dis_ctx, int argc, char** argv)
 				dis_setopt(dis_ctx, DIS_OPT_DONT_CHECK_VOLUME_STATE, &trueval);
 				break;
 			}
+			case 't':
+			{
+				unsigned int nb_threads = (unsigned int) strtoul(optarg, NULL, 10);
+				dis_setopt(dis_ctx, DIS_OPT_NB_THREADS, &nb_threads);
+				break;
+			}
 			case 'u':
 			{
 				dis_setopt(dis_ctx, DIS_OPT_USE_USER_PASSWORD, &trueval);
@@ -509,6 +599,33 @@ int dis_getopt(dis_context_t dis_ctx, dis_opt_e opt_name, void** opt_value)
 			else
 				*opt_value = (void*) FALSE;
 			break;
+		case DIS_OPT_NB_THREADS:
+			*opt_value = (void*) ((long) cfg->nb_threads);
+			break;
+		case DIS_OPT_CACHE_SIZE:
+			*opt_value = (void*) ((long) cfg->cache_size);
+			break;
+		case DIS_OPT_DISCARD:
+			if(cfg->flags & DIS_FLAG_DISCARD)
+				*opt_value = (void*) TRUE;
+			else
+				*opt_value = (void*) FALSE;
+			break;
+		case DIS_OPT_DIRECT_IO:
+			if(cfg->flags & DIS_FLAG_DIRECT_IO)
+				*opt_value = (void*) TRUE;
+			else
+				*opt_value = (void*) FALSE;
+			break;
+		case DIS_OPT_IDLE_THREADS:
+			*opt_value = (void*) ((long) cfg->idle_threads);
+			break;
+		case DIS_OPT_NTFS_HOLES:
+			if(cfg->flags & DIS_FLAG_NTFS_HOLES)
+				*opt_value = (void*) TRUE;
+			else
+				*opt_value = (void*) FALSE;
+			break;
 		case DIS_OPT_INITIALIZE_STATE:
 			*opt_value = (void*) cfg->init_stop_at;
 			break;
@@ -696,6 +813,60 @@ int dis_setopt(dis_context_t dis_ctx, dis_opt_e opt_name, const void* opt_value)
 					cfg->flags &= (unsigned) ~DIS_FLAG_DONT_CHECK_VOLUME_STATE;
 			}
 			break;
+		case DIS_OPT_NB_THREADS:
+			if(opt_value == NULL)
+				cfg->nb_threads = 0;
+			else
+				cfg->nb_threads = *(unsigned int*) opt_value;
+			break;
+		case DIS_OPT_CACHE_SIZE:
+			if(opt_value == NULL)
+				cfg->cache_size = 0;
+			else
+				cfg->cache_size = *(unsigned int*) opt_value;
+			break;
+		case DIS_OPT_DIRECT_IO:
+			if(opt_value == NULL)
+				cfg->flags &= (unsigned) ~DIS_FLAG_DIRECT_IO;
+			else
+			{
+				int flag = *(int*) opt_value;
+				if(flag == TRUE)
+					cfg->flags |= DIS_FLAG_DIRECT_IO;
+				else
+					cfg->flags &= (unsigned) ~DIS_FLAG_DIRECT_IO;
+			}
+			break;
+		case DIS_OPT_IDLE_THREADS:
+			if(opt_value == NULL)
+				cfg->idle_threads = 0;
+			else
+				cfg->idle_threads = *(unsigned int*) opt_value;
+			break;
+		case DIS_OPT_NTFS_HOLES:
+			if(opt_value == NULL)
+				cfg->flags &= (unsigned) ~DIS_FLAG_NTFS_HOLES;
+			else
+			{
+				int flag = *(int*) opt_value;
+				if(flag == TRUE)
+					cfg->flags |= DIS_FLAG_NTFS_HOLES;
+				else
+					cfg->flags &= (unsigned) ~DIS_FLAG_NTFS_HOLES;
+			}
+			break;
+		case DIS_OPT_DISCARD:
+			if(opt_value == NULL)
+				cfg->flags &= (unsigned) ~DIS_FLAG_DISCARD;
+			else
+			{
+				int flag = *(int*) opt_value;
+				if(flag == TRUE)
+					cfg->flags |= DIS_FLAG_DISCARD;
+				else
+					cfg->flags &= (unsigned) ~DIS_FLAG_DISCARD;
+			}
+			break;
 		case DIS_OPT_INITIALIZE_STATE:
 			if(opt_value == NULL)
 				cfg->init_stop_at = DIS_STATE_COMPLETE_EVERYTHING;
@@ -809,6 +980,26 @@ void dis_print_args(dis_context_t dis_ctx)
 			"(read only mode)\n"
 		);
 
+	if(cfg->flags & DIS_FLAG_DIRECT_IO)
+		dis_printf(L_DEBUG, "   Accessing the volume with direct I/O\n");
+
+	if(cfg->flags & DIS_FLAG_NTFS_HOLES)
+		dis_printf(L_DEBUG, "   Reporting the NTFS free clusters as holes\n");
+
+	if(cfg->flags & DIS_FLAG_DISCARD)
+		dis_printf(L_DEBUG, "   Deallocating the discarded ranges\n");
+
+	if(cfg->nb_threads)
+		dis_printf(L_DEBUG, "   Using %u thread(s) for dec/encryption\n", cfg->nb_threads);
+	else
+		dis_printf(L_DEBUG, "   Using as many threads as online processors\n");
+
+	if(cfg->cache_size)
+		dis_printf(L_DEBUG, "   Caching up to %u MiB of decrypted sectors\n", cfg->cache_size);
+
+	if(cfg->idle_threads)
+		dis_printf(L_DEBUG, "   Keeping up to %u idle FUSE thread(s)\n", cfg->idle_threads);
+
 	dis_printf(L_DEBUG, "... End config ---\n");
 }
 
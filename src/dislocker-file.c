@@ -43,8 +43,9 @@
 #endif /* __DARWIN || __FREEBSD */
 
 
-/* Number of sectors we're reading at a time */
-#define NB_READ_SECTOR 16
+/* Size of the chunks we're reading at a time, and how many are in flight */
+#define READ_CHUNK_SIZE (1024 * 1024)
+#define NB_READ_CHUNKS  4
 
 
 
@@ -98,9 +99,6 @@ static int file_main(char* ntfs_file, dis_context_t dis_ctx)
 		return EXIT_FAILURE;
 	}
 
-	size_t buf_size = (size_t)(NB_READ_SECTOR * dis_inouts_sector_size(dis_ctx));
-	uint8_t* buffer = dis_malloc(buf_size);
-
 	mode_t mode = S_IRUSR|S_IWUSR;
 	if(dis_is_read_only(dis_ctx))
 		mode = S_IRUSR;
@@ -111,23 +109,33 @@ static int file_main(char* ntfs_file, dis_context_t dis_ctx)
 	off_t offset          = 0;
 	long long int percent = 0;
 	off_t decrypting_size = (off_t)dis_inouts_volume_size(dis_ctx);
+	const uint8_t* chunk  = NULL;
+	ssize_t chunk_size    = 0;
 
 	dis_printf(L_INFO, "File size: %" PRIu64 " bytes\n", decrypting_size);
 
-	/* Read all sectors and decrypt them if necessary */
+	/*
+	 * Read all sectors and decrypt them if necessary, the stream decrypts the
+	 * next chunks while the current one is written
+	 */
+	dis_stream_t stream = dis_stream_open(dis_ctx, 0, READ_CHUNK_SIZE, NB_READ_CHUNKS);
+	if(!stream)
+	{
+		dis_printf(L_ERROR, "Cannot read the volume. Abort.\n");
+		dis_close(fd_ntfs);
+		return EXIT_FAILURE;
+	}
+
 	dis_printf(L_INFO, "\rDecrypting... 0%%");
 	fflush(stdout);
 
-	while(offset < decrypting_size)
+	while((chunk_size = dis_stream_next(stream, &chunk)) > 0)
 	{
-		/* Read and decrypt an entire region of the disk */
-		dislock(dis_ctx, buffer, offset, buf_size);
-
-		offset += (off_t) buf_size;
+		offset += (off_t) chunk_size;
 
 
-		/* Now copy the required amount of data to the user file */
-		dis_write(fd_ntfs, buffer, buf_size);
+		/* Now copy the decrypted data to the user file */
+		dis_write(fd_ntfs, (void*) chunk, (size_t) chunk_size);
 
 		/* Screen update */
 		if(percent != (offset*100)/decrypting_size)
@@ -138,11 +146,17 @@ static int file_main(char* ntfs_file, dis_context_t dis_ctx)
 		}
 	}
 
-	dis_printf(L_INFO, "\rDecrypting... Done.\n");
-
-	dis_free(buffer);
+	dis_stream_close(stream);
 	dis_close(fd_ntfs);
 
+	if(chunk_size < 0)
+	{
+		dis_printf(L_ERROR, "\nCannot decrypt the volume at %#" F_OFF_T ". Abort.\n", offset);
+		return EXIT_FAILURE;
+	}
+
+	dis_printf(L_INFO, "\rDecrypting... Done.\n");
+
 	return EXIT_SUCCESS;
 }
 
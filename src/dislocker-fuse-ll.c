@@ -0,0 +1,721 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+/*
+ * Same as dislocker-fuse, but on FUSE's low-level API. The virtual file has a
+ * fixed inode number instead of a path looked up on each request, and reads
+ * and writes are queued to the library's worker threads, which reply once
+ * they are done. The thread reading FUSE's channel can then keep many requests
+ * outstanding.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+
+#include "dislocker/common.h"
+#include "dislocker/xstd/xstdio.h"
+#include "dislocker/xstd/xstdlib.h"
+#include "dislocker/return_values.h"
+#include "dislocker/config.h"
+#include "dislocker/dislocker.h"
+#include "dislocker/inouts/inouts.h"
+
+
+#include <fuse_lowlevel.h>
+
+
+/** NTFS virtual partition's name and inode number */
+#define NTFS_FILENAME "dislocker-file"
+#define NTFS_FILE_INO 2
+
+/** Largest read or write asked to the kernel, as many pages as FUSE takes */
+#define DIS_FUSE_LL_MAX_IO (1024 * 1024)
+
+/** Number of reads and writes the kernel keeps outstanding at once */
+#define DIS_FUSE_LL_MAX_BACKGROUND 64
+
+/** Nothing changes the attributes behind the kernel's back */
+#define DIS_FUSE_LL_TIMEOUT 3600.0
+
+#define DIS_STR_(x) #x
+#define DIS_STR(x) DIS_STR_(x)
+
+
+/**
+ * Data used globally for operation on disk (encryption/decryption) and in the
+ * dislocker library.
+ */
+dis_context_t dis_ctx;
+
+
+/**
+ * A read or a write queued to the worker threads
+ */
+typedef struct _ll_request
+{
+	fuse_req_t req;
+	uint8_t*   buffer;
+	size_t     size;
+	off_t      offset;
+} ll_request_t;
+
+
+
+/**
+ * Fill in the attributes of one of the two inodes
+ *
+ * @param ino The inode number
+ * @param stbuf Where to put the attributes
+ * @return TRUE if the inode exists, FALSE otherwise
+ */
+static int fill_attr(fuse_ino_t ino, struct stat* stbuf)
+{
+	memset(stbuf, 0, sizeof(*stbuf));
+	stbuf->st_ino = ino;
+
+	if(ino == FUSE_ROOT_ID)
+	{
+		stbuf->st_mode  = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+	}
+	else if(ino == NTFS_FILE_INO)
+	{
+		mode_t m = dis_is_read_only(dis_ctx) ? 0444 : 0666;
+		stbuf->st_mode  = S_IFREG | m;
+		stbuf->st_nlink = 1;
+		stbuf->st_size  = (off_t)dis_inouts_volume_size(dis_ctx);
+	}
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+
+/**
+ * Queue a request to the worker threads, replying with an error if it can't
+ * be
+ */
+static void queue_request(
+	fuse_req_t req,
+	void (*fn)(void*),
+	uint8_t* buffer,
+	size_t size,
+	off_t offset)
+{
+	ll_request_t* request = malloc(sizeof(ll_request_t));
+	int           ret     = 0;
+
+	if(!request)
+	{
+		free(buffer);
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	request->req    = req;
+	request->buffer = buffer;
+	request->size   = size;
+	request->offset = offset;
+
+	ret = dis_run_async(dis_ctx, fn, request);
+	if(ret < 0)
+	{
+		free(request->buffer);
+		free(request);
+		fuse_reply_err(req, -ret);
+	}
+}
+
+
+/**
+ * Decrypt a read request on a worker thread and reply to it
+ */
+static void read_job(void* arg)
+{
+	ll_request_t*      request = (ll_request_t*) arg;
+	struct fuse_bufvec bufvec;
+	int                ret     = 0;
+
+	ret = dislock(dis_ctx, request->buffer, request->offset, request->size);
+	if(ret < 0)
+		fuse_reply_err(request->req, -ret);
+	else
+	{
+		/* Spliced to the kernel if it can take it this way */
+		bufvec = FUSE_BUFVEC_INIT((size_t) ret);
+		bufvec.buf[0].mem = request->buffer;
+		fuse_reply_data(request->req, &bufvec, 0);
+	}
+
+	free(request->buffer);
+	free(request);
+}
+
+
+/**
+ * Deallocate a range on a worker thread and reply to it
+ */
+static void discard_job(void* arg)
+{
+	ll_request_t* request = (ll_request_t*) arg;
+
+	fuse_reply_err(
+		request->req,
+		-dis_discard(dis_ctx, request->offset, (off_t) request->size)
+	);
+
+	free(request);
+}
+
+
+/**
+ * Encrypt a write request on a worker thread and reply to it
+ */
+static void write_job(void* arg)
+{
+	ll_request_t* request = (ll_request_t*) arg;
+	int           ret     = 0;
+
+	ret = enlock(dis_ctx, request->buffer, request->offset, request->size);
+	if(ret < 0)
+		fuse_reply_err(request->req, -ret);
+	else
+		fuse_reply_write(request->req, (size_t) ret);
+
+	free(request->buffer);
+	free(request);
+}
+
+
+
+/**
+ * Operations used by the FUSE driver.
+ */
+static void ll_init(void* userdata, struct fuse_conn_info* conn)
+{
+	(void) userdata;
+
+	if(conn->capable & FUSE_CAP_SPLICE_WRITE)
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	if(conn->capable & FUSE_CAP_ASYNC_READ)
+		conn->want |= FUSE_CAP_ASYNC_READ;
+
+	/*
+	 * libfuse asks the kernel for as many pages per request as it allows
+	 * (max_pages), which these are clamped to
+	 */
+	conn->max_read  = DIS_FUSE_LL_MAX_IO;
+	conn->max_write = DIS_FUSE_LL_MAX_IO;
+
+	conn->max_background       = DIS_FUSE_LL_MAX_BACKGROUND;
+	conn->congestion_threshold = DIS_FUSE_LL_MAX_BACKGROUND * 3 / 4;
+
+	dis_printf(
+		L_DEBUG,
+		"FUSE connection: max_read=%u, max_write=%u, max_background=%u\n",
+		conn->max_read,
+		conn->max_write,
+		conn->max_background
+	);
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+	struct fuse_entry_param entry;
+
+	if(parent != FUSE_ROOT_ID || !name || strcmp(name, NTFS_FILENAME) != 0)
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	entry.ino           = NTFS_FILE_INO;
+	entry.attr_timeout  = DIS_FUSE_LL_TIMEOUT;
+	entry.entry_timeout = DIS_FUSE_LL_TIMEOUT;
+	fill_attr(NTFS_FILE_INO, &entry.attr);
+
+	fuse_reply_entry(req, &entry);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	struct stat stbuf;
+	(void) fi;
+
+	if(!fill_attr(ino, &stbuf))
+		fuse_reply_err(req, ENOENT);
+	else
+		fuse_reply_attr(req, &stbuf, DIS_FUSE_LL_TIMEOUT);
+}
+
+static void ll_readdir(
+	fuse_req_t req,
+	fuse_ino_t ino,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info* fi)
+{
+	static const char* const names[] = { ".", "..", NTFS_FILENAME };
+	static const fuse_ino_t  inos[]  = { FUSE_ROOT_ID, FUSE_ROOT_ID, NTFS_FILE_INO };
+
+	struct stat stbuf;
+	char*       buf    = NULL;
+	size_t      length = 0;
+	size_t      entry  = 0;
+	size_t      loop   = 0;
+	(void) fi;
+
+	if(ino != FUSE_ROOT_ID)
+	{
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	buf = malloc(size ? size : 1);
+	if(!buf)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	/* The offset of an entry is the index of the next one */
+	for(loop = offset > 0 ? (size_t) offset : 0; loop < 3; loop++)
+	{
+		fill_attr(inos[loop], &stbuf);
+		entry = fuse_add_direntry(
+			req,
+			buf + length,
+			size - length,
+			names[loop],
+			&stbuf,
+			(off_t) loop + 1
+		);
+		if(entry > size - length)
+			break;
+		length += entry;
+	}
+
+	fuse_reply_buf(req, buf, length);
+	free(buf);
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	if(ino == FUSE_ROOT_ID)
+	{
+		fuse_reply_err(req, EISDIR);
+		return;
+	}
+
+	if(ino != NTFS_FILE_INO)
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	if(dis_is_read_only(dis_ctx))
+	{
+		if((fi->flags & O_ACCMODE) != O_RDONLY)
+		{
+			fuse_reply_err(req, EACCES);
+			return;
+		}
+	}
+	else
+	{
+		/* Authorize read/write, readonly and writeonly operations */
+		if((fi->flags & O_ACCMODE) != O_RDWR   &&
+		   (fi->flags & O_ACCMODE) != O_RDONLY &&
+		   (fi->flags & O_ACCMODE) != O_WRONLY)
+		{
+			fuse_reply_err(req, EACCES);
+			return;
+		}
+	}
+
+	fuse_reply_open(req, fi);
+}
+
+static void ll_read(
+	fuse_req_t req,
+	fuse_ino_t ino,
+	size_t size,
+	off_t offset,
+	struct fuse_file_info* fi)
+{
+	void* buffer = NULL;
+	(void) fi;
+
+	if(ino != NTFS_FILE_INO)
+	{
+		fuse_reply_err(req, ino == FUSE_ROOT_ID ? EISDIR : ENOENT);
+		return;
+	}
+
+	/* On whole pages, so that splicing can take them as they are */
+	if(posix_memalign(&buffer, (size_t) sysconf(_SC_PAGESIZE), size ? size : 1) != 0)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	queue_request(req, read_job, buffer, size, offset);
+}
+
+/**
+ * The data is only valid until this returns, it's copied out of FUSE's buffers
+ * (or pipe, when the kernel spliced it) before the write is queued
+ */
+static void ll_write_buf(
+	fuse_req_t req,
+	fuse_ino_t ino,
+	struct fuse_bufvec* bufv,
+	off_t offset,
+	struct fuse_file_info* fi)
+{
+	struct fuse_bufvec dest;
+	uint8_t*           buffer = NULL;
+	size_t             size   = fuse_buf_size(bufv);
+	ssize_t            ret    = 0;
+	(void) fi;
+
+	if(ino != NTFS_FILE_INO)
+	{
+		fuse_reply_err(req, ino == FUSE_ROOT_ID ? EISDIR : ENOENT);
+		return;
+	}
+
+	if(size == 0)
+	{
+		fuse_reply_write(req, 0);
+		return;
+	}
+
+	if(size > INT_MAX)
+	{
+		fuse_reply_err(req, EOVERFLOW);
+		return;
+	}
+
+	buffer = malloc(size);
+	if(!buffer)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	dest = FUSE_BUFVEC_INIT(size);
+	dest.buf[0].mem = buffer;
+
+	ret = fuse_buf_copy(&dest, bufv, 0);
+	if(ret < 0)
+	{
+		free(buffer);
+		fuse_reply_err(req, (int) -ret);
+		return;
+	}
+
+	queue_request(req, write_job, buffer, (size_t) ret, offset);
+}
+
+
+/**
+ * Deallocate the sectors ntfs-3g or fstrim on a loop device free, so that the
+ * storage behind the volume can reclaim them
+ */
+static void ll_fallocate(
+	fuse_req_t req,
+	fuse_ino_t ino,
+	int mode,
+	off_t offset,
+	off_t length,
+	struct fuse_file_info* fi)
+{
+	(void) fi;
+
+	if(ino != NTFS_FILE_INO)
+	{
+		fuse_reply_err(req, ino == FUSE_ROOT_ID ? EISDIR : ENOENT);
+		return;
+	}
+
+	/* The volume's size can't change */
+	if(mode != (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE))
+	{
+		fuse_reply_err(req, EOPNOTSUPP);
+		return;
+	}
+
+	if(offset < 0 || length < 0)
+	{
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	queue_request(req, discard_job, NULL, (size_t) length, offset);
+}
+
+
+/**
+ * Tell cp --sparse, qemu-img and others where the holes are. Unlike reads and
+ * writes, this is answered right away: only the first search in the NTFS
+ * bitmap, which reads it, takes some time.
+ */
+static void ll_lseek(
+	fuse_req_t req,
+	fuse_ino_t ino,
+	off_t offset,
+	int whence,
+	struct fuse_file_info* fi)
+{
+	off_t ret;
+
+	(void) fi;
+
+	if(ino != NTFS_FILE_INO)
+	{
+		fuse_reply_err(req, ino == FUSE_ROOT_ID ? EISDIR : ENOENT);
+		return;
+	}
+
+	ret = dis_seek(dis_ctx, offset, whence);
+	if(ret < 0)
+		fuse_reply_err(req, (int) -ret);
+	else
+		fuse_reply_lseek(req, ret);
+}
+
+
+/* Structure used by the FUSE driver */
+static const struct fuse_lowlevel_ops ll_oper = {
+	.init      = ll_init,
+	.lookup    = ll_lookup,
+	.getattr   = ll_getattr,
+	.readdir   = ll_readdir,
+	.open      = ll_open,
+	.read      = ll_read,
+	.write_buf = ll_write_buf,
+	.fallocate = ll_fallocate,
+	.lseek     = ll_lseek,
+};
+
+
+/**
+ * Run FUSE's session on the low-level operations above. Even with FUSE's -s,
+ * where a single thread reads requests, these are decrypted and replied to by
+ * the worker threads.
+ *
+ * @param argc The number of arguments for FUSE
+ * @param argv The arguments for FUSE, starting with the program's name
+ * @param idle_threads The number of idle threads to keep, 0 for as many as
+ * there are online processors
+ * @return 0 if FUSE ran fine, 1 otherwise
+ */
+static int run_fuse_ll(int argc, char** argv, unsigned int idle_threads)
+{
+	struct fuse_args         args    = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_cmdline_opts opts;
+	struct fuse_loop_config* config  = NULL;
+	struct fuse_session*     session = NULL;
+	int                      ret     = 1;
+
+	if(idle_threads == 0)
+	{
+		long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		idle_threads = nb_cpus > 0 ? (unsigned int) nb_cpus : 1;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	if(fuse_parse_cmdline(&args, &opts) != 0)
+		return 1;
+
+	/* The kernel only sends reads this large if it's told so when mounting */
+	if(fuse_opt_add_arg(&args, "-omax_read=" DIS_STR(DIS_FUSE_LL_MAX_IO)) != 0)
+		dis_printf(L_WARNING, "Cannot ask for large reads, going on without\n");
+
+	if(opts.show_help)
+	{
+		fuse_cmdline_help();
+		fuse_lowlevel_help();
+		ret = 0;
+	}
+	else if(opts.show_version)
+	{
+		fuse_lowlevel_version();
+		ret = 0;
+	}
+	else if(!opts.mountpoint)
+		dis_printf(L_CRITICAL, "Error, no mount point given. Abort.\n");
+	else if((session = fuse_session_new(&args, &ll_oper, sizeof(ll_oper), NULL)) != NULL)
+	{
+		if(fuse_set_signal_handlers(session) == 0)
+		{
+			if(fuse_session_mount(session, opts.mountpoint) == 0)
+			{
+				if(fuse_daemonize(opts.foreground) == 0)
+				{
+					if(opts.singlethread)
+						ret = fuse_session_loop(session);
+					else if((config = fuse_loop_cfg_create()) != NULL)
+					{
+						fuse_loop_cfg_set_clone_fd(config, (unsigned int) opts.clone_fd);
+						fuse_loop_cfg_set_max_threads(config, opts.max_threads);
+
+						/* FUSE's -o max_idle_threads has the last word */
+						fuse_loop_cfg_set_idle_threads(
+							config,
+							opts.max_idle_threads != UINT_MAX ?
+								opts.max_idle_threads : idle_threads
+						);
+
+						ret = fuse_session_loop_mt(session, config);
+						fuse_loop_cfg_destroy(config);
+					}
+				}
+
+				fuse_session_unmount(session);
+			}
+
+			fuse_remove_signal_handlers(session);
+		}
+
+		/* The replies still to come need the session */
+		dis_wait_async(dis_ctx);
+		fuse_session_destroy(session);
+	}
+
+	free(opts.mountpoint);
+	fuse_opt_free_args(&args);
+
+	return ret ? 1 : 0;
+}
+
+
+/**
+ * Main function ran initially
+ */
+int main(int argc, char** argv)
+{
+	char* volume_path = NULL;
+
+	// Check parameters number
+	if(argc < 2)
+	{
+		dis_usage();
+		exit(EXIT_FAILURE);
+	}
+
+	int param_idx = 0;
+	int ret       = EXIT_SUCCESS;
+	void* idle_threads = NULL;
+
+	/* Get command line options */
+	dis_ctx = dis_new();
+	param_idx = dis_getopts(dis_ctx, argc, argv);
+	if (param_idx == -1)
+		exit(EXIT_FAILURE);
+
+	/*
+	 * Check we have a volume path given and if not, take the first non-argument
+	 * as the volume path
+	 */
+	dis_getopt(dis_ctx, DIS_OPT_VOLUME_PATH, (void**) &volume_path);
+	if(volume_path == NULL)
+	{
+		if(param_idx >= argc || param_idx <= 0)
+		{
+			dis_printf(L_CRITICAL, "Error, no volume path given. Abort.\n");
+			return EXIT_FAILURE;
+		}
+
+		dis_printf(L_DEBUG, "Setting the volume path to %s.\n", argv[param_idx]);
+		dis_setopt(dis_ctx, DIS_OPT_VOLUME_PATH, argv[param_idx]);
+		param_idx++;
+	}
+
+	/* Initialize dislocker */
+	if(dis_initialize(dis_ctx) != DIS_RET_SUCCESS)
+	{
+		dis_printf(L_CRITICAL, "Can't initialize dislocker. Abort.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Check we got enough arguments for at least one more, the mount point */
+	if(param_idx >= argc || param_idx <= 0)
+	{
+		dis_printf(L_CRITICAL, "Error, no mount point given. Abort.\n");
+		return EXIT_FAILURE;
+	}
+
+
+	/*
+	 * Create the parameters table needed for FUSE and run it
+	 * This is as we're running argv[0] followed by ARGS (see usage())
+	 */
+	/* Compute the new argc given to FUSE */
+	size_t new_argc = (size_t)(argc - param_idx + 1);
+	dis_printf(L_DEBUG, "New value for argc: %d\n", new_argc);
+
+	char** new_argv = dis_malloc(new_argc * sizeof(char*));
+
+	/* Get argv[0] */
+	size_t lg = strlen(argv[0]) + 1;
+	*new_argv = dis_malloc(lg);
+	memcpy(*new_argv, argv[0], lg);
+
+	/* Get all of the parameters from param_idx till the end */
+	size_t loop = 0;
+	for(loop = 1; loop < new_argc; ++loop)
+	{
+		lg = strlen(argv[(size_t)param_idx + loop - 1]) + 1;
+		*(new_argv + loop) = dis_malloc(lg);
+		memcpy(*(new_argv + loop), argv[(size_t)param_idx + loop - 1], lg);
+	}
+
+
+	dis_printf(L_INFO, "Running FUSE with these arguments: \n");
+	for(loop = 0; loop < new_argc; ++loop)
+		dis_printf(L_INFO, "  `--> '%s'\n", *(new_argv + loop));
+
+
+	/* Run FUSE */
+	dis_getopt(dis_ctx, DIS_OPT_IDLE_THREADS, &idle_threads);
+	ret = run_fuse_ll((int)new_argc, new_argv, (unsigned int) (long) idle_threads);
+
+	/* Free FUSE params */
+	for(loop = 0; loop < new_argc; ++loop)
+		dis_free(new_argv[loop]);
+	dis_free(new_argv);
+
+
+	/* Destroy dislocker structures */
+	dis_destroy(dis_ctx);
+
+	return ret;
+}
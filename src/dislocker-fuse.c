@@ -22,9 +22,16 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <linux/falloc.h>
+#endif
 
+#include "dislocker/common.h"
 #include "dislocker/xstd/xstdio.h"
 #include "dislocker/xstd/xstdlib.h"
 #include "dislocker/return_values.h"
@@ -33,6 +40,9 @@
 
 
 # include <fuse.h>
+#ifndef __APPLE__
+# include <fuse_lowlevel.h>
+#endif
 
 
 /** NTFS virtual partition's name */
@@ -195,16 +205,347 @@ static int fs_write(
 }
 
 
+#ifndef __APPLE__
+/**
+ * Ask the kernel to take the replies to reads from a pipe, which libfuse fills
+ * by splicing the buffers fs_read_buf() decrypts into, and to give the writes'
+ * requests in a pipe, which fs_write_buf() reads the data from
+ */
+static void* fs_init(struct fuse_conn_info* conn, struct fuse_config* cfg)
+{
+	(void) cfg;
+
+	if(conn->capable & FUSE_CAP_SPLICE_WRITE)
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	if(conn->capable & FUSE_CAP_SPLICE_MOVE)
+		conn->want |= FUSE_CAP_SPLICE_MOVE;
+	if(conn->capable & FUSE_CAP_SPLICE_READ)
+		conn->want |= FUSE_CAP_SPLICE_READ;
+
+	return NULL;
+}
+
+/**
+ * Same as fs_read(), but the data is decrypted into a buffer given to libfuse
+ * as is, instead of being copied from the one libfuse would give
+ */
+static int fs_read_buf(
+	const char *path,
+	struct fuse_bufvec **bufp,
+	size_t size,
+	off_t offset,
+	__attribute__ ((unused)) struct fuse_file_info *fi)
+{
+	struct fuse_bufvec* bufvec = NULL;
+	void*               data   = NULL;
+	int                 ret    = 0;
+
+	if(!path || !bufp)
+		return -EINVAL;
+
+	if(strcmp(path, NTFS_FILERELATIVEPATH) != 0)
+	{
+		dis_printf(L_DEBUG, "Unknown entry requested: \"%s\"\n", path);
+		return -ENOENT;
+	}
+
+	bufvec = malloc(sizeof(struct fuse_bufvec));
+	if(!bufvec)
+		return -ENOMEM;
+
+	/* On whole pages, so that splicing can move them instead of copying them */
+	if(posix_memalign(&data, (size_t) sysconf(_SC_PAGESIZE), size ? size : 1) != 0)
+	{
+		free(bufvec);
+		return -ENOMEM;
+	}
+
+	ret = dislock(dis_ctx, (uint8_t*) data, offset, size);
+	if(ret < 0)
+	{
+		free(data);
+		free(bufvec);
+		return ret;
+	}
+
+	/* libfuse frees both once the reply is sent */
+	*bufvec = FUSE_BUFVEC_INIT((size_t) ret);
+	bufvec->buf[0].mem = data;
+	*bufp = bufvec;
+
+	return 0;
+}
+
+/**
+ * Same as fs_write(), but the data is encrypted from the buffers libfuse got
+ * it in, instead of being gathered into a single buffer first. Only data which
+ * is still in a pipe is read into memory.
+ */
+static int fs_write_buf(
+	const char *path,
+	struct fuse_bufvec *buf,
+	off_t offset,
+	__attribute__ ((unused)) struct fuse_file_info *fi)
+{
+	struct fuse_bufvec dest;
+	dis_iovec_t*       iov    = NULL;
+	void*              data   = NULL;
+	size_t             nb_iov = 0;
+	size_t             size   = 0;
+	size_t             loop   = 0;
+	size_t             skip   = 0;
+	size_t             first  = 0;
+	size_t             first_skip = 0;
+	ssize_t            ret    = 0;
+	int                in_fd  = FALSE;
+
+	if(!path || !buf)
+		return -EINVAL;
+
+	if(strcmp(path, NTFS_FILERELATIVEPATH) != 0)
+	{
+		dis_printf(L_DEBUG, "Unknown entry requested: \"%s\"\n", path);
+		return -ENOENT;
+	}
+
+	/* What's left of the buffers, from the current one and its offset */
+	for(loop = buf->idx, skip = buf->off; loop < buf->count; loop++, skip = 0)
+	{
+		if(buf->buf[loop].size <= skip)
+			continue;
+
+		if(nb_iov == 0)
+		{
+			first      = loop;
+			first_skip = skip;
+		}
+
+		size += buf->buf[loop].size - skip;
+		nb_iov++;
+		if(buf->buf[loop].flags & FUSE_BUF_IS_FD)
+			in_fd = TRUE;
+	}
+
+	if(size == 0)
+		return 0;
+
+	if(size > INT_MAX)
+		return -EOVERFLOW;
+
+	/* Most of the time, the data is in a single buffer */
+	if(nb_iov == 1 && !in_fd)
+		return enlock(
+			dis_ctx,
+			(uint8_t*) buf->buf[first].mem + first_skip,
+			offset,
+			size
+		);
+
+	if(!in_fd)
+	{
+		iov = malloc(nb_iov * sizeof(dis_iovec_t));
+		if(!iov)
+			return -ENOMEM;
+
+		nb_iov = 0;
+		for(loop = buf->idx, skip = buf->off; loop < buf->count; loop++, skip = 0)
+		{
+			if(buf->buf[loop].size <= skip)
+				continue;
+
+			iov[nb_iov].offset = offset;
+			iov[nb_iov].size   = buf->buf[loop].size - skip;
+			iov[nb_iov].buffer = (uint8_t*) buf->buf[loop].mem + skip;
+			offset += (off_t) iov[nb_iov].size;
+			nb_iov++;
+		}
+
+		ret = dis_writev(dis_ctx, iov, nb_iov);
+		free(iov);
+
+		return (int) ret;
+	}
+
+	/* The kernel spliced the data into a pipe, it has to be read out of it */
+	data = malloc(size);
+	if(!data)
+		return -ENOMEM;
+
+	dest = FUSE_BUFVEC_INIT(size);
+	dest.buf[0].mem = data;
+
+	ret = fuse_buf_copy(&dest, buf, 0);
+	if(ret >= 0)
+		ret = enlock(dis_ctx, (uint8_t*) data, offset, (size_t) ret);
+
+	free(data);
+
+	return (int) ret;
+}
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+/**
+ * Deallocate the sectors ntfs-3g or fstrim on a loop device free, so that the
+ * storage behind the volume can reclaim them
+ */
+static int fs_fallocate(
+	const char *path,
+	int mode,
+	off_t offset,
+	off_t length,
+	__attribute__ ((unused)) struct fuse_file_info *fi)
+{
+	if(!path)
+		return -EINVAL;
+
+	if(strcmp(path, NTFS_FILERELATIVEPATH) != 0)
+	{
+		dis_printf(L_DEBUG, "Unknown entry requested: \"%s\"\n", path);
+		return -ENOENT;
+	}
+
+	/* The volume's size can't change */
+	if(mode != (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE))
+		return -EOPNOTSUPP;
+
+	return dis_discard(dis_ctx, offset, length);
+}
+#endif
+
+/**
+ * Tell cp --sparse, qemu-img and others where the holes are, so that they
+ * skip them instead of reading zeroes
+ */
+static off_t fs_lseek(
+	const char *path,
+	off_t offset,
+	int whence,
+	__attribute__ ((unused)) struct fuse_file_info *fi)
+{
+	if(!path)
+		return -EINVAL;
+
+	if(strcmp(path, NTFS_FILERELATIVEPATH) != 0)
+	{
+		dis_printf(L_DEBUG, "Unknown entry requested: \"%s\"\n", path);
+		return -ENOENT;
+	}
+
+	return dis_seek(dis_ctx, offset, whence);
+}
+#endif
+
+
 /* Structure used by the FUSE driver */
 struct fuse_operations fs_oper = {
-	.getattr = fs_getattr,
-	.readdir = fs_readdir,
-	.open    = fs_open,
-	.read    = fs_read,
-	.write   = fs_write,
+	.getattr   = fs_getattr,
+	.readdir   = fs_readdir,
+	.open      = fs_open,
+	.read      = fs_read,
+	.write     = fs_write,
+#ifndef __APPLE__
+	.init      = fs_init,
+	.read_buf  = fs_read_buf,
+	.write_buf = fs_write_buf,
+#ifdef FALLOC_FL_PUNCH_HOLE
+	.fallocate = fs_fallocate,
+#endif
+	.lseek     = fs_lseek,
+#endif
 };
 
 
+#ifndef __APPLE__
+/**
+ * Run FUSE as fuse_main() does, but with as many idle threads as the user
+ * asked for in its multi-threaded loop, so that parallel readers are each
+ * served on their own thread. dislock() and enlock() are reentrant.
+ *
+ * @param argc The number of arguments for FUSE
+ * @param argv The arguments for FUSE, starting with the program's name
+ * @param idle_threads The number of idle threads to keep, 0 for as many as
+ * there are online processors
+ * @return 0 if FUSE ran fine, 1 otherwise
+ */
+static int run_fuse(int argc, char** argv, unsigned int idle_threads)
+{
+	struct fuse_args         args   = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_cmdline_opts opts;
+	struct fuse_loop_config* config = NULL;
+	struct fuse*             fuse   = NULL;
+	int                      ret    = 1;
+
+	if(idle_threads == 0)
+	{
+		long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		idle_threads = nb_cpus > 0 ? (unsigned int) nb_cpus : 1;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	if(fuse_parse_cmdline(&args, &opts) != 0)
+		return 1;
+
+	if(opts.show_help)
+	{
+		fuse_cmdline_help();
+		fuse_lib_help(&args);
+		ret = 0;
+	}
+	else if(opts.show_version)
+	{
+		fuse_lowlevel_version();
+		ret = 0;
+	}
+	else if(!opts.mountpoint)
+		dis_printf(L_CRITICAL, "Error, no mount point given. Abort.\n");
+	else if((fuse = fuse_new(&args, &fs_oper, sizeof(fs_oper), NULL)) != NULL)
+	{
+		if(fuse_mount(fuse, opts.mountpoint) == 0)
+		{
+			if(fuse_daemonize(opts.foreground) == 0 &&
+			   fuse_set_signal_handlers(fuse_get_session(fuse)) == 0)
+			{
+				if(opts.singlethread)
+					ret = fuse_loop(fuse);
+				else if((config = fuse_loop_cfg_create()) != NULL)
+				{
+					fuse_loop_cfg_set_clone_fd(config, (unsigned int) opts.clone_fd);
+					fuse_loop_cfg_set_max_threads(config, opts.max_threads);
+
+					/* FUSE's -o max_idle_threads has the last word */
+					fuse_loop_cfg_set_idle_threads(
+						config,
+						opts.max_idle_threads != UINT_MAX ?
+							opts.max_idle_threads : idle_threads
+					);
+
+					dis_printf(
+						L_DEBUG,
+						"Running FUSE's multi-threaded loop, up to %u thread(s)\n",
+						opts.max_threads
+					);
+
+					ret = fuse_loop_mt(fuse, config);
+					fuse_loop_cfg_destroy(config);
+				}
+
+				fuse_remove_signal_handlers(fuse_get_session(fuse));
+			}
+
+			fuse_unmount(fuse);
+		}
+
+		fuse_destroy(fuse);
+	}
+
+	free(opts.mountpoint);
+	fuse_opt_free_args(&args);
+
+	return ret ? 1 : 0;
+}
+#endif
+
+
 /**
  * Main function ran initially
  */
@@ -221,6 +562,9 @@ int main(int argc, char** argv)
 
 	int param_idx = 0;
 	int ret       = EXIT_SUCCESS;
+#ifndef __APPLE__
+	void* idle_threads = NULL;
+#endif
 
 	/* Get command line options */
 	dis_ctx = dis_new();
@@ -292,7 +636,12 @@ int main(int argc, char** argv)
 
 
 	/* Run FUSE */
+#ifdef __APPLE__
 	ret = fuse_main((int)new_argc, new_argv, &fs_oper, NULL);
+#else
+	dis_getopt(dis_ctx, DIS_OPT_IDLE_THREADS, &idle_threads);
+	ret = run_fuse((int)new_argc, new_argv, (unsigned int) (long) idle_threads);
+#endif
 
 	/* Free FUSE params */
 	for(loop = 0; loop < new_argc; ++loop)
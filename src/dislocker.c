@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "dislocker/accesses/accesses.h"
 #include "dislocker/metadata/datums.h"
@@ -41,6 +42,12 @@
 #include "dislocker/metadata/vmk.h"
 #include "dislocker/inouts/prepare.h"
 #include "dislocker/inouts/sectors.h"
+#include "dislocker/inouts/runs.h"
+#include "dislocker/inouts/workers.h"
+#include "dislocker/inouts/uring.h"
+#include "dislocker/inouts/readahead.h"
+#include "dislocker/inouts/cache.h"
+#include "dislocker/inouts/direct.h"
 
 #include "dislocker/xstd/xstdio.h"
 
@@ -67,7 +74,79 @@
 
 
 /* Get low-level errors the library encountered by looking at this variable */
-int dis_errno;
+__thread int dis_errno;
+
+
+
+/**
+ * Compute how many threads should be used for dec/encryption
+ *
+ * @param dis_ctx The dislocker context, holding the user's configuration
+ * @return The number of threads to use, at least 1
+ */
+static unsigned int get_nb_threads(dis_context_t dis_ctx)
+{
+	unsigned int nb_threads = dis_ctx->cfg.nb_threads;
+
+	if(nb_threads == 0)
+	{
+		long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nb_threads = nb_cpus > 0 ? (unsigned int) nb_cpus : 1;
+	}
+
+	if(nb_threads > DIS_WORKERS_MAX)
+		nb_threads = DIS_WORKERS_MAX;
+
+	return nb_threads;
+}
+
+
+/**
+ * Get the flag to open the volume with, for the user's direct I/O choice
+ *
+ * @param dis_ctx The dislocker context, holding the user's configuration
+ * @return O_DIRECT if direct I/O is asked for and supported, 0 otherwise
+ */
+static int get_direct_flag(dis_context_t dis_ctx)
+{
+	if(!(dis_ctx->cfg.flags & DIS_FLAG_DIRECT_IO))
+		return 0;
+
+#ifdef O_DIRECT
+	return O_DIRECT;
+#else
+	dis_printf(L_WARNING, "Direct I/O is not supported on this system, not using it\n");
+	dis_ctx->cfg.flags &= (unsigned) ~DIS_FLAG_DIRECT_IO;
+	return 0;
+#endif
+}
+
+
+/**
+ * Get the aligned buffers needed once the volume is opened with O_DIRECT, or
+ * go back to buffered I/O if the volume can't be read this way
+ *
+ * @param dis_ctx The dislocker context, whose volume is opened
+ */
+static void setup_direct_io(dis_context_t dis_ctx)
+{
+#ifdef O_DIRECT
+	int flags = 0;
+
+	dis_ctx->io_data.direct = dis_direct_new(dis_ctx->fve_fd);
+	if(dis_ctx->io_data.direct)
+		return;
+
+	dis_printf(L_WARNING, "Going on without direct I/O\n");
+	dis_ctx->cfg.flags &= (unsigned) ~DIS_FLAG_DIRECT_IO;
+
+	flags = fcntl(dis_ctx->fve_fd, F_GETFL);
+	if(flags >= 0)
+		fcntl(dis_ctx->fve_fd, F_SETFL, flags & ~O_DIRECT);
+#else
+	(void) dis_ctx;
+#endif
+}
 
 
 
@@ -99,6 +178,7 @@ dis_context_t dis_new()
 int dis_initialize(dis_context_t dis_ctx)
 {
 	int ret = DIS_RET_SUCCESS;
+	int direct_flag = 0;
 	dis_metadata_config_t dis_meta_cfg = NULL;
 
 
@@ -128,13 +208,22 @@ int dis_initialize(dis_context_t dis_ctx)
 
 	/* Open the volume as a (big) normal file */
 	dis_printf(L_DEBUG, "Trying to open '%s'...\n", dis_ctx->cfg.volume_path);
-	dis_ctx->fve_fd = dis_open(dis_ctx->cfg.volume_path, O_RDWR|O_LARGEFILE);
+	direct_flag = get_direct_flag(dis_ctx);
+	dis_ctx->fve_fd = dis_open(dis_ctx->cfg.volume_path, O_RDWR|O_LARGEFILE|direct_flag);
+	if(dis_ctx->fve_fd < 0 && direct_flag && errno == EINVAL)
+	{
+		/* The filesystem the volume is on may not support O_DIRECT */
+		dis_printf(L_WARNING, "Cannot open the volume for direct I/O, not using it\n");
+		dis_ctx->cfg.flags &= (unsigned) ~DIS_FLAG_DIRECT_IO;
+		direct_flag = 0;
+		dis_ctx->fve_fd = dis_open(dis_ctx->cfg.volume_path, O_RDWR|O_LARGEFILE);
+	}
 	if(dis_ctx->fve_fd < 0)
 	{
 		/* Trying to open it in read-only if O_RDWR doesn't work */
 		dis_ctx->fve_fd = dis_open(
 			dis_ctx->cfg.volume_path,
-			O_RDONLY|O_LARGEFILE
+			O_RDONLY|O_LARGEFILE|direct_flag
 		);
 
 		if(dis_ctx->fve_fd < 0)
@@ -160,6 +249,9 @@ int dis_initialize(dis_context_t dis_ctx)
 
 	dis_ctx->io_data.volume_fd = dis_ctx->fve_fd;
 
+	if(direct_flag)
+		setup_direct_io(dis_ctx);
+
 	checkupdate_dis_state(dis_ctx, DIS_STATE_AFTER_OPEN_VOLUME);
 
 
@@ -250,6 +342,28 @@ int dis_initialize(dis_context_t dis_ctx)
 	 */
 	if((ret = prepare_crypt(dis_ctx)) != DIS_RET_SUCCESS)
 		dis_printf(L_CRITICAL, "Can't prepare the crypt structure. Abort.\n");
+	else
+	{
+		/*
+		 * Start the threads once and for all, instead of creating them for
+		 * each and every request
+		 */
+		dis_ctx->io_data.workers    = dis_workers_new(get_nb_threads(dis_ctx));
+		dis_ctx->io_data.uring      = dis_uring_new(DIS_URING_DEPTH);
+		dis_ctx->io_data.readahead  = dis_readahead_new(&dis_ctx->io_data);
+		dis_ctx->io_data.write_lock = dis_rangelock_new();
+
+		if(dis_ctx->cfg.cache_size)
+			dis_ctx->io_data.cache = dis_cache_new(
+				dis_ctx->io_data.sector_size,
+				(size_t)dis_ctx->cfg.cache_size * 1024 * 1024
+			);
+
+		if(dis_ctx->cfg.flags & DIS_FLAG_NTFS_HOLES)
+			dis_ctx->ntfs_bitmap = dis_ntfs_bitmap_new(dis_ctx);
+
+		dis_ctx->io_data.discard = (dis_ctx->cfg.flags & DIS_FLAG_DISCARD) != 0;
+	}
 
 
 	// TODO add the DIS_STATE_BEFORE_DECRYPTION_CHECKING event here, so add the check here too
@@ -278,13 +392,50 @@ int dis_initialize(dis_context_t dis_ctx)
 
 
 
+/**
+ * Decrypt a sector partially requested by the user into a bounce buffer, then
+ * copy the requested part of it
+ *
+ * @param dis_ctx The dislocker context
+ * @param sector_offset The offset of the sector to decrypt
+ * @param bounce A buffer of one sector
+ * @param skip The number of bytes to skip at the beginning of the sector
+ * @param size The number of bytes to copy
+ * @param output Where to copy the requested bytes
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+static int dislock_partial_sector(
+	dis_context_t dis_ctx,
+	off_t sector_offset,
+	uint8_t* bounce,
+	size_t skip,
+	size_t size,
+	uint8_t* output)
+{
+	if(!dis_cache_decrypt_region(
+		dis_ctx->io_data.cache,
+		&dis_ctx->io_data,
+		1,
+		dis_ctx->io_data.sector_size,
+		sector_offset,
+		bounce))
+		return FALSE;
+
+	memcpy(output, bounce + skip, size);
+
+	return TRUE;
+}
+
+
 int dislock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 {
-	uint8_t* buf = NULL;
+	uint8_t* bounce = NULL;
+	int      ok     = TRUE;
 
-	size_t sector_count;
 	off_t  sector_start;
-	size_t sector_to_add = 0;
+	off_t  aligned_start;
+	off_t  aligned_end;
+	off_t  end;
 	uint16_t sector_size;
 
 
@@ -357,20 +508,17 @@ int dislock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 	 *
 	 *
 	 * Logic to do this is below :
-	 *  - count the number of full sectors
-	 *  - decode all sectors
-	 *  - select and copy the data to user and deallocate all buffers
+	 *  - decrypt the full sectors (3 and 4) directly into the user's buffer
+	 *  - decrypt the partial ones (2 and 5) into a bounce buffer and copy the
+	 *    needed part to the user
+	 * Most requests are aligned, so they don't need any other buffer.
 	 */
 
-	/* Do not add sectors if we're at the edge of one already */
-	sector_size = dis_ctx->io_data.sector_size;
-	if((offset % sector_size) != 0)
-		sector_to_add += 1;
-	if(((offset + (off_t)size) % sector_size) != 0)
-		sector_to_add += 1;
-
-	sector_count = ( size / sector_size ) + sector_to_add;
-	sector_start = offset / sector_size;
+	sector_size   = dis_ctx->io_data.sector_size;
+	end           = offset + (off_t)size;
+	sector_start  = offset / sector_size;
+	aligned_start = (offset + sector_size - 1) / sector_size * sector_size;
+	aligned_end   = end / sector_size * sector_size;
 
 	dis_printf(L_DEBUG,
 	        "--------------------{ Fuse reading }-----------------------\n");
@@ -378,49 +526,92 @@ int dislock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 	                 " and %#" F_SIZE_T "\n", offset, size);
 	dis_printf(L_DEBUG, "  Start sector number: %#" F_OFF_T
 	                 " || Number of sectors: %#" F_SIZE_T "\n",
-	                 sector_start, sector_count);
+	                 sector_start,
+	                 (size_t)((end + sector_size - 1) / sector_size - sector_start));
+
+
+	/* The request may have been read ahead */
+	if(dis_readahead_read(dis_ctx->io_data.readahead, buffer, offset, size))
+	{
+		dis_readahead_done(dis_ctx->io_data.readahead, offset, size);
+		dis_printf(L_DEBUG, "  Served from the read-ahead: %d\n", (int)size);
+		dis_printf(L_DEBUG,
+		        "-----------------------------------------------------------\n");
+		return (int)size;
+	}
 
 
 	/*
 	 * NOTE: DO NOT use dis_malloc() here, we don't want to mess everything up!
 	 * In general, do not use xfunctions() but dis_printf() here.
 	 */
+	if(offset != aligned_start || end != aligned_end)
+	{
+		bounce = malloc(sector_size);
+
+		/* If buffer could not be allocated, return an error */
+		if(!bounce)
+		{
+			dis_printf(L_ERROR, "Cannot allocate buffer for reading, abort.\n");
+			dis_printf(L_DEBUG,
+			       "-----------------------------------------------------------\n");
+			if(errno < 0)
+				return errno;
+			else
+				return -ENOMEM;
+		}
+	}
 
-	size_t to_allocate = size + sector_to_add*sector_size;
-	dis_printf(L_DEBUG, "  Trying to allocate %#" F_SIZE_T " bytes\n",to_allocate);
-	buf = malloc(to_allocate);
 
-	/* If buffer could not be allocated, return an error */
-	if(!buf)
+	if(aligned_start > aligned_end)
 	{
-		dis_printf(L_ERROR, "Cannot allocate buffer for reading, abort.\n");
-		dis_printf(L_DEBUG,
-		       "-----------------------------------------------------------\n");
-		if(errno < 0)
-			return errno;
-		else
-			return -ENOMEM;
+		/* The request is within one sector */
+		ok = dislock_partial_sector(
+			dis_ctx, aligned_end, bounce,
+			(size_t)(offset - aligned_end), size, buffer
+		);
 	}
+	else
+	{
+		/* Beginning of the first sector, if it's a partial one */
+		if(offset < aligned_start)
+			ok = dislock_partial_sector(
+				dis_ctx, aligned_start - sector_size, bounce,
+				(size_t)(offset - (aligned_start - sector_size)),
+				(size_t)(aligned_start - offset), buffer
+			);
 
+		/* Full sectors, decrypted in place */
+		if(ok && aligned_start < aligned_end)
+			ok = dis_cache_decrypt_region(
+				dis_ctx->io_data.cache,
+				&dis_ctx->io_data,
+				(size_t)(aligned_end - aligned_start) / sector_size,
+				sector_size,
+				aligned_start,
+				buffer + (aligned_start - offset)
+			);
 
-	if(!dis_ctx->io_data.decrypt_region(
-		&dis_ctx->io_data,
-		sector_count,
-		sector_size,
-		sector_start * sector_size,
-		buf))
+		/* End of the last sector, if it's a partial one */
+		if(ok && aligned_end < end)
+			ok = dislock_partial_sector(
+				dis_ctx, aligned_end, bounce,
+				0, (size_t)(end - aligned_end),
+				buffer + (aligned_end - offset)
+			);
+	}
+
+	free(bounce);
+
+	if(!ok)
 	{
-		free(buf);
 		dis_printf(L_ERROR, "Cannot decrypt sectors, abort.\n");
 		dis_printf(L_DEBUG,
 		       "-----------------------------------------------------------\n");
 		return -EIO;
 	}
 
-	/* Now copy the required amount of data to the user buffer */
-	memcpy(buffer, buf + (offset % sector_size), size);
-
-	free(buf);
+	dis_readahead_done(dis_ctx->io_data.readahead, offset, size);
 
 	dis_printf(L_DEBUG, "  Outsize which will be returned: %d\n", (int)size);
 	dis_printf(L_DEBUG,
@@ -432,15 +623,61 @@ int dislock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 
 
 
+/**
+ * Read-modify-write a sector partially written by the user: decrypt it into a
+ * bounce buffer, put the user's data into it, then encrypt and write it back
+ *
+ * @param dis_ctx The dislocker context
+ * @param sector_offset The offset of the sector to modify
+ * @param bounce A buffer of one sector
+ * @param skip The number of bytes to skip at the beginning of the sector
+ * @param size The number of bytes to write
+ * @param input The user's bytes to write
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+static int enlock_partial_sector(
+	dis_context_t dis_ctx,
+	off_t sector_offset,
+	uint8_t* bounce,
+	size_t skip,
+	size_t size,
+	uint8_t* input)
+{
+	if(!dis_cache_decrypt_region(
+		dis_ctx->io_data.cache,
+		&dis_ctx->io_data,
+		1,
+		dis_ctx->io_data.sector_size,
+		sector_offset,
+		bounce))
+	{
+		dis_printf(L_ERROR, "Cannot decrypt sectors, abort.\n");
+		return FALSE;
+	}
+
+	memcpy(bounce + skip, input, size);
+
+	return dis_ctx->io_data.encrypt_region(
+		&dis_ctx->io_data,
+		1,
+		dis_ctx->io_data.sector_size,
+		sector_offset,
+		bounce
+	);
+}
+
+
 int enlock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 {
-	uint8_t* buf = NULL;
-	int      ret = 0;
+	uint8_t*    bounce = NULL;
+	int         ok     = TRUE;
+	dis_range_t range;
 
 	uint16_t sector_size;
-	size_t sector_count;
 	off_t  sector_start;
-	size_t sector_to_add = 0;
+	off_t  aligned_start;
+	off_t  aligned_end;
+	off_t  end;
 
 
 	if(!dis_ctx || !buffer)
@@ -518,52 +755,13 @@ int enlock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 		return -EFAULT;
 
 
-	/*
-	 * For BitLocker 7's volume, redirect writes to firsts sectors to the backed
-	 * up ones
-	 */
-	if(dis_ctx->metadata->information->version == V_SEVEN &&
-	   offset < dis_ctx->metadata->virtualized_size)
-	{
-		dis_printf(L_DEBUG, "  Entering virtualized area\n");
-		if(offset + (off_t)size <= dis_ctx->metadata->virtualized_size)
-		{
-			/*
-			 * If all the request is within the virtualized area, just change
-			 * the offset
-			 */
-			offset = offset + (off_t)dis_ctx->metadata->information->boot_sectors_backup;
-			dis_printf(L_DEBUG, "  `-> Just redirecting to %#"F_OFF_T"\n", offset);
-		}
-		else
-		{
-			/*
-			 * But if the buffer is within the virtualized area and overflow it,
-			 * split the request in two:
-			 * - One for the virtualized area completely (which will be handled
-			 *   by "recursing" and entering the case above)
-			 * - One for the rest by changing the offset to the end of the
-			 *   virtualized area and the size to the rest to be dec/encrypted
-			 */
-			dis_printf(L_DEBUG, "  `-> Splitting the request in two, recursing\n");
-
-			size_t nsize = (size_t)(dis_ctx->metadata->virtualized_size - offset);
-			ret = enlock(dis_ctx, buffer, offset, nsize);
-			if(ret < 0)
-				return ret;
-
-			offset  = dis_ctx->metadata->virtualized_size;
-			size   -= nsize;
-			buffer += nsize;
-		}
-	}
-
-
 	/*
 	 * As in the read function, the offset may not be at a sector limit, so we
-	 * need to decrypt the entire sector where it starts till the entire sector
-	 * where it ends, then push the changes into the sectors at correct offset
-	 * and finally encrypt all of these sectors and write them back to the disk.
+	 * need to decrypt the entire sectors where it starts and where it ends,
+	 * then push the changes into these sectors at correct offset and finally
+	 * encrypt them and write them back to the disk.
+	 * The sectors the user completely overwrites don't need to be decrypted
+	 * first, they're encrypted straight from the user's buffer.
 	 *
 	 *
 	 * Example:
@@ -573,26 +771,19 @@ int enlock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 	 *
 	 * The user don't want to write everywhere, just from the middle of sector 2
 	 * till a part of sector 5. But we're writing sectors by sectors to be able
-	 * to encrypt using AES. So we'll need entire sectors 2 to 5 included.
+	 * to encrypt using AES. So we'll need entire sectors 2 and 5 to be read and
+	 * decrypted, sectors 3 and 4 are just encrypted.
 	 *
-	 *
-	 *
-	 * Logic to do this is below :
-	 *  - read and decrypt all sectors completely (2 to 5 in the example above)
-	 *  - replace some data by the user's one
-	 *  - encrypt and write the read sectors
+	 * For BitLocker 7's volume, writes to the firsts sectors are redirected to
+	 * the backed up ones when the sectors are split into runs, see
+	 * runs.c:dis_runs_classify_write().
 	 */
 
-	/* Do not add sectors if we're at the edge of one already */
-	sector_size = dis_ctx->io_data.sector_size;
-	if((offset % sector_size) != 0)
-		sector_to_add += 1;
-	if(((offset + (off_t)size) % sector_size) != 0)
-		sector_to_add += 1;
-
-
-	sector_count = ( size / sector_size ) + sector_to_add;
-	sector_start = offset / sector_size;
+	sector_size   = dis_ctx->io_data.sector_size;
+	end           = offset + (off_t)size;
+	sector_start  = offset / sector_size;
+	aligned_start = (offset + sector_size - 1) / sector_size * sector_size;
+	aligned_end   = end / sector_size * sector_size;
 
 	dis_printf(L_DEBUG,
 	        "--------------------{ Fuse writing }-----------------------\n");
@@ -600,107 +791,950 @@ int enlock(dis_context_t dis_ctx, uint8_t* buffer, off_t offset, size_t size)
 	        F_SIZE_T "\n", offset, size);
 	dis_printf(L_DEBUG, "  Start sector number: %#" F_OFF_T
 	        " || Number of sectors: %#" F_SIZE_T "\n",
-	        sector_start, sector_count);
+	        sector_start,
+	        (size_t)((end + sector_size - 1) / sector_size - sector_start));
 
 
 	/*
 	 * NOTE: DO NOT use dis_malloc() here, we don't want to mess everything up!
 	 * In general, do not use xfunctions() but dis_printf() here.
 	 */
+	if(offset != aligned_start || end != aligned_end)
+	{
+		bounce = malloc(sector_size);
+
+		/* If buffer could not be allocated */
+		if(!bounce)
+		{
+			dis_printf(L_ERROR, "Cannot allocate buffer for writing, abort.\n");
+			dis_printf(L_DEBUG,
+			       "-----------------------------------------------------------\n");
+			return -ENOMEM;
+		}
+	}
+
+	/*
+	 * Another request writing on the same sectors would undo what this one
+	 * writes on the sectors read-modify-written, or the other way around
+	 */
+	dis_rangelock_lock(
+		dis_ctx->io_data.write_lock,
+		&range,
+		sector_start * sector_size,
+		(end + sector_size - 1) / sector_size * sector_size
+	);
+
+	/* What has been read ahead on this range isn't valid anymore */
+	dis_readahead_begin_write(dis_ctx->io_data.readahead, offset, size);
 
-	buf = malloc(size + sector_to_add * (size_t)sector_size);
 
-	/* If buffer could not be allocated */
-	if(!buf)
+	if(aligned_start > aligned_end)
 	{
-		dis_printf(L_ERROR, "Cannot allocate buffer for writing, abort.\n");
-		dis_printf(L_DEBUG,
-		       "-----------------------------------------------------------\n");
-		return -ENOMEM;
+		/* The request is within one sector */
+		ok = enlock_partial_sector(
+			dis_ctx, aligned_end, bounce,
+			(size_t)(offset - aligned_end), size, buffer
+		);
 	}
+	else
+	{
+		/* Beginning of the first sector, if it's a partial one */
+		if(offset < aligned_start)
+			ok = enlock_partial_sector(
+				dis_ctx, aligned_start - sector_size, bounce,
+				(size_t)(offset - (aligned_start - sector_size)),
+				(size_t)(aligned_start - offset), buffer
+			);
 
+		/* Full sectors, encrypted from the user's buffer */
+		if(ok && aligned_start < aligned_end)
+			ok = dis_ctx->io_data.encrypt_region(
+				&dis_ctx->io_data,
+				(size_t)(aligned_end - aligned_start) / sector_size,
+				sector_size,
+				aligned_start,
+				buffer + (aligned_start - offset)
+			);
 
-	if(!dis_ctx->io_data.decrypt_region(
-		&dis_ctx->io_data,
-		sector_count,
-		sector_size,
-		sector_start * sector_size,
-		buf
-	))
+		/* End of the last sector, if it's a partial one */
+		if(ok && aligned_end < end)
+			ok = enlock_partial_sector(
+				dis_ctx, aligned_end, bounce,
+				0, (size_t)(end - aligned_end),
+				buffer + (aligned_end - offset)
+			);
+	}
+
+	free(bounce);
+
+	/* Even if it failed, some sectors may have been written */
+	dis_cache_invalidate(dis_ctx->io_data.cache, offset, size);
+	dis_ntfs_bitmap_invalidate(dis_ctx->ntfs_bitmap);
+	dis_readahead_end_write(dis_ctx->io_data.readahead);
+	dis_rangelock_unlock(dis_ctx->io_data.write_lock, &range);
+
+	if(!ok)
 	{
-		free(buf);
-		dis_printf(L_ERROR, "Cannot decrypt sectors, abort.\n");
+		dis_printf(L_ERROR, "Cannot encrypt sectors, abort.\n");
 		dis_printf(L_DEBUG,
 		       "-----------------------------------------------------------\n");
 		return -EIO;
 	}
 
+	dis_printf(L_DEBUG, "  Outsize which will be returned: %d\n", (int)size);
+	dis_printf(L_DEBUG,
+	        "-----------------------------------------------------------\n");
 
-	/* Now copy the user's buffer to the received data */
-	memcpy(buf + (offset % sector_size), buffer, size);
+	return (int)size;
+}
 
 
-	/* Finally, encrypt the buffer and write it to the disk */
-	if(!dis_ctx->io_data.encrypt_region(
-		&dis_ctx->io_data,
-		sector_count,
-		sector_size,
-		sector_start * sector_size,
-		buf
-	))
+/**
+ * Zero a part of a sector, unless it's in the metadata which is read as zeroes
+ * anyway
+ *
+ * @param dis_ctx The dislocker context
+ * @param offset Where to start zeroing
+ * @param size The number of bytes to zero, within one sector
+ * @return 0 on success, a negative errno value otherwise
+ */
+static int zero_partial_sector(dis_context_t dis_ctx, off_t offset, size_t size)
+{
+	uint8_t* zeroes = NULL;
+	int      ret    = 0;
+
+	if(size == 0 ||
+	   dis_metadata_is_overwritten(dis_ctx->metadata, offset, size) != DIS_RET_SUCCESS)
+		return 0;
+
+	zeroes = calloc(1, size);
+	if(!zeroes)
+		return -ENOMEM;
+
+	ret = enlock(dis_ctx, zeroes, offset, size);
+	free(zeroes);
+
+	return ret < 0 ? ret : 0;
+}
+
+
+int dis_discard(dis_context_t dis_ctx, off_t offset, off_t size)
+{
+	dis_range_t range;
+	uint16_t    sector_size;
+	off_t       aligned_start;
+	off_t       aligned_end;
+	off_t       end;
+	int         ret = 0;
+
+	if(!dis_ctx)
+		return -EINVAL;
+
+	/* Check the initialization's state */
+	if(dis_ctx->curr_state != DIS_STATE_COMPLETE_EVERYTHING)
 	{
-		free(buf);
-		dis_printf(L_ERROR, "Cannot encrypt sectors, abort.\n");
-		dis_printf(L_DEBUG,
-		       "-----------------------------------------------------------\n");
-		return -EIO;
+		dis_printf(L_ERROR, "Initialization not completed. Abort.\n");
+		return -EFAULT;
+	}
+
+	/* Check the state the BitLocker volume is in */
+	if(dis_ctx->io_data.volume_state == FALSE)
+	{
+		dis_printf(L_ERROR, "Invalid volume state, can't run safely. Abort.\n");
+		return -EFAULT;
+	}
+
+	if(dis_ctx->cfg.flags & DIS_FLAG_READ_ONLY)
+	{
+		dis_printf(L_DEBUG, "Only decrypting (-r or --read-only option passed)\n");
+		return -EACCES;
 	}
 
+	/* All-zero sectors are read as zeroes only if the user asked for it */
+	if(!dis_ctx->io_data.discard)
+		return -EOPNOTSUPP;
+
+	if(offset < 0 || size < 0)
+		return -EINVAL;
 
-	free(buf);
+	/* Nothing is there past the volume's end */
+	if(offset >= (off_t)dis_ctx->io_data.volume_size || size == 0)
+		return 0;
 
+	end = offset + size;
+	if(end > (off_t)dis_ctx->io_data.volume_size || end < offset)
+		end = (off_t)dis_ctx->io_data.volume_size;
 
-	/* Note that ret is zero when no recursion occurs */
-	int outsize = (int)size + ret;
+	sector_size   = dis_ctx->io_data.sector_size;
+	aligned_start = (offset + sector_size - 1) / sector_size * sector_size;
+	aligned_end   = end / sector_size * sector_size;
 
-	dis_printf(L_DEBUG, "  Outsize which will be returned: %d\n", outsize);
-	dis_printf(L_DEBUG,
-	        "-----------------------------------------------------------\n");
+	dis_printf(L_DEBUG, "Discarding %#" F_OFF_T " bytes from %#" F_OFF_T "\n",
+	        end - offset, offset);
+
+	/* Parts of sectors are zeroed, whole ones are deallocated */
+	if(aligned_start >= aligned_end)
+		return zero_partial_sector(dis_ctx, offset, (size_t)(end - offset));
+
+	ret = zero_partial_sector(dis_ctx, offset, (size_t)(aligned_start - offset));
+
+	if(ret == 0)
+	{
+		dis_rangelock_lock(
+			dis_ctx->io_data.write_lock,
+			&range,
+			aligned_start,
+			aligned_end
+		);
+		dis_readahead_begin_write(
+			dis_ctx->io_data.readahead,
+			aligned_start,
+			(size_t)(aligned_end - aligned_start)
+		);
+
+		ret = discard_sectors(
+			&dis_ctx->io_data,
+			(size_t)(aligned_end - aligned_start) / sector_size,
+			sector_size,
+			aligned_start
+		);
 
-	return outsize;
+		/* Even if it failed, some sectors may have been deallocated */
+		dis_cache_invalidate(
+			dis_ctx->io_data.cache,
+			aligned_start,
+			(size_t)(aligned_end - aligned_start)
+		);
+		dis_ntfs_bitmap_invalidate(dis_ctx->ntfs_bitmap);
+		dis_readahead_end_write(dis_ctx->io_data.readahead);
+		dis_rangelock_unlock(dis_ctx->io_data.write_lock, &range);
+	}
+
+	if(ret == 0)
+		ret = zero_partial_sector(dis_ctx, aligned_end, (size_t)(end - aligned_end));
+
+	if(ret < 0)
+		dis_printf(L_DEBUG, "Cannot discard sectors: %s\n", strerror(-ret));
+
+	return ret;
 }
 
 
 
-int dis_destroy(dis_context_t dis_ctx)
+/**
+ * Find the first offset, from the given one, which is in a hole: the metadata,
+ * read as zeroes, and the NTFS free clusters if they're reported
+ *
+ * @param dis_ctx The dislocker context
+ * @param offset The offset to start looking from, within the volume
+ * @return The offset found, the volume's size if there's no hole after offset
+ */
+static off_t seek_hole(dis_context_t dis_ctx, off_t offset)
 {
-	/* Finish cleaning things */
-	if(dis_ctx->io_data.vmk)
-		dis_free(dis_ctx->io_data.vmk);
+	off_t hole = dis_runs_seek_zeroed(&dis_ctx->io_data, offset, TRUE);
+	off_t free_cluster = dis_ntfs_bitmap_seek(dis_ctx->ntfs_bitmap, offset, FALSE);
 
-	if(dis_ctx->io_data.fvek)
-		dis_free(dis_ctx->io_data.fvek);
+	if(free_cluster >= 0 && free_cluster < hole)
+		hole = free_cluster;
 
-	dis_crypt_destroy(dis_ctx->io_data.crypt);
+	if(hole > (off_t)dis_ctx->io_data.volume_size)
+		hole = (off_t)dis_ctx->io_data.volume_size;
 
-	dis_metadata_destroy(dis_ctx->metadata);
+	return hole;
+}
 
-	dis_free_args(dis_ctx);
 
-	dis_close(dis_ctx->io_data.volume_fd);
+/**
+ * Find the first offset, from the given one, which isn't in a hole
+ * @see seek_hole()
+ *
+ * @param dis_ctx The dislocker context
+ * @param offset The offset to start looking from, within the volume
+ * @return The offset found, -ENXIO if there's only holes after offset
+ */
+static off_t seek_data(dis_context_t dis_ctx, off_t offset)
+{
+	off_t end  = (off_t)dis_ctx->io_data.volume_size;
+	off_t next = 0;
 
-	dis_stdio_end();
+	/* Both kinds of holes may follow each other, skip them until none is left */
+	while(offset < end)
+	{
+		next = dis_runs_seek_zeroed(&dis_ctx->io_data, offset, FALSE);
+		next = dis_ntfs_bitmap_seek(dis_ctx->ntfs_bitmap, next, TRUE);
 
-	dis_free(dis_ctx);
+		if(next == offset)
+			return offset;
 
-	return EXIT_SUCCESS;
-}
+		offset = next;
+	}
 
+	return -ENXIO;
+}
 
 
-int get_fvevol_fd(dis_context_t dis_ctx)
+off_t dis_seek(dis_context_t dis_ctx, off_t offset, int whence)
 {
-	return dis_ctx->fve_fd;
+	if(!dis_ctx)
+		return -EINVAL;
+
+	/* Check the initialization's state */
+	if(dis_ctx->curr_state != DIS_STATE_COMPLETE_EVERYTHING)
+	{
+		dis_printf(L_ERROR, "Initialization not completed. Abort.\n");
+		return -EFAULT;
+	}
+
+	/* As lseek(2), there's nothing to find past the end */
+	if(offset < 0 || offset >= (off_t)dis_ctx->io_data.volume_size)
+		return -ENXIO;
+
+#ifdef SEEK_HOLE
+	if(whence == SEEK_HOLE)
+		return seek_hole(dis_ctx, offset);
+#endif
+
+#ifdef SEEK_DATA
+	if(whence == SEEK_DATA)
+		return seek_data(dis_ctx, offset);
+#endif
+
+	return -EINVAL;
+}
+
+
+
+/*
+ * Sectors a scatter-gather request works on, and where they are in the
+ * request's buffer
+ */
+typedef struct _dis_span
+{
+	off_t  start;
+	off_t  end;
+	size_t pos;
+} dis_span_t;
+
+
+/*
+ * What a scatter-gather request is turned into
+ */
+typedef struct _dis_sg_plan
+{
+	/* Size of each range, once checked */
+	size_t*  sizes;
+	size_t   total;
+
+	/* Merged sectors of the ranges, sorted */
+	dis_span_t* spans;
+	size_t   nb_spans;
+
+	/* The same, as regions for the sectors functions */
+	dis_sector_region_t* regions;
+
+	/* Plaintext of the spans, one after the other */
+	uint8_t* data;
+} dis_sg_plan_t;
+
+
+
+static int compare_spans(const void* first, const void* second)
+{
+	const dis_span_t* span1 = (const dis_span_t*) first;
+	const dis_span_t* span2 = (const dis_span_t*) second;
+
+	if(span1->start < span2->start)
+		return -1;
+
+	return span1->start > span2->start;
+}
+
+
+/**
+ * Sort spans and merge the overlapping and adjacent ones, then compute where
+ * each one is in the request's buffer
+ *
+ * @param spans The spans to merge, modified in place
+ * @param nb_spans The number of spans
+ * @param size Where to put the total size of the merged spans
+ * @return The number of spans once merged
+ */
+static size_t merge_spans(dis_span_t* spans, size_t nb_spans, size_t* size)
+{
+	size_t nb_merged = 0;
+	size_t loop      = 0;
+
+	*size = 0;
+
+	if(nb_spans == 0)
+		return 0;
+
+	qsort(spans, nb_spans, sizeof(dis_span_t), compare_spans);
+
+	for(loop = 1; loop < nb_spans; loop++)
+	{
+		if(spans[loop].start <= spans[nb_merged].end)
+		{
+			if(spans[loop].end > spans[nb_merged].end)
+				spans[nb_merged].end = spans[loop].end;
+		}
+		else
+			spans[++nb_merged] = spans[loop];
+	}
+	nb_merged++;
+
+	for(loop = 0; loop < nb_merged; loop++)
+	{
+		spans[loop].pos = *size;
+		*size += (size_t)(spans[loop].end - spans[loop].start);
+	}
+
+	return nb_merged;
+}
+
+
+/**
+ * Find the span an offset is in
+ *
+ * @param spans The merged spans
+ * @param nb_spans The number of spans, at least 1
+ * @param offset The offset to look for, which has to be in a span
+ * @return The span
+ */
+static dis_span_t* find_span(dis_span_t* spans, size_t nb_spans, off_t offset)
+{
+	size_t low  = 0;
+	size_t high = nb_spans - 1;
+	size_t mid  = 0;
+
+	while(low < high)
+	{
+		mid = (low + high + 1) / 2;
+
+		if(spans[mid].start <= offset)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return &spans[low];
+}
+
+
+/**
+ * Check the ranges of a scatter-gather request, as dislock() and enlock() do
+ * for theirs
+ *
+ * @param dis_ctx The dislocker context
+ * @param iov The ranges
+ * @param nb_iov The number of ranges
+ * @param write TRUE for dis_writev(), FALSE for dis_readv()
+ * @param sizes Where to put the size of each range, cut at the volume's end
+ * for writes
+ * @return 0 if the request can go on, a negative errno value otherwise
+ */
+static int check_iovec(
+	dis_context_t dis_ctx,
+	const dis_iovec_t* iov,
+	size_t nb_iov,
+	int write,
+	size_t* sizes)
+{
+	off_t  volume_size = (off_t)dis_ctx->io_data.volume_size;
+	size_t total       = 0;
+	size_t loop        = 0;
+
+	/* Check the initialization's state */
+	if(dis_ctx->curr_state != DIS_STATE_COMPLETE_EVERYTHING)
+	{
+		dis_printf(L_ERROR, "Initialization not completed. Abort.\n");
+		return -EFAULT;
+	}
+
+	/* Check the state the BitLocker volume is in */
+	if(dis_ctx->io_data.volume_state == FALSE)
+	{
+		dis_printf(L_ERROR, "Invalid volume state, can't run safely. Abort.\n");
+		return -EFAULT;
+	}
+
+	if(write && (dis_ctx->cfg.flags & DIS_FLAG_READ_ONLY))
+	{
+		dis_printf(L_DEBUG, "Only decrypting (-r or --read-only option passed)\n");
+		return -EACCES;
+	}
+
+	for(loop = 0; loop < nb_iov; loop++)
+	{
+		off_t  offset = iov[loop].offset;
+		size_t size   = iov[loop].size;
+
+		sizes[loop] = 0;
+
+		if(size == 0)
+			continue;
+
+		if(!iov[loop].buffer)
+			return -EINVAL;
+
+		if(size > INT_MAX || total > SSIZE_MAX - size)
+		{
+			dis_printf(L_ERROR, "Received size which will overflow: %#" F_SIZE_T "\n",
+				size
+			);
+			return -EOVERFLOW;
+		}
+
+		if(offset < 0)
+		{
+			dis_printf(L_ERROR, "Offset under 0: %#" F_OFF_T "\n", offset);
+			return -EFAULT;
+		}
+
+		if(offset >= volume_size &&
+		   (write || !dis_metadata_is_decrypted_state(dis_ctx->io_data.metadata)))
+		{
+			dis_printf(
+				L_ERROR,
+				"Offset (%#" F_OFF_T ") exceeds volume's size (%#" F_OFF_T ")\n",
+				offset,
+				volume_size
+			);
+			return -EFAULT;
+		}
+
+		if(write)
+		{
+			if(offset + (off_t)size >= volume_size)
+				size = (size_t)(volume_size - offset);
+
+			/* Same as in enlock(), metadata are not to be written */
+			if(dis_metadata_is_overwritten(dis_ctx->metadata, offset, size)
+			   != DIS_RET_SUCCESS)
+				return -EFAULT;
+		}
+
+		sizes[loop] = size;
+		total      += size;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Free what has been allocated for a scatter-gather request
+ */
+static void free_plan(dis_sg_plan_t* plan)
+{
+	free(plan->sizes);
+	free(plan->spans);
+	free(plan->regions);
+	free(plan->data);
+}
+
+
+/**
+ * Check a scatter-gather request and merge the sectors of its ranges
+ *
+ * @param dis_ctx The dislocker context
+ * @param iov The ranges
+ * @param nb_iov The number of ranges
+ * @param write TRUE for dis_writev(), FALSE for dis_readv()
+ * @param plan Where to put the merged sectors, to free with free_plan() in
+ * any case
+ * @return 0 if the request can go on, a negative errno value otherwise
+ */
+static int plan_iovec(
+	dis_context_t dis_ctx,
+	const dis_iovec_t* iov,
+	size_t nb_iov,
+	int write,
+	dis_sg_plan_t* plan)
+{
+	uint16_t sector_size = dis_ctx->io_data.sector_size;
+	size_t   nb_spans    = 0;
+	size_t   size        = 0;
+	size_t   loop        = 0;
+	int      ret         = 0;
+
+	memset(plan, 0, sizeof(dis_sg_plan_t));
+
+	if(nb_iov == 0)
+		return 0;
+
+	/*
+	 * NOTE: DO NOT use dis_malloc() here, we don't want to mess everything up!
+	 */
+	plan->sizes = malloc(nb_iov * sizeof(size_t));
+	plan->spans = malloc(nb_iov * sizeof(dis_span_t));
+	if(!plan->sizes || !plan->spans)
+		return -ENOMEM;
+
+	ret = check_iovec(dis_ctx, iov, nb_iov, write, plan->sizes);
+	if(ret < 0)
+		return ret;
+
+	for(loop = 0; loop < nb_iov; loop++)
+	{
+		if(plan->sizes[loop] == 0)
+			continue;
+
+		plan->spans[nb_spans].start = iov[loop].offset / sector_size * sector_size;
+		plan->spans[nb_spans].end   =
+			(iov[loop].offset + (off_t)plan->sizes[loop] + sector_size - 1)
+			/ sector_size * sector_size;
+		plan->total += plan->sizes[loop];
+		nb_spans++;
+	}
+
+	plan->nb_spans = merge_spans(plan->spans, nb_spans, &size);
+
+	if(plan->nb_spans == 0)
+		return 0;
+
+	plan->regions = malloc(plan->nb_spans * sizeof(dis_sector_region_t));
+	plan->data    = malloc(size);
+	if(!plan->regions || !plan->data)
+		return -ENOMEM;
+
+	for(loop = 0; loop < plan->nb_spans; loop++)
+	{
+		dis_span_t* span = &plan->spans[loop];
+
+		plan->regions[loop].sector_start = span->start;
+		plan->regions[loop].nb_sectors   =
+			(size_t)(span->end - span->start) / sector_size;
+		plan->regions[loop].buffer       = plan->data + span->pos;
+	}
+
+	dis_printf(
+		L_DEBUG,
+		"  %" F_SIZE_T " range(s) merged into %" F_SIZE_T " span(s) of %#"
+		F_SIZE_T " bytes\n",
+		nb_iov,
+		plan->nb_spans,
+		size
+	);
+
+	return 0;
+}
+
+
+/**
+ * Get where a range is in a scatter-gather request's buffer
+ */
+static uint8_t* plan_data_at(dis_sg_plan_t* plan, off_t offset)
+{
+	dis_span_t* span = find_span(plan->spans, plan->nb_spans, offset);
+
+	return plan->data + span->pos + (offset - span->start);
+}
+
+
+ssize_t dis_readv(dis_context_t dis_ctx, const dis_iovec_t* iov, size_t nb_iov)
+{
+	dis_sg_plan_t plan;
+	size_t        loop = 0;
+	int           ret  = 0;
+
+	if(!dis_ctx || (!iov && nb_iov > 0))
+		return -EINVAL;
+
+	dis_printf(L_DEBUG,
+	        "----------------{ Scatter-gather reading }-----------------\n");
+
+	ret = plan_iovec(dis_ctx, iov, nb_iov, FALSE, &plan);
+
+	if(ret == 0 && plan.nb_spans > 0)
+	{
+		/* Don't decrypt along with the read-ahead if it can't be done */
+		dis_readahead_wait(dis_ctx->io_data.readahead);
+
+		if(!read_decrypt_regions(
+			&dis_ctx->io_data,
+			dis_ctx->io_data.sector_size,
+			plan.regions,
+			plan.nb_spans))
+		{
+			dis_printf(L_ERROR, "Cannot decrypt sectors, abort.\n");
+			ret = -EIO;
+		}
+	}
+
+	if(ret == 0)
+		for(loop = 0; loop < nb_iov; loop++)
+			if(plan.sizes[loop] > 0)
+				memcpy(
+					iov[loop].buffer,
+					plan_data_at(&plan, iov[loop].offset),
+					plan.sizes[loop]
+				);
+
+	free_plan(&plan);
+
+	dis_printf(L_DEBUG,
+	        "-----------------------------------------------------------\n");
+
+	return ret < 0 ? ret : (ssize_t)plan.total;
+}
+
+
+ssize_t dis_writev(dis_context_t dis_ctx, const dis_iovec_t* iov, size_t nb_iov)
+{
+	uint16_t      sector_size = 0;
+	dis_sg_plan_t plan;
+	dis_span_t*   partials    = NULL;
+	dis_sector_region_t* regions = NULL;
+	dis_range_t   range;
+	size_t        nb_partials = 0;
+	size_t        size        = 0;
+	size_t        loop        = 0;
+	off_t         end         = 0;
+	int           ret         = 0;
+
+	if(!dis_ctx || (!iov && nb_iov > 0))
+		return -EINVAL;
+
+	dis_printf(L_DEBUG,
+	        "----------------{ Scatter-gather writing }-----------------\n");
+
+	sector_size = dis_ctx->io_data.sector_size;
+	ret = plan_iovec(dis_ctx, iov, nb_iov, TRUE, &plan);
+
+	if(ret < 0 || plan.nb_spans == 0)
+	{
+		free_plan(&plan);
+		dis_printf(L_DEBUG,
+		        "-----------------------------------------------------------\n");
+		return ret < 0 ? ret : 0;
+	}
+
+	/*
+	 * The sectors the ranges only partly cover have to be decrypted first, as
+	 * in enlock(). They are merged too, to be read at once.
+	 */
+	partials = malloc(2 * nb_iov * sizeof(dis_span_t));
+	regions  = malloc(2 * nb_iov * sizeof(dis_sector_region_t));
+	if(!partials || !regions)
+		ret = -ENOMEM;
+
+	for(loop = 0; loop < nb_iov && ret == 0; loop++)
+	{
+		if(plan.sizes[loop] == 0)
+			continue;
+
+		end = iov[loop].offset + (off_t)plan.sizes[loop];
+
+		if(iov[loop].offset % sector_size)
+		{
+			partials[nb_partials].start = iov[loop].offset / sector_size * sector_size;
+			partials[nb_partials].end   = partials[nb_partials].start + sector_size;
+			nb_partials++;
+		}
+
+		if(end % sector_size)
+		{
+			partials[nb_partials].start = end / sector_size * sector_size;
+			partials[nb_partials].end   = partials[nb_partials].start + sector_size;
+			nb_partials++;
+		}
+	}
+
+	if(ret == 0)
+	{
+		nb_partials = merge_spans(partials, nb_partials, &size);
+
+		for(loop = 0; loop < nb_partials; loop++)
+		{
+			regions[loop].sector_start = partials[loop].start;
+			regions[loop].nb_sectors   =
+				(size_t)(partials[loop].end - partials[loop].start) / sector_size;
+			regions[loop].buffer       = plan_data_at(&plan, partials[loop].start);
+		}
+
+		/* As in enlock(), from the first sector to the last one written */
+		dis_rangelock_lock(
+			dis_ctx->io_data.write_lock,
+			&range,
+			plan.spans[0].start,
+			plan.spans[plan.nb_spans - 1].end
+		);
+
+		/* What has been read ahead on these ranges isn't valid anymore */
+		for(loop = 0; loop < plan.nb_spans; loop++)
+			dis_readahead_begin_write(
+				dis_ctx->io_data.readahead,
+				plan.spans[loop].start,
+				(size_t)(plan.spans[loop].end - plan.spans[loop].start)
+			);
+
+		if(nb_partials > 0 &&
+		   !read_decrypt_regions(
+				&dis_ctx->io_data, sector_size, regions, nb_partials))
+		{
+			dis_printf(L_ERROR, "Cannot decrypt sectors, abort.\n");
+			ret = -EIO;
+		}
+
+		/* In the list's order, so that the last range wins */
+		if(ret == 0)
+			for(loop = 0; loop < nb_iov; loop++)
+				if(plan.sizes[loop] > 0)
+					memcpy(
+						plan_data_at(&plan, iov[loop].offset),
+						iov[loop].buffer,
+						plan.sizes[loop]
+					);
+
+		if(ret == 0 &&
+		   !encrypt_write_regions(
+				&dis_ctx->io_data, sector_size, plan.regions, plan.nb_spans))
+		{
+			dis_printf(L_ERROR, "Cannot encrypt sectors, abort.\n");
+			ret = -EIO;
+		}
+
+		/* Even if it failed, some sectors may have been written */
+		for(loop = 0; loop < plan.nb_spans; loop++)
+		{
+			dis_cache_invalidate(
+				dis_ctx->io_data.cache,
+				plan.spans[loop].start,
+				(size_t)(plan.spans[loop].end - plan.spans[loop].start)
+			);
+			dis_readahead_end_write(dis_ctx->io_data.readahead);
+		}
+		dis_ntfs_bitmap_invalidate(dis_ctx->ntfs_bitmap);
+
+		dis_rangelock_unlock(dis_ctx->io_data.write_lock, &range);
+	}
+
+	free(regions);
+	free(partials);
+	free_plan(&plan);
+
+	dis_printf(L_DEBUG,
+	        "-----------------------------------------------------------\n");
+
+	return ret < 0 ? ret : (ssize_t)plan.total;
+}
+
+
+
+int dis_destroy(dis_context_t dis_ctx)
+{
+	/*
+	 * Stop the threads first, they may still use the structures below. The
+	 * functions given to dis_run_async() and the read-ahead's thread use the
+	 * workers.
+	 */
+	dis_workers_wait(dis_ctx->io_data.workers);
+
+	dis_readahead_destroy(dis_ctx->io_data.readahead);
+	dis_ctx->io_data.readahead = NULL;
+
+	dis_workers_destroy(dis_ctx->io_data.workers);
+	dis_ctx->io_data.workers = NULL;
+
+	dis_uring_destroy(dis_ctx->io_data.uring);
+	dis_ctx->io_data.uring = NULL;
+
+	dis_direct_destroy(dis_ctx->io_data.direct);
+	dis_ctx->io_data.direct = NULL;
+
+	dis_rangelock_destroy(dis_ctx->io_data.write_lock);
+	dis_ctx->io_data.write_lock = NULL;
+
+	dis_ntfs_bitmap_destroy(dis_ctx->ntfs_bitmap);
+	dis_ctx->ntfs_bitmap = NULL;
+
+	if(dis_ctx->io_data.cache)
+	{
+		uint64_t hits   = 0;
+		uint64_t misses = 0;
+
+		dis_cache_stats(dis_ctx->io_data.cache, &hits, &misses);
+		dis_printf(
+			L_DEBUG,
+			"Sectors cache: %" PRIu64 " hit(s), %" PRIu64 " miss(es)\n",
+			hits,
+			misses
+		);
+
+		dis_cache_destroy(dis_ctx->io_data.cache);
+		dis_ctx->io_data.cache = NULL;
+	}
+
+	/* Finish cleaning things */
+	if(dis_ctx->io_data.vmk)
+		dis_free(dis_ctx->io_data.vmk);
+
+	if(dis_ctx->io_data.fvek)
+		dis_free(dis_ctx->io_data.fvek);
+
+	dis_crypt_destroy(dis_ctx->io_data.crypt);
+
+	dis_metadata_destroy(dis_ctx->metadata);
+
+	dis_free_args(dis_ctx);
+
+	dis_close(dis_ctx->io_data.volume_fd);
+
+	dis_stdio_end();
+
+	dis_free(dis_ctx);
+
+	return EXIT_SUCCESS;
+}
+
+
+
+int get_fvevol_fd(dis_context_t dis_ctx)
+{
+	return dis_ctx->fve_fd;
+}
+
+
+void dis_get_cache_stats(dis_context_t dis_ctx, uint64_t* hits, uint64_t* misses)
+{
+	if(!hits || !misses)
+		return;
+
+	if(!dis_ctx)
+	{
+		*hits   = 0;
+		*misses = 0;
+		return;
+	}
+
+	dis_cache_stats(dis_ctx->io_data.cache, hits, misses);
+}
+
+
+int dis_run_async(dis_context_t dis_ctx, void (*fn)(void* arg), void* arg)
+{
+	if(!dis_ctx || !fn)
+		return -EINVAL;
+
+	if(dis_ctx->curr_state != DIS_STATE_COMPLETE_EVERYTHING)
+	{
+		dis_printf(L_ERROR, "Initialization not completed. Abort.\n");
+		return -EFAULT;
+	}
+
+	dis_workers_post(dis_ctx->io_data.workers, fn, arg);
+
+	return 0;
+}
+
+
+void dis_wait_async(dis_context_t dis_ctx)
+{
+	if(!dis_ctx)
+		return;
+
+	dis_workers_wait(dis_ctx->io_data.workers);
 }
 
 
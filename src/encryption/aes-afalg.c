@@ -0,0 +1,514 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_alg.h>
+
+#include "dislocker/common.h"
+#include "dislocker/xstd/xstdio.h"
+#include "ssl_bindings.h"
+
+
+#ifndef SOL_ALG
+#  define SOL_ALG 279
+#endif
+
+/*
+ * Largest request sent to the kernel, well under what the socket buffers. CBC
+ * and ECB data larger than this is chained over several requests.
+ */
+#define DIS_AFALG_MAX_REQUEST (64 * 1024)
+
+/*
+ * Requests at least this large are spliced to the kernel rather than copied,
+ * up to what fits in a pipe whatever the alignment of the data
+ */
+#define DIS_AFALG_SPLICE_MIN 4096
+#define DIS_AFALG_SPLICE_MAX (15 * 4096)
+
+
+/*
+ * The modes are wrapped around the kernel's preferred AES, or the driver this
+ * variable names: aes-generic for instance, to test against the software one
+ */
+#define DIS_AFALG_AES_ENV "DISLOCKER_AFALG_AES"
+
+static const char* mode_names[DIS_AFALG_NB_CIPHERS] = {
+	"ecb",
+	"cbc",
+	"xts"
+};
+
+
+
+/**
+ * Open an operation socket of one of the kernel's ciphers
+ *
+ * @param cipher One of DIS_AFALG_CIPHER_*
+ * @param key The key to give the cipher
+ * @param key_len The length of the key, in bytes
+ * @return The socket, or -errno if it couldn't be opened
+ */
+static int open_op(int cipher, const unsigned char* key, size_t key_len)
+{
+	struct sockaddr_alg sa;
+	const char*         aes = getenv(DIS_AFALG_AES_ENV);
+	int                 tfm = -1;
+	int                 op  = -1;
+	int                 err = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	strncpy((char*) sa.salg_type, "skcipher", sizeof(sa.salg_type) - 1);
+	snprintf(
+		(char*) sa.salg_name,
+		sizeof(sa.salg_name),
+		"%s(%s)",
+		mode_names[cipher],
+		aes && *aes ? aes : "aes"
+	);
+
+	tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(tfm < 0)
+	{
+		err = -errno;
+		dis_printf(L_ERROR, "Cannot open an AF_ALG socket: %s\n", strerror(errno));
+		return err;
+	}
+
+	/* The operation socket keeps the transform, its socket isn't needed after */
+	if(bind(tfm, (struct sockaddr*) &sa, sizeof(sa)) < 0 ||
+	   setsockopt(tfm, SOL_ALG, ALG_SET_KEY, key, (socklen_t) key_len) < 0 ||
+	   (op = accept4(tfm, NULL, 0, SOCK_CLOEXEC)) < 0)
+	{
+		err = -errno;
+		dis_printf(
+			L_ERROR,
+			"Cannot set the kernel's %s up: %s\n",
+			(char*) sa.salg_name,
+			strerror(errno)
+		);
+	}
+
+	close(tfm);
+
+	return op < 0 ? err : op;
+}
+
+
+/**
+ * Get the operation socket of a cipher, opening it if it's its first use
+ *
+ * @param ctx The AES context
+ * @param cipher One of DIS_AFALG_CIPHER_*
+ * @param key The key to give the cipher if the socket is opened
+ * @param key_len The length of the key, in bytes
+ * @return The socket, or -errno if it couldn't be opened
+ */
+static int get_op(dis_afalg_aes_ctx* ctx, int cipher, const unsigned char* key, size_t key_len)
+{
+	int op = 0;
+
+	if(ctx->opened & (1u << cipher))
+		return ctx->ops[cipher];
+
+	op = open_op(cipher, key, key_len);
+	if(op < 0)
+		return op;
+
+	ctx->ops[cipher] = op;
+	ctx->opened |= 1u << cipher;
+
+	return op;
+}
+
+
+static void close_op(dis_afalg_aes_ctx* ctx, int cipher)
+{
+	if(!(ctx->opened & (1u << cipher)))
+		return;
+
+	close(ctx->ops[cipher]);
+	ctx->opened &= ~(1u << cipher);
+}
+
+
+static int open_pipe(dis_afalg_aes_ctx* ctx)
+{
+	if(ctx->pipe_opened)
+		return 0;
+
+	if(pipe2(ctx->pipe, O_CLOEXEC) < 0)
+		return -errno;
+
+	ctx->pipe_opened = TRUE;
+
+	return 0;
+}
+
+
+static void close_pipe(dis_afalg_aes_ctx* ctx)
+{
+	if(!ctx->pipe_opened)
+		return;
+
+	close(ctx->pipe[0]);
+	close(ctx->pipe[1]);
+	ctx->pipe_opened = FALSE;
+}
+
+
+/**
+ * Forget the state of a cipher after a failed request: its socket and the pipe
+ * may hold part of it
+ *
+ * @param ctx The AES context
+ * @param cipher One of DIS_AFALG_CIPHER_*
+ */
+static void reset_cipher(dis_afalg_aes_ctx* ctx, int cipher)
+{
+	close_op(ctx, cipher);
+	close_pipe(ctx);
+}
+
+
+/**
+ * Send a request to an operation socket. Its data is spliced from the caller's
+ * pages when it's large enough, copied otherwise.
+ *
+ * @param ctx The AES context
+ * @param op The operation socket
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param iv The IV, NULL for ECB
+ * @param input The data
+ * @param length The length of the data
+ * @return 0 if the request has been sent, -errno otherwise
+ */
+static int send_request(
+	dis_afalg_aes_ctx* ctx,
+	int op,
+	int mode,
+	const unsigned char* iv,
+	const unsigned char* input,
+	size_t length)
+{
+	union {
+		char buffer[CMSG_SPACE(sizeof(uint32_t)) +
+		            CMSG_SPACE(sizeof(struct af_alg_iv) + 16)];
+		struct cmsghdr align;
+	} control;
+
+	struct msghdr     msg;
+	struct cmsghdr*   cmsg      = NULL;
+	struct af_alg_iv* alg_iv    = NULL;
+	struct iovec      iov;
+	uint32_t          operation = mode == AES_ENCRYPT ? ALG_OP_ENCRYPT : ALG_OP_DECRYPT;
+	ssize_t           ret       = 0;
+	ssize_t           spliced   = 0;
+	ssize_t           moved     = 0;
+
+	memset(&control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+
+	msg.msg_control    = control.buffer;
+	msg.msg_controllen = iv ? sizeof(control.buffer) : CMSG_SPACE(sizeof(uint32_t));
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_ALG;
+	cmsg->cmsg_type  = ALG_SET_OP;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(uint32_t));
+	memcpy(CMSG_DATA(cmsg), &operation, sizeof(uint32_t));
+
+	if(iv)
+	{
+		cmsg = CMSG_NXTHDR(&msg, cmsg);
+		cmsg->cmsg_level = SOL_ALG;
+		cmsg->cmsg_type  = ALG_SET_IV;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(struct af_alg_iv) + 16);
+
+		alg_iv = (struct af_alg_iv*) CMSG_DATA(cmsg);
+		alg_iv->ivlen = 16;
+		memcpy(alg_iv->iv, iv, 16);
+	}
+
+	iov.iov_base = (void*) input;
+	iov.iov_len  = length;
+
+	if(length < DIS_AFALG_SPLICE_MIN || length > DIS_AFALG_SPLICE_MAX ||
+	   open_pipe(ctx) < 0)
+	{
+		msg.msg_iov    = &iov;
+		msg.msg_iovlen = 1;
+
+		ret = sendmsg(op, &msg, 0);
+		if(ret < 0)
+			return -errno;
+
+		return ret == (ssize_t) length ? 0 : -EIO;
+	}
+
+	/* The operation and the IV first, then the pages of the data */
+	if(sendmsg(op, &msg, MSG_MORE) < 0)
+		return -errno;
+
+	while(iov.iov_len > 0)
+	{
+		ret = vmsplice(ctx->pipe[1], &iov, 1, 0);
+		if(ret <= 0)
+			return ret < 0 ? -errno : -EIO;
+
+		iov.iov_base = (char*) iov.iov_base + ret;
+		iov.iov_len -= (size_t) ret;
+
+		for(spliced = 0; spliced < ret; spliced += moved)
+		{
+			moved = splice(
+				ctx->pipe[0],
+				NULL,
+				op,
+				NULL,
+				(size_t) (ret - spliced),
+				iov.iov_len > 0 ? SPLICE_F_MORE : 0
+			);
+			if(moved <= 0)
+				return moved < 0 ? -errno : -EIO;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Read the result of a request
+ *
+ * @param op The operation socket
+ * @param output Where to put the result
+ * @param length The length of the result
+ * @return 0 if it has been read, -errno otherwise
+ */
+static int receive_result(int op, unsigned char* output, size_t length)
+{
+	ssize_t ret = 0;
+
+	while(length > 0)
+	{
+		ret = read(op, output, length);
+		if(ret < 0 && errno == EINTR)
+			continue;
+
+		if(ret <= 0)
+			return ret < 0 ? -errno : -EIO;
+
+		output += ret;
+		length -= (size_t) ret;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Set the key of an AES context. The kernel's transforms are keyed when
+ * they're first used, in both directions at once, so that only the ones the
+ * volume's cipher needs are opened.
+ *
+ * @param ctx The AES context
+ * @param key The raw key
+ * @param key_bits The size of the key, in bits
+ * @return 0 if the key has been set, -EINVAL otherwise
+ */
+int dis_afalg_set_key(dis_afalg_aes_ctx* ctx, const unsigned char* key, unsigned int key_bits)
+{
+	size_t key_len = key_bits / 8;
+	int    loop    = 0;
+
+	if(!ctx || !key || key_len > sizeof(ctx->key))
+		return -EINVAL;
+
+	/* The sockets keyed with the previous key are useless now */
+	for(loop = 0; loop < DIS_AFALG_NB_CIPHERS; loop++)
+		close_op(ctx, loop);
+
+	memcpy(ctx->key, key, key_len);
+	ctx->key_len = key_len;
+
+	return 0;
+}
+
+
+/**
+ * Close the sockets of an AES context and wipe it
+ *
+ * @param ctx The AES context
+ */
+void dis_afalg_free(dis_afalg_aes_ctx* ctx)
+{
+	int loop = 0;
+
+	if(!ctx)
+		return;
+
+	for(loop = 0; loop < DIS_AFALG_NB_CIPHERS; loop++)
+		close_op(ctx, loop);
+
+	close_pipe(ctx);
+
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+/**
+ * Encrypt or decrypt data with the kernel's AES-ECB or AES-CBC
+ *
+ * @param ctx The AES context
+ * @param cipher DIS_AFALG_CIPHER_ECB or DIS_AFALG_CIPHER_CBC
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param length The length of the data, a multiple of 16 bytes
+ * @param iv The IV for CBC, NULL for ECB
+ * @param input The data to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @return 0 if the data has been dealt with, -errno otherwise
+ */
+int dis_afalg_crypt(
+	dis_afalg_aes_ctx* ctx,
+	int cipher,
+	int mode,
+	size_t length,
+	const unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output)
+{
+	unsigned char next_iv[16];
+	size_t        chunk = 0;
+	int           op    = 0;
+	int           err   = 0;
+
+	if(length % 16)
+		return -EINVAL;
+
+	op = get_op(ctx, cipher, ctx->key, ctx->key_len);
+	if(op < 0)
+		return op;
+
+	/* Each request takes the last ciphertext block of the previous one as IV */
+	for(; length > 0; length -= chunk, input += chunk, output += chunk)
+	{
+		chunk = length < DIS_AFALG_MAX_REQUEST ? length : DIS_AFALG_MAX_REQUEST;
+
+		if(iv && mode == AES_DECRYPT)
+			memcpy(next_iv, input + chunk - 16, 16);
+
+		err = send_request(ctx, op, mode, iv, input, chunk);
+		if(!err)
+			err = receive_result(op, output, chunk);
+
+		if(err)
+		{
+			reset_cipher(ctx, cipher);
+			break;
+		}
+
+		if(iv && mode == AES_ENCRYPT)
+			memcpy(next_iv, output + chunk - 16, 16);
+
+		if(iv)
+			iv = next_iv;
+	}
+
+	memset(next_iv, 0, sizeof(next_iv));
+
+	return err;
+}
+
+
+/**
+ * Encrypt or decrypt data with the kernel's AES-XTS
+ *
+ * @param crypt_ctx The AES context of the data key
+ * @param tweak_ctx The AES context of the tweak key
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param length The length of the data, from 16 bytes to a single request's
+ * @param iv The IV
+ * @param input The data to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @return 0 if the data has been dealt with, -errno otherwise
+ */
+int dis_afalg_crypt_xts(
+	dis_afalg_aes_ctx* crypt_ctx,
+	dis_afalg_aes_ctx* tweak_ctx,
+	int mode,
+	size_t length,
+	const unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output)
+{
+	unsigned char xts_key[2 * DIS_AFALG_MAX_KEY_BYTES];
+	int           op  = 0;
+	int           err = 0;
+
+	if(length < 16 || length > DIS_AFALG_MAX_REQUEST)
+		return -EINVAL;
+
+	/* The XTS socket holds both keys, it's keyed again if the tweak changed */
+	if(crypt_ctx->xts_tweak_len != tweak_ctx->key_len ||
+	   memcmp(crypt_ctx->xts_tweak, tweak_ctx->key, tweak_ctx->key_len) != 0)
+	{
+		close_op(crypt_ctx, DIS_AFALG_CIPHER_XTS);
+		memcpy(crypt_ctx->xts_tweak, tweak_ctx->key, tweak_ctx->key_len);
+		crypt_ctx->xts_tweak_len = tweak_ctx->key_len;
+	}
+
+	memcpy(xts_key, crypt_ctx->key, crypt_ctx->key_len);
+	memcpy(xts_key + crypt_ctx->key_len, tweak_ctx->key, tweak_ctx->key_len);
+
+	op = get_op(
+		crypt_ctx,
+		DIS_AFALG_CIPHER_XTS,
+		xts_key,
+		crypt_ctx->key_len + tweak_ctx->key_len
+	);
+
+	memset(xts_key, 0, sizeof(xts_key));
+
+	if(op < 0)
+		return op;
+
+	err = send_request(crypt_ctx, op, mode, iv, input, length);
+	if(!err)
+		err = receive_result(op, output, length);
+
+	if(err)
+		reset_cipher(crypt_ctx, DIS_AFALG_CIPHER_XTS);
+
+	return err;
+}
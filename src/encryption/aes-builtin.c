@@ -0,0 +1,887 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dislocker/common.h"
+#include "dislocker/encryption/aes-vaes.h"
+#include "ssl_bindings.h"
+
+
+/*
+ * The portable code is bitsliced, so that it runs in constant time without any
+ * table indexed by secret data. A state holds DIS_BUILTIN_LANES blocks: word i
+ * has the bit i of all their bytes, byte pos of the block in lane l being its
+ * bit (16 * l + pos). AES's state being column-major, pos is 4 * column + row.
+ */
+typedef uint64_t state_t[8];
+
+/*
+ * The loops over the words of a state have to be unrolled for them to stay in
+ * registers, which the default optimization level doesn't do
+ */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 8)
+#  define DIS_BUILTIN_UNROLL _Pragma("GCC unroll 8")
+#else
+#  define DIS_BUILTIN_UNROLL
+#endif
+
+
+/**
+ * Transpose the 8x8 bit matrix whose rows are the bytes of a word
+ *
+ * @param x The matrix
+ * @return The transposed matrix
+ */
+static inline uint64_t transpose_8x8(uint64_t x)
+{
+	uint64_t t = 0;
+
+	t = (x ^ (x >>  7)) & 0x00aa00aa00aa00aaULL;
+	x ^= t ^ (t <<  7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x ^= t ^ (t << 28);
+
+	return x;
+}
+
+
+/**
+ * Bitslice blocks into a state, the lanes without a block being zeroed
+ *
+ * @param q The state to fill
+ * @param blocks The blocks
+ * @param nb_blocks The number of blocks, at most DIS_BUILTIN_LANES
+ */
+static void load_state(state_t q, const uint8_t* blocks, size_t nb_blocks)
+{
+	size_t   length = nb_blocks * 16;
+	size_t   group  = 0;
+	size_t   loop   = 0;
+	uint64_t x      = 0;
+
+	memset(q, 0, sizeof(state_t));
+
+	for(group = 0; group < 8; group++)
+	{
+		x = 0;
+		for(loop = 0; loop < 8 && group * 8 + loop < length; loop++)
+			x |= (uint64_t) blocks[group * 8 + loop] << (8 * loop);
+
+		x = transpose_8x8(x);
+
+		for(loop = 0; loop < 8; loop++)
+			q[loop] |= ((x >> (8 * loop)) & 0xff) << (8 * group);
+	}
+}
+
+
+/**
+ * Get the blocks back from a state
+ *
+ * @param q The state
+ * @param blocks Where to put the blocks
+ * @param nb_blocks The number of blocks, at most DIS_BUILTIN_LANES
+ */
+static void store_state(const state_t q, uint8_t* blocks, size_t nb_blocks)
+{
+	size_t   length = nb_blocks * 16;
+	size_t   group  = 0;
+	size_t   loop   = 0;
+	uint64_t x      = 0;
+
+	for(group = 0; group < 8; group++)
+	{
+		x = 0;
+		for(loop = 0; loop < 8; loop++)
+			x |= ((q[loop] >> (8 * group)) & 0xff) << (8 * loop);
+
+		x = transpose_8x8(x);
+
+		for(loop = 0; loop < 8 && group * 8 + loop < length; loop++)
+			blocks[group * 8 + loop] = (uint8_t) (x >> (8 * loop));
+	}
+}
+
+
+/**
+ * Reduce a product of polynomials modulo AES's one, x^8 + x^4 + x^3 + x + 1
+ *
+ * @param t The product, which is modified
+ * @param r Where to put the result
+ */
+static inline void gf_reduce(uint64_t t[15], state_t r)
+{
+	int loop = 0;
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 14; loop >= 8; loop--)
+	{
+		t[loop - 4] ^= t[loop];
+		t[loop - 5] ^= t[loop];
+		t[loop - 7] ^= t[loop];
+		t[loop - 8] ^= t[loop];
+	}
+
+	memcpy(r, t, sizeof(state_t));
+}
+
+
+/**
+ * Multiply the bytes of two states in GF(2^8)
+ *
+ * @param r Where to put the result, which may be one of the operands
+ * @param a The first operand
+ * @param b The second operand
+ */
+static void gf_mul(state_t r, const state_t a, const state_t b)
+{
+	uint64_t t[15] = {0};
+	int      i     = 0;
+	int      j     = 0;
+
+	DIS_BUILTIN_UNROLL
+	for(i = 0; i < 8; i++)
+		DIS_BUILTIN_UNROLL
+		for(j = 0; j < 8; j++)
+			t[i + j] ^= a[i] & b[j];
+
+	gf_reduce(t, r);
+}
+
+
+/**
+ * Square the bytes of a state in GF(2^8), which doesn't mix their bits
+ *
+ * @param r Where to put the result, which may be the operand
+ * @param a The operand
+ */
+static void gf_square(state_t r, const state_t a)
+{
+	uint64_t t[15] = {0};
+	int      loop  = 0;
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		t[2 * loop] = a[loop];
+
+	gf_reduce(t, r);
+}
+
+
+/**
+ * Invert the bytes of a state in GF(2^8), as x^254, 0 staying 0
+ *
+ * @param q The state, which is modified
+ */
+static void gf_invert(state_t q)
+{
+	state_t x2;
+	state_t x3;
+	state_t x12;
+	state_t y;
+
+	gf_square(x2, q);
+	gf_mul(x3, x2, q);
+	gf_square(y, x3);      /* x^6   */
+	gf_square(x12, y);     /* x^12  */
+	gf_mul(y, x12, x3);    /* x^15  */
+	gf_square(y, y);       /* x^30  */
+	gf_square(y, y);       /* x^60  */
+	gf_square(y, y);       /* x^120 */
+	gf_square(y, y);       /* x^240 */
+	gf_mul(y, y, x12);     /* x^252 */
+	gf_mul(q, y, x2);      /* x^254 */
+}
+
+
+static void sub_bytes(state_t q)
+{
+	state_t b;
+	int     loop = 0;
+
+	gf_invert(q);
+	memcpy(b, q, sizeof(b));
+
+	/* The affine transformation, then its constant 0x63 */
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] = b[loop] ^ b[(loop + 7) & 7] ^ b[(loop + 6) & 7] ^
+		          b[(loop + 5) & 7] ^ b[(loop + 4) & 7];
+
+	q[0] = ~q[0];
+	q[1] = ~q[1];
+	q[5] = ~q[5];
+	q[6] = ~q[6];
+}
+
+
+static void inv_sub_bytes(state_t q)
+{
+	state_t s;
+	int     loop = 0;
+
+	memcpy(s, q, sizeof(s));
+
+	/* The inverse affine transformation, with its constant 0x05 */
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] = s[(loop + 7) & 7] ^ s[(loop + 5) & 7] ^ s[(loop + 2) & 7];
+
+	q[0] = ~q[0];
+	q[2] = ~q[2];
+
+	gf_invert(q);
+}
+
+
+/*
+ * Row r of the state is rotated by r columns: each bit moves by a multiple of 4
+ * positions within its lane
+ */
+static void shift_rows(state_t q)
+{
+	int loop = 0;
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] =  (q[loop] & 0x1111111111111111ULL)
+		        | ((q[loop] & 0x0888088808880888ULL) <<  4)
+		        | ((q[loop] & 0x0044004400440044ULL) <<  8)
+		        | ((q[loop] & 0x0002000200020002ULL) << 12)
+		        | ((q[loop] & 0x2220222022202220ULL) >>  4)
+		        | ((q[loop] & 0x4400440044004400ULL) >>  8)
+		        | ((q[loop] & 0x8000800080008000ULL) >> 12);
+}
+
+
+static void inv_shift_rows(state_t q)
+{
+	int loop = 0;
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] =  (q[loop] & 0x1111111111111111ULL)
+		        | ((q[loop] & 0x0222022202220222ULL) <<  4)
+		        | ((q[loop] & 0x0044004400440044ULL) <<  8)
+		        | ((q[loop] & 0x0008000800080008ULL) << 12)
+		        | ((q[loop] & 0x8880888088808880ULL) >>  4)
+		        | ((q[loop] & 0x4400440044004400ULL) >>  8)
+		        | ((q[loop] & 0x2000200020002000ULL) >> 12);
+}
+
+
+/* Give each byte the one 1, 2 or 3 rows below it in its column */
+#define ROTATE_COLUMN_1(x) \
+	((((x) >> 1) & 0x7777777777777777ULL) | (((x) << 3) & 0x8888888888888888ULL))
+#define ROTATE_COLUMN_2(x) \
+	((((x) >> 2) & 0x3333333333333333ULL) | (((x) << 2) & 0xccccccccccccccccULL))
+#define ROTATE_COLUMN_3(x) \
+	((((x) >> 3) & 0x1111111111111111ULL) | (((x) << 1) & 0xeeeeeeeeeeeeeeeeULL))
+
+
+/**
+ * Multiply the bytes of a state by x in GF(2^8)
+ *
+ * @param r Where to put the result, which can't be the operand
+ * @param a The operand
+ */
+static inline void xtime(state_t r, const state_t a)
+{
+	r[0] = a[7];
+	r[1] = a[0] ^ a[7];
+	r[2] = a[1];
+	r[3] = a[2] ^ a[7];
+	r[4] = a[3] ^ a[7];
+	r[5] = a[4];
+	r[6] = a[5];
+	r[7] = a[6];
+}
+
+
+static void mix_columns(state_t q)
+{
+	state_t a1;
+	state_t t;
+	state_t x;
+	int     loop = 0;
+
+	/* 2.a[r] ^ 3.a[r+1] ^ a[r+2] ^ a[r+3], as 2.(a[r] ^ a[r+1]) ^ ... */
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+	{
+		a1[loop] = ROTATE_COLUMN_1(q[loop]);
+		t[loop]  = q[loop] ^ a1[loop];
+	}
+
+	xtime(x, t);
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] = x[loop] ^ a1[loop] ^
+		          ROTATE_COLUMN_2(q[loop]) ^ ROTATE_COLUMN_3(q[loop]);
+}
+
+
+static void inv_mix_columns(state_t q)
+{
+	state_t t;
+	state_t u;
+	state_t v;
+	int     loop = 0;
+
+	/* a[r] ^= 4.(a[r] ^ a[r+2]) turns MixColumns into its inverse */
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		t[loop] = q[loop] ^ ROTATE_COLUMN_2(q[loop]);
+
+	xtime(u, t);
+	xtime(v, u);
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] ^= v[loop];
+
+	mix_columns(q);
+}
+
+
+static inline void add_round_key(state_t q, const uint64_t round_key[8])
+{
+	int loop = 0;
+
+	DIS_BUILTIN_UNROLL
+	for(loop = 0; loop < 8; loop++)
+		q[loop] ^= round_key[loop];
+}
+
+
+static void encrypt_state(const dis_builtin_aes_ctx* ctx, state_t q)
+{
+	unsigned int round = 0;
+
+	add_round_key(q, ctx->round_keys[0]);
+
+	for(round = 1; round < ctx->nb_rounds; round++)
+	{
+		sub_bytes(q);
+		shift_rows(q);
+		mix_columns(q);
+		add_round_key(q, ctx->round_keys[round]);
+	}
+
+	sub_bytes(q);
+	shift_rows(q);
+	add_round_key(q, ctx->round_keys[ctx->nb_rounds]);
+}
+
+
+static void decrypt_state(const dis_builtin_aes_ctx* ctx, state_t q)
+{
+	unsigned int round = 0;
+
+	add_round_key(q, ctx->round_keys[ctx->nb_rounds]);
+
+	for(round = ctx->nb_rounds - 1; round > 0; round--)
+	{
+		inv_shift_rows(q);
+		inv_sub_bytes(q);
+		add_round_key(q, ctx->round_keys[round]);
+		inv_mix_columns(q);
+	}
+
+	inv_shift_rows(q);
+	inv_sub_bytes(q);
+	add_round_key(q, ctx->round_keys[0]);
+}
+
+
+/**
+ * Encrypt or decrypt blocks with the portable code, DIS_BUILTIN_LANES at a time
+ *
+ * @param ctx The AES context
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param input The blocks to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @param nb_blocks The number of blocks
+ */
+static void crypt_blocks(
+	const dis_builtin_aes_ctx* ctx,
+	int mode,
+	const uint8_t* input,
+	uint8_t* output,
+	size_t nb_blocks)
+{
+	state_t q;
+	size_t  chunk = 0;
+
+	for(; nb_blocks > 0; nb_blocks -= chunk,
+	    input  += chunk * 16,
+	    output += chunk * 16)
+	{
+		chunk = nb_blocks < DIS_BUILTIN_LANES ? nb_blocks : DIS_BUILTIN_LANES;
+
+		load_state(q, input, chunk);
+
+		if(mode == AES_ENCRYPT)
+			encrypt_state(ctx, q);
+		else
+			decrypt_state(ctx, q);
+
+		store_state(q, output, chunk);
+	}
+
+	memset(q, 0, sizeof(q));
+}
+
+
+/**
+ * AES's SubWord, on the portable code
+ *
+ * @param word The word, which is modified
+ */
+static void sub_word(uint8_t word[4])
+{
+	state_t q;
+	uint8_t block[16] = {0};
+
+	memcpy(block, word, 4);
+
+	load_state(q, block, 1);
+	sub_bytes(q);
+	store_state(q, block, 1);
+
+	memcpy(word, block, 4);
+
+	memset(q, 0, sizeof(q));
+	memset(block, 0, sizeof(block));
+}
+
+
+/**
+ * Tell whether the AES-NI and VAES kernels may be used, i.e. whether the CPU
+ * has them and DIS_BUILTIN_AES_ENV doesn't ask for the portable code
+ *
+ * @return TRUE if they may, FALSE otherwise
+ */
+static int cpu_kernels_allowed(void)
+{
+	const char* aes = getenv(DIS_BUILTIN_AES_ENV);
+
+	if(aes && strcmp(aes, "portable") == 0)
+		return FALSE;
+
+	return dis_aesni_available();
+}
+
+
+/**
+ * Set the key of an AES context. The portable round keys are always computed,
+ * the AES-NI schedule of the given direction taking over when the CPU has the
+ * instructions and DIS_BUILTIN_AES_ENV allows them.
+ *
+ * @param ctx The AES context
+ * @param key The raw key
+ * @param key_bits The size of the key, 128, 192 or 256
+ * @param mode AES_ENCRYPT or AES_DECRYPT, the direction the key is used for
+ * @return 0 if the key has been set, -EINVAL otherwise
+ */
+int dis_builtin_aes_set_key(dis_builtin_aes_ctx* ctx, const unsigned char* key, unsigned int key_bits, int mode)
+{
+	uint8_t         words[DIS_BUILTIN_MAX_ROUND_KEYS * 16];
+	uint8_t         lanes[DIS_BUILTIN_LANES * 16];
+	uint8_t         temp[4];
+	uint8_t         first = 0;
+	uint8_t         rcon  = 0x01;
+	unsigned int    nk    = key_bits / 32;
+	unsigned int    loop  = 0;
+	unsigned int    byte  = 0;
+	dis_aesni_key_t enc_key;
+
+	if(!ctx || !key)
+		return -EINVAL;
+
+	if(key_bits != 128 && key_bits != 192 && key_bits != 256)
+		return -EINVAL;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->nb_rounds = nk + 6;
+
+	/* The key expansion, one word at a time */
+	memcpy(words, key, 4 * nk);
+
+	for(loop = nk; loop < 4 * (ctx->nb_rounds + 1); loop++)
+	{
+		memcpy(temp, words + 4 * (loop - 1), 4);
+
+		if(loop % nk == 0)
+		{
+			first   = temp[0];
+			temp[0] = temp[1];
+			temp[1] = temp[2];
+			temp[2] = temp[3];
+			temp[3] = first;
+
+			sub_word(temp);
+			temp[0] ^= rcon;
+
+			rcon = (uint8_t) ((rcon << 1) ^ (0x1b & -(rcon >> 7)));
+		}
+		else if(nk > 6 && loop % nk == 4)
+			sub_word(temp);
+
+		for(byte = 0; byte < 4; byte++)
+			words[4 * loop + byte] = words[4 * (loop - nk) + byte] ^ temp[byte];
+	}
+
+	/* Each round key is the same in all the lanes */
+	for(loop = 0; loop <= ctx->nb_rounds; loop++)
+	{
+		for(byte = 0; byte < DIS_BUILTIN_LANES; byte++)
+			memcpy(lanes + byte * 16, words + loop * 16, 16);
+
+		load_state(ctx->round_keys[loop], lanes, DIS_BUILTIN_LANES);
+	}
+
+	memset(words, 0, sizeof(words));
+	memset(lanes, 0, sizeof(lanes));
+	memset(temp, 0, sizeof(temp));
+
+	/* AES-NI has no AES-192 kernel */
+	if(key_bits != 192 && cpu_kernels_allowed())
+	{
+		if(mode == AES_ENCRYPT)
+		{
+			if(!dis_aesni_set_key(&ctx->ni, NULL, key, key_bits))
+				ctx->ni.nb_rounds = 0;
+		}
+		else
+		{
+			if(!dis_aesni_set_key(&enc_key, &ctx->ni, key, key_bits))
+				ctx->ni.nb_rounds = 0;
+
+			memset(&enc_key, 0, sizeof(enc_key));
+		}
+
+		if(ctx->ni.nb_rounds)
+			ctx->vaes_width = dis_vaes_width();
+	}
+
+	return 0;
+}
+
+
+/**
+ * Wipe an AES context
+ *
+ * @param ctx The AES context
+ */
+void dis_builtin_aes_free(dis_builtin_aes_ctx* ctx)
+{
+	if(!ctx)
+		return;
+
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+/**
+ * Encrypt or decrypt a block
+ *
+ * @param ctx The AES context
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param input The block to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @return 0
+ */
+int dis_builtin_aes_crypt_ecb(
+	dis_builtin_aes_ctx* ctx,
+	int mode,
+	const unsigned char* input,
+	unsigned char* output)
+{
+	if(ctx->ni.nb_rounds)
+		dis_aesni_crypt_block(&ctx->ni, mode == AES_ENCRYPT, input, output);
+	else
+		crypt_blocks(ctx, mode, input, output, 1);
+
+	return 0;
+}
+
+
+/**
+ * Encrypt or decrypt data with AES-CBC. The decryption of the portable code
+ * goes DIS_BUILTIN_LANES blocks at a time.
+ *
+ * @param ctx The AES context
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param length The length of the data, a multiple of 16 bytes
+ * @param iv The IV, which isn't modified
+ * @param input The data to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @return 0 if the data has been dealt with, -EINVAL otherwise
+ */
+int dis_builtin_aes_crypt_cbc(
+	dis_builtin_aes_ctx* ctx,
+	int mode,
+	size_t length,
+	const unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output)
+{
+	uint8_t chain[16];
+	uint8_t blocks[DIS_BUILTIN_LANES * 16];
+	size_t  chunk = 0;
+	size_t  loop  = 0;
+
+	if(length % 16)
+		return -EINVAL;
+
+	if(mode == AES_DECRYPT && ctx->ni.nb_rounds)
+	{
+		dis_aesni_decrypt_cbc(&ctx->ni, length, iv, input, output);
+		return 0;
+	}
+
+	memcpy(chain, iv, 16);
+
+	if(mode == AES_ENCRYPT)
+	{
+		/* Each block depends on the previous one */
+		for(; length > 0; length -= 16, input += 16, output += 16)
+		{
+			for(loop = 0; loop < 16; loop++)
+				chain[loop] ^= input[loop];
+
+			dis_builtin_aes_crypt_ecb(ctx, AES_ENCRYPT, chain, chain);
+			memcpy(output, chain, 16);
+		}
+	}
+	else
+	{
+		for(; length > 0; length -= chunk * 16,
+		    input  += chunk * 16,
+		    output += chunk * 16)
+		{
+			chunk = length / 16 < DIS_BUILTIN_LANES ? length / 16 : DIS_BUILTIN_LANES;
+
+			/* Keep the ciphertext, output may overwrite it */
+			memcpy(blocks, input, chunk * 16);
+			crypt_blocks(ctx, AES_DECRYPT, blocks, output, chunk);
+
+			for(loop = 0; loop < 16; loop++)
+				output[loop] ^= chain[loop];
+			for(loop = 16; loop < chunk * 16; loop++)
+				output[loop] ^= blocks[loop - 16];
+
+			memcpy(chain, blocks + (chunk - 1) * 16, 16);
+		}
+	}
+
+	memset(chain, 0, sizeof(chain));
+	memset(blocks, 0, sizeof(blocks));
+
+	return 0;
+}
+
+
+/**
+ * Multiply an XTS tweak by alpha in GF(2^128)
+ *
+ * @param output Where to put the result, which may be input
+ * @param input The tweak
+ */
+static inline void xts_next_tweak(uint8_t* output, const uint8_t* input)
+{
+	uint8_t carry = (uint8_t) (input[15] >> 7);
+	int     loop  = 0;
+
+	for(loop = 15; loop > 0; loop--)
+		output[loop] = (uint8_t) ((input[loop] << 1) | (input[loop - 1] >> 7));
+
+	output[0] = (uint8_t) ((input[0] << 1) ^ (0x87 & -carry));
+}
+
+
+/**
+ * Encrypt or decrypt blocks of XTS with the portable code, their tweaks being
+ * known
+ *
+ * @param ctx The AES context of the data key
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param tweaks The tweaks of the blocks
+ * @param input The blocks to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @param nb_blocks The number of blocks, at most DIS_BUILTIN_LANES
+ */
+static void xts_crypt_blocks(
+	const dis_builtin_aes_ctx* ctx,
+	int mode,
+	const uint8_t* tweaks,
+	const uint8_t* input,
+	uint8_t* output,
+	size_t nb_blocks)
+{
+	uint8_t blocks[DIS_BUILTIN_LANES * 16] = {0};
+	size_t  loop = 0;
+
+	for(loop = 0; loop < nb_blocks * 16; loop++)
+		blocks[loop] = input[loop] ^ tweaks[loop];
+
+	crypt_blocks(ctx, mode, blocks, blocks, nb_blocks);
+
+	for(loop = 0; loop < nb_blocks * 16; loop++)
+		output[loop] = blocks[loop] ^ tweaks[loop];
+
+	memset(blocks, 0, sizeof(blocks));
+}
+
+
+/**
+ * Encrypt or decrypt data with AES-XTS, with ciphertext stealing when the
+ * length isn't a multiple of 16. Full sectors whose IV is a 64 bits sector
+ * number go through the VAES kernels when the CPU has them.
+ *
+ * @param crypt_ctx The AES context of the data key
+ * @param tweak_ctx The AES context of the tweak key, set for encryption
+ * @param mode AES_ENCRYPT or AES_DECRYPT
+ * @param length The length of the data, at least 16 bytes
+ * @param iv The IV
+ * @param input The data to encrypt or decrypt
+ * @param output Where to put the result, which may be input
+ * @return 0 if the data has been dealt with, an error code otherwise
+ */
+int dis_builtin_aes_crypt_xts(
+	dis_builtin_aes_ctx* crypt_ctx,
+	dis_builtin_aes_ctx* tweak_ctx,
+	int mode,
+	size_t length,
+	unsigned char* iv,
+	const unsigned char* input,
+	unsigned char* output)
+{
+	uint8_t  tweaks[DIS_BUILTIN_LANES * 16];
+	uint8_t  blocks[16];
+	uint8_t  last[16];
+	uint64_t sector    = 0;
+	size_t   remaining = length % 16;
+	size_t   nb_blocks = 0;
+	size_t   chunk     = 0;
+	size_t   loop      = 0;
+
+	if(length < 16)
+		return -EINVAL;
+
+	if(crypt_ctx->ni.nb_rounds && tweak_ctx->ni.nb_rounds)
+	{
+		memcpy(&sector, iv, sizeof(sector));
+
+		if(crypt_ctx->vaes_width != DIS_VAES_NONE &&
+		   length % DIS_VAES_SECTOR_ALIGN == 0 && length <= UINT16_MAX &&
+		   memcmp(iv + 8, "\0\0\0\0\0\0\0\0", 8) == 0)
+			dis_vaes_crypt_xts_sectors(
+				crypt_ctx->vaes_width,
+				&crypt_ctx->ni,
+				&tweak_ctx->ni,
+				mode == AES_ENCRYPT,
+				(uint16_t) length,
+				1,
+				sector,
+				input,
+				output
+			);
+		else
+			dis_aesni_crypt_xts(
+				&crypt_ctx->ni,
+				&tweak_ctx->ni,
+				mode == AES_ENCRYPT,
+				length,
+				iv,
+				input,
+				output
+			);
+
+		return 0;
+	}
+
+	/* With ciphertext stealing, the last full block is dealt with apart */
+	nb_blocks = length / 16 - (remaining ? 1 : 0);
+
+	dis_builtin_aes_crypt_ecb(tweak_ctx, AES_ENCRYPT, iv, tweaks);
+
+	for(; nb_blocks > 0; nb_blocks -= chunk,
+	    input  += chunk * 16,
+	    output += chunk * 16)
+	{
+		chunk = nb_blocks < DIS_BUILTIN_LANES ? nb_blocks : DIS_BUILTIN_LANES;
+
+		for(loop = 1; loop < chunk; loop++)
+			xts_next_tweak(tweaks + loop * 16, tweaks + (loop - 1) * 16);
+
+		xts_crypt_blocks(crypt_ctx, mode, tweaks, input, output, chunk);
+
+		xts_next_tweak(tweaks, tweaks + (chunk - 1) * 16);
+	}
+
+	if(remaining)
+	{
+		/*
+		 * The last full block takes the tweak after its own when decrypting,
+		 * the partial one getting its head and the full one its tail
+		 */
+		xts_next_tweak(tweaks + 16, tweaks);
+
+		xts_crypt_blocks(
+			crypt_ctx,
+			mode,
+			mode == AES_ENCRYPT ? tweaks : tweaks + 16,
+			input,
+			last,
+			1
+		);
+
+		memcpy(blocks, input + 16, remaining);
+		memcpy(blocks + remaining, last + remaining, 16 - remaining);
+		memcpy(output + 16, last, remaining);
+
+		xts_crypt_blocks(
+			crypt_ctx,
+			mode,
+			mode == AES_ENCRYPT ? tweaks + 16 : tweaks,
+			blocks,
+			output,
+			1
+		);
+
+		memset(last, 0, sizeof(last));
+	}
+
+	memset(tweaks, 0, sizeof(tweaks));
+	memset(blocks, 0, sizeof(blocks));
+
+	return 0;
+}
@@ -0,0 +1,695 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <string.h>
+
+#include "dislocker/common.h"
+#include "dislocker/encryption/aes-ni.h"
+
+
+#if DIS_HAVE_AESNI
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+
+/*
+ * Only the kernels below are built for the AES-NI instructions, the rest of
+ * the library runs on any x86 CPU
+ */
+#define DIS_AESNI_TARGET __attribute__((target("aes,sse2")))
+
+/* Number of blocks kept in flight, enough to hide the latency of aesenc */
+#define DIS_AESNI_PIPELINE 8
+
+/*
+ * The loops over the blocks in flight have to be unrolled for the blocks to
+ * stay in registers, which the default optimization level doesn't do
+ */
+#if defined(__clang__) || __GNUC__ >= 8
+#  define DIS_AESNI_UNROLL _Pragma("GCC unroll 8")
+#else
+#  define DIS_AESNI_UNROLL
+#endif
+
+
+
+/**
+ * Tell whether the CPU has the AES-NI instructions
+ *
+ * @return TRUE if the kernels of this file can be used, FALSE otherwise
+ */
+int dis_aesni_available(void)
+{
+	unsigned int eax = 0;
+	unsigned int ebx = 0;
+	unsigned int ecx = 0;
+	unsigned int edx = 0;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return FALSE;
+
+	return (ecx & bit_AES) && (edx & bit_SSE2) ? TRUE : FALSE;
+}
+
+
+DIS_AESNI_TARGET
+static inline __m128i expand_128(__m128i key, __m128i assist)
+{
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+
+	return _mm_xor_si128(key, assist);
+}
+
+
+DIS_AESNI_TARGET
+static inline __m128i expand_256(__m128i key, __m128i assist, int shuffle_odd)
+{
+	if(shuffle_odd)
+		assist = _mm_shuffle_epi32(assist, 0xaa);
+	else
+		assist = _mm_shuffle_epi32(assist, 0xff);
+
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+
+	return _mm_xor_si128(key, assist);
+}
+
+
+/* aeskeygenassist's round constant has to be an immediate */
+#define EXPAND_128(rk, i, rcon) \
+	rk[i] = expand_128(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+#define EXPAND_256(rk, i, rcon)                                               \
+	do {                                                                      \
+		rk[i] = expand_256(                                                   \
+			rk[i - 2], _mm_aeskeygenassist_si128(rk[i - 1], rcon), FALSE      \
+		);                                                                    \
+		if(i + 1 < 15)                                                        \
+			rk[i + 1] = expand_256(                                           \
+				rk[i - 1], _mm_aeskeygenassist_si128(rk[i], 0), TRUE          \
+			);                                                                \
+	} while(0)
+
+
+/**
+ * Expand an AES key for the AES-NI kernels
+ *
+ * @param enc_key Where to put the encryption key schedule
+ * @param dec_key Where to put the decryption key schedule, may be NULL
+ * @param key The raw key
+ * @param key_bits The size of the key, 128 or 256
+ * @return TRUE if the key has been expanded, FALSE otherwise
+ */
+DIS_AESNI_TARGET
+int dis_aesni_set_key(
+	dis_aesni_key_t* enc_key,
+	dis_aesni_key_t* dec_key,
+	const uint8_t* key,
+	unsigned int key_bits)
+{
+	__m128i      rk[DIS_AESNI_MAX_ROUND_KEYS];
+	unsigned int nb_rounds = 0;
+	unsigned int loop      = 0;
+
+	if(!enc_key || !key)
+		return FALSE;
+
+	rk[0] = _mm_loadu_si128((const __m128i*) key);
+
+	if(key_bits == 128)
+	{
+		nb_rounds = 10;
+		EXPAND_128(rk,  1, 0x01);
+		EXPAND_128(rk,  2, 0x02);
+		EXPAND_128(rk,  3, 0x04);
+		EXPAND_128(rk,  4, 0x08);
+		EXPAND_128(rk,  5, 0x10);
+		EXPAND_128(rk,  6, 0x20);
+		EXPAND_128(rk,  7, 0x40);
+		EXPAND_128(rk,  8, 0x80);
+		EXPAND_128(rk,  9, 0x1b);
+		EXPAND_128(rk, 10, 0x36);
+	}
+	else if(key_bits == 256)
+	{
+		nb_rounds = 14;
+		rk[1] = _mm_loadu_si128((const __m128i*) (key + 16));
+		EXPAND_256(rk,  2, 0x01);
+		EXPAND_256(rk,  4, 0x02);
+		EXPAND_256(rk,  6, 0x04);
+		EXPAND_256(rk,  8, 0x08);
+		EXPAND_256(rk, 10, 0x10);
+		EXPAND_256(rk, 12, 0x20);
+		EXPAND_256(rk, 14, 0x40);
+	}
+	else
+		return FALSE;
+
+	enc_key->nb_rounds = nb_rounds;
+	for(loop = 0; loop <= nb_rounds; loop++)
+		_mm_storeu_si128((__m128i*) &enc_key->round_keys[loop * 16], rk[loop]);
+
+	/* The decryption uses the equivalent inverse cipher */
+	if(dec_key)
+	{
+		dec_key->nb_rounds = nb_rounds;
+		for(loop = 0; loop <= nb_rounds; loop++)
+		{
+			__m128i round_key = rk[nb_rounds - loop];
+
+			if(loop > 0 && loop < nb_rounds)
+				round_key = _mm_aesimc_si128(round_key);
+
+			_mm_storeu_si128((__m128i*) &dec_key->round_keys[loop * 16], round_key);
+		}
+	}
+
+	memset(rk, 0, sizeof(rk));
+
+	return TRUE;
+}
+
+
+DIS_AESNI_TARGET
+static inline void load_keys(const dis_aesni_key_t* key, __m128i* keys)
+{
+	unsigned int loop = 0;
+
+	for(loop = 0; loop <= key->nb_rounds; loop++)
+		keys[loop] = _mm_loadu_si128((const __m128i*) &key->round_keys[loop * 16]);
+}
+
+
+DIS_AESNI_TARGET
+static inline __m128i crypt_block(
+	const __m128i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m128i block)
+{
+	unsigned int round = 0;
+
+	block = _mm_xor_si128(block, keys[0]);
+
+	if(encrypt)
+	{
+		for(round = 1; round < nb_rounds; round++)
+			block = _mm_aesenc_si128(block, keys[round]);
+		return _mm_aesenclast_si128(block, keys[nb_rounds]);
+	}
+
+	for(round = 1; round < nb_rounds; round++)
+		block = _mm_aesdec_si128(block, keys[round]);
+	return _mm_aesdeclast_si128(block, keys[nb_rounds]);
+}
+
+
+/**
+ * Run nb_blocks independent blocks through AES at once, each round being
+ * issued for all of them before the next one. nb_blocks has to be known at
+ * compile time, for the loops to be unrolled.
+ */
+DIS_AESNI_TARGET
+static inline void crypt_blocks(
+	const __m128i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m128i* blocks,
+	unsigned int nb_blocks)
+{
+	unsigned int round = 0;
+	unsigned int loop  = 0;
+
+	DIS_AESNI_UNROLL
+	for(loop = 0; loop < nb_blocks; loop++)
+		blocks[loop] = _mm_xor_si128(blocks[loop], keys[0]);
+
+	if(encrypt)
+	{
+		for(round = 1; round < nb_rounds; round++)
+			DIS_AESNI_UNROLL
+			for(loop = 0; loop < nb_blocks; loop++)
+				blocks[loop] = _mm_aesenc_si128(blocks[loop], keys[round]);
+		DIS_AESNI_UNROLL
+		for(loop = 0; loop < nb_blocks; loop++)
+			blocks[loop] = _mm_aesenclast_si128(blocks[loop], keys[nb_rounds]);
+	}
+	else
+	{
+		for(round = 1; round < nb_rounds; round++)
+			DIS_AESNI_UNROLL
+			for(loop = 0; loop < nb_blocks; loop++)
+				blocks[loop] = _mm_aesdec_si128(blocks[loop], keys[round]);
+		DIS_AESNI_UNROLL
+		for(loop = 0; loop < nb_blocks; loop++)
+			blocks[loop] = _mm_aesdeclast_si128(blocks[loop], keys[nb_rounds]);
+	}
+}
+
+
+/**
+ * Run DIS_AESNI_PIPELINE independent blocks through AES at once
+ */
+DIS_AESNI_TARGET
+static inline void crypt_pipeline(
+	const __m128i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m128i* blocks)
+{
+	crypt_blocks(keys, nb_rounds, encrypt, blocks, DIS_AESNI_PIPELINE);
+}
+
+
+/**
+ * Multiply a tweak by x in GF(2^128), as gf128mul_x_ble() does, with SSE
+ * shifts instead of a table
+ */
+DIS_AESNI_TARGET
+static inline __m128i xts_mul_x(__m128i tweak)
+{
+	/* 0x87 reduces bit 127, 1 carries bit 63 into the upper half */
+	const __m128i poly  = _mm_set_epi32(0, 1, 0, 0x87);
+	__m128i       carry = _mm_srai_epi32(_mm_shuffle_epi32(tweak, 0x13), 31);
+
+	tweak = _mm_add_epi64(tweak, tweak);
+
+	return _mm_xor_si128(tweak, _mm_and_si128(carry, poly));
+}
+
+
+/**
+ * AES-XTS buffer encryption/decryption, DIS_AESNI_PIPELINE blocks at a time
+ * The result is the same as dis_aes_crypt_xts()'s, ciphertext stealing
+ * included when the length isn't a multiple of 16.
+ *
+ * @param crypt_key The data key, expanded for the encryption or for the
+ * decryption according to the encrypt parameter
+ * @param tweak_key The tweak key, expanded for the encryption
+ * @param encrypt TRUE to encrypt, FALSE to decrypt
+ * @param length The length of the data, at least 16 bytes
+ * @param iv The tweak's input, usually the sector number
+ * @param input The data to encrypt or to decrypt
+ * @param output Where to put the result, may be the same as input
+ */
+DIS_AESNI_TARGET
+void dis_aesni_crypt_xts(
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	size_t length,
+	const uint8_t* iv,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m128i      keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m128i      tweaks[DIS_AESNI_PIPELINE];
+	__m128i      blocks[DIS_AESNI_PIPELINE];
+	__m128i      tweak;
+	__m128i      next_tweak;
+	__m128i      block;
+	unsigned int nb_rounds = crypt_key->nb_rounds;
+	size_t       nb_blocks = length / 16;
+	size_t       remaining = length % 16;
+	size_t       nb_full   = 0;
+	size_t       loop      = 0;
+	unsigned int pipe      = 0;
+	uint8_t      stolen[16];
+
+	if(length < 16)
+		return;
+
+	load_keys(tweak_key, keys);
+	tweak = crypt_block(
+		keys, tweak_key->nb_rounds, TRUE, _mm_loadu_si128((const __m128i*) iv)
+	);
+
+	load_keys(crypt_key, keys);
+
+	/* With ciphertext stealing, the last full block is dealt with apart */
+	nb_full = remaining ? nb_blocks - 1 : nb_blocks;
+
+	for(loop = 0; loop + DIS_AESNI_PIPELINE <= nb_full; loop += DIS_AESNI_PIPELINE)
+	{
+		DIS_AESNI_UNROLL
+		for(pipe = 0; pipe < DIS_AESNI_PIPELINE; pipe++)
+		{
+			tweaks[pipe] = tweak;
+			tweak        = xts_mul_x(tweak);
+			blocks[pipe] = _mm_xor_si128(
+				_mm_loadu_si128((const __m128i*) (input + (loop + pipe) * 16)),
+				tweaks[pipe]
+			);
+		}
+
+		crypt_pipeline(keys, nb_rounds, encrypt, blocks);
+
+		DIS_AESNI_UNROLL
+		for(pipe = 0; pipe < DIS_AESNI_PIPELINE; pipe++)
+			_mm_storeu_si128(
+				(__m128i*) (output + (loop + pipe) * 16),
+				_mm_xor_si128(blocks[pipe], tweaks[pipe])
+			);
+	}
+
+	for(; loop < nb_full; loop++)
+	{
+		block = _mm_xor_si128(
+			_mm_loadu_si128((const __m128i*) (input + loop * 16)),
+			tweak
+		);
+		block = crypt_block(keys, nb_rounds, encrypt, block);
+		_mm_storeu_si128(
+			(__m128i*) (output + loop * 16),
+			_mm_xor_si128(block, tweak)
+		);
+		tweak = xts_mul_x(tweak);
+	}
+
+	if(remaining == 0)
+	{
+		memset(keys, 0, sizeof(keys));
+		return;
+	}
+
+	/*
+	 * Ciphertext stealing: the last full block is crypted with the tweak of
+	 * the partial one when decrypting, and the other way around when
+	 * encrypting
+	 */
+	next_tweak = xts_mul_x(tweak);
+	if(!encrypt)
+	{
+		block      = tweak;
+		tweak      = next_tweak;
+		next_tweak = block;
+	}
+
+	block = _mm_xor_si128(
+		_mm_loadu_si128((const __m128i*) (input + nb_full * 16)),
+		tweak
+	);
+	block = crypt_block(keys, nb_rounds, encrypt, block);
+	_mm_storeu_si128((__m128i*) stolen, _mm_xor_si128(block, tweak));
+
+	/* The partial block takes the head of the crypted one, which takes its data */
+	for(loop = 0; loop < remaining; loop++)
+	{
+		uint8_t byte = input[(nb_full + 1) * 16 + loop];
+
+		output[(nb_full + 1) * 16 + loop] = stolen[loop];
+		stolen[loop] = byte;
+	}
+
+	block = _mm_xor_si128(_mm_loadu_si128((const __m128i*) stolen), next_tweak);
+	block = crypt_block(keys, nb_rounds, encrypt, block);
+	_mm_storeu_si128(
+		(__m128i*) (output + nb_full * 16),
+		_mm_xor_si128(block, next_tweak)
+	);
+
+	memset(stolen, 0, sizeof(stolen));
+	memset(keys, 0, sizeof(keys));
+}
+
+
+/**
+ * Encrypt or decrypt a single block
+ *
+ * @param key The key, expanded for the encryption or for the decryption
+ * according to the encrypt parameter
+ * @param encrypt TRUE to encrypt, FALSE to decrypt
+ * @param input The block to encrypt or to decrypt
+ * @param output Where to put the result, may be the same as input
+ */
+DIS_AESNI_TARGET
+void dis_aesni_crypt_block(
+	const dis_aesni_key_t* key,
+	int encrypt,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m128i keys[DIS_AESNI_MAX_ROUND_KEYS];
+
+	load_keys(key, keys);
+	_mm_storeu_si128(
+		(__m128i*) output,
+		crypt_block(
+			keys, key->nb_rounds, encrypt,
+			_mm_loadu_si128((const __m128i*) input)
+		)
+	);
+
+	memset(keys, 0, sizeof(keys));
+}
+
+
+/**
+ * AES-ECB encryption or decryption of independent blocks, DIS_AESNI_PIPELINE
+ * of them at a time, then two by two
+ *
+ * @param key The key, expanded for the encryption or for the decryption
+ * according to the encrypt parameter
+ * @param encrypt TRUE to encrypt, FALSE to decrypt
+ * @param nb_blocks The number of 16-byte blocks
+ * @param input The blocks to encrypt or to decrypt
+ * @param output Where to put the result, may be the same as input
+ */
+DIS_AESNI_TARGET
+void dis_aesni_crypt_ecb(
+	const dis_aesni_key_t* key,
+	int encrypt,
+	size_t nb_blocks,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m128i      keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m128i      blocks[DIS_AESNI_PIPELINE];
+	unsigned int nb_rounds = key->nb_rounds;
+	size_t       loop      = 0;
+	unsigned int pipe      = 0;
+
+	load_keys(key, keys);
+
+	for(loop = 0; loop + DIS_AESNI_PIPELINE <= nb_blocks; loop += DIS_AESNI_PIPELINE)
+	{
+		DIS_AESNI_UNROLL
+		for(pipe = 0; pipe < DIS_AESNI_PIPELINE; pipe++)
+			blocks[pipe] = _mm_loadu_si128(
+				(const __m128i*) (input + (loop + pipe) * 16)
+			);
+
+		crypt_pipeline(keys, nb_rounds, encrypt, blocks);
+
+		DIS_AESNI_UNROLL
+		for(pipe = 0; pipe < DIS_AESNI_PIPELINE; pipe++)
+			_mm_storeu_si128((__m128i*) (output + (loop + pipe) * 16), blocks[pipe]);
+	}
+
+	for(; loop + 2 <= nb_blocks; loop += 2)
+	{
+		blocks[0] = _mm_loadu_si128((const __m128i*) (input + loop * 16));
+		blocks[1] = _mm_loadu_si128((const __m128i*) (input + loop * 16 + 16));
+
+		crypt_blocks(keys, nb_rounds, encrypt, blocks, 2);
+
+		_mm_storeu_si128((__m128i*) (output + loop * 16), blocks[0]);
+		_mm_storeu_si128((__m128i*) (output + loop * 16 + 16), blocks[1]);
+	}
+
+	if(loop < nb_blocks)
+		_mm_storeu_si128(
+			(__m128i*) (output + loop * 16),
+			crypt_block(
+				keys, nb_rounds, encrypt,
+				_mm_loadu_si128((const __m128i*) (input + loop * 16))
+			)
+		);
+
+	memset(keys, 0, sizeof(keys));
+}
+
+
+/**
+ * AES-CBC buffer decryption, DIS_AESNI_PIPELINE blocks at a time. Unlike the
+ * encryption, each block only depends on the ciphertext, so blocks are
+ * decrypted independently and the chain is applied afterward.
+ *
+ * @param dec_key The key, expanded for the decryption
+ * @param length The length of the data, a multiple of 16 bytes
+ * @param iv The IV
+ * @param input The data to decrypt
+ * @param output Where to put the result, may be the same as input
+ */
+DIS_AESNI_TARGET
+void dis_aesni_decrypt_cbc(
+	const dis_aesni_key_t* dec_key,
+	size_t length,
+	const uint8_t* iv,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m128i      keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m128i      ciphers[DIS_AESNI_PIPELINE];
+	__m128i      blocks[DIS_AESNI_PIPELINE];
+	__m128i      previous = _mm_loadu_si128((const __m128i*) iv);
+	__m128i      block;
+	unsigned int nb_rounds = dec_key->nb_rounds;
+	size_t       nb_blocks = length / 16;
+	size_t       loop      = 0;
+	unsigned int pipe      = 0;
+
+	load_keys(dec_key, keys);
+
+	for(loop = 0; loop + DIS_AESNI_PIPELINE <= nb_blocks; loop += DIS_AESNI_PIPELINE)
+	{
+		/* The ciphertexts are kept, as output may be input */
+		DIS_AESNI_UNROLL
+		for(pipe = 0; pipe < DIS_AESNI_PIPELINE; pipe++)
+		{
+			ciphers[pipe] = _mm_loadu_si128(
+				(const __m128i*) (input + (loop + pipe) * 16)
+			);
+			blocks[pipe]  = ciphers[pipe];
+		}
+
+		crypt_pipeline(keys, nb_rounds, FALSE, blocks);
+
+		DIS_AESNI_UNROLL
+		for(pipe = 0; pipe < DIS_AESNI_PIPELINE; pipe++)
+		{
+			_mm_storeu_si128(
+				(__m128i*) (output + (loop + pipe) * 16),
+				_mm_xor_si128(blocks[pipe], previous)
+			);
+			previous = ciphers[pipe];
+		}
+	}
+
+	for(; loop < nb_blocks; loop++)
+	{
+		block = _mm_loadu_si128((const __m128i*) (input + loop * 16));
+		_mm_storeu_si128(
+			(__m128i*) (output + loop * 16),
+			_mm_xor_si128(crypt_block(keys, nb_rounds, FALSE, block), previous)
+		);
+		previous = block;
+	}
+
+	memset(keys, 0, sizeof(keys));
+}
+
+
+#else /* DIS_HAVE_AESNI */
+
+
+int dis_aesni_available(void)
+{
+	return FALSE;
+}
+
+
+int dis_aesni_set_key(
+	dis_aesni_key_t* enc_key,
+	dis_aesni_key_t* dec_key,
+	const uint8_t* key,
+	unsigned int key_bits)
+{
+	(void) enc_key;
+	(void) dec_key;
+	(void) key;
+	(void) key_bits;
+
+	return FALSE;
+}
+
+
+void dis_aesni_crypt_xts(
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	size_t length,
+	const uint8_t* iv,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) crypt_key;
+	(void) tweak_key;
+	(void) encrypt;
+	(void) length;
+	(void) iv;
+	(void) input;
+	(void) output;
+}
+
+
+void dis_aesni_crypt_block(
+	const dis_aesni_key_t* key,
+	int encrypt,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) key;
+	(void) encrypt;
+	(void) input;
+	(void) output;
+}
+
+
+void dis_aesni_crypt_ecb(
+	const dis_aesni_key_t* key,
+	int encrypt,
+	size_t nb_blocks,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) key;
+	(void) encrypt;
+	(void) nb_blocks;
+	(void) input;
+	(void) output;
+}
+
+
+void dis_aesni_decrypt_cbc(
+	const dis_aesni_key_t* dec_key,
+	size_t length,
+	const uint8_t* iv,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) dec_key;
+	(void) length;
+	(void) iv;
+	(void) input;
+	(void) output;
+}
+
+#endif /* DIS_HAVE_AESNI */
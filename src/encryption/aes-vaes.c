@@ -0,0 +1,1204 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <string.h>
+
+#include "dislocker/common.h"
+#include "dislocker/encryption/aes-vaes.h"
+
+
+#if DIS_HAVE_VAES
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+
+/*
+ * Only the kernels below are built for these instructions, the rest of the
+ * library runs on any x86 CPU
+ */
+#define DIS_VAES_512_TARGET \
+	__attribute__((target("aes,vaes,vpclmulqdq,avx512f,avx512bw")))
+#define DIS_VAES_256_TARGET \
+	__attribute__((target("aes,vaes,vpclmulqdq,avx2")))
+
+/* Number of vectors kept in flight, enough to hide the latency of vaesenc */
+#define DIS_VAES_PIPELINE 8
+
+/* See aes-ni.c, the vectors in flight stay in registers only if unrolled */
+#define DIS_VAES_UNROLL _Pragma("GCC unroll 8")
+
+/*
+ * With CBC encryption, each lane of a vector carries its own sector. That's
+ * the number of vectors kept in flight then.
+ */
+#define DIS_VAES_CBC_VECTORS 4
+
+#ifndef bit_VAES
+#  define bit_VAES       (1 << 9)
+#endif
+#ifndef bit_VPCLMULQDQ
+#  define bit_VPCLMULQDQ (1 << 10)
+#endif
+
+/* XCR0's bits telling the OS saves the YMM, and the ZMM and opmask, states */
+#define DIS_XCR0_YMM 0x06
+#define DIS_XCR0_ZMM 0xe0
+
+
+
+static uint64_t read_xcr0(void)
+{
+	uint32_t eax = 0;
+	uint32_t edx = 0;
+
+	__asm__ volatile("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+	return ((uint64_t) edx << 32) | eax;
+}
+
+
+/**
+ * Tell which VAES kernels the CPU, and the OS, can run
+ *
+ * @return DIS_VAES_512 if AVX-512 is there too, DIS_VAES_256 if only AVX2 is,
+ * DIS_VAES_NONE if the kernels of this file can't be used
+ */
+unsigned int dis_vaes_width(void)
+{
+	unsigned int eax = 0;
+	unsigned int ebx = 0;
+	unsigned int ecx = 0;
+	unsigned int edx = 0;
+	uint64_t     xcr0 = 0;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return DIS_VAES_NONE;
+
+	if(!(ecx & bit_AES) || !(ecx & bit_AVX) || !(ecx & bit_OSXSAVE))
+		return DIS_VAES_NONE;
+
+	if(__get_cpuid_max(0, NULL) < 7)
+		return DIS_VAES_NONE;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	if(!(ecx & bit_VAES) || !(ecx & bit_VPCLMULQDQ))
+		return DIS_VAES_NONE;
+
+	xcr0 = read_xcr0();
+	if((xcr0 & DIS_XCR0_YMM) != DIS_XCR0_YMM)
+		return DIS_VAES_NONE;
+
+	if((ebx & bit_AVX512F) && (ebx & bit_AVX512BW) &&
+	   (xcr0 & DIS_XCR0_ZMM) == DIS_XCR0_ZMM)
+		return DIS_VAES_512;
+
+	if(ebx & bit_AVX2)
+		return DIS_VAES_256;
+
+	return DIS_VAES_NONE;
+}
+
+
+
+/*
+ * 512-bit kernels, four AES blocks per vector
+ */
+
+DIS_VAES_512_TARGET
+static inline void load_keys_512(const dis_aesni_key_t* key, __m512i* keys)
+{
+	unsigned int loop = 0;
+
+	for(loop = 0; loop <= key->nb_rounds; loop++)
+		keys[loop] = _mm512_broadcast_i32x4(
+			_mm_loadu_si128((const __m128i*) &key->round_keys[loop * 16])
+		);
+}
+
+
+/**
+ * Run nb_vectors independent vectors through AES at once, each round being
+ * issued for all of them before the next one. nb_vectors has to be known at
+ * compile time, for the loops to be unrolled and the vectors to stay in
+ * registers.
+ */
+DIS_VAES_512_TARGET
+static inline void crypt_512(
+	const __m512i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m512i* vectors,
+	unsigned int nb_vectors)
+{
+	unsigned int round = 0;
+	unsigned int loop  = 0;
+
+	DIS_VAES_UNROLL
+	for(loop = 0; loop < nb_vectors; loop++)
+		vectors[loop] = _mm512_xor_si512(vectors[loop], keys[0]);
+
+	if(encrypt)
+	{
+		for(round = 1; round < nb_rounds; round++)
+			DIS_VAES_UNROLL
+			for(loop = 0; loop < nb_vectors; loop++)
+				vectors[loop] = _mm512_aesenc_epi128(vectors[loop], keys[round]);
+		DIS_VAES_UNROLL
+		for(loop = 0; loop < nb_vectors; loop++)
+			vectors[loop] = _mm512_aesenclast_epi128(vectors[loop], keys[nb_rounds]);
+	}
+	else
+	{
+		for(round = 1; round < nb_rounds; round++)
+			DIS_VAES_UNROLL
+			for(loop = 0; loop < nb_vectors; loop++)
+				vectors[loop] = _mm512_aesdec_epi128(vectors[loop], keys[round]);
+		DIS_VAES_UNROLL
+		for(loop = 0; loop < nb_vectors; loop++)
+			vectors[loop] = _mm512_aesdeclast_epi128(vectors[loop], keys[nb_rounds]);
+	}
+}
+
+
+/**
+ * Multiply each lane's tweak by x^n in GF(2^128), n being given per 64-bit
+ * word in shifts (at most 63), the carries being reduced with a carry-less
+ * multiplication by 0x87
+ */
+DIS_VAES_512_TARGET
+static inline __m512i xts_mul_xn_512(__m512i tweaks, __m512i shifts)
+{
+	const __m512i poly  = _mm512_broadcast_i32x4(_mm_set_epi32(0, 0, 0, 0x87));
+	__m512i       carry = _mm512_srlv_epi64(
+		tweaks, _mm512_sub_epi64(_mm512_set1_epi64(64), shifts)
+	);
+
+	tweaks = _mm512_sllv_epi64(tweaks, shifts);
+	tweaks = _mm512_xor_si512(tweaks, _mm512_bslli_epi128(carry, 8));
+
+	return _mm512_xor_si512(tweaks, _mm512_clmulepi64_epi128(carry, poly, 0x01));
+}
+
+
+/**
+ * Encrypt or decrypt with AES-XTS nb_vectors consecutive vectors of a sector
+ *
+ * @param tweak The tweaks of the first vector's blocks
+ * @return The tweaks of the vector following them
+ */
+DIS_VAES_512_TARGET
+static inline __m512i xts_vectors_512(
+	const __m512i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m512i tweak,
+	const uint8_t* input,
+	uint8_t* output,
+	unsigned int nb_vectors)
+{
+	const __m512i next_shifts = _mm512_set1_epi64(4);
+	__m512i       tweaks[DIS_VAES_PIPELINE];
+	__m512i       vectors[DIS_VAES_PIPELINE];
+	unsigned int pipe = 0;
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+	{
+		tweaks[pipe]  = tweak;
+		tweak         = xts_mul_xn_512(tweak, next_shifts);
+		vectors[pipe] = _mm512_xor_si512(
+			_mm512_loadu_si512((const void*) (input + pipe * 64)), tweaks[pipe]
+		);
+	}
+
+	crypt_512(keys, nb_rounds, encrypt, vectors, nb_vectors);
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+		_mm512_storeu_si512(
+			(void*) (output + pipe * 64),
+			_mm512_xor_si512(vectors[pipe], tweaks[pipe])
+		);
+
+	return tweak;
+}
+
+
+DIS_VAES_512_TARGET
+static void crypt_xts_sectors_512(
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_tweak,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m512i       keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m512i       tweak_keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m512i       tweak;
+	/* Lane i holds the tweak of the sector's block i */
+	const __m512i lane_shifts = _mm512_set_epi64(3, 3, 2, 2, 1, 1, 0, 0);
+	uint8_t       sector_tweaks[64];
+	size_t        nb_vectors = sector_size / 64;
+	size_t        sector     = 0;
+	size_t        loop       = 0;
+
+	load_keys_512(crypt_key, keys);
+	load_keys_512(tweak_key, tweak_keys);
+
+	for(sector = 0; sector < nb_sectors; sector++)
+	{
+		/* The tweaks of four sectors are computed at once */
+		if(sector % 4 == 0)
+		{
+			tweak = _mm512_set_epi64(
+				0, (long long) (first_tweak + sector + 3),
+				0, (long long) (first_tweak + sector + 2),
+				0, (long long) (first_tweak + sector + 1),
+				0, (long long) (first_tweak + sector)
+			);
+			crypt_512(tweak_keys, tweak_key->nb_rounds, TRUE, &tweak, 1);
+			_mm512_storeu_si512((__m512i*) sector_tweaks, tweak);
+		}
+
+		tweak = _mm512_broadcast_i32x4(
+			_mm_loadu_si128((const __m128i*) &sector_tweaks[(sector % 4) * 16])
+		);
+		tweak = xts_mul_xn_512(tweak, lane_shifts);
+
+		for(loop = 0; loop + DIS_VAES_PIPELINE <= nb_vectors; loop += DIS_VAES_PIPELINE)
+			tweak = xts_vectors_512(
+				keys, crypt_key->nb_rounds, encrypt, tweak,
+				input + loop * 64, output + loop * 64, DIS_VAES_PIPELINE
+			);
+
+		for(; loop < nb_vectors; loop++)
+			tweak = xts_vectors_512(
+				keys, crypt_key->nb_rounds, encrypt, tweak,
+				input + loop * 64, output + loop * 64, 1
+			);
+
+		input  += sector_size;
+		output += sector_size;
+	}
+
+	memset(sector_tweaks, 0, sizeof(sector_tweaks));
+	memset(keys, 0, sizeof(keys));
+	memset(tweak_keys, 0, sizeof(tweak_keys));
+}
+
+
+/**
+ * Compute the CBC IVs of four consecutive sectors, that is the encryption of
+ * their addresses
+ */
+DIS_VAES_512_TARGET
+static inline __m512i cbc_ivs_512(
+	const __m512i* iv_keys,
+	unsigned int nb_rounds,
+	uint64_t address,
+	uint16_t sector_size)
+{
+	__m512i ivs = _mm512_set_epi64(
+		0, (long long) (address + 3 * (uint64_t) sector_size),
+		0, (long long) (address + 2 * (uint64_t) sector_size),
+		0, (long long) (address + (uint64_t) sector_size),
+		0, (long long) address
+	);
+
+	crypt_512(iv_keys, nb_rounds, TRUE, &ivs, 1);
+
+	return ivs;
+}
+
+
+/**
+ * Decrypt with AES-CBC nb_vectors consecutive vectors of a sector. The blocks
+ * don't depend on each other's decryption, only on the ciphertext.
+ *
+ * @param last The ciphertext block preceding them, or the sector's IV
+ * @return The last ciphertext block of them
+ */
+DIS_VAES_512_TARGET
+static inline __m128i cbc_decrypt_vectors_512(
+	const __m512i* keys,
+	unsigned int nb_rounds,
+	__m128i last,
+	const uint8_t* input,
+	uint8_t* output,
+	unsigned int nb_vectors)
+{
+	__m512i      vectors[DIS_VAES_PIPELINE];
+	__m512i      previous[DIS_VAES_PIPELINE];
+	unsigned int pipe = 0;
+
+	/*
+	 * Everything is loaded before anything is stored, so that the decryption
+	 * can be done in place
+	 */
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+	{
+		vectors[pipe] = _mm512_loadu_si512((const void*) (input + pipe * 64));
+
+		if(pipe == 0)
+			previous[pipe] = _mm512_alignr_epi64(
+				vectors[0], _mm512_broadcast_i32x4(last), 6
+			);
+		else
+			previous[pipe] = _mm512_loadu_si512(
+				(const void*) (input + pipe * 64 - 16)
+			);
+	}
+
+	last = _mm512_extracti32x4_epi32(vectors[nb_vectors - 1], 3);
+
+	crypt_512(keys, nb_rounds, FALSE, vectors, nb_vectors);
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+		_mm512_storeu_si512(
+			(void*) (output + pipe * 64),
+			_mm512_xor_si512(vectors[pipe], previous[pipe])
+		);
+
+	return last;
+}
+
+
+/*
+ * CBC decryption doesn't chain, so a sector's blocks are all decrypted at once,
+ * the IVs being computed four sectors at a time
+ */
+DIS_VAES_512_TARGET
+static void decrypt_cbc_sectors_512(
+	const dis_aesni_key_t* dec_key,
+	const dis_aesni_key_t* iv_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m512i keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m512i iv_keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m128i last;
+	uint8_t sector_ivs[64];
+	size_t  nb_vectors = sector_size / 64;
+	size_t  sector     = 0;
+	size_t  loop       = 0;
+
+	load_keys_512(dec_key, keys);
+	load_keys_512(iv_key, iv_keys);
+
+	for(sector = 0; sector < nb_sectors; sector++)
+	{
+		if(sector % 4 == 0)
+			_mm512_storeu_si512(
+				(__m512i*) sector_ivs,
+				cbc_ivs_512(
+					iv_keys,
+					iv_key->nb_rounds,
+					first_address + sector * sector_size,
+					sector_size
+				)
+			);
+
+		last = _mm_loadu_si128((const __m128i*) &sector_ivs[(sector % 4) * 16]);
+
+		for(loop = 0; loop + DIS_VAES_PIPELINE <= nb_vectors; loop += DIS_VAES_PIPELINE)
+			last = cbc_decrypt_vectors_512(
+				keys, dec_key->nb_rounds, last,
+				input + loop * 64, output + loop * 64, DIS_VAES_PIPELINE
+			);
+
+		for(; loop < nb_vectors; loop++)
+			last = cbc_decrypt_vectors_512(
+				keys, dec_key->nb_rounds, last,
+				input + loop * 64, output + loop * 64, 1
+			);
+
+		input  += sector_size;
+		output += sector_size;
+	}
+
+	memset(sector_ivs, 0, sizeof(sector_ivs));
+	memset(keys, 0, sizeof(keys));
+	memset(iv_keys, 0, sizeof(iv_keys));
+}
+
+
+/**
+ * Load the block at offset of four sectors, one per lane
+ */
+DIS_VAES_512_TARGET
+static inline __m512i gather_512(const uint8_t* const* sectors, size_t offset)
+{
+	__m512i vector = _mm512_castsi128_si512(
+		_mm_loadu_si128((const __m128i*) (sectors[0] + offset))
+	);
+
+	vector = _mm512_inserti32x4(
+		vector, _mm_loadu_si128((const __m128i*) (sectors[1] + offset)), 1
+	);
+	vector = _mm512_inserti32x4(
+		vector, _mm_loadu_si128((const __m128i*) (sectors[2] + offset)), 2
+	);
+	return _mm512_inserti32x4(
+		vector, _mm_loadu_si128((const __m128i*) (sectors[3] + offset)), 3
+	);
+}
+
+
+/**
+ * Store each lane at offset of its sector, lanes without a sector being dropped
+ */
+DIS_VAES_512_TARGET
+static inline void scatter_512(uint8_t* const* sectors, size_t offset, __m512i vector)
+{
+	_mm_storeu_si128(
+		(__m128i*) (sectors[0] + offset), _mm512_castsi512_si128(vector)
+	);
+	if(sectors[1])
+		_mm_storeu_si128(
+			(__m128i*) (sectors[1] + offset), _mm512_extracti32x4_epi32(vector, 1)
+		);
+	if(sectors[2])
+		_mm_storeu_si128(
+			(__m128i*) (sectors[2] + offset), _mm512_extracti32x4_epi32(vector, 2)
+		);
+	if(sectors[3])
+		_mm_storeu_si128(
+			(__m128i*) (sectors[3] + offset), _mm512_extracti32x4_epi32(vector, 3)
+		);
+}
+
+
+/**
+ * Encrypt with AES-CBC 4 * nb_vectors consecutive sectors, one per lane
+ *
+ * @param address The address of the first sector
+ * @param inputs The sectors to encrypt
+ * @param outputs Where to put them, NULL for lanes without a sector
+ */
+DIS_VAES_512_TARGET
+static inline void cbc_encrypt_vectors_512(
+	const __m512i* keys,
+	unsigned int nb_rounds,
+	uint16_t sector_size,
+	uint64_t address,
+	const uint8_t* const* inputs,
+	uint8_t* const* outputs,
+	unsigned int nb_vectors)
+{
+	__m512i      states[DIS_VAES_CBC_VECTORS];
+	size_t       offset = 0;
+	unsigned int vec    = 0;
+
+	DIS_VAES_UNROLL
+	for(vec = 0; vec < nb_vectors; vec++)
+		states[vec] = cbc_ivs_512(
+			keys, nb_rounds, address + vec * 4 * (uint64_t) sector_size, sector_size
+		);
+
+	for(offset = 0; offset < sector_size; offset += 16)
+	{
+		DIS_VAES_UNROLL
+		for(vec = 0; vec < nb_vectors; vec++)
+			states[vec] = _mm512_xor_si512(
+				states[vec], gather_512(&inputs[vec * 4], offset)
+			);
+
+		crypt_512(keys, nb_rounds, TRUE, states, nb_vectors);
+
+		DIS_VAES_UNROLL
+		for(vec = 0; vec < nb_vectors; vec++)
+			scatter_512(&outputs[vec * 4], offset, states[vec]);
+	}
+}
+
+
+/*
+ * CBC encryption chains within a sector, so lanes are given to different
+ * sectors instead: the same block of up to 4 * DIS_VAES_CBC_VECTORS sectors
+ * is encrypted at once
+ */
+DIS_VAES_512_TARGET
+static void encrypt_cbc_sectors_512(
+	const dis_aesni_key_t* enc_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m512i        keys[DIS_AESNI_MAX_ROUND_KEYS];
+	const uint8_t* inputs[4 * DIS_VAES_CBC_VECTORS];
+	uint8_t*       outputs[4 * DIS_VAES_CBC_VECTORS];
+	uint64_t       address = 0;
+	size_t         group   = 0;
+	size_t         sector  = 0;
+	unsigned int   nb      = 0;
+	unsigned int   nb_vecs = 0;
+	unsigned int   lane    = 0;
+	unsigned int   vec     = 0;
+
+	load_keys_512(enc_key, keys);
+
+	for(group = 0; group < nb_sectors; group += 4 * DIS_VAES_CBC_VECTORS)
+	{
+		nb = 4 * DIS_VAES_CBC_VECTORS;
+		if(nb_sectors - group < nb)
+			nb = (unsigned int) (nb_sectors - group);
+		nb_vecs = (nb + 3) / 4;
+
+		/* Lanes without a sector work on the last one, but aren't stored */
+		for(lane = 0; lane < 4 * nb_vecs; lane++)
+		{
+			sector = group + (lane < nb ? lane : nb - 1);
+
+			inputs[lane]  = input + sector * sector_size;
+			outputs[lane] = lane < nb ? output + sector * sector_size : NULL;
+		}
+
+		address = first_address + group * sector_size;
+
+		/* A last, partial, group goes one vector at a time */
+		if(nb_vecs == DIS_VAES_CBC_VECTORS)
+			cbc_encrypt_vectors_512(
+				keys, enc_key->nb_rounds, sector_size, address,
+				inputs, outputs, DIS_VAES_CBC_VECTORS
+			);
+		else
+			for(vec = 0; vec < nb_vecs; vec++)
+				cbc_encrypt_vectors_512(
+					keys, enc_key->nb_rounds, sector_size,
+					address + vec * 4 * (uint64_t) sector_size,
+					&inputs[vec * 4], &outputs[vec * 4], 1
+				);
+	}
+
+	memset(keys, 0, sizeof(keys));
+}
+
+
+
+
+/*
+ * 256-bit kernels, two AES blocks per vector, for CPUs having VAES without
+ * AVX-512. They work the same way as the ones above.
+ */
+
+DIS_VAES_256_TARGET
+static inline void load_keys_256(const dis_aesni_key_t* key, __m256i* keys)
+{
+	unsigned int loop = 0;
+
+	for(loop = 0; loop <= key->nb_rounds; loop++)
+		keys[loop] = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i*) &key->round_keys[loop * 16])
+		);
+}
+
+
+DIS_VAES_256_TARGET
+static inline void crypt_256(
+	const __m256i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m256i* vectors,
+	unsigned int nb_vectors)
+{
+	unsigned int round = 0;
+	unsigned int loop  = 0;
+
+	DIS_VAES_UNROLL
+	for(loop = 0; loop < nb_vectors; loop++)
+		vectors[loop] = _mm256_xor_si256(vectors[loop], keys[0]);
+
+	if(encrypt)
+	{
+		for(round = 1; round < nb_rounds; round++)
+			DIS_VAES_UNROLL
+			for(loop = 0; loop < nb_vectors; loop++)
+				vectors[loop] = _mm256_aesenc_epi128(vectors[loop], keys[round]);
+		DIS_VAES_UNROLL
+		for(loop = 0; loop < nb_vectors; loop++)
+			vectors[loop] = _mm256_aesenclast_epi128(vectors[loop], keys[nb_rounds]);
+	}
+	else
+	{
+		for(round = 1; round < nb_rounds; round++)
+			DIS_VAES_UNROLL
+			for(loop = 0; loop < nb_vectors; loop++)
+				vectors[loop] = _mm256_aesdec_epi128(vectors[loop], keys[round]);
+		DIS_VAES_UNROLL
+		for(loop = 0; loop < nb_vectors; loop++)
+			vectors[loop] = _mm256_aesdeclast_epi128(vectors[loop], keys[nb_rounds]);
+	}
+}
+
+
+DIS_VAES_256_TARGET
+static inline __m256i xts_mul_xn_256(__m256i tweaks, __m256i shifts)
+{
+	const __m256i poly  = _mm256_broadcastsi128_si256(_mm_set_epi32(0, 0, 0, 0x87));
+	__m256i       carry = _mm256_srlv_epi64(
+		tweaks, _mm256_sub_epi64(_mm256_set1_epi64x(64), shifts)
+	);
+
+	tweaks = _mm256_sllv_epi64(tweaks, shifts);
+	tweaks = _mm256_xor_si256(tweaks, _mm256_bslli_epi128(carry, 8));
+
+	return _mm256_xor_si256(tweaks, _mm256_clmulepi64_epi128(carry, poly, 0x01));
+}
+
+
+DIS_VAES_256_TARGET
+static inline __m256i xts_vectors_256(
+	const __m256i* keys,
+	unsigned int nb_rounds,
+	int encrypt,
+	__m256i tweak,
+	const uint8_t* input,
+	uint8_t* output,
+	unsigned int nb_vectors)
+{
+	const __m256i next_shifts = _mm256_set1_epi64x(2);
+	__m256i       tweaks[DIS_VAES_PIPELINE];
+	__m256i       vectors[DIS_VAES_PIPELINE];
+	unsigned int pipe = 0;
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+	{
+		tweaks[pipe]  = tweak;
+		tweak         = xts_mul_xn_256(tweak, next_shifts);
+		vectors[pipe] = _mm256_xor_si256(
+			_mm256_loadu_si256((const __m256i*) (input + pipe * 32)), tweaks[pipe]
+		);
+	}
+
+	crypt_256(keys, nb_rounds, encrypt, vectors, nb_vectors);
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+		_mm256_storeu_si256(
+			(__m256i*) (output + pipe * 32),
+			_mm256_xor_si256(vectors[pipe], tweaks[pipe])
+		);
+
+	return tweak;
+}
+
+
+DIS_VAES_256_TARGET
+static void crypt_xts_sectors_256(
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_tweak,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m256i       keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m256i       tweak_keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m256i       tweak;
+	/* Lane i holds the tweak of the sector's block i */
+	const __m256i lane_shifts = _mm256_set_epi64x(1, 1, 0, 0);
+	uint8_t       sector_tweaks[32];
+	size_t        nb_vectors = sector_size / 32;
+	size_t        sector     = 0;
+	size_t        loop       = 0;
+
+	load_keys_256(crypt_key, keys);
+	load_keys_256(tweak_key, tweak_keys);
+
+	for(sector = 0; sector < nb_sectors; sector++)
+	{
+		/* The tweaks of two sectors are computed at once */
+		if(sector % 2 == 0)
+		{
+			tweak = _mm256_set_epi64x(
+				0, (long long) (first_tweak + sector + 1),
+				0, (long long) (first_tweak + sector)
+			);
+			crypt_256(tweak_keys, tweak_key->nb_rounds, TRUE, &tweak, 1);
+			_mm256_storeu_si256((__m256i*) sector_tweaks, tweak);
+		}
+
+		tweak = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i*) &sector_tweaks[(sector % 2) * 16])
+		);
+		tweak = xts_mul_xn_256(tweak, lane_shifts);
+
+		for(loop = 0; loop + DIS_VAES_PIPELINE <= nb_vectors; loop += DIS_VAES_PIPELINE)
+			tweak = xts_vectors_256(
+				keys, crypt_key->nb_rounds, encrypt, tweak,
+				input + loop * 32, output + loop * 32, DIS_VAES_PIPELINE
+			);
+
+		for(; loop < nb_vectors; loop++)
+			tweak = xts_vectors_256(
+				keys, crypt_key->nb_rounds, encrypt, tweak,
+				input + loop * 32, output + loop * 32, 1
+			);
+
+		input  += sector_size;
+		output += sector_size;
+	}
+
+	memset(sector_tweaks, 0, sizeof(sector_tweaks));
+	memset(keys, 0, sizeof(keys));
+	memset(tweak_keys, 0, sizeof(tweak_keys));
+}
+
+
+/**
+ * Compute the CBC IVs of two consecutive sectors
+ */
+DIS_VAES_256_TARGET
+static inline __m256i cbc_ivs_256(
+	const __m256i* iv_keys,
+	unsigned int nb_rounds,
+	uint64_t address,
+	uint16_t sector_size)
+{
+	__m256i ivs = _mm256_set_epi64x(
+		0, (long long) (address + (uint64_t) sector_size),
+		0, (long long) address
+	);
+
+	crypt_256(iv_keys, nb_rounds, TRUE, &ivs, 1);
+
+	return ivs;
+}
+
+
+DIS_VAES_256_TARGET
+static inline __m128i cbc_decrypt_vectors_256(
+	const __m256i* keys,
+	unsigned int nb_rounds,
+	__m128i last,
+	const uint8_t* input,
+	uint8_t* output,
+	unsigned int nb_vectors)
+{
+	__m256i      vectors[DIS_VAES_PIPELINE];
+	__m256i      previous[DIS_VAES_PIPELINE];
+	unsigned int pipe = 0;
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+	{
+		vectors[pipe] = _mm256_loadu_si256((const __m256i*) (input + pipe * 32));
+
+		if(pipe == 0)
+			previous[pipe] = _mm256_permute2x128_si256(
+				_mm256_castsi128_si256(last), vectors[0], 0x20
+			);
+		else
+			previous[pipe] = _mm256_loadu_si256(
+				(const __m256i*) (input + pipe * 32 - 16)
+			);
+	}
+
+	last = _mm256_extracti128_si256(vectors[nb_vectors - 1], 1);
+
+	crypt_256(keys, nb_rounds, FALSE, vectors, nb_vectors);
+
+	DIS_VAES_UNROLL
+	for(pipe = 0; pipe < nb_vectors; pipe++)
+		_mm256_storeu_si256(
+			(__m256i*) (output + pipe * 32),
+			_mm256_xor_si256(vectors[pipe], previous[pipe])
+		);
+
+	return last;
+}
+
+
+DIS_VAES_256_TARGET
+static void decrypt_cbc_sectors_256(
+	const dis_aesni_key_t* dec_key,
+	const dis_aesni_key_t* iv_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m256i keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m256i iv_keys[DIS_AESNI_MAX_ROUND_KEYS];
+	__m128i last;
+	uint8_t sector_ivs[32];
+	size_t  nb_vectors = sector_size / 32;
+	size_t  sector     = 0;
+	size_t  loop       = 0;
+
+	load_keys_256(dec_key, keys);
+	load_keys_256(iv_key, iv_keys);
+
+	for(sector = 0; sector < nb_sectors; sector++)
+	{
+		if(sector % 2 == 0)
+			_mm256_storeu_si256(
+				(__m256i*) sector_ivs,
+				cbc_ivs_256(
+					iv_keys,
+					iv_key->nb_rounds,
+					first_address + sector * sector_size,
+					sector_size
+				)
+			);
+
+		last = _mm_loadu_si128((const __m128i*) &sector_ivs[(sector % 2) * 16]);
+
+		for(loop = 0; loop + DIS_VAES_PIPELINE <= nb_vectors; loop += DIS_VAES_PIPELINE)
+			last = cbc_decrypt_vectors_256(
+				keys, dec_key->nb_rounds, last,
+				input + loop * 32, output + loop * 32, DIS_VAES_PIPELINE
+			);
+
+		for(; loop < nb_vectors; loop++)
+			last = cbc_decrypt_vectors_256(
+				keys, dec_key->nb_rounds, last,
+				input + loop * 32, output + loop * 32, 1
+			);
+
+		input  += sector_size;
+		output += sector_size;
+	}
+
+	memset(sector_ivs, 0, sizeof(sector_ivs));
+	memset(keys, 0, sizeof(keys));
+	memset(iv_keys, 0, sizeof(iv_keys));
+}
+
+
+DIS_VAES_256_TARGET
+static inline __m256i gather_256(const uint8_t* const* sectors, size_t offset)
+{
+	return _mm256_inserti128_si256(
+		_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i*) (sectors[0] + offset))
+		),
+		_mm_loadu_si128((const __m128i*) (sectors[1] + offset)),
+		1
+	);
+}
+
+
+DIS_VAES_256_TARGET
+static inline void scatter_256(uint8_t* const* sectors, size_t offset, __m256i vector)
+{
+	_mm_storeu_si128(
+		(__m128i*) (sectors[0] + offset), _mm256_castsi256_si128(vector)
+	);
+	if(sectors[1])
+		_mm_storeu_si128(
+			(__m128i*) (sectors[1] + offset), _mm256_extracti128_si256(vector, 1)
+		);
+}
+
+
+DIS_VAES_256_TARGET
+static inline void cbc_encrypt_vectors_256(
+	const __m256i* keys,
+	unsigned int nb_rounds,
+	uint16_t sector_size,
+	uint64_t address,
+	const uint8_t* const* inputs,
+	uint8_t* const* outputs,
+	unsigned int nb_vectors)
+{
+	__m256i      states[DIS_VAES_CBC_VECTORS];
+	size_t       offset = 0;
+	unsigned int vec    = 0;
+
+	DIS_VAES_UNROLL
+	for(vec = 0; vec < nb_vectors; vec++)
+		states[vec] = cbc_ivs_256(
+			keys, nb_rounds, address + vec * 2 * (uint64_t) sector_size, sector_size
+		);
+
+	for(offset = 0; offset < sector_size; offset += 16)
+	{
+		DIS_VAES_UNROLL
+		for(vec = 0; vec < nb_vectors; vec++)
+			states[vec] = _mm256_xor_si256(
+				states[vec], gather_256(&inputs[vec * 2], offset)
+			);
+
+		crypt_256(keys, nb_rounds, TRUE, states, nb_vectors);
+
+		DIS_VAES_UNROLL
+		for(vec = 0; vec < nb_vectors; vec++)
+			scatter_256(&outputs[vec * 2], offset, states[vec]);
+	}
+}
+
+
+DIS_VAES_256_TARGET
+static void encrypt_cbc_sectors_256(
+	const dis_aesni_key_t* enc_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	__m256i        keys[DIS_AESNI_MAX_ROUND_KEYS];
+	const uint8_t* inputs[2 * DIS_VAES_CBC_VECTORS];
+	uint8_t*       outputs[2 * DIS_VAES_CBC_VECTORS];
+	uint64_t       address = 0;
+	size_t         group   = 0;
+	size_t         sector  = 0;
+	unsigned int   nb      = 0;
+	unsigned int   nb_vecs = 0;
+	unsigned int   lane    = 0;
+	unsigned int   vec     = 0;
+
+	load_keys_256(enc_key, keys);
+
+	for(group = 0; group < nb_sectors; group += 2 * DIS_VAES_CBC_VECTORS)
+	{
+		nb = 2 * DIS_VAES_CBC_VECTORS;
+		if(nb_sectors - group < nb)
+			nb = (unsigned int) (nb_sectors - group);
+		nb_vecs = (nb + 1) / 2;
+
+		for(lane = 0; lane < 2 * nb_vecs; lane++)
+		{
+			sector = group + (lane < nb ? lane : nb - 1);
+
+			inputs[lane]  = input + sector * sector_size;
+			outputs[lane] = lane < nb ? output + sector * sector_size : NULL;
+		}
+
+		address = first_address + group * sector_size;
+
+		if(nb_vecs == DIS_VAES_CBC_VECTORS)
+			cbc_encrypt_vectors_256(
+				keys, enc_key->nb_rounds, sector_size, address,
+				inputs, outputs, DIS_VAES_CBC_VECTORS
+			);
+		else
+			for(vec = 0; vec < nb_vecs; vec++)
+				cbc_encrypt_vectors_256(
+					keys, enc_key->nb_rounds, sector_size,
+					address + vec * 2 * (uint64_t) sector_size,
+					&inputs[vec * 2], &outputs[vec * 2], 1
+				);
+	}
+
+	memset(keys, 0, sizeof(keys));
+}
+
+
+
+/**
+ * AES-XTS encryption/decryption of consecutive sectors, the tweak of each one
+ * being its number
+ *
+ * @param width The width of the vectors to use, as given by dis_vaes_width()
+ * @param crypt_key The data key, expanded for the encryption or for the
+ * decryption according to the encrypt parameter
+ * @param tweak_key The tweak key, expanded for the encryption
+ * @param encrypt TRUE to encrypt, FALSE to decrypt
+ * @param sector_size The size of a sector, a multiple of DIS_VAES_SECTOR_ALIGN
+ * @param nb_sectors The number of sectors to work on
+ * @param first_tweak The number of the first sector
+ * @param input The sectors to encrypt or to decrypt
+ * @param output Where to put the result, may be the same as input
+ */
+void dis_vaes_crypt_xts_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_tweak,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	if(width == DIS_VAES_512)
+		crypt_xts_sectors_512(
+			crypt_key, tweak_key, encrypt, sector_size,
+			nb_sectors, first_tweak, input, output
+		);
+	else if(width == DIS_VAES_256)
+		crypt_xts_sectors_256(
+			crypt_key, tweak_key, encrypt, sector_size,
+			nb_sectors, first_tweak, input, output
+		);
+}
+
+
+/**
+ * AES-CBC decryption of consecutive sectors, the IV of each one being the
+ * encryption of its address, as BitLocker does
+ *
+ * @param width The width of the vectors to use, as given by dis_vaes_width()
+ * @param dec_key The data key, expanded for the decryption
+ * @param iv_key The data key, expanded for the encryption
+ * @param sector_size The size of a sector, a multiple of DIS_VAES_SECTOR_ALIGN
+ * @param nb_sectors The number of sectors to decrypt
+ * @param first_address The address of the first sector, in bytes
+ * @param input The sectors to decrypt
+ * @param output Where to put the result, may be the same as input
+ */
+void dis_vaes_decrypt_cbc_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* dec_key,
+	const dis_aesni_key_t* iv_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	if(width == DIS_VAES_512)
+		decrypt_cbc_sectors_512(
+			dec_key, iv_key, sector_size,
+			nb_sectors, first_address, input, output
+		);
+	else if(width == DIS_VAES_256)
+		decrypt_cbc_sectors_256(
+			dec_key, iv_key, sector_size,
+			nb_sectors, first_address, input, output
+		);
+}
+
+
+/**
+ * AES-CBC encryption of consecutive sectors
+ * @see dis_vaes_decrypt_cbc_sectors()
+ *
+ * @param width The width of the vectors to use, as given by dis_vaes_width()
+ * @param enc_key The data key, expanded for the encryption
+ * @param sector_size The size of a sector, a multiple of DIS_VAES_SECTOR_ALIGN
+ * @param nb_sectors The number of sectors to encrypt
+ * @param first_address The address of the first sector, in bytes
+ * @param input The sectors to encrypt
+ * @param output Where to put the result, may be the same as input
+ */
+void dis_vaes_encrypt_cbc_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* enc_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	if(width == DIS_VAES_512)
+		encrypt_cbc_sectors_512(
+			enc_key, sector_size, nb_sectors, first_address, input, output
+		);
+	else if(width == DIS_VAES_256)
+		encrypt_cbc_sectors_256(
+			enc_key, sector_size, nb_sectors, first_address, input, output
+		);
+}
+
+
+#else /* DIS_HAVE_VAES */
+
+
+unsigned int dis_vaes_width(void)
+{
+	return DIS_VAES_NONE;
+}
+
+
+void dis_vaes_crypt_xts_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* crypt_key,
+	const dis_aesni_key_t* tweak_key,
+	int encrypt,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_tweak,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) width;
+	(void) crypt_key;
+	(void) tweak_key;
+	(void) encrypt;
+	(void) sector_size;
+	(void) nb_sectors;
+	(void) first_tweak;
+	(void) input;
+	(void) output;
+}
+
+
+void dis_vaes_decrypt_cbc_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* dec_key,
+	const dis_aesni_key_t* iv_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) width;
+	(void) dec_key;
+	(void) iv_key;
+	(void) sector_size;
+	(void) nb_sectors;
+	(void) first_address;
+	(void) input;
+	(void) output;
+}
+
+
+void dis_vaes_encrypt_cbc_sectors(
+	unsigned int width,
+	const dis_aesni_key_t* enc_key,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint64_t first_address,
+	const uint8_t* input,
+	uint8_t* output)
+{
+	(void) width;
+	(void) enc_key;
+	(void) sector_size;
+	(void) nb_sectors;
+	(void) first_address;
+	(void) input;
+	(void) output;
+}
+
+#endif /* DIS_HAVE_VAES */
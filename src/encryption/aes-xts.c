@@ -149,7 +149,8 @@ int dis_aes_crypt_xex(
 		return( -1 );
 
 
-	AES_ECB_ENC( tweak_ctx, AES_ENCRYPT, iv, t_buf.u8 );
+	if( AES_ECB_ENC( tweak_ctx, AES_ENCRYPT, iv, t_buf.u8 ) != 0 )
+		return( -1 );
 
 	goto first;
 
@@ -163,7 +164,8 @@ first:
 		scratch.u64[1] = (uint64_t)( inbuf->u64[1] ^ t_buf.u64[1] );
 
 		/* CC <- E(Key2,PP) */
-		AES_ECB_ENC( crypt_ctx, mode, scratch.u8, outbuf->u8 );
+		if( AES_ECB_ENC( crypt_ctx, mode, scratch.u8, outbuf->u8 ) != 0 )
+			return( -1 );
 
 		/* C <- T xor CC */
 		outbuf->u64[0] = (uint64_t)( outbuf->u64[0] ^ t_buf.u64[0] );
@@ -214,7 +216,8 @@ int dis_aes_crypt_xts(
 		return( -1 );
 
 
-	AES_ECB_ENC( tweak_ctx, AES_ENCRYPT, iv, t_buf.u8 );
+	if( AES_ECB_ENC( tweak_ctx, AES_ENCRYPT, iv, t_buf.u8 ) != 0 )
+		return( -1 );
 
 	goto first;
 
@@ -228,7 +231,8 @@ first:
 		scratch.u64[1] = (uint64_t)( inbuf->u64[1] ^ t_buf.u64[1] );
 
 		/* CC <- E(Key2,PP) */
-		AES_ECB_ENC( crypt_ctx, mode, scratch.u8, outbuf->u8 );
+		if( AES_ECB_ENC( crypt_ctx, mode, scratch.u8, outbuf->u8 ) != 0 )
+			return( -1 );
 
 		/* C <- T xor CC */
 		outbuf->u64[0] = (uint64_t)( outbuf->u64[0] ^ t_buf.u64[0] );
@@ -258,7 +262,8 @@ first:
 			scratch.u64[1] = (uint64_t)( cts_scratch.u64[1] ^ t_buf.u64[1] );
 
 			/* CC <- E(Key2,PP) */
-			AES_ECB_ENC( crypt_ctx, mode, scratch.u8, scratch.u8 );
+			if( AES_ECB_ENC( crypt_ctx, mode, scratch.u8, scratch.u8 ) != 0 )
+				return( -1 );
 
 			/* C <- T xor CC */
 			( &outbuf[nb_blocks - 1] )->u64[0] = (uint64_t)( scratch.u64[0] ^ t_buf.u64[0] );
@@ -276,7 +281,8 @@ first:
 			scratch.u64[1] = (uint64_t)( outbuf[nb_blocks - 1].u64[1] ^ t_buf.u64[1] );
 
 			/* CC <- E(Key2,PP) */
-			AES_ECB_ENC( crypt_ctx, mode, scratch.u8, scratch.u8 );
+			if( AES_ECB_ENC( crypt_ctx, mode, scratch.u8, scratch.u8 ) != 0 )
+				return( -1 );
 
 			/* C <- T xor CC */
 			cts_scratch.u64[0] = (uint64_t)( scratch.u64[0] ^ t_buf.u64[0] );
@@ -293,7 +299,8 @@ first:
 			scratch.u64[1] = (uint64_t)( ( &outbuf[nb_blocks - 1] )->u64[1] ^ cts_t_buf.u64[1] );
 
 			/* CC <- E(Key2,PP) */
-			AES_ECB_ENC( crypt_ctx, mode, scratch.u8, scratch.u8 );
+			if( AES_ECB_ENC( crypt_ctx, mode, scratch.u8, scratch.u8 ) != 0 )
+				return( -1 );
 
 			/* C <- T xor CC */
 			( &outbuf[nb_blocks - 1] )->u64[0] = (uint64_t)( scratch.u64[0] ^ cts_t_buf.u64[0] );
@@ -95,7 +95,12 @@ int decrypt_key(
 	/*
 	 * Set key which is used to decrypt (already extracted from a datum_key_t structure)
 	 */
-	AES_SETENC_KEY(&ctx, key, keybits);
+	if(AES_SETENC_KEY(&ctx, key, keybits) != 0)
+	{
+		dis_printf(L_ERROR, "Cannot set the key up.\n");
+		AES_FREE(&ctx);
+		return FALSE;
+	}
 
 
 	/*
@@ -111,7 +116,7 @@ int decrypt_key(
 	hexdump(L_DEBUG, mac_first, AUTHENTICATOR_LENGTH);
 	dis_printf(L_DEBUG, "}----------------------------------------------------------{\n");
 
-	aes_ccm_encrypt_decrypt(
+	int ok = aes_ccm_encrypt_decrypt(
 		&ctx,
 		nonce,
 		0xc,
@@ -128,18 +133,25 @@ int decrypt_key(
 	 * Compute to check decryption
 	 */
 	memset(mac_second, 0, AUTHENTICATOR_LENGTH);
-	aes_ccm_compute_unencrypted_tag(
-		&ctx,
-		nonce,
-		0xc,
-		(unsigned char*) *output,
-		input_size,
-		mac_second
-	);
+	if(ok)
+		ok = aes_ccm_compute_unencrypted_tag(
+			&ctx,
+			nonce,
+			0xc,
+			(unsigned char*) *output,
+			input_size,
+			mac_second
+		);
 
 
 	AES_FREE(&ctx);
 
+	if(!ok)
+	{
+		dis_printf(L_ERROR, "Cannot decrypt the key.\n");
+		return FALSE;
+	}
+
 
 
 	/*
@@ -219,7 +231,8 @@ static int aes_ccm_encrypt_decrypt(
 	*iv = (unsigned char)(15 - nonce_length - 1);
 
 
-	AES_ECB_ENC(ctx, AES_ENCRYPT, iv, tmp_buf);
+	if(AES_ECB_ENC(ctx, AES_ENCRYPT, iv, tmp_buf) != 0)
+		return FALSE;
 
 	dis_printf(L_DEBUG, "\tTmp buffer:\n");
 	hexdump(L_DEBUG, tmp_buf, 16);
@@ -244,7 +257,8 @@ static int aes_ccm_encrypt_decrypt(
 
 		do
 		{
-			AES_ECB_ENC(ctx, AES_ENCRYPT, iv, tmp_buf);
+			if(AES_ECB_ENC(ctx, AES_ENCRYPT, iv, tmp_buf) != 0)
+				return FALSE;
 
 			xor_buffer(input, tmp_buf, output, sizeof(iv));
 
@@ -276,7 +290,8 @@ static int aes_ccm_encrypt_decrypt(
 	 */
 	if(input_length)
 	{
-		AES_ECB_ENC(ctx, AES_ENCRYPT, iv, tmp_buf);
+		if(AES_ECB_ENC(ctx, AES_ENCRYPT, iv, tmp_buf) != 0)
+			return FALSE;
 
 		xor_buffer(input, tmp_buf, output, input_length);
 	}
@@ -335,7 +350,8 @@ static int aes_ccm_compute_unencrypted_tag(
 	/*
 	 * Compute algorithm
 	 */
-	AES_ECB_ENC(ctx, AES_ENCRYPT, iv, iv);
+	if(AES_ECB_ENC(ctx, AES_ENCRYPT, iv, iv) != 0)
+		return FALSE;
 
 
 	if(buffer_length > 16)
@@ -351,7 +367,8 @@ static int aes_ccm_compute_unencrypted_tag(
 
 			xor_buffer(iv, buffer, NULL, AUTHENTICATOR_LENGTH);
 
-			AES_ECB_ENC(ctx, AES_ENCRYPT, iv, iv);
+			if(AES_ECB_ENC(ctx, AES_ENCRYPT, iv, iv) != 0)
+				return FALSE;
 
 			buffer += AUTHENTICATOR_LENGTH;
 			buffer_length -= AUTHENTICATOR_LENGTH;
@@ -365,7 +382,8 @@ static int aes_ccm_compute_unencrypted_tag(
 	if(buffer_length)
 	{
 		xor_buffer(iv, buffer, NULL, buffer_length);
-		AES_ECB_ENC(ctx, AES_ENCRYPT, iv, iv);
+		if(AES_ECB_ENC(ctx, AES_ENCRYPT, iv, iv) != 0)
+			return FALSE;
 	}
 
 
@@ -393,17 +411,76 @@ static int aes_ccm_compute_unencrypted_tag(
  */
 int decrypt_sector(dis_crypt_t crypt, uint8_t* sector, off_t sector_address, uint8_t* buffer)
 {
+	dis_aes_contexts_t* ctx = NULL;
+
 	// Check parameters
 	if(!crypt || !sector || !buffer)
 		return FALSE;
 
-	crypt->decrypt_fn(
-		&crypt->ctx,
+	ctx = dis_crypt_context(crypt);
+	if(!ctx)
+		return FALSE;
+
+	return crypt->decrypt_fn(
+		ctx,
 		crypt->sector_size,
 		sector,
 		sector_address,
 		buffer
 	);
+}
+
+
+/**
+ * Interface to decrypt consecutive sectors at once
+ *
+ * @param crypt Data needed by the decryption to deal with encrypted data
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_sectors(
+	dis_crypt_t crypt,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	dis_aes_contexts_t* ctx  = NULL;
+	size_t              loop = 0;
+
+	// Check parameters
+	if(!crypt || !sectors || !buffer)
+		return FALSE;
+
+	ctx = dis_crypt_context(crypt);
+	if(!ctx)
+		return FALSE;
+
+	if(crypt->decrypt_sectors_fn)
+		return crypt->decrypt_sectors_fn(
+			ctx,
+			crypt->sector_size,
+			nb_sectors,
+			sectors,
+			sector_address,
+			buffer
+		);
+
+	for(loop = 0; loop < nb_sectors; loop++,
+	    sectors        += crypt->sector_size,
+	    sector_address += crypt->sector_size,
+	    buffer         += crypt->sector_size)
+		if(!crypt->decrypt_fn(
+			ctx,
+			crypt->sector_size,
+			sectors,
+			sector_address,
+			buffer
+		))
+			return FALSE;
 
 	return TRUE;
 }
@@ -417,8 +494,9 @@ int decrypt_sector(dis_crypt_t crypt, uint8_t* sector, off_t sector_address, uin
  * @param sector The sector to decrypt
  * @param sector_address Address of the sector to decrypt
  * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-void decrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
+int decrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
 {
 	/* Parameters are assumed to be correctly checked already */
 	union {
@@ -430,10 +508,47 @@ void decrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size,
 
 	/* Create the iv */
 	iv.single = sector_address;
-	AES_ECB_ENC(&ctx->FVEK_E_ctx, AES_ENCRYPT, iv.multi, iv.multi);
+	if(AES_ECB_ENC(&ctx->FVEK_E_ctx, AES_ENCRYPT, iv.multi, iv.multi) != 0)
+		return FALSE;
 
 	/* Actually decrypt data */
-	AES_CBC(&ctx->FVEK_D_ctx, AES_DECRYPT, sector_size, iv.multi, sector, buffer);
+	return AES_CBC(&ctx->FVEK_D_ctx, AES_DECRYPT, sector_size, iv.multi, sector, buffer) == 0;
+}
+
+
+/**
+ * Remove the diffuser and the sector key from a sector, once it's decrypted
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector_address Address of the sector
+ * @param buffer The decrypted sector, which is modified in place
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+static int remove_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, off_t sector_address, uint8_t* buffer)
+{
+	uint8_t sector_key[32];
+
+
+	/* First, create the sector key */
+	if(!dis_crypt_sector_keys(ctx, sector_size, 1, sector_address, sector_key))
+		return FALSE;
+
+
+	/* Call diffuser B */
+	diffuserB_decrypt(buffer, sector_size, (uint32_t*)buffer);
+
+
+	/* Afterward, call diffuser A */
+	diffuserA_decrypt(buffer, sector_size, (uint32_t*)buffer);
+
+
+	/* And finally, apply the sector key */
+	dis_crypt_xor_sector_key(buffer, sector_size, sector_key);
+
+	memset(sector_key, 0, 32);
+
+	return TRUE;
 }
 
 
@@ -445,48 +560,82 @@ void decrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size,
  * @param sector The sector to decrypt
  * @param sector_address Address of the sector to decrypt
  * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-void decrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
+int decrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
 {
 	/* Parameters are assumed to be correctly checked already */
 
+	/* First actually decrypt the buffer */
+	if(!decrypt_cbc_without_diffuser(ctx, sector_size, sector, sector_address, buffer))
+		return FALSE;
+
+	/* Then undo what's done before the encryption */
+	return remove_diffuser(ctx, sector_size, sector_address, buffer);
+}
+
+
+/**
+ * Decrypt a sector which was not encrypted with the diffuser, using the AES-NI
+ * kernels
+ * @see dis_aesni_available()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector The sector to decrypt
+ * @param sector_address Address of the sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_without_diffuser_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
 	union {
-		uint8_t multi[16];
+		unsigned char multi[16];
 		off_t single;
 	} iv;
-	memset(iv.multi, 0, 16);
-
-	uint8_t sector_key[32] = {0,};
-
-	int loop = 0;
 
+	memset(iv.multi, 0, 16);
 
-	/* First, create the sector key */
+	/* Create the iv */
 	iv.single = sector_address;
+	dis_aesni_crypt_block(&ctx->FVEK_E_ni, TRUE, iv.multi, iv.multi);
 
-	AES_ECB_ENC(&ctx->TWEAK_E_ctx, AES_ENCRYPT, iv.multi, sector_key);
-	/* For iv unicity reason... */
-	iv.multi[15] = 0x80;
-	AES_ECB_ENC(&ctx->TWEAK_E_ctx, AES_ENCRYPT, iv.multi, &sector_key[16]);
-
-
-	/* Then actually decrypt the buffer */
-	decrypt_cbc_without_diffuser(ctx, sector_size, sector, sector_address, buffer);
-
-
-	/* Call diffuser B */
-	diffuserB_decrypt(buffer, sector_size, (uint32_t*)buffer);
-
+	/* Actually decrypt data */
+	dis_aesni_decrypt_cbc(&ctx->FVEK_D_ni, sector_size, iv.multi, sector, buffer);
 
-	/* Afterward, call diffuser A */
-	diffuserA_decrypt(buffer, sector_size, (uint32_t*)buffer);
+	return TRUE;
+}
 
 
-	/* And finally, apply the sector key */
-	for(loop = 0; loop < sector_size; ++loop)
-		buffer[loop] ^= sector_key[loop % 32];
+/**
+ * Decrypt a sector which was encrypted with the diffuser enabled, using the
+ * AES-NI kernels for the AES part
+ * @see dis_aesni_available()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector The sector to decrypt
+ * @param sector_address Address of the sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_with_diffuser_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	decrypt_cbc_without_diffuser_aesni(ctx, sector_size, sector, sector_address, buffer);
 
-	memset(sector_key, 0, 32);
+	return remove_diffuser(ctx, sector_size, sector_address, buffer);
 }
 
 
@@ -498,8 +647,9 @@ void decrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, ui
  * @param sector The sector to decrypt
  * @param sector_address Address of the sector to decrypt
  * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-void decrypt_xts(
+int decrypt_xts(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -516,7 +666,7 @@ void decrypt_xts(
 	memset(iv.multi, 0, 16);
 	iv.single = sector_address / sector_size;
 
-	AES_XTS(
+	return AES_XTS(
 		&ctx->FVEK_D_ctx,
 		&ctx->TWEAK_E_ctx,
 		AES_DECRYPT,
@@ -524,5 +674,382 @@ void decrypt_xts(
 		iv.multi,
 		sector,
 		buffer
+	) == 0;
+}
+
+
+/**
+ * Decrypt a sector which was encrypted with AES-XTS, using the AES-NI kernel
+ * @see dis_aesni_available()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector The sector to decrypt
+ * @param sector_address Address of the sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_xts_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	union {
+		unsigned char multi[16];
+		off_t single;
+	} iv;
+
+	/* Create the iv */
+	memset(iv.multi, 0, 16);
+	iv.single = sector_address / sector_size;
+
+	dis_aesni_crypt_xts(
+		&ctx->FVEK_D_ni,
+		&ctx->TWEAK_E_ni,
+		FALSE,
+		sector_size,
+		iv.multi,
+		sector,
+		buffer
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Decrypt consecutive sectors which were encrypted with the diffuser enabled, a
+ * chunk at a time: each chunk is decrypted, then de-diffused and unkeyed while
+ * it's in the cache, with the sector keys of the whole chunk computed at once
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @param decrypt_cbc_fn The function decrypting the AES part of a chunk
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+static int decrypt_cbc_with_diffuser_chunks(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer,
+	int (*decrypt_cbc_fn)(dis_aes_contexts_t*, uint16_t, size_t, uint8_t*, off_t, uint8_t*))
+{
+	uint8_t sector_keys[DIS_CBC_CHUNK_SECTORS * 32];
+	size_t  chunk = 0;
+	size_t  loop  = 0;
+	int     ok    = TRUE;
+
+	for(; nb_sectors > 0; nb_sectors -= chunk,
+	    sectors        += chunk * sector_size,
+	    buffer         += chunk * sector_size,
+	    sector_address += (off_t) (chunk * sector_size))
+	{
+		chunk = nb_sectors < DIS_CBC_CHUNK_SECTORS ?
+		        nb_sectors : DIS_CBC_CHUNK_SECTORS;
+
+		ok = decrypt_cbc_fn(ctx, sector_size, chunk, sectors, sector_address, buffer) &&
+		     dis_crypt_sector_keys(ctx, sector_size, chunk, sector_address, sector_keys);
+		if(!ok)
+			break;
+
+		diffuser_decrypt_sectors(buffer, sector_size, chunk);
+
+		for(loop = 0; loop < chunk; loop++)
+			dis_crypt_xor_sector_key(
+				buffer + loop * sector_size,
+				sector_size,
+				sector_keys + loop * 32
+			);
+	}
+
+	memset(sector_keys, 0, sizeof(sector_keys));
+
+	return ok;
+}
+
+
+/**
+ * Decrypt consecutive sectors which were not encrypted with the diffuser, their
+ * IVs being computed a chunk at a time
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_without_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	uint8_t ivs[DIS_CBC_CHUNK_SECTORS * 16];
+	size_t  chunk = 0;
+	size_t  loop  = 0;
+
+	for(; nb_sectors > 0; nb_sectors -= chunk,
+	    sectors        += chunk * sector_size,
+	    buffer         += chunk * sector_size,
+	    sector_address += (off_t) (chunk * sector_size))
+	{
+		chunk = nb_sectors < DIS_CBC_CHUNK_SECTORS ?
+		        nb_sectors : DIS_CBC_CHUNK_SECTORS;
+
+		if(!dis_crypt_sector_ivs(ctx, sector_size, chunk, sector_address, ivs))
+			return FALSE;
+
+		for(loop = 0; loop < chunk; loop++)
+			if(AES_CBC(
+				&ctx->FVEK_D_ctx,
+				AES_DECRYPT,
+				sector_size,
+				ivs + loop * 16,
+				sectors + loop * sector_size,
+				buffer + loop * sector_size
+			) != 0)
+				return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Decrypt consecutive sectors which were encrypted with the diffuser enabled
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_with_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	return decrypt_cbc_with_diffuser_chunks(
+		ctx,
+		sector_size,
+		nb_sectors,
+		sectors,
+		sector_address,
+		buffer,
+		decrypt_cbc_without_diffuser_sectors
+	);
+}
+
+
+/**
+ * Decrypt consecutive sectors which were not encrypted with the diffuser, using
+ * the AES-NI kernels; the IVs of a chunk go through the pipeline at once
+ * @see dis_aesni_available()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_without_diffuser_sectors_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	uint8_t ivs[DIS_CBC_CHUNK_SECTORS * 16];
+	size_t  chunk = 0;
+	size_t  loop  = 0;
+
+	for(; nb_sectors > 0; nb_sectors -= chunk,
+	    sectors        += chunk * sector_size,
+	    buffer         += chunk * sector_size,
+	    sector_address += (off_t) (chunk * sector_size))
+	{
+		chunk = nb_sectors < DIS_CBC_CHUNK_SECTORS ?
+		        nb_sectors : DIS_CBC_CHUNK_SECTORS;
+
+		if(!dis_crypt_sector_ivs(ctx, sector_size, chunk, sector_address, ivs))
+			return FALSE;
+
+		for(loop = 0; loop < chunk; loop++)
+			dis_aesni_decrypt_cbc(
+				&ctx->FVEK_D_ni,
+				sector_size,
+				ivs + loop * 16,
+				sectors + loop * sector_size,
+				buffer + loop * sector_size
+			);
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Decrypt consecutive sectors which were encrypted with the diffuser enabled,
+ * using the AES-NI kernels for the AES part
+ * @see dis_aesni_available()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_with_diffuser_sectors_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	return decrypt_cbc_with_diffuser_chunks(
+		ctx,
+		sector_size,
+		nb_sectors,
+		sectors,
+		sector_address,
+		buffer,
+		decrypt_cbc_without_diffuser_sectors_aesni
+	);
+}
+
+
+/**
+ * Decrypt consecutive sectors which were encrypted with AES-XTS, using the
+ * VAES kernels
+ * @see dis_vaes_width()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_xts_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	dis_vaes_crypt_xts_sectors(
+		ctx->vaes_width,
+		&ctx->FVEK_D_ni,
+		&ctx->TWEAK_E_ni,
+		FALSE,
+		sector_size,
+		nb_sectors,
+		(uint64_t) (sector_address / sector_size),
+		sectors,
+		buffer
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Decrypt consecutive sectors which were not encrypted with the diffuser,
+ * using the VAES kernels
+ * @see dis_vaes_width()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_without_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	dis_vaes_decrypt_cbc_sectors(
+		ctx->vaes_width,
+		&ctx->FVEK_D_ni,
+		&ctx->FVEK_E_ni,
+		sector_size,
+		nb_sectors,
+		(uint64_t) sector_address,
+		sectors,
+		buffer
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Decrypt consecutive sectors which were encrypted with the diffuser enabled,
+ * using the VAES kernels for the AES part
+ * @see dis_vaes_width()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to decrypt
+ * @param sectors The sectors to decrypt
+ * @param sector_address Address of the first sector to decrypt
+ * @param buffer The place where we have to put decrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int decrypt_cbc_with_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	return decrypt_cbc_with_diffuser_chunks(
+		ctx,
+		sector_size,
+		nb_sectors,
+		sectors,
+		sector_address,
+		buffer,
+		decrypt_cbc_without_diffuser_sectors_vaes
 	);
 }
@@ -27,10 +27,137 @@
 #include "dislocker/encryption/diffuser.h"
 
 
-#define ROTATE_LEFT(a,n)  (((a) << (n)) | ((a) >> ((sizeof(a) * 8)-(n))))
+/* Rotations by 0 are fine: the right shift is masked to 0 too */
+#define ROTATE_LEFT(a,n)  (((a) << (n)) | ((a) >> ((32 - (n)) & 31)))
 #define ROTATE_RIGHT(a,n) (((a) >> (n)) | ((a) << ((sizeof(a) * 8)-(n))))
 
 
+/*
+ * Niels Ferguson's diffusers work on the sector as an array d of 32-bit words,
+ * over a few cycles:
+ *  - diffuser A: d[i] = d[i] +/- (d[i-2] xor ROTATE_LEFT(d[i-5], Ra[i mod 4]))
+ *  - diffuser B: d[i] = d[i] +/- (d[i+2] xor ROTATE_LEFT(d[i+5], Rb[i mod 4]))
+ * with indices taken modulo the number of words, ascending to decrypt and
+ * descending to encrypt.
+ *
+ * Only the few words at the edges wrap around, they're peeled off the main
+ * loops, which go four words at a time so that the rotations are constants.
+ *
+ * The cycles are written once as macros, working the same way on single words
+ * and on vectors of words taken from several sectors, see below.
+ */
+static const unsigned int Ra[] = {9, 0, 13, 0};
+static const unsigned int Rb[] = {0, 10, 0, 25};
+
+#define DIFFUSER_A_CYCLES 5
+#define DIFFUSER_B_CYCLES 3
+
+
+/**
+ * Wrap an index, a few words off the sector, around its number of words
+ */
+static inline int wrap(int index, int int_size)
+{
+	while(index < 0)
+		index += int_size;
+	while(index >= int_size)
+		index -= int_size;
+
+	return index;
+}
+
+
+/* d[i] = d[i] op (d[i2] xor ROTATE_LEFT(d[i5], r)) */
+#define DIFFUSE_WORD(d, i, i2, i5, op, r) \
+	((d)[i] = (d)[i] op ((d)[i2] ^ ROTATE_LEFT((d)[i5], r)))
+
+#define DIFFUSER_A_DECRYPT_CYCLE(d, int_size, i, word_t)                       \
+	do {                                                                       \
+		word_t w1, w2, w3, w4, w5, x0, x1, x2, x3;                             \
+		/* The first words use the end of the sector, not updated yet */      \
+		for(i = 0; i < 8 && i < (int_size); i++)                               \
+			DIFFUSE_WORD(d, i, wrap(i - 2, int_size), wrap(i - 5, int_size),   \
+			             +, Ra[i % 4]);                                        \
+		if(i + 4 <= (int_size))                                                \
+		{                                                                      \
+			/* The words just updated are kept at hand, wi being d[i-i] */     \
+			w1 = (d)[i - 1]; w2 = (d)[i - 2]; w3 = (d)[i - 3];                 \
+			w4 = (d)[i - 4]; w5 = (d)[i - 5];                                  \
+			for(; i + 4 <= (int_size); i += 4)                                 \
+			{                                                                  \
+				x0 = (d)[i]     + (w2 ^ ROTATE_LEFT(w5, 9));                   \
+				x1 = (d)[i + 1] + (w1 ^ w4);                                   \
+				x2 = (d)[i + 2] + (x0 ^ ROTATE_LEFT(w3, 13));                  \
+				x3 = (d)[i + 3] + (x1 ^ w2);                                   \
+				(d)[i] = x0; (d)[i + 1] = x1; (d)[i + 2] = x2; (d)[i + 3] = x3; \
+				w5 = w1; w4 = x0; w3 = x1; w2 = x2; w1 = x3;                   \
+			}                                                                  \
+		}                                                                      \
+		for(; i < (int_size); i++)                                             \
+			DIFFUSE_WORD(d, i, i - 2, i - 5, +, Ra[i % 4]);                    \
+	} while(0)
+
+#define DIFFUSER_A_ENCRYPT_CYCLE(d, int_size, i)                               \
+	do {                                                                       \
+		/* Words past the last group of four */                                \
+		for(i = (int_size) - 1; i >= ((int_size) & ~3); i--)                   \
+			DIFFUSE_WORD(d, i, wrap(i - 2, int_size), wrap(i - 5, int_size),   \
+			             -, Ra[i % 4]);                                        \
+		for(i = ((int_size) & ~3) - 4; i >= 8; i -= 4)                        \
+		{                                                                      \
+			DIFFUSE_WORD(d, i + 3, i + 1, i - 2, -, 0);                        \
+			DIFFUSE_WORD(d, i + 2, i,     i - 3, -, 13);                       \
+			DIFFUSE_WORD(d, i + 1, i - 1, i - 4, -, 0);                        \
+			DIFFUSE_WORD(d, i,     i - 2, i - 5, -, 9);                        \
+		}                                                                      \
+		/* The first words use the end of the sector, updated already */      \
+		for(i += 3; i >= 0; i--)                                               \
+			DIFFUSE_WORD(d, i, wrap(i - 2, int_size), wrap(i - 5, int_size),   \
+			             -, Ra[i % 4]);                                        \
+	} while(0)
+
+#define DIFFUSER_B_DECRYPT_CYCLE(d, int_size, i)                               \
+	do {                                                                       \
+		for(i = 0; i + 9 <= (int_size); i += 4)                                \
+		{                                                                      \
+			DIFFUSE_WORD(d, i,     i + 2, i + 5, +, 0);                        \
+			DIFFUSE_WORD(d, i + 1, i + 3, i + 6, +, 10);                       \
+			DIFFUSE_WORD(d, i + 2, i + 4, i + 7, +, 0);                        \
+			DIFFUSE_WORD(d, i + 3, i + 5, i + 8, +, 25);                       \
+		}                                                                      \
+		/* The last words use the start of the sector, updated already */     \
+		for(; i < (int_size); i++)                                             \
+			DIFFUSE_WORD(d, i, wrap(i + 2, int_size), wrap(i + 5, int_size),   \
+			             +, Rb[i % 4]);                                        \
+	} while(0)
+
+#define DIFFUSER_B_ENCRYPT_CYCLE(d, int_size, i, last_group, word_t)           \
+	do {                                                                       \
+		word_t w4, w5, w6, w7, w8, x0, x1, x2, x3;                             \
+		last_group = (int_size) >= 9 ? ((int_size) - 9) & ~3 : -4;             \
+		/* The last words use the start of the sector, not updated yet */     \
+		for(i = (int_size) - 1; i >= last_group + 4; i--)                      \
+			DIFFUSE_WORD(d, i, wrap(i + 2, int_size), wrap(i + 5, int_size),   \
+			             -, Rb[i % 4]);                                        \
+		if(last_group >= 0)                                                    \
+		{                                                                      \
+			/* The words just updated are kept at hand, wi being d[i+i] */     \
+			i = last_group;                                                    \
+			w4 = (d)[i + 4]; w5 = (d)[i + 5]; w6 = (d)[i + 6];                 \
+			w7 = (d)[i + 7]; w8 = (d)[i + 8];                                  \
+			for(; i >= 0; i -= 4)                                              \
+			{                                                                  \
+				x3 = (d)[i + 3] - (w5 ^ ROTATE_LEFT(w8, 25));                  \
+				x2 = (d)[i + 2] - (w4 ^ w7);                                   \
+				x1 = (d)[i + 1] - (x3 ^ ROTATE_LEFT(w6, 10));                  \
+				x0 = (d)[i]     - (x2 ^ w5);                                   \
+				(d)[i] = x0; (d)[i + 1] = x1; (d)[i + 2] = x2; (d)[i + 3] = x3; \
+				w8 = w4; w7 = x3; w6 = x2; w5 = x1; w4 = x0;                   \
+			}                                                                  \
+		}                                                                      \
+	} while(0)
+
+
 /**
  * Implement diffuser A's decryption algorithm as explained by Niels Ferguson
  * @warning sector and buffer should not overlap
@@ -42,10 +169,9 @@
 void diffuserA_decrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 {
 	int i = 0;
-	int Acycles = 5;
-	uint16_t Ra[] = {9, 0, 13, 0};
+	int Acycles = DIFFUSER_A_CYCLES;
 	/* buffer is a pointer on a 4 bytes object */
-	uint16_t int_size = sector_size / 4;
+	int int_size = sector_size / 4;
 
 	/* Use buffer for the algorithm */
 	if((uint8_t*)buffer != sector)
@@ -53,15 +179,7 @@ void diffuserA_decrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 
 	while(Acycles)
 	{
-		for(i = 0; i < int_size; ++i)
-		{
-			*(buffer + i) = *(buffer + i) +                                               // d[i] +
-					( /* Remember that, for instance, -5 % 2 yields -1, not 1 as expected */
-						*(buffer + ((i-2 + int_size) % int_size)) ^                       // d[i-2] xor
-						ROTATE_LEFT(*(buffer + ((i-5 + int_size) % int_size)), Ra[i % 4]) // ROTATE_LEFT(d[i-5], Ra[i mod 4])
-					);
-		}
-
+		DIFFUSER_A_DECRYPT_CYCLE(buffer, int_size, i, uint32_t);
 		Acycles--;
 	}
 }
@@ -79,10 +197,9 @@ void diffuserA_decrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 void diffuserB_decrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 {
 	int i = 0;
-	int Bcycles = 3;
-	uint16_t Rb[] = {0, 10, 0, 25};
+	int Bcycles = DIFFUSER_B_CYCLES;
 	/* buffer is a pointer on a 4 bytes object */
-	uint16_t int_size = sector_size / 4;
+	int int_size = sector_size / 4;
 
 	/* Use buffer for the algorithm */
 	if((uint8_t*)buffer != sector)
@@ -91,15 +208,7 @@ void diffuserB_decrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 
 	while(Bcycles)
 	{
-		for(i = 0; i < int_size; ++i)
-		{
-			*(buffer+i) = *(buffer + i) +                                      // d[i] +
-					(
-						*(buffer + ((i+2) % int_size)) ^                       // d[i+2] xor
-						ROTATE_LEFT(*(buffer + ((i+5) % int_size)), Rb[i % 4]) // ROTATE_LEFT(d[i+5], Rb[i mod 4])
-					);
-		}
-
+		DIFFUSER_B_DECRYPT_CYCLE(buffer, int_size, i);
 		Bcycles--;
 	}
 }
@@ -118,10 +227,9 @@ void diffuserB_decrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 void diffuserA_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 {
 	int i = 0;
-	int Acycles = 5;
-	uint16_t Ra[] = {9, 0, 13, 0};
+	int Acycles = DIFFUSER_A_CYCLES;
 	/* buffer is a pointer on a 4 bytes object */
-	uint16_t int_size = sector_size / 4;
+	int int_size = sector_size / 4;
 
 	/* Use buffer for the algorithm */
 	if((uint8_t*)buffer != sector)
@@ -129,15 +237,7 @@ void diffuserA_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 
 	while(Acycles)
 	{
-		for(i = int_size - 1; i >= 0; --i)
-		{
-			*(buffer + i) = *(buffer + i) -                                               // d[i] -
-					( /* Remember that, for instance, -5 % 2 yields -1, not 1 as expected */
-						*(buffer + ((i-2 + int_size) % int_size)) ^                       // d[i-2] xor
-						ROTATE_LEFT(*(buffer + ((i-5 + int_size) % int_size)), Ra[i % 4]) // ROTATE_LEFT(d[i-5], Ra[i mod 4])
-					);
-		}
-
+		DIFFUSER_A_ENCRYPT_CYCLE(buffer, int_size, i);
 		Acycles--;
 	}
 }
@@ -154,10 +254,10 @@ void diffuserA_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 void diffuserB_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 {
 	int i = 0;
-	int Bcycles = 3;
-	uint16_t Rb[] = {0, 10, 0, 25};
+	int last_group = 0;
+	int Bcycles = DIFFUSER_B_CYCLES;
 	/* buffer is a pointer on a 4 bytes object */
-	uint16_t int_size = sector_size >> 2;
+	int int_size = sector_size >> 2;
 
 	/* Use buffer for the algorithm */
 	if((uint8_t*)buffer != sector)
@@ -165,15 +265,239 @@ void diffuserB_encrypt(uint8_t* sector, uint16_t sector_size, uint32_t* buffer)
 
 	while(Bcycles)
 	{
-		for(i = int_size - 1; i >= 0; --i)
+		DIFFUSER_B_ENCRYPT_CYCLE(buffer, int_size, i, last_group, uint32_t);
+		Bcycles--;
+	}
+}
+
+
+
+/*
+ * The SIMD kernels need the compiler's vector extensions
+ */
+#if defined(__GNUC__)
+#  define DIS_HAVE_DIFFUSER_LANES 1
+#else
+#  define DIS_HAVE_DIFFUSER_LANES 0
+#endif
+
+/* Least number of sectors worth the transposition */
+#define DIS_DIFFUSER_MIN_LANES 3
+
+/* The transposed sectors are kept on the stack */
+#define DIS_DIFFUSER_MAX_SECTOR_SIZE 4096
+
+
+#if DIS_HAVE_DIFFUSER_LANES
+
+/*
+ * The cycles are sequential within a sector, each word depending on the ones
+ * just updated. So the SIMD kernels work on DIS_DIFFUSER_LANES sectors at
+ * once instead: the sectors are transposed, lane s of vector i being word i of
+ * sector s, and the cycles run on the vectors as they do on single words.
+ *
+ * They're written with the compiler's vector extensions, that is SSE2 on x86
+ * (a vector being two registers then), NEON on ARM... They're compiled again
+ * for AVX2, used when the CPU has it.
+ */
+typedef uint32_t dis_diffuser_lanes_t
+	__attribute__((vector_size(4 * DIS_DIFFUSER_LANES)));
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define DIS_DIFFUSER_AVX2 1
+#else
+#  define DIS_DIFFUSER_AVX2 0
+#endif
+
+
+/**
+ * Diffuse, or remove the diffusion of, up to DIS_DIFFUSER_LANES consecutive
+ * sectors in place
+ *
+ * @param sectors The first sector
+ * @param sector_size The size of a sector, at most DIS_DIFFUSER_MAX_SECTOR_SIZE
+ * @param nb_sectors The number of sectors, lanes past them being left unused
+ * @param encrypt Non-zero to diffuse (A then B), zero to remove it (B then A)
+ */
+static inline __attribute__((always_inline)) void diffuse_lanes(
+	uint8_t* sectors,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	int encrypt)
+{
+	dis_diffuser_lanes_t d[DIS_DIFFUSER_MAX_SECTOR_SIZE / 4];
+	int      int_size   = sector_size / 4;
+	int      i          = 0;
+	int      last_group = 0;
+	int      cycle      = 0;
+	size_t   lane       = 0;
+	uint8_t* sector     = NULL;
+	uint32_t word       = 0;
+
+	/* Lanes without a sector work on the last one, but aren't stored back */
+	for(lane = 0; lane < DIS_DIFFUSER_LANES; lane++)
+	{
+		sector = sectors + (lane < nb_sectors ? lane : nb_sectors - 1) * sector_size;
+
+		for(i = 0; i < int_size; i++)
 		{
-			*(buffer+i) = *(buffer + i) -                                      // d[i] -
-					(
-						*(buffer + ((i+2) % int_size)) ^                       // d[i+2] xor
-						ROTATE_LEFT(*(buffer + ((i+5) % int_size)), Rb[i % 4]) // ROTATE_LEFT(d[i+5], Rb[i mod 4])
-					);
+			memcpy(&word, sector + i * 4, 4);
+			d[i][lane] = word;
 		}
+	}
 
-		Bcycles--;
+	if(encrypt)
+	{
+		for(cycle = 0; cycle < DIFFUSER_A_CYCLES; cycle++)
+			DIFFUSER_A_ENCRYPT_CYCLE(d, int_size, i);
+		for(cycle = 0; cycle < DIFFUSER_B_CYCLES; cycle++)
+			DIFFUSER_B_ENCRYPT_CYCLE(d, int_size, i, last_group, dis_diffuser_lanes_t);
+	}
+	else
+	{
+		for(cycle = 0; cycle < DIFFUSER_B_CYCLES; cycle++)
+			DIFFUSER_B_DECRYPT_CYCLE(d, int_size, i);
+		for(cycle = 0; cycle < DIFFUSER_A_CYCLES; cycle++)
+			DIFFUSER_A_DECRYPT_CYCLE(d, int_size, i, dis_diffuser_lanes_t);
+	}
+
+	for(lane = 0; lane < nb_sectors; lane++)
+	{
+		sector = sectors + lane * sector_size;
+
+		for(i = 0; i < int_size; i++)
+		{
+			word = d[i][lane];
+			memcpy(sector + i * 4, &word, 4);
+		}
+	}
+}
+
+
+static void diffuse_lanes_default(
+	uint8_t* sectors,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	int encrypt)
+{
+	diffuse_lanes(sectors, sector_size, nb_sectors, encrypt);
+}
+
+
+#if DIS_DIFFUSER_AVX2
+__attribute__((target("avx2")))
+static void diffuse_lanes_avx2(
+	uint8_t* sectors,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	int encrypt)
+{
+	diffuse_lanes(sectors, sector_size, nb_sectors, encrypt);
+}
+#endif
+
+
+/**
+ * Run the diffusers on consecutive sectors, in place, DIS_DIFFUSER_LANES of
+ * them at a time
+ */
+static void diffuse_sectors(
+	uint8_t* sectors,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	int encrypt)
+{
+	size_t nb   = 0;
+	int    avx2 = 0;
+
+#if DIS_DIFFUSER_AVX2
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	while(nb_sectors > 0)
+	{
+		nb = nb_sectors < DIS_DIFFUSER_LANES ? nb_sectors : DIS_DIFFUSER_LANES;
+
+		/* Too few sectors to fill the vectors, go on one word at a time */
+		if(nb < DIS_DIFFUSER_MIN_LANES)
+			break;
+
+#if DIS_DIFFUSER_AVX2
+		if(avx2)
+			diffuse_lanes_avx2(sectors, sector_size, nb, encrypt);
+		else
+#endif
+			diffuse_lanes_default(sectors, sector_size, nb, encrypt);
+
+		sectors    += nb * sector_size;
+		nb_sectors -= nb;
+	}
+
+	for(; nb_sectors > 0; nb_sectors--, sectors += sector_size)
+	{
+		if(encrypt)
+		{
+			diffuserA_encrypt(sectors, sector_size, (uint32_t*) sectors);
+			diffuserB_encrypt(sectors, sector_size, (uint32_t*) sectors);
+		}
+		else
+		{
+			diffuserB_decrypt(sectors, sector_size, (uint32_t*) sectors);
+			diffuserA_decrypt(sectors, sector_size, (uint32_t*) sectors);
+		}
+	}
+}
+
+#endif /* DIS_HAVE_DIFFUSER_LANES */
+
+
+/**
+ * Remove the diffusion from consecutive decrypted sectors, in place: diffuser B
+ * then diffuser A are undone on each of them
+ *
+ * @param sectors The sectors, one after the other
+ * @param sector_size The size of a sector (in bytes)
+ * @param nb_sectors The number of sectors
+ */
+void diffuser_decrypt_sectors(uint8_t* sectors, uint16_t sector_size, size_t nb_sectors)
+{
+#if DIS_HAVE_DIFFUSER_LANES
+	if(sector_size <= DIS_DIFFUSER_MAX_SECTOR_SIZE)
+	{
+		diffuse_sectors(sectors, sector_size, nb_sectors, 0);
+		return;
+	}
+#endif
+
+	for(; nb_sectors > 0; nb_sectors--, sectors += sector_size)
+	{
+		diffuserB_decrypt(sectors, sector_size, (uint32_t*) sectors);
+		diffuserA_decrypt(sectors, sector_size, (uint32_t*) sectors);
+	}
+}
+
+
+/**
+ * Diffuse consecutive sectors before their encryption, in place: diffuser A
+ * then diffuser B are run on each of them
+ *
+ * @param sectors The sectors, one after the other
+ * @param sector_size The size of a sector (in bytes)
+ * @param nb_sectors The number of sectors
+ */
+void diffuser_encrypt_sectors(uint8_t* sectors, uint16_t sector_size, size_t nb_sectors)
+{
+#if DIS_HAVE_DIFFUSER_LANES
+	if(sector_size <= DIS_DIFFUSER_MAX_SECTOR_SIZE)
+	{
+		diffuse_sectors(sectors, sector_size, nb_sectors, 1);
+		return;
+	}
+#endif
+
+	for(; nb_sectors > 0; nb_sectors--, sectors += sector_size)
+	{
+		diffuserA_encrypt(sectors, sector_size, (uint32_t*) sectors);
+		diffuserB_encrypt(sectors, sector_size, (uint32_t*) sectors);
 	}
 }
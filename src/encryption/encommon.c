@@ -21,7 +21,9 @@
  * USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include "dislocker/common.h"
 #include "dislocker/return_values.h"
 #include "dislocker/xstd/xstdio.h"
 #include "dislocker/xstd/xstdlib.h"
@@ -31,6 +33,49 @@
 #include "ssl_bindings.h"
 
 
+/*
+ * Whether the AES-NI and VAES kernels may take over from the backend: those
+ * offloading AES somewhere else, AF_ALG's, keep it all
+ */
+#ifndef AES_ALLOW_CPU_KERNELS
+#  define AES_ALLOW_CPU_KERNELS 1
+#endif
+
+/*
+ * Backends able to encrypt several blocks in a single call say so, the others
+ * see their AES_ECB_ENC() called for each block
+ */
+#ifndef AES_ECB_BLOCKS
+static int aes_ecb_blocks(AES_CONTEXT* ctx, int mode, size_t nb_blocks, uint8_t* in, uint8_t* out)
+{
+	size_t block = 0;
+
+	for(block = 0; block < nb_blocks; block++)
+		if(AES_ECB_ENC(ctx, mode, in + 16 * block, out + 16 * block) != 0)
+			return 1;
+
+	return 0;
+}
+#  define AES_ECB_BLOCKS(ctx, mode, nb_blocks, in, out) \
+                                          aes_ecb_blocks(ctx, mode, nb_blocks, in, out)
+#endif
+
+
+/**
+ * Give the replica of an exiting thread back, for the next thread to use it
+ *
+ * @param params The thread's replica
+ */
+static void release_replica(void* params)
+{
+	dis_aes_replica_t* replica = (dis_aes_replica_t*) params;
+	dis_crypt_t        crypt   = replica->crypt;
+
+	pthread_mutex_lock(&crypt->replicas_lock);
+	replica->in_use = FALSE;
+	pthread_mutex_unlock(&crypt->replicas_lock);
+}
+
 
 /**
  * Create "an object" of type dis_crypt_t
@@ -51,6 +96,8 @@ dis_crypt_t dis_crypt_new(uint16_t sector_size, cipher_t disk_cipher)
 		crypt->flags |= DIS_ENC_FLAG_USE_DIFFUSER;
 		crypt->encrypt_fn = encrypt_cbc_with_diffuser;
 		crypt->decrypt_fn = decrypt_cbc_with_diffuser;
+		crypt->encrypt_sectors_fn = encrypt_cbc_with_diffuser_sectors;
+		crypt->decrypt_sectors_fn = decrypt_cbc_with_diffuser_sectors;
 	}
 	else if(disk_cipher == AES_XTS_128 || disk_cipher == AES_XTS_256)
 	{
@@ -61,66 +108,585 @@ dis_crypt_t dis_crypt_new(uint16_t sector_size, cipher_t disk_cipher)
 	{
 		crypt->encrypt_fn = encrypt_cbc_without_diffuser;
 		crypt->decrypt_fn = decrypt_cbc_without_diffuser;
+		crypt->encrypt_sectors_fn = encrypt_cbc_without_diffuser_sectors;
+		crypt->decrypt_sectors_fn = decrypt_cbc_without_diffuser_sectors;
+	}
+
+	/* Contexts which can't be shared are replicated for each thread */
+	if(!AES_CONTEXT_IS_REENTRANT)
+	{
+		if(pthread_key_create(&crypt->replica_key, release_replica) != 0)
+		{
+			dis_printf(L_ERROR, "Cannot create the threads' crypto contexts\n");
+			dis_free(crypt);
+			return NULL;
+		}
+
+		pthread_mutex_init(&crypt->replicas_lock, NULL);
+		crypt->has_replicas = TRUE;
 	}
 
 	return crypt;
 }
 
-int dis_crypt_set_fvekey(dis_crypt_t crypt, uint16_t algorithm, uint8_t* fvekey)
+/**
+ * Switch an XTS volume to the AES-NI kernel, if the CPU has the instructions.
+ * The backend's contexts are still set, as a fallback.
+ *
+ * @param crypt The crypt structure of the volume
+ * @param fvekey The data key, followed by the tweak one
+ * @param key_bits The size of each key, in bits
+ */
+static void select_xts_kernel(dis_crypt_t crypt, uint8_t* fvekey, unsigned int key_bits)
 {
-	if(!crypt || !fvekey)
-		return DIS_RET_ERROR_DISLOCKER_INVAL;
+	if(!AES_ALLOW_CPU_KERNELS || !dis_aesni_available())
+		return;
+
+	if(!dis_aesni_set_key(
+			&crypt->ctx.FVEK_E_ni,
+			&crypt->ctx.FVEK_D_ni,
+			fvekey,
+			key_bits) ||
+	   !dis_aesni_set_key(
+			&crypt->ctx.TWEAK_E_ni,
+			NULL,
+			fvekey + key_bits / 8,
+			key_bits))
+		return;
+
+	crypt->encrypt_fn = encrypt_xts_aesni;
+	crypt->decrypt_fn = decrypt_xts_aesni;
+
+	dis_printf(L_DEBUG, "Using the AES-NI kernel for AES-XTS\n");
+}
+
+
+/**
+ * Switch a CBC volume to the AES-NI decryption kernel, if the CPU has the
+ * instructions. The encryption chains blocks, it stays with the backend.
+ *
+ * @param crypt The crypt structure of the volume
+ * @param fvekey The data key
+ * @param key_bits The size of the key, in bits
+ */
+static void select_cbc_kernel(dis_crypt_t crypt, uint8_t* fvekey, unsigned int key_bits)
+{
+	if(!AES_ALLOW_CPU_KERNELS || !dis_aesni_available())
+		return;
+
+	if(!dis_aesni_set_key(
+			&crypt->ctx.FVEK_E_ni,
+			&crypt->ctx.FVEK_D_ni,
+			fvekey,
+			key_bits))
+		return;
+
+	/* The diffuser's sector keys come from the tweak key, in both directions */
+	if(crypt->flags & DIS_ENC_FLAG_USE_DIFFUSER &&
+	   !dis_aesni_set_key(&crypt->ctx.TWEAK_E_ni, NULL, fvekey + 0x20, key_bits))
+		return;
+
+	if(crypt->flags & DIS_ENC_FLAG_USE_DIFFUSER)
+	{
+		crypt->decrypt_fn         = decrypt_cbc_with_diffuser_aesni;
+		crypt->decrypt_sectors_fn = decrypt_cbc_with_diffuser_sectors_aesni;
+	}
+	else
+	{
+		crypt->decrypt_fn         = decrypt_cbc_without_diffuser_aesni;
+		crypt->decrypt_sectors_fn = decrypt_cbc_without_diffuser_sectors_aesni;
+	}
+
+	dis_printf(L_DEBUG, "Using the AES-NI kernel for AES-CBC decryption\n");
+}
+
+
+/**
+ * Give the volume the VAES kernels working on several sectors at once, if the
+ * CPU has them. Lone sectors still go through the per-sector functions.
+ *
+ * @param crypt The crypt structure of the volume
+ * @param algorithm The volume's cipher
+ * @param fvekey The data key, followed by the tweak one
+ * @param key_bits The size of the data key, in bits
+ */
+static void select_sectors_kernel(
+	dis_crypt_t crypt,
+	uint16_t algorithm,
+	uint8_t* fvekey,
+	unsigned int key_bits)
+{
+	unsigned int width = AES_ALLOW_CPU_KERNELS ? dis_vaes_width() : DIS_VAES_NONE;
+
+	if(width == DIS_VAES_NONE || crypt->sector_size % DIS_VAES_SECTOR_ALIGN)
+		return;
+
+	if(!dis_aesni_set_key(
+			&crypt->ctx.FVEK_E_ni,
+			&crypt->ctx.FVEK_D_ni,
+			fvekey,
+			key_bits))
+		return;
 
 	switch(algorithm)
 	{
+		case AES_XTS_128:
+		case AES_XTS_256:
+			if(!dis_aesni_set_key(
+					&crypt->ctx.TWEAK_E_ni,
+					NULL,
+					fvekey + key_bits / 8,
+					key_bits))
+				return;
+			crypt->encrypt_sectors_fn = encrypt_xts_sectors_vaes;
+			crypt->decrypt_sectors_fn = decrypt_xts_sectors_vaes;
+			break;
+
 		case AES_128_DIFFUSER:
-			AES_SETENC_KEY(&crypt->ctx.TWEAK_E_ctx, fvekey + 0x20, 128);
-			AES_SETDEC_KEY(&crypt->ctx.TWEAK_D_ctx, fvekey + 0x20, 128);
+		case AES_256_DIFFUSER:
+			crypt->encrypt_sectors_fn = encrypt_cbc_with_diffuser_sectors_vaes;
+			crypt->decrypt_sectors_fn = decrypt_cbc_with_diffuser_sectors_vaes;
+			break;
+
+		default:
+			crypt->encrypt_sectors_fn = encrypt_cbc_without_diffuser_sectors_vaes;
+			crypt->decrypt_sectors_fn = decrypt_cbc_without_diffuser_sectors_vaes;
+			break;
+	}
+
+	crypt->ctx.vaes_width = width;
+
+	dis_printf(L_DEBUG, "Using the %u-bit VAES kernels for batches of sectors\n", width);
+}
+
+
+/**
+ * Key the backend's contexts
+ *
+ * @param ctx The contexts to key
+ * @param algorithm The volume's cipher
+ * @param fvekey The data key, followed by the tweak one
+ * @param key_bits Where to put the size of the data key, in bits
+ * @return DIS_RET_SUCCESS, DIS_RET_ERROR_CRYPTO_ALGORITHM_UNSUPPORTED if the
+ * cipher isn't supported, DIS_RET_ERROR_CRYPTO_INIT if the backend failed
+ */
+static int set_backend_keys(dis_aes_contexts_t* ctx, uint16_t algorithm, uint8_t* fvekey, unsigned int* key_bits)
+{
+	int err = 0;
+
+	switch(algorithm)
+	{
+		case AES_128_DIFFUSER:
+			err |= AES_SETENC_KEY(&ctx->TWEAK_E_ctx, fvekey + 0x20, 128);
+			err |= AES_SETDEC_KEY(&ctx->TWEAK_D_ctx, fvekey + 0x20, 128);
 			// fall through
 		case AES_128_NO_DIFFUSER:
-			AES_SETENC_KEY(&crypt->ctx.FVEK_E_ctx, fvekey, 128);
-			AES_SETDEC_KEY(&crypt->ctx.FVEK_D_ctx, fvekey, 128);
-			return DIS_RET_SUCCESS;
+			err |= AES_SETENC_KEY(&ctx->FVEK_E_ctx, fvekey, 128);
+			err |= AES_SETDEC_KEY(&ctx->FVEK_D_ctx, fvekey, 128);
+			*key_bits = 128;
+			break;
 
 		case AES_256_DIFFUSER:
-			AES_SETENC_KEY(&crypt->ctx.TWEAK_E_ctx, fvekey + 0x20, 256);
-			AES_SETDEC_KEY(&crypt->ctx.TWEAK_D_ctx, fvekey + 0x20, 256);
+			err |= AES_SETENC_KEY(&ctx->TWEAK_E_ctx, fvekey + 0x20, 256);
+			err |= AES_SETDEC_KEY(&ctx->TWEAK_D_ctx, fvekey + 0x20, 256);
 			// fall through
 		case AES_256_NO_DIFFUSER:
-			AES_SETENC_KEY(&crypt->ctx.FVEK_E_ctx, fvekey, 256);
-			AES_SETDEC_KEY(&crypt->ctx.FVEK_D_ctx, fvekey, 256);
-			return DIS_RET_SUCCESS;
+			err |= AES_SETENC_KEY(&ctx->FVEK_E_ctx, fvekey, 256);
+			err |= AES_SETDEC_KEY(&ctx->FVEK_D_ctx, fvekey, 256);
+			*key_bits = 256;
+			break;
 
 		case AES_XTS_128:
-			AES_SETENC_KEY(&crypt->ctx.FVEK_E_ctx, fvekey, 128);
-			AES_SETDEC_KEY(&crypt->ctx.FVEK_D_ctx, fvekey, 128);
-			AES_SETENC_KEY(&crypt->ctx.TWEAK_E_ctx, fvekey + 0x10, 128);
-			AES_SETDEC_KEY(&crypt->ctx.TWEAK_D_ctx, fvekey + 0x10, 128);
-			return DIS_RET_SUCCESS;
+			err |= AES_SETENC_KEY(&ctx->FVEK_E_ctx, fvekey, 128);
+			err |= AES_SETDEC_KEY(&ctx->FVEK_D_ctx, fvekey, 128);
+			err |= AES_SETENC_KEY(&ctx->TWEAK_E_ctx, fvekey + 0x10, 128);
+			err |= AES_SETDEC_KEY(&ctx->TWEAK_D_ctx, fvekey + 0x10, 128);
+			*key_bits = 128;
+			break;
 
 		case AES_XTS_256:
-			AES_SETENC_KEY(&crypt->ctx.FVEK_E_ctx, fvekey, 256);
-			AES_SETDEC_KEY(&crypt->ctx.FVEK_D_ctx, fvekey, 256);
-			AES_SETENC_KEY(&crypt->ctx.TWEAK_E_ctx, fvekey + 0x20, 256);
-			AES_SETDEC_KEY(&crypt->ctx.TWEAK_D_ctx, fvekey + 0x20, 256);
-			return DIS_RET_SUCCESS;
+			err |= AES_SETENC_KEY(&ctx->FVEK_E_ctx, fvekey, 256);
+			err |= AES_SETDEC_KEY(&ctx->FVEK_D_ctx, fvekey, 256);
+			err |= AES_SETENC_KEY(&ctx->TWEAK_E_ctx, fvekey + 0x20, 256);
+			err |= AES_SETDEC_KEY(&ctx->TWEAK_D_ctx, fvekey + 0x20, 256);
+			*key_bits = 256;
+			break;
 
 		default:
-			dis_printf(L_WARNING, "Algo not supported: %#hx\n", algorithm);
+			return DIS_RET_ERROR_CRYPTO_ALGORITHM_UNSUPPORTED;
+	}
+
+	return err ? DIS_RET_ERROR_CRYPTO_INIT : DIS_RET_SUCCESS;
+}
+
+
+/**
+ * Get how many bytes of the FVEK a cipher uses
+ *
+ * @param algorithm The volume's cipher
+ * @return The size of the data key and, if any, of the tweak key after it
+ */
+static size_t fvekey_size(uint16_t algorithm)
+{
+	switch(algorithm)
+	{
+		case AES_128_NO_DIFFUSER: return 0x10;
+		case AES_256_NO_DIFFUSER: return 0x20;
+		case AES_XTS_128:         return 0x20;
+		case AES_128_DIFFUSER:    return 0x30;
+		case AES_256_DIFFUSER:    return 0x40;
+		case AES_XTS_256:         return 0x40;
+		default:                  return 0;
+	}
+}
+
+
+/**
+ * Key a thread's replica with the volume's key. The backend's contexts are
+ * keyed on their own, the AES-NI schedules are only read so they're copied.
+ *
+ * @param crypt The crypt structure of the volume
+ * @param replica The replica to key
+ * @return TRUE if the replica has been keyed, FALSE otherwise
+ */
+static int key_replica(dis_crypt_t crypt, dis_aes_replica_t* replica)
+{
+	unsigned int key_bits = 0;
+
+	replica->ctx.FVEK_E_ni  = crypt->ctx.FVEK_E_ni;
+	replica->ctx.FVEK_D_ni  = crypt->ctx.FVEK_D_ni;
+	replica->ctx.TWEAK_E_ni = crypt->ctx.TWEAK_E_ni;
+	replica->ctx.vaes_width = crypt->ctx.vaes_width;
+
+	return set_backend_keys(
+		&replica->ctx, crypt->algorithm, crypt->fvekey, &key_bits
+	) == DIS_RET_SUCCESS;
+}
+
+
+/**
+ * Have the backend encrypt a block with the keys, the way the volume's cipher
+ * uses them. This is done once per volume, so that a backend unable to use
+ * them, as AF_ALG on a kernel without it, is noticed when they're set rather
+ * than on the first sector.
+ *
+ * @param ctx The keyed contexts
+ * @param algorithm The volume's cipher
+ * @return TRUE if the backend took the keys, FALSE otherwise
+ */
+static int check_backend_keys(dis_aes_contexts_t* ctx, uint16_t algorithm)
+{
+	uint8_t block[16];
+	uint8_t iv[16];
+	int     err = 0;
+
+	memset(block, 0, sizeof(block));
+	memset(iv, 0, sizeof(iv));
+
+	if(algorithm == AES_XTS_128 || algorithm == AES_XTS_256)
+		err = AES_XTS(&ctx->FVEK_E_ctx, &ctx->TWEAK_E_ctx, AES_ENCRYPT, 16, iv, block, block);
+	else
+	{
+		err = AES_CBC(&ctx->FVEK_E_ctx, AES_ENCRYPT, 16, iv, block, block);
+
+		if(!err && (algorithm == AES_128_DIFFUSER || algorithm == AES_256_DIFFUSER))
+			err = AES_ECB_ENC(&ctx->TWEAK_E_ctx, AES_ENCRYPT, block, block);
+	}
+
+	memset(block, 0, sizeof(block));
+
+	return err == 0;
+}
+
+
+int dis_crypt_set_fvekey(dis_crypt_t crypt, uint16_t algorithm, uint8_t* fvekey)
+{
+	dis_aes_replica_t* replica  = NULL;
+	unsigned int       key_bits = 0;
+	int                ret      = DIS_RET_SUCCESS;
+
+	if(!crypt || !fvekey)
+		return DIS_RET_ERROR_DISLOCKER_INVAL;
+
+	ret = set_backend_keys(&crypt->ctx, algorithm, fvekey, &key_bits);
+	if(ret == DIS_RET_ERROR_CRYPTO_ALGORITHM_UNSUPPORTED)
+	{
+		dis_printf(L_WARNING, "Algo not supported: %#hx\n", algorithm);
+		return ret;
+	}
+	if(ret == DIS_RET_SUCCESS && !check_backend_keys(&crypt->ctx, algorithm))
+		ret = DIS_RET_ERROR_CRYPTO_INIT;
+
+	if(ret != DIS_RET_SUCCESS)
+	{
+		dis_printf(L_ERROR, "Cannot give the keys to the crypto backend\n");
+		return ret;
+	}
+
+	if(algorithm == AES_XTS_128 || algorithm == AES_XTS_256)
+		select_xts_kernel(crypt, fvekey, key_bits);
+	else
+		select_cbc_kernel(crypt, fvekey, key_bits);
+
+	select_sectors_kernel(crypt, algorithm, fvekey, key_bits);
+
+	crypt->algorithm = algorithm;
+	memset(crypt->fvekey, 0, sizeof(crypt->fvekey));
+	memcpy(crypt->fvekey, fvekey, fvekey_size(algorithm));
+
+	if(!crypt->has_replicas)
+		return DIS_RET_SUCCESS;
+
+	/* Threads which already have a replica get it keyed again */
+	pthread_mutex_lock(&crypt->replicas_lock);
+	for(replica = crypt->replicas; replica; replica = replica->next)
+		if(!key_replica(crypt, replica))
+			ret = DIS_RET_ERROR_CRYPTO_INIT;
+	pthread_mutex_unlock(&crypt->replicas_lock);
+
+	if(ret != DIS_RET_SUCCESS)
+		dis_printf(L_ERROR, "Cannot give the keys to the crypto backend\n");
+
+	return ret;
+}
+
+
+/**
+ * Free a set of contexts
+ *
+ * @param ctx The contexts to free
+ */
+static void free_contexts(dis_aes_contexts_t* ctx)
+{
+	AES_FREE(&ctx->FVEK_D_ctx);
+	AES_FREE(&ctx->FVEK_E_ctx);
+	AES_FREE(&ctx->TWEAK_D_ctx);
+	AES_FREE(&ctx->TWEAK_E_ctx);
+	memset(&ctx->FVEK_E_ni, 0, sizeof(dis_aesni_key_t));
+	memset(&ctx->FVEK_D_ni, 0, sizeof(dis_aesni_key_t));
+	memset(&ctx->TWEAK_E_ni, 0, sizeof(dis_aesni_key_t));
+}
+
+
+/**
+ * Allocate a replica for a thread, on cache lines of its own
+ * @warning The replicas' lock has to be held
+ *
+ * @param crypt The crypt structure of the volume
+ * @return The keyed replica, NULL if it can't be allocated
+ */
+static dis_aes_replica_t* new_replica(dis_crypt_t crypt)
+{
+	dis_aes_replica_t* replica = NULL;
+	void*              memory  = NULL;
+	size_t             size    = (sizeof(dis_aes_replica_t) + DIS_CACHE_LINE_SIZE - 1)
+	                             / DIS_CACHE_LINE_SIZE * DIS_CACHE_LINE_SIZE;
+
+	if(posix_memalign(&memory, DIS_CACHE_LINE_SIZE, size) != 0)
+	{
+		dis_printf(L_ERROR, "Cannot allocate the thread's crypto contexts\n");
+		return NULL;
+	}
+
+	memset(memory, 0, size);
+
+	replica        = (dis_aes_replica_t*) memory;
+	replica->crypt = crypt;
+
+	if(!key_replica(crypt, replica))
+	{
+		dis_printf(L_ERROR, "Cannot key the thread's crypto contexts\n");
+		free_contexts(&replica->ctx);
+		free(memory);
+		return NULL;
+	}
+
+	replica->next   = crypt->replicas;
+	crypt->replicas = replica;
+
+	return replica;
+}
+
+
+/**
+ * Get the contexts the calling thread has to use: the shared ones if the
+ * backend's are reentrant, the thread's replica otherwise. Once the thread has
+ * its replica, getting it takes no lock.
+ *
+ * @param crypt The crypt structure of the volume
+ * @return The contexts, NULL if the thread's replica can't be allocated
+ */
+dis_aes_contexts_t* dis_crypt_context(dis_crypt_t crypt)
+{
+	dis_aes_replica_t* replica = NULL;
+
+	if(!crypt->has_replicas)
+		return &crypt->ctx;
+
+	replica = pthread_getspecific(crypt->replica_key);
+	if(replica)
+		return &replica->ctx;
+
+	pthread_mutex_lock(&crypt->replicas_lock);
+
+	/* A thread which exited may have left one, already keyed */
+	for(replica = crypt->replicas; replica; replica = replica->next)
+		if(!replica->in_use)
 			break;
+
+	if(!replica)
+		replica = new_replica(crypt);
+
+	if(replica)
+	{
+		replica->in_use = TRUE;
+
+		if(pthread_setspecific(crypt->replica_key, replica) != 0)
+		{
+			replica->in_use = FALSE;
+			replica = NULL;
+		}
 	}
 
-	return DIS_RET_ERROR_CRYPTO_ALGORITHM_UNSUPPORTED;
+	pthread_mutex_unlock(&crypt->replicas_lock);
+
+	return replica ? &replica->ctx : NULL;
 }
 
+
+/**
+ * Compute the IVs of consecutive sectors of a CBC volume, that is their
+ * addresses encrypted with the data key. They're all issued at once, so that
+ * the AES-NI kernel pipelines them.
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors
+ * @param first_address Address of the first sector
+ * @param ivs Where to put the IVs, 16 bytes per sector
+ * @return TRUE if the IVs have been computed, FALSE otherwise
+ */
+int dis_crypt_sector_ivs(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	off_t first_address,
+	uint8_t* ivs)
+{
+	off_t  address = first_address;
+	size_t loop    = 0;
+
+	memset(ivs, 0, nb_sectors * 16);
+
+	for(loop = 0; loop < nb_sectors; loop++, address += sector_size)
+		memcpy(ivs + loop * 16, &address, sizeof(off_t));
+
+	if(ctx->FVEK_E_ni.nb_rounds)
+		dis_aesni_crypt_ecb(&ctx->FVEK_E_ni, TRUE, nb_sectors, ivs, ivs);
+	else if(AES_ECB_BLOCKS(&ctx->FVEK_E_ctx, AES_ENCRYPT, nb_sectors, ivs, ivs) != 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+
+/**
+ * Compute the sector keys the volumes using the diffuser XOR their sectors
+ * with: the address of the sector, then the same marked with 0x80 in its last
+ * byte, encrypted with the tweak key. As with the IVs, the keys of all the
+ * sectors are issued at once.
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors
+ * @param first_address Address of the first sector
+ * @param sector_keys Where to put the keys, 32 bytes per sector
+ * @return TRUE if the keys have been computed, FALSE otherwise
+ */
+int dis_crypt_sector_keys(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	off_t first_address,
+	uint8_t* sector_keys)
+{
+	off_t  address = first_address;
+	size_t loop    = 0;
+
+	memset(sector_keys, 0, nb_sectors * 32);
+
+	for(loop = 0; loop < nb_sectors; loop++, address += sector_size)
+	{
+		memcpy(sector_keys + loop * 32, &address, sizeof(off_t));
+		memcpy(sector_keys + loop * 32 + 16, &address, sizeof(off_t));
+		/* For iv unicity reason... */
+		sector_keys[loop * 32 + 31] = 0x80;
+	}
+
+	if(ctx->TWEAK_E_ni.nb_rounds)
+		dis_aesni_crypt_ecb(&ctx->TWEAK_E_ni, TRUE, 2 * nb_sectors, sector_keys, sector_keys);
+	else if(AES_ECB_BLOCKS(&ctx->TWEAK_E_ctx, AES_ENCRYPT, 2 * nb_sectors, sector_keys, sector_keys) != 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+
+/**
+ * XOR a sector with its sector key, eight bytes at a time. That applies the
+ * key as well as it removes it.
+ *
+ * @param buffer The sector, modified in place
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector_key The key, 32 bytes
+ */
+void dis_crypt_xor_sector_key(uint8_t* buffer, uint16_t sector_size, const uint8_t* sector_key)
+{
+	uint64_t key[4];
+	uint64_t word = 0;
+	size_t   loop = 0;
+	size_t   part = 0;
+
+	memcpy(key, sector_key, sizeof(key));
+
+	for(loop = 0; loop + sizeof(key) <= sector_size; loop += sizeof(key))
+		for(part = 0; part < 4; part++)
+		{
+			memcpy(&word, buffer + loop + part * 8, 8);
+			word ^= key[part];
+			memcpy(buffer + loop + part * 8, &word, 8);
+		}
+
+	for(; loop < sector_size; loop++)
+		buffer[loop] ^= sector_key[loop % 32];
+
+	memset(key, 0, sizeof(key));
+}
+
+
 void dis_crypt_destroy(dis_crypt_t crypt)
 {
+	dis_aes_replica_t* replica = NULL;
+
 	if (!crypt)
 		return;
-	
-	AES_FREE(&crypt->ctx.FVEK_D_ctx);
-	AES_FREE(&crypt->ctx.FVEK_E_ctx);
-	AES_FREE(&crypt->ctx.TWEAK_D_ctx);
-	AES_FREE(&crypt->ctx.TWEAK_E_ctx);
+
+	if(crypt->has_replicas)
+	{
+		pthread_key_delete(crypt->replica_key);
+
+		while(crypt->replicas)
+		{
+			replica         = crypt->replicas;
+			crypt->replicas = replica->next;
+			free_contexts(&replica->ctx);
+			free(replica);
+		}
+
+		pthread_mutex_destroy(&crypt->replicas_lock);
+	}
+
+	free_contexts(&crypt->ctx);
+	memset(crypt->fvekey, 0, sizeof(crypt->fvekey));
 	dis_free(crypt);
 }
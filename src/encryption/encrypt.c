@@ -40,17 +40,76 @@
  */
 int encrypt_sector(dis_crypt_t crypt, uint8_t* sector, off_t sector_address, uint8_t* buffer)
 {
+	dis_aes_contexts_t* ctx = NULL;
+
 	// Check parameters
 	if(!crypt || !sector || !buffer)
 		return FALSE;
 
-	crypt->encrypt_fn(
-		&crypt->ctx,
+	ctx = dis_crypt_context(crypt);
+	if(!ctx)
+		return FALSE;
+
+	return crypt->encrypt_fn(
+		ctx,
 		crypt->sector_size,
 		sector,
 		sector_address,
 		buffer
 	);
+}
+
+
+/**
+ * Interface to encrypt consecutive sectors at once
+ *
+ * @param crypt Data needed by the encryption to deal with encrypted data
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address The address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_sectors(
+	dis_crypt_t crypt,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	dis_aes_contexts_t* ctx  = NULL;
+	size_t              loop = 0;
+
+	// Check parameters
+	if(!crypt || !sectors || !buffer)
+		return FALSE;
+
+	ctx = dis_crypt_context(crypt);
+	if(!ctx)
+		return FALSE;
+
+	if(crypt->encrypt_sectors_fn)
+		return crypt->encrypt_sectors_fn(
+			ctx,
+			crypt->sector_size,
+			nb_sectors,
+			sectors,
+			sector_address,
+			buffer
+		);
+
+	for(loop = 0; loop < nb_sectors; loop++,
+	    sectors        += crypt->sector_size,
+	    sector_address += crypt->sector_size,
+	    buffer         += crypt->sector_size)
+		if(!crypt->encrypt_fn(
+			ctx,
+			crypt->sector_size,
+			sectors,
+			sector_address,
+			buffer
+		))
+			return FALSE;
 
 	return TRUE;
 }
@@ -64,8 +123,9 @@ int encrypt_sector(dis_crypt_t crypt, uint8_t* sector, off_t sector_address, uin
  * @param sector The sector to encrypt
  * @param sector_address Address of the sector to encrypt
  * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-void encrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
+int encrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
 {
 	/* Parameters are assumed to be correctly checked already */
 
@@ -77,49 +137,37 @@ void encrypt_cbc_without_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size,
 
 	/* Create the iv */
 	iv.single = sector_address;
-	AES_ECB_ENC(&ctx->FVEK_E_ctx, AES_ENCRYPT, iv.multi, iv.multi);
+	if(AES_ECB_ENC(&ctx->FVEK_E_ctx, AES_ENCRYPT, iv.multi, iv.multi) != 0)
+		return FALSE;
 
 	/* Actually encrypt data */
-	AES_CBC(&ctx->FVEK_E_ctx, AES_ENCRYPT, sector_size, iv.multi, sector, buffer);
+	return AES_CBC(&ctx->FVEK_E_ctx, AES_ENCRYPT, sector_size, iv.multi, sector, buffer) == 0;
 }
 
 
 /**
- * Encrypt a sector when the diffuser is enabled
+ * Apply the sector key and the diffuser to a sector, before its encryption
  *
  * @param ctx AES's contexts
  * @param sector_size Size of a sector (in bytes)
  * @param sector The sector to encrypt
  * @param sector_address Address of the sector to encrypt
- * @param buffer The place where we have to put encrypted data
+ * @param buffer The place where we have to put the diffused data
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-void encrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
+static int apply_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
 {
-	/* Parameters are assumed to be correctly checked already */
-
-	union {
-		uint8_t multi[16];
-		off_t single;
-	} iv;
-	memset(iv.multi, 0, 16);
-	uint8_t sector_key[32] = {0,};
-
-	int loop = 0;
+	uint8_t sector_key[32];
 
 
 	/* First, create the sector key */
-	iv.single = sector_address;
-
-	AES_ECB_ENC(&ctx->TWEAK_E_ctx, AES_ENCRYPT, iv.multi, sector_key);
-	/* For iv unicity reason... */
-	iv.multi[15] = 0x80;
-	AES_ECB_ENC(&ctx->TWEAK_E_ctx, AES_ENCRYPT, iv.multi, &sector_key[16]);
+	if(!dis_crypt_sector_keys(ctx, sector_size, 1, sector_address, sector_key))
+		return FALSE;
 
 	memcpy(buffer, sector, sector_size);
 
 	/* Then apply the sector key */
-	for(loop = 0; loop < sector_size; ++loop)
-		buffer[loop] ^= sector_key[loop % 32];
+	dis_crypt_xor_sector_key(buffer, sector_size, sector_key);
 
 
 	/* Afterward, call diffuser A */
@@ -129,11 +177,31 @@ void encrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, ui
 	/* Call diffuser B */
 	diffuserB_encrypt(buffer, sector_size, (uint32_t*)buffer);
 
+	memset(sector_key, 0, 32);
 
-	/* And finally, actually encrypt the buffer */
-	encrypt_cbc_without_diffuser(ctx, sector_size, buffer, sector_address, buffer);
+	return TRUE;
+}
 
-	memset(sector_key, 0, 32);
+
+/**
+ * Encrypt a sector when the diffuser is enabled
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector The sector to encrypt
+ * @param sector_address Address of the sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, uint8_t* sector, off_t sector_address, uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+
+	if(!apply_diffuser(ctx, sector_size, sector, sector_address, buffer))
+		return FALSE;
+
+	/* And finally, actually encrypt the buffer */
+	return encrypt_cbc_without_diffuser(ctx, sector_size, buffer, sector_address, buffer);
 }
 
 
@@ -145,8 +213,9 @@ void encrypt_cbc_with_diffuser(dis_aes_contexts_t* ctx, uint16_t sector_size, ui
  * @param sector The sector to encrypt
  * @param sector_address Address of the sector to encrypt
  * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-void encrypt_xts(
+int encrypt_xts(
 	dis_aes_contexts_t* ctx,
 	uint16_t sector_size,
 	uint8_t* sector,
@@ -163,7 +232,7 @@ void encrypt_xts(
 	memset(iv.multi, 0, 16);
 	iv.single = sector_address / sector_size;
 
-	AES_XTS(
+	return AES_XTS(
 		&ctx->FVEK_E_ctx,
 		&ctx->TWEAK_E_ctx,
 		AES_ENCRYPT,
@@ -171,5 +240,299 @@ void encrypt_xts(
 		iv.multi,
 		sector,
 		buffer
+	) == 0;
+}
+
+
+/**
+ * Encrypt a sector which is encrypted with AES-XTS, using the AES-NI kernel
+ * @see dis_aesni_available()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param sector The sector to encrypt
+ * @param sector_address Address of the sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_xts_aesni(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	uint8_t* sector,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	union {
+		unsigned char multi[16];
+		off_t single;
+	} iv;
+
+	/* Create the iv */
+	memset(iv.multi, 0, 16);
+	iv.single = sector_address / sector_size;
+
+	dis_aesni_crypt_xts(
+		&ctx->FVEK_E_ni,
+		&ctx->TWEAK_E_ni,
+		TRUE,
+		sector_size,
+		iv.multi,
+		sector,
+		buffer
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Encrypt consecutive sectors when the diffuser is enabled, a chunk at a time:
+ * each chunk is keyed, diffused and encrypted in place while it's in the
+ * cache, with the sector keys of the whole chunk computed at once
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address Address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @param encrypt_cbc_fn The function encrypting the AES part of a chunk
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+static int encrypt_cbc_with_diffuser_chunks(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer,
+	int (*encrypt_cbc_fn)(dis_aes_contexts_t*, uint16_t, size_t, uint8_t*, off_t, uint8_t*))
+{
+	uint8_t sector_keys[DIS_CBC_CHUNK_SECTORS * 32];
+	size_t  chunk = 0;
+	size_t  loop  = 0;
+	int     ok    = TRUE;
+
+	for(; nb_sectors > 0; nb_sectors -= chunk,
+	    sectors        += chunk * sector_size,
+	    buffer         += chunk * sector_size,
+	    sector_address += (off_t) (chunk * sector_size))
+	{
+		chunk = nb_sectors < DIS_CBC_CHUNK_SECTORS ?
+		        nb_sectors : DIS_CBC_CHUNK_SECTORS;
+
+		ok = dis_crypt_sector_keys(ctx, sector_size, chunk, sector_address, sector_keys);
+		if(!ok)
+			break;
+
+		memcpy(buffer, sectors, chunk * sector_size);
+
+		for(loop = 0; loop < chunk; loop++)
+			dis_crypt_xor_sector_key(
+				buffer + loop * sector_size,
+				sector_size,
+				sector_keys + loop * 32
+			);
+
+		diffuser_encrypt_sectors(buffer, sector_size, chunk);
+
+		ok = encrypt_cbc_fn(ctx, sector_size, chunk, buffer, sector_address, buffer);
+		if(!ok)
+			break;
+	}
+
+	memset(sector_keys, 0, sizeof(sector_keys));
+
+	return ok;
+}
+
+
+/**
+ * Encrypt consecutive sectors without the diffuser, their IVs being computed a
+ * chunk at a time
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address Address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_cbc_without_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	uint8_t ivs[DIS_CBC_CHUNK_SECTORS * 16];
+	size_t  chunk = 0;
+	size_t  loop  = 0;
+
+	for(; nb_sectors > 0; nb_sectors -= chunk,
+	    sectors        += chunk * sector_size,
+	    buffer         += chunk * sector_size,
+	    sector_address += (off_t) (chunk * sector_size))
+	{
+		chunk = nb_sectors < DIS_CBC_CHUNK_SECTORS ?
+		        nb_sectors : DIS_CBC_CHUNK_SECTORS;
+
+		if(!dis_crypt_sector_ivs(ctx, sector_size, chunk, sector_address, ivs))
+			return FALSE;
+
+		for(loop = 0; loop < chunk; loop++)
+			if(AES_CBC(
+				&ctx->FVEK_E_ctx,
+				AES_ENCRYPT,
+				sector_size,
+				ivs + loop * 16,
+				sectors + loop * sector_size,
+				buffer + loop * sector_size
+			) != 0)
+				return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Encrypt consecutive sectors when the diffuser is enabled
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address Address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_cbc_with_diffuser_sectors(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	return encrypt_cbc_with_diffuser_chunks(
+		ctx,
+		sector_size,
+		nb_sectors,
+		sectors,
+		sector_address,
+		buffer,
+		encrypt_cbc_without_diffuser_sectors
+	);
+}
+
+
+/**
+ * Encrypt consecutive sectors with AES-XTS, using the VAES kernels
+ * @see dis_vaes_width()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address Address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_xts_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	dis_vaes_crypt_xts_sectors(
+		ctx->vaes_width,
+		&ctx->FVEK_E_ni,
+		&ctx->TWEAK_E_ni,
+		TRUE,
+		sector_size,
+		nb_sectors,
+		(uint64_t) (sector_address / sector_size),
+		sectors,
+		buffer
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Encrypt consecutive sectors without the diffuser, using the VAES kernels
+ * @see dis_vaes_width()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address Address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_cbc_without_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	dis_vaes_encrypt_cbc_sectors(
+		ctx->vaes_width,
+		&ctx->FVEK_E_ni,
+		sector_size,
+		nb_sectors,
+		(uint64_t) sector_address,
+		sectors,
+		buffer
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Encrypt consecutive sectors when the diffuser is enabled, using the VAES
+ * kernels for the AES part
+ * @see dis_vaes_width()
+ *
+ * @param ctx AES's contexts
+ * @param sector_size Size of a sector (in bytes)
+ * @param nb_sectors The number of sectors to encrypt
+ * @param sectors The sectors to encrypt
+ * @param sector_address Address of the first sector to encrypt
+ * @param buffer The place where we have to put encrypted data
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int encrypt_cbc_with_diffuser_sectors_vaes(
+	dis_aes_contexts_t* ctx,
+	uint16_t sector_size,
+	size_t nb_sectors,
+	uint8_t* sectors,
+	off_t sector_address,
+	uint8_t* buffer)
+{
+	/* Parameters are assumed to be correctly checked already */
+	return encrypt_cbc_with_diffuser_chunks(
+		ctx,
+		sector_size,
+		nb_sectors,
+		sectors,
+		sector_address,
+		buffer,
+		encrypt_cbc_without_diffuser_sectors_vaes
 	);
 }
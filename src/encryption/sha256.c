@@ -0,0 +1,147 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ssl_bindings.h"
+
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTATE_RIGHT(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+/**
+ * Process a 64 bytes block of data
+ *
+ * @param state The state of the hash, which is updated
+ * @param block The block
+ */
+static void sha256_block(uint32_t state[8], const unsigned char* block)
+{
+	uint32_t w[64];
+	uint32_t v[8];
+	uint32_t t1   = 0;
+	uint32_t t2   = 0;
+	int      loop = 0;
+
+	for(loop = 0; loop < 16; loop++)
+		w[loop] = (uint32_t) block[4 * loop]     << 24 |
+		          (uint32_t) block[4 * loop + 1] << 16 |
+		          (uint32_t) block[4 * loop + 2] <<  8 |
+		          (uint32_t) block[4 * loop + 3];
+
+	for(loop = 16; loop < 64; loop++)
+		w[loop] = w[loop - 16] + w[loop - 7] +
+		          (ROTATE_RIGHT(w[loop - 15],  7) ^ ROTATE_RIGHT(w[loop - 15], 18) ^ (w[loop - 15] >>  3)) +
+		          (ROTATE_RIGHT(w[loop - 2],  17) ^ ROTATE_RIGHT(w[loop - 2],  19) ^ (w[loop - 2]  >> 10));
+
+	memcpy(v, state, sizeof(v));
+
+	for(loop = 0; loop < 64; loop++)
+	{
+		t1 = v[7] + (ROTATE_RIGHT(v[4], 6) ^ ROTATE_RIGHT(v[4], 11) ^ ROTATE_RIGHT(v[4], 25)) +
+		     ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[loop] + w[loop];
+		t2 = (ROTATE_RIGHT(v[0], 2) ^ ROTATE_RIGHT(v[0], 13) ^ ROTATE_RIGHT(v[0], 22)) +
+		     ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = v[3] + t1;
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = t1 + t2;
+	}
+
+	for(loop = 0; loop < 8; loop++)
+		state[loop] += v[loop];
+
+	memset(w, 0, sizeof(w));
+	memset(v, 0, sizeof(v));
+}
+
+
+/**
+ * Compute the SHA-256 hash of some data
+ *
+ * @param input The data to hash
+ * @param length The length of the data
+ * @param output Where to put the 32 bytes hash, which may overlap input
+ */
+void dis_sha256(const unsigned char* input, size_t length, unsigned char* output)
+{
+	uint32_t state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	unsigned char last[128];
+	size_t        remaining = length % 64;
+	size_t        last_size = remaining < 56 ? 64 : 128;
+	uint64_t      bits      = (uint64_t) length * 8;
+	size_t        loop      = 0;
+
+	for(loop = 0; loop + 64 <= length; loop += 64)
+		sha256_block(state, input + loop);
+
+	/* The padding, then the length of the data in bits */
+	memset(last, 0, sizeof(last));
+	memcpy(last, input + length - remaining, remaining);
+	last[remaining] = 0x80;
+
+	for(loop = 0; loop < 8; loop++)
+		last[last_size - 1 - loop] = (unsigned char) (bits >> (8 * loop));
+
+	for(loop = 0; loop < last_size; loop += 64)
+		sha256_block(state, last + loop);
+
+	for(loop = 0; loop < 8; loop++)
+	{
+		output[4 * loop]     = (unsigned char) (state[loop] >> 24);
+		output[4 * loop + 1] = (unsigned char) (state[loop] >> 16);
+		output[4 * loop + 2] = (unsigned char) (state[loop] >>  8);
+		output[4 * loop + 3] = (unsigned char) (state[loop]);
+	}
+
+	memset(last, 0, sizeof(last));
+	memset(state, 0, sizeof(state));
+}
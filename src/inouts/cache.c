@@ -0,0 +1,514 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <pthread.h>
+
+#include "dislocker/common.h"
+#include "dislocker/inouts/inouts.priv.h"
+#include "dislocker/inouts/cache.h"
+
+
+/* Index used for "no entry" in the buckets and the chains */
+#define DIS_CACHE_NONE UINT32_MAX
+
+
+/*
+ * A cached sector, whose data is at the same index in the shard's data
+ */
+typedef struct _dis_cache_entry
+{
+	/* Offset of the sector, -1 if the entry is unused */
+	off_t    offset;
+	/* Next entry in the same bucket */
+	uint32_t next;
+	/* CLOCK's bit, set when the sector is used and cleared when the hand passes */
+	int      referenced;
+} dis_cache_entry_t;
+
+
+typedef struct _dis_cache_shard
+{
+	pthread_mutex_t    lock;
+
+	dis_cache_entry_t* entries;
+	uint8_t*           data;
+	uint32_t           nb_entries;
+	/* Number of entries used at least once, the next ones are free */
+	uint32_t           nb_used;
+	/* CLOCK's hand, the next entry to look at for an eviction */
+	uint32_t           hand;
+
+	/* Hash table of the entries, nb_buckets being a power of 2 */
+	uint32_t*          buckets;
+	uint32_t           nb_buckets;
+
+	uint64_t           hits;
+	uint64_t           misses;
+} dis_cache_shard_t;
+
+
+/*
+ * Sectors are spread over the shards by their number. The generation changes
+ * each time sectors are invalidated, so that sectors read before an
+ * invalidation are not put into the cache after it. It's only accessed
+ * atomically, the shards' locks ordering it with the sectors' removal.
+ */
+struct _dis_cache
+{
+	uint16_t          sector_size;
+
+	uint64_t          generation;
+
+	dis_cache_shard_t shards[DIS_CACHE_SHARDS];
+};
+
+
+
+/**
+ * Get the shard a sector belongs to, and its bucket in there
+ */
+static dis_cache_shard_t* get_shard(
+	dis_cache_t cache,
+	off_t offset,
+	uint32_t* bucket)
+{
+	uint64_t sector = (uint64_t)offset / cache->sector_size;
+	dis_cache_shard_t* shard = &cache->shards[sector & (DIS_CACHE_SHARDS - 1)];
+
+	*bucket = (uint32_t)(sector / DIS_CACHE_SHARDS) & (shard->nb_buckets - 1);
+
+	return shard;
+}
+
+
+/**
+ * Find a sector in a shard
+ * @warning The shard's lock has to be held
+ *
+ * @return The sector's entry index, DIS_CACHE_NONE if it's not cached
+ */
+static uint32_t find_entry(dis_cache_shard_t* shard, uint32_t bucket, off_t offset)
+{
+	uint32_t index = shard->buckets[bucket];
+
+	while(index != DIS_CACHE_NONE && shard->entries[index].offset != offset)
+		index = shard->entries[index].next;
+
+	return index;
+}
+
+
+/**
+ * Remove an entry from its bucket, making it unused
+ * @warning The shard's lock has to be held
+ */
+static void remove_entry(dis_cache_t cache, dis_cache_shard_t* shard, uint32_t index)
+{
+	dis_cache_entry_t* entry = &shard->entries[index];
+	uint32_t  bucket = 0;
+	uint32_t* link   = NULL;
+
+	get_shard(cache, entry->offset, &bucket);
+
+	link = &shard->buckets[bucket];
+	while(*link != index)
+		link = &shard->entries[*link].next;
+	*link = entry->next;
+
+	entry->offset     = -1;
+	entry->next       = DIS_CACHE_NONE;
+	entry->referenced = FALSE;
+}
+
+
+/**
+ * Get an entry to put a new sector into, evicting a sector if needed. Unused
+ * entries and sectors which weren't used since the hand last passed are taken.
+ * @warning The shard's lock has to be held
+ */
+static uint32_t evict_entry(dis_cache_t cache, dis_cache_shard_t* shard)
+{
+	uint32_t index = 0;
+
+	if(shard->nb_used < shard->nb_entries)
+		return shard->nb_used++;
+
+	while(1)
+	{
+		index = shard->hand;
+		shard->hand = (shard->hand + 1) % shard->nb_entries;
+
+		if(!shard->entries[index].referenced)
+			break;
+
+		shard->entries[index].referenced = FALSE;
+	}
+
+	if(shard->entries[index].offset >= 0)
+		remove_entry(cache, shard, index);
+
+	return index;
+}
+
+
+/**
+ * Copy a sector from the cache, if it's there
+ *
+ * @return TRUE if the sector was cached, FALSE otherwise
+ */
+static int cache_get(dis_cache_t cache, off_t offset, uint8_t* output)
+{
+	uint32_t bucket = 0;
+	uint32_t index  = 0;
+	dis_cache_shard_t* shard = get_shard(cache, offset, &bucket);
+
+	pthread_mutex_lock(&shard->lock);
+
+	index = find_entry(shard, bucket, offset);
+	if(index != DIS_CACHE_NONE)
+	{
+		memcpy(
+			output,
+			shard->data + (size_t)index * cache->sector_size,
+			cache->sector_size
+		);
+		shard->entries[index].referenced = TRUE;
+		shard->hits++;
+	}
+	else
+		shard->misses++;
+
+	pthread_mutex_unlock(&shard->lock);
+
+	return index != DIS_CACHE_NONE;
+}
+
+
+/**
+ * Put a sector into the cache, unless sectors have been invalidated since it
+ * has been read
+ *
+ * @param referenced FALSE to have the sector evicted first
+ * @param generation The cache's generation before the sector was read
+ */
+static void cache_put(
+	dis_cache_t cache,
+	off_t offset,
+	const uint8_t* input,
+	int referenced,
+	uint64_t generation)
+{
+	uint32_t bucket = 0;
+	uint32_t index  = 0;
+	int      stale  = FALSE;
+	dis_cache_shard_t* shard = get_shard(cache, offset, &bucket);
+
+	pthread_mutex_lock(&shard->lock);
+
+	stale = generation != __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+
+	if(!stale && find_entry(shard, bucket, offset) == DIS_CACHE_NONE)
+	{
+		index = evict_entry(cache, shard);
+
+		shard->entries[index].offset     = offset;
+		shard->entries[index].referenced = referenced;
+		shard->entries[index].next       = shard->buckets[bucket];
+		shard->buckets[bucket]           = index;
+
+		memcpy(
+			shard->data + (size_t)index * cache->sector_size,
+			input,
+			cache->sector_size
+		);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+
+
+/**
+ * Create a cache of decrypted sectors
+ *
+ * @param sector_size The volume's sector size
+ * @param max_size The memory, in bytes, the sectors can use
+ * @return The newly allocated cache, or NULL if max_size is too small
+ */
+dis_cache_t dis_cache_new(uint16_t sector_size, size_t max_size)
+{
+	dis_cache_t cache = NULL;
+	size_t   nb_entries = 0;
+	uint32_t loop = 0;
+	uint32_t idx  = 0;
+
+	if(sector_size == 0)
+		return NULL;
+
+	nb_entries = max_size / sector_size / DIS_CACHE_SHARDS;
+	if(nb_entries == 0)
+	{
+		dis_printf(L_WARNING, "Cache size too small, not caching sectors\n");
+		return NULL;
+	}
+
+	if(nb_entries > UINT32_MAX / 2)
+		nb_entries = UINT32_MAX / 2;
+
+	cache = dis_malloc(sizeof(struct _dis_cache));
+	memset(cache, 0, sizeof(struct _dis_cache));
+
+	cache->sector_size = sector_size;
+
+	for(loop = 0; loop < DIS_CACHE_SHARDS; loop++)
+	{
+		dis_cache_shard_t* shard = &cache->shards[loop];
+
+		pthread_mutex_init(&shard->lock, NULL);
+
+		shard->nb_entries = (uint32_t) nb_entries;
+		shard->entries    = dis_malloc(nb_entries * sizeof(dis_cache_entry_t));
+		shard->data       = dis_malloc(nb_entries * sector_size);
+
+		for(idx = 0; idx < shard->nb_entries; idx++)
+		{
+			shard->entries[idx].offset     = -1;
+			shard->entries[idx].next       = DIS_CACHE_NONE;
+			shard->entries[idx].referenced = FALSE;
+		}
+
+		shard->nb_buckets = 1;
+		while(shard->nb_buckets < shard->nb_entries)
+			shard->nb_buckets <<= 1;
+
+		shard->buckets = dis_malloc(shard->nb_buckets * sizeof(uint32_t));
+		memset(shard->buckets, 0xff, shard->nb_buckets * sizeof(uint32_t));
+	}
+
+	dis_printf(
+		L_DEBUG,
+		"Caching up to %" F_SIZE_T " sectors of %hu bytes\n",
+		nb_entries * DIS_CACHE_SHARDS,
+		sector_size
+	);
+
+	return cache;
+}
+
+
+/**
+ * Decrypt a region of the volume, taking the sectors which are cached from the
+ * cache and caching the other ones. This has the same prototype as the
+ * decrypt_region function it wraps, but for the cache.
+ *
+ * @param cache The cache to use, if NULL io_data->decrypt_region is used
+ * @param io_data The volume's data
+ * @param nb_read_sector The number of sectors to decrypt
+ * @param sector_size The size of a sector
+ * @param sector_start The offset of the first sector to decrypt
+ * @param output Where to put the decrypted sectors
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int dis_cache_decrypt_region(
+	dis_cache_t cache,
+	struct _data* io_data,
+	size_t nb_read_sector,
+	uint16_t sector_size,
+	off_t sector_start,
+	uint8_t* output)
+{
+	uint64_t generation = 0;
+	size_t   loop       = 0;
+	size_t   first      = 0;
+	size_t   idx        = 0;
+	int      referenced = nb_read_sector <= DIS_CACHE_HOT_REQUEST;
+
+	if(!cache)
+		return io_data->decrypt_region(
+			io_data,
+			nb_read_sector,
+			sector_size,
+			sector_start,
+			output
+		);
+
+	generation = __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+
+	while(loop < nb_read_sector)
+	{
+		if(cache_get(cache, sector_start + (off_t)(loop * sector_size),
+		             output + loop * sector_size))
+		{
+			loop++;
+			continue;
+		}
+
+		/* Gather the following sectors which aren't cached either */
+		first = loop++;
+		while(loop < nb_read_sector &&
+		      !cache_get(cache, sector_start + (off_t)(loop * sector_size),
+		                 output + loop * sector_size))
+			loop++;
+
+		if(!io_data->decrypt_region(
+			io_data,
+			loop - first,
+			sector_size,
+			sector_start + (off_t)(first * sector_size),
+			output + first * sector_size))
+			return FALSE;
+
+		for(idx = first; idx < loop; idx++)
+			cache_put(
+				cache,
+				sector_start + (off_t)(idx * sector_size),
+				output + idx * sector_size,
+				referenced,
+				generation
+			);
+
+		/* The sector which stopped the gathering has been taken from the cache */
+		if(loop < nb_read_sector)
+			loop++;
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Remove from the cache the sectors overlapping a region which is written
+ *
+ * @param cache The cache to use, may be NULL
+ * @param offset The offset of the written region
+ * @param size The size of the written region
+ */
+void dis_cache_invalidate(dis_cache_t cache, off_t offset, size_t size)
+{
+	off_t    sector = 0;
+	off_t    end    = 0;
+	uint32_t bucket = 0;
+	uint32_t index  = 0;
+	uint32_t loop   = 0;
+	dis_cache_shard_t* shard = NULL;
+
+	if(!cache || size == 0)
+		return;
+
+	__atomic_add_fetch(&cache->generation, 1, __ATOMIC_SEQ_CST);
+
+	sector = offset / cache->sector_size * cache->sector_size;
+	end    = offset + (off_t)size;
+
+	/*
+	 * A region larger than the cache, as a discarded one may be, costs a scan
+	 * of the entries rather than a lookup per sector
+	 */
+	if((uint64_t)(end - sector) / cache->sector_size >
+	   (uint64_t)cache->shards[0].nb_entries * DIS_CACHE_SHARDS)
+	{
+		for(loop = 0; loop < DIS_CACHE_SHARDS; loop++)
+		{
+			shard = &cache->shards[loop];
+
+			pthread_mutex_lock(&shard->lock);
+
+			for(index = 0; index < shard->nb_used; index++)
+				if(shard->entries[index].offset >= sector &&
+				   shard->entries[index].offset < end)
+					remove_entry(cache, shard, index);
+
+			pthread_mutex_unlock(&shard->lock);
+		}
+
+		return;
+	}
+
+	for(; sector < end; sector += cache->sector_size)
+	{
+		shard = get_shard(cache, sector, &bucket);
+
+		pthread_mutex_lock(&shard->lock);
+
+		index = find_entry(shard, bucket, sector);
+		if(index != DIS_CACHE_NONE)
+			remove_entry(cache, shard, index);
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+
+/**
+ * Get the number of sectors found or not found in the cache so far
+ *
+ * @param cache The cache to look at, may be NULL
+ * @param hits Where to put the number of sectors found
+ * @param misses Where to put the number of sectors not found
+ */
+void dis_cache_stats(dis_cache_t cache, uint64_t* hits, uint64_t* misses)
+{
+	uint32_t loop = 0;
+
+	*hits   = 0;
+	*misses = 0;
+
+	if(!cache)
+		return;
+
+	for(loop = 0; loop < DIS_CACHE_SHARDS; loop++)
+	{
+		dis_cache_shard_t* shard = &cache->shards[loop];
+
+		pthread_mutex_lock(&shard->lock);
+		*hits   += shard->hits;
+		*misses += shard->misses;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+
+/**
+ * Free a cache
+ *
+ * @param cache The cache to destroy
+ */
+void dis_cache_destroy(dis_cache_t cache)
+{
+	uint32_t loop = 0;
+
+	if(!cache)
+		return;
+
+	for(loop = 0; loop < DIS_CACHE_SHARDS; loop++)
+	{
+		dis_cache_shard_t* shard = &cache->shards[loop];
+
+		dis_free(shard->buckets);
+		dis_free(shard->data);
+		dis_free(shard->entries);
+		pthread_mutex_destroy(&shard->lock);
+	}
+
+	dis_free(cache);
+}
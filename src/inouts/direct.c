@@ -0,0 +1,622 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dislocker/common.h"
+#include "dislocker/inouts/direct.h"
+
+
+/* Index used for "no I/O" in the lists of merged I/O */
+#define DIS_DIRECT_NONE SIZE_MAX
+
+/* Aligned offsets right below/above the given one */
+#define DIRECT_FLOOR(off) ((off) / DIS_DIRECT_ALIGN * DIS_DIRECT_ALIGN)
+#define DIRECT_CEIL(off) \
+	(((off) + DIS_DIRECT_ALIGN - 1) / DIS_DIRECT_ALIGN * DIS_DIRECT_ALIGN)
+
+
+/*
+ * An I/O as it is submitted, for one or several of the caller's I/O. Writes
+ * sharing an aligned block are merged into one, so that this block is read
+ * and written back once with all of their data. An I/O which doesn't respect
+ * the alignment is run on a buffer of the pool, extended to the surrounding
+ * aligned blocks.
+ */
+typedef struct _dis_direct_sub
+{
+	/* The first caller's I/O run by this one */
+	size_t   first;
+
+	/* The aligned buffer used instead, NULL if the I/O is run as is */
+	uint8_t* bounce;
+	size_t   bounce_size;
+
+	int      done;
+} dis_direct_sub_t;
+
+
+/*
+ * A caller's write, as sorted to find the ones sharing aligned blocks
+ */
+typedef struct _dis_direct_span
+{
+	off_t  offset;
+	off_t  end;
+	size_t index;
+} dis_direct_span_t;
+
+
+struct _dis_direct
+{
+	/* Free aligned buffers, of DIS_DIRECT_BUFFER_SIZE bytes */
+	pthread_mutex_t lock;
+	uint8_t*        buffers[DIS_DIRECT_POOL_SIZE];
+	unsigned int    nb_buffers;
+
+	/*
+	 * Taken by writes which have to read the blocks around them, so that two
+	 * of them don't write back each other's old data
+	 */
+	pthread_mutex_t rmw_lock;
+};
+
+
+typedef struct _dis_direct_run
+{
+	/* The caller's I/O */
+	dis_uring_io_t*   ios;
+	/* Next caller's I/O run by the same submitted one, in the caller's order */
+	size_t*           next;
+
+	/* The I/O submitted */
+	dis_uring_io_t*   sub_ios;
+	dis_direct_sub_t* subs;
+
+	dis_uring_fn_t    fn;
+	void*             arg;
+} dis_direct_run_t;
+
+
+
+/**
+ * Get an aligned buffer, from the pool if it's small enough
+ *
+ * @return The buffer, NULL if it can't be allocated
+ */
+static uint8_t* get_buffer(dis_direct_t direct, size_t size)
+{
+	void* buffer = NULL;
+
+	if(size <= DIS_DIRECT_BUFFER_SIZE)
+	{
+		pthread_mutex_lock(&direct->lock);
+		if(direct->nb_buffers > 0)
+			buffer = direct->buffers[--direct->nb_buffers];
+		pthread_mutex_unlock(&direct->lock);
+
+		if(buffer)
+			return buffer;
+
+		size = DIS_DIRECT_BUFFER_SIZE;
+	}
+
+	if(posix_memalign(&buffer, DIS_DIRECT_ALIGN, size) != 0)
+		return NULL;
+
+	return buffer;
+}
+
+
+/**
+ * Give a buffer back to the pool, or free it if the pool is full
+ */
+static void put_buffer(dis_direct_t direct, uint8_t* buffer, size_t size)
+{
+	if(size <= DIS_DIRECT_BUFFER_SIZE)
+	{
+		pthread_mutex_lock(&direct->lock);
+		if(direct->nb_buffers < DIS_DIRECT_POOL_SIZE)
+		{
+			direct->buffers[direct->nb_buffers++] = buffer;
+			buffer = NULL;
+		}
+		pthread_mutex_unlock(&direct->lock);
+	}
+
+	free(buffer);
+}
+
+
+/**
+ * Read an aligned block of the volume, completing it with zeros after its end
+ *
+ * @return TRUE if the block could be read, FALSE otherwise
+ */
+static int read_block(int fd, uint8_t* block, off_t offset)
+{
+	ssize_t ret = 0;
+
+	do
+		ret = pread(fd, block, DIS_DIRECT_ALIGN, offset);
+	while(ret < 0 && errno == EINTR);
+
+	if(ret < 0)
+	{
+		dis_printf(
+			L_ERROR,
+			"Cannot read block at %#" F_OFF_T ": %s\n",
+			offset,
+			strerror(errno)
+		);
+		return FALSE;
+	}
+
+	if(ret < DIS_DIRECT_ALIGN)
+		memset(block + ret, 0, DIS_DIRECT_ALIGN - (size_t)ret);
+
+	return TRUE;
+}
+
+
+/**
+ * Read the aligned blocks of a region the caller's writes don't cover
+ *
+ * @param fd The volume
+ * @param bounce The aligned buffer the region is read into
+ * @param start Where bounce begins on the volume
+ * @param from Where the region begins
+ * @param to Where the region ends
+ * @param read_end The end of the blocks already read, updated
+ * @return TRUE if the blocks could be read, FALSE otherwise
+ */
+static int read_gap(
+	int fd,
+	uint8_t* bounce,
+	off_t start,
+	off_t from,
+	off_t to,
+	off_t* read_end)
+{
+	off_t block = DIRECT_FLOOR(from);
+
+	if(block < *read_end)
+		block = *read_end;
+
+	for(; block < to; block += DIS_DIRECT_ALIGN)
+	{
+		if(!read_block(fd, bounce + (block - start), block))
+			return FALSE;
+
+		*read_end = block + DIS_DIRECT_ALIGN;
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Fill the bounce buffer of a submitted write: the blocks its writes only
+ * partially cover are read first, then the writes' data is copied in the
+ * caller's order, so that the last one wins where they overlap
+ *
+ * @param fd The volume
+ * @param run The batch
+ * @param sub_index The submitted write
+ * @param spans The caller's writes merged into it, sorted by offset
+ * @param nb_spans The number of such writes
+ * @return TRUE if the write can be run, FALSE otherwise
+ */
+static int fill_bounce(
+	int fd,
+	dis_direct_run_t* run,
+	size_t sub_index,
+	dis_direct_span_t* spans,
+	size_t nb_spans)
+{
+	dis_direct_sub_t* sub      = &run->subs[sub_index];
+	dis_uring_io_t*   io       = NULL;
+	off_t             start    = run->sub_ios[sub_index].offset;
+	off_t             end      = start + (off_t)sub->bounce_size;
+	off_t             covered  = start;
+	off_t             read_end = start;
+	size_t            loop     = 0;
+
+	for(loop = 0; loop < nb_spans; loop++)
+	{
+		if(spans[loop].offset > covered &&
+		   !read_gap(fd, sub->bounce, start, covered, spans[loop].offset, &read_end))
+			return FALSE;
+
+		if(spans[loop].end > covered)
+			covered = spans[loop].end;
+	}
+
+	if(covered < end &&
+	   !read_gap(fd, sub->bounce, start, covered, end, &read_end))
+		return FALSE;
+
+	for(loop = sub->first; loop != DIS_DIRECT_NONE; loop = run->next[loop])
+	{
+		io = &run->ios[loop];
+		memcpy(sub->bounce + (io->offset - start), io->buffer, io->size);
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Give a caller's I/O the result of the submitted one it was run by, copying
+ * what has been read to its buffer
+ */
+static void give_result(
+	dis_direct_sub_t* sub,
+	dis_uring_io_t* sub_io,
+	dis_uring_io_t* io)
+{
+	size_t skip  = (size_t)(io->offset - sub_io->offset);
+	size_t valid = 0;
+
+	if(!sub->bounce || sub_io->result < 0)
+	{
+		io->result = sub_io->result;
+		return;
+	}
+
+	if((size_t)sub_io->result > skip)
+		valid = (size_t)sub_io->result - skip;
+	if(valid > io->size)
+		valid = io->size;
+
+	if(!io->write && valid > 0)
+		memcpy(io->buffer, sub->bounce + skip, valid);
+
+	io->result = (ssize_t) valid;
+}
+
+
+/**
+ * Called when a submitted I/O is completed, gives its result to the caller's
+ * I/O it was run for
+ */
+static void direct_completed(void* arg, dis_uring_io_t* sub_io)
+{
+	dis_direct_run_t* run   = (dis_direct_run_t*) arg;
+	size_t            index = (size_t)(sub_io - run->sub_ios);
+	dis_direct_sub_t* sub   = &run->subs[index];
+	size_t            loop  = 0;
+
+	sub->done = TRUE;
+
+	for(loop = sub->first; loop != DIS_DIRECT_NONE; loop = run->next[loop])
+	{
+		give_result(sub, sub_io, &run->ios[loop]);
+
+		if(run->fn)
+			run->fn(run->arg, &run->ios[loop]);
+	}
+}
+
+
+/**
+ * Sort the caller's writes by offset, keeping their order for a same offset
+ */
+static int compare_spans(const void* first, const void* second)
+{
+	const dis_direct_span_t* a = (const dis_direct_span_t*) first;
+	const dis_direct_span_t* b = (const dis_direct_span_t*) second;
+
+	if(a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+
+	return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+
+
+/**
+ * Create the pool of aligned buffers used for a volume opened with O_DIRECT
+ *
+ * @param fd The volume, opened with O_DIRECT
+ * @return The pool, or NULL if O_DIRECT can't be used on this volume
+ */
+dis_direct_t dis_direct_new(int fd)
+{
+	dis_direct_t direct = NULL;
+	void*        probe  = NULL;
+	ssize_t      ret    = 0;
+
+	/* Some filesystems accept O_DIRECT but fail on the first I/O */
+	if(posix_memalign(&probe, DIS_DIRECT_ALIGN, DIS_DIRECT_ALIGN) != 0)
+		return NULL;
+
+	ret = pread(fd, probe, DIS_DIRECT_ALIGN, 0);
+	free(probe);
+
+	if(ret < 0)
+	{
+		dis_printf(L_WARNING, "Cannot use direct I/O: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	direct = dis_malloc(sizeof(struct _dis_direct));
+	memset(direct, 0, sizeof(struct _dis_direct));
+
+	pthread_mutex_init(&direct->lock, NULL);
+	pthread_mutex_init(&direct->rmw_lock, NULL);
+
+	dis_printf(
+		L_DEBUG,
+		"Using direct I/O, aligned on %d bytes\n",
+		DIS_DIRECT_ALIGN
+	);
+
+	return direct;
+}
+
+
+/**
+ * Run a batch of I/O on a volume opened with O_DIRECT. The I/O which don't
+ * respect the alignment are run on aligned buffers of the pool and copied
+ * back, so callers don't have to care. Writes sharing an aligned block are run
+ * as one. This is otherwise the same as dis_uring_run().
+ *
+ * @param direct The pool of aligned buffers, if NULL dis_uring_run() is used
+ * @param uring The ring to give the I/O to
+ * @param fd The file descriptor to read from or write to
+ * @param ios The I/O to run
+ * @param nb_ios The number of I/O
+ * @param fn The function called on each completion, may be NULL
+ * @param arg The argument given to fn
+ * @return TRUE if every I/O has been handled, FALSE otherwise
+ */
+int dis_direct_run(
+	dis_direct_t direct,
+	dis_uring_t uring,
+	int fd,
+	dis_uring_io_t* ios,
+	size_t nb_ios,
+	dis_uring_fn_t fn,
+	void* arg)
+{
+	dis_direct_run_t   run;
+	dis_direct_span_t* spans   = NULL;
+	size_t*            leaders = NULL;
+	size_t*            tails   = NULL;
+	size_t*            sub_of  = NULL;
+	dis_uring_io_t*    io      = NULL;
+	dis_direct_sub_t*  sub     = NULL;
+	size_t nb_spans = 0;
+	size_t nb_subs  = 0;
+	size_t leader   = 0;
+	size_t loop     = 0;
+	size_t first    = 0;
+	size_t last     = 0;
+	off_t  start    = 0;
+	off_t  end      = 0;
+	int    rmw      = FALSE;
+	int    ok       = TRUE;
+
+	if(!direct)
+		return dis_uring_run(uring, fd, ios, nb_ios, fn, arg);
+
+	if(!ios)
+		return FALSE;
+
+	if(nb_ios == 0)
+		return TRUE;
+
+	memset(&run, 0, sizeof(run));
+	run.ios     = ios;
+	run.fn      = fn;
+	run.arg     = arg;
+	run.next    = dis_malloc(nb_ios * sizeof(size_t));
+	run.sub_ios = dis_malloc(nb_ios * sizeof(dis_uring_io_t));
+	run.subs    = dis_malloc(nb_ios * sizeof(dis_direct_sub_t));
+	memset(run.subs, 0, nb_ios * sizeof(dis_direct_sub_t));
+
+	spans   = dis_malloc(nb_ios * sizeof(dis_direct_span_t));
+	leaders = dis_malloc(3 * nb_ios * sizeof(size_t));
+	tails   = leaders + nb_ios;
+	sub_of  = tails + nb_ios;
+
+	for(loop = 0; loop < nb_ios; loop++)
+	{
+		leaders[loop]  = loop;
+		run.next[loop] = DIS_DIRECT_NONE;
+
+		if(ios[loop].write && ios[loop].size > 0)
+		{
+			spans[nb_spans].offset = ios[loop].offset;
+			spans[nb_spans].end    = ios[loop].offset + (off_t)ios[loop].size;
+			spans[nb_spans].index  = loop;
+			nb_spans++;
+		}
+	}
+
+	/*
+	 * Writes sharing an aligned block are merged, the first one the caller
+	 * gave leading them
+	 */
+	qsort(spans, nb_spans, sizeof(dis_direct_span_t), compare_spans);
+
+	for(first = 0; first < nb_spans; first = last)
+	{
+		leader = spans[first].index;
+		end    = DIRECT_CEIL(spans[first].end);
+
+		for(last = first + 1;
+		    last < nb_spans && DIRECT_FLOOR(spans[last].offset) < end;
+		    last++)
+		{
+			if(DIRECT_CEIL(spans[last].end) > end)
+				end = DIRECT_CEIL(spans[last].end);
+			if(spans[last].index < leader)
+				leader = spans[last].index;
+		}
+
+		for(loop = first; loop < last; loop++)
+			leaders[spans[loop].index] = leader;
+	}
+
+	/* One I/O is submitted per leader, covering the I/O it leads */
+	for(loop = 0; loop < nb_ios; loop++)
+	{
+		io     = &ios[loop];
+		leader = leaders[loop];
+
+		if(leader == loop)
+		{
+			sub_of[loop]            = nb_subs;
+			tails[loop]             = loop;
+			run.subs[nb_subs].first = loop;
+			run.sub_ios[nb_subs]    = *io;
+			nb_subs++;
+			continue;
+		}
+
+		run.next[tails[leader]] = loop;
+		tails[leader]           = loop;
+
+		/* The merged I/O's buffer is set along with the bounce buffer below */
+		io    = &run.sub_ios[sub_of[leader]];
+		start = ios[loop].offset < io->offset ? ios[loop].offset : io->offset;
+		end   = ios[loop].offset + (off_t)ios[loop].size;
+		if(end < io->offset + (off_t)io->size)
+			end = io->offset + (off_t)io->size;
+
+		io->offset = start;
+		io->size   = (size_t)(end - start);
+	}
+
+	/* Get a bounce buffer for the I/O which need one */
+	for(loop = 0; loop < nb_subs && ok; loop++)
+	{
+		io  = &run.sub_ios[loop];
+		sub = &run.subs[loop];
+
+		if(run.next[sub->first] == DIS_DIRECT_NONE &&
+		   (uintptr_t)io->buffer % DIS_DIRECT_ALIGN == 0 &&
+		   io->offset % DIS_DIRECT_ALIGN == 0 &&
+		   io->size % DIS_DIRECT_ALIGN == 0)
+			continue;
+
+		start = DIRECT_FLOOR(io->offset);
+		end   = DIRECT_CEIL(io->offset + (off_t)io->size);
+
+		if(io->write &&
+		   (start < io->offset || end > io->offset + (off_t)io->size ||
+		    run.next[sub->first] != DIS_DIRECT_NONE))
+			rmw = TRUE;
+
+		sub->bounce_size = (size_t)(end - start);
+		sub->bounce      = get_buffer(direct, sub->bounce_size);
+
+		if(!sub->bounce)
+		{
+			dis_printf(L_ERROR, "Cannot allocate an aligned buffer, abort.\n");
+			ok = FALSE;
+		}
+
+		io->buffer = sub->bounce;
+		io->offset = start;
+		io->size   = sub->bounce_size;
+	}
+
+	/*
+	 * Writes read the blocks around them, and do so only once their lock is
+	 * held, so that two batches don't write back each other's old data
+	 */
+	if(rmw)
+		pthread_mutex_lock(&direct->rmw_lock);
+
+	for(first = 0; first < nb_spans && ok; first = last)
+	{
+		leader = leaders[spans[first].index];
+
+		for(last = first + 1;
+		    last < nb_spans && leaders[spans[last].index] == leader;
+		    last++);
+
+		if(run.subs[sub_of[leader]].bounce)
+			ok = fill_bounce(fd, &run, sub_of[leader], spans + first, last - first);
+	}
+
+	if(ok)
+		ok = dis_uring_run(
+			uring, fd, run.sub_ios, nb_subs, direct_completed, &run
+		);
+
+	/* I/O which haven't been completed are given back as failed */
+	for(loop = 0; loop < nb_subs; loop++)
+	{
+		sub = &run.subs[loop];
+
+		if(!sub->done)
+			for(first = sub->first; first != DIS_DIRECT_NONE; first = run.next[first])
+				ios[first].result = -EIO;
+
+		if(sub->bounce)
+			put_buffer(direct, sub->bounce, sub->bounce_size);
+	}
+
+	if(rmw)
+		pthread_mutex_unlock(&direct->rmw_lock);
+
+	dis_free(leaders);
+	dis_free(spans);
+	dis_free(run.subs);
+	dis_free(run.sub_ios);
+	dis_free(run.next);
+
+	return ok;
+}
+
+
+/**
+ * Free the pool of aligned buffers
+ *
+ * @param direct The pool to destroy
+ */
+void dis_direct_destroy(dis_direct_t direct)
+{
+	unsigned int loop = 0;
+
+	if(!direct)
+		return;
+
+	for(loop = 0; loop < direct->nb_buffers; loop++)
+		free(direct->buffers[loop]);
+
+	pthread_mutex_destroy(&direct->rmw_lock);
+	pthread_mutex_destroy(&direct->lock);
+
+	dis_free(direct);
+}
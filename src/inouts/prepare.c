@@ -73,10 +73,13 @@ int init_keys(bitlocker_dataset_t* dataset, datum_key_t* fvek_datum,
 
 	while(*palgo != 0)
 	{
-		if(dis_crypt_set_fvekey(crypt, *palgo, fvek) == DIS_RET_SUCCESS)
+		int ret = dis_crypt_set_fvekey(crypt, *palgo, fvek);
+
+		/* Another algorithm won't help if the crypto backend itself failed */
+		if(ret == DIS_RET_SUCCESS || ret == DIS_RET_ERROR_CRYPTO_INIT)
 		{
 			memclean(fvek, size_fvek);
-			return DIS_RET_SUCCESS;
+			return ret;
 		}
 
 		palgo++;
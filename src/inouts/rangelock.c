@@ -0,0 +1,150 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <pthread.h>
+
+#include "dislocker/common.h"
+#include "dislocker/xstd/xstdlib.h"
+#include "dislocker/inouts/rangelock.h"
+
+
+struct _dis_rangelock
+{
+	pthread_mutex_t lock;
+	/* Signaled when a range is unlocked */
+	pthread_cond_t  cond;
+
+	/* Ranges locked, in no particular order */
+	dis_range_t*    ranges;
+};
+
+
+
+/**
+ * Tell whether a range overlaps one which is locked
+ * @warning The lock has to be held
+ */
+static int is_locked(dis_rangelock_t rangelock, off_t start, off_t end)
+{
+	dis_range_t* range = rangelock->ranges;
+
+	for(; range; range = range->next)
+		if(range->start < end && start < range->end)
+			return TRUE;
+
+	return FALSE;
+}
+
+
+/**
+ * Create a lock on ranges
+ *
+ * @return The newly allocated lock
+ */
+dis_rangelock_t dis_rangelock_new(void)
+{
+	dis_rangelock_t rangelock = dis_malloc(sizeof(struct _dis_rangelock));
+	memset(rangelock, 0, sizeof(struct _dis_rangelock));
+
+	pthread_mutex_init(&rangelock->lock, NULL);
+	pthread_cond_init(&rangelock->cond, NULL);
+
+	return rangelock;
+}
+
+
+/**
+ * Lock a range, waiting for the ranges overlapping it to be unlocked. A thread
+ * locks one range at a time, so that there's no deadlock.
+ *
+ * @param rangelock The lock to use, may be NULL
+ * @param range Where the range is recorded, until it's unlocked
+ * @param start The offset of the range
+ * @param end The offset following the range
+ */
+void dis_rangelock_lock(
+	dis_rangelock_t rangelock,
+	dis_range_t* range,
+	off_t start,
+	off_t end)
+{
+	if(!rangelock)
+		return;
+
+	range->start = start;
+	range->end   = end;
+
+	pthread_mutex_lock(&rangelock->lock);
+
+	while(is_locked(rangelock, start, end))
+		pthread_cond_wait(&rangelock->cond, &rangelock->lock);
+
+	range->next       = rangelock->ranges;
+	rangelock->ranges = range;
+
+	pthread_mutex_unlock(&rangelock->lock);
+}
+
+
+/**
+ * Unlock a range, waking up the threads waiting for it
+ *
+ * @param rangelock The lock to use, may be NULL
+ * @param range The range given to dis_rangelock_lock()
+ */
+void dis_rangelock_unlock(dis_rangelock_t rangelock, dis_range_t* range)
+{
+	dis_range_t** link = NULL;
+
+	if(!rangelock)
+		return;
+
+	pthread_mutex_lock(&rangelock->lock);
+
+	for(link = &rangelock->ranges; *link; link = &(*link)->next)
+		if(*link == range)
+		{
+			*link = range->next;
+			break;
+		}
+
+	pthread_cond_broadcast(&rangelock->cond);
+	pthread_mutex_unlock(&rangelock->lock);
+}
+
+
+/**
+ * Free a lock on ranges, which no range is locked with anymore
+ *
+ * @param rangelock The lock to destroy
+ */
+void dis_rangelock_destroy(dis_rangelock_t rangelock)
+{
+	if(!rangelock)
+		return;
+
+	pthread_cond_destroy(&rangelock->cond);
+	pthread_mutex_destroy(&rangelock->lock);
+
+	dis_free(rangelock);
+}
@@ -0,0 +1,648 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "dislocker/common.h"
+#include "dislocker/inouts/inouts.priv.h"
+#include "dislocker/inouts/readahead.h"
+
+
+/*
+ * A read-ahead buffer goes from free to pending when a window is staged in it,
+ * then busy while the background thread decrypts it, then ready once its data
+ * can be given to dislock() callers
+ */
+enum {
+	DIS_RA_FREE = 0,
+	DIS_RA_PENDING,
+	DIS_RA_BUSY,
+	DIS_RA_READY
+};
+
+
+/*
+ * Sector-aligned piece of the volume, staged at pos in a buffer's data
+ */
+typedef struct _dis_ra_extent
+{
+	off_t  offset;
+	size_t size;
+	size_t pos;
+} dis_ra_extent_t;
+
+
+typedef struct _dis_ra_buffer
+{
+	int             state;
+	uint8_t*        data;
+
+	dis_ra_extent_t extents[DIS_READAHEAD_MAX_EXTENTS];
+	unsigned int    nb_extents;
+} dis_ra_buffer_t;
+
+
+struct _dis_readahead
+{
+	struct _data*   io_data;
+
+	pthread_mutex_t lock;
+	/* Signaled when a window is pending or when the thread has to stop */
+	pthread_cond_t  work_cond;
+	/* Signaled when the thread is done with a window */
+	pthread_cond_t  done_cond;
+
+	pthread_t       thread;
+	int             has_thread;
+
+	/* One buffer is consumed while the other one is filled */
+	dis_ra_buffer_t buffers[2];
+
+	/* Last request seen, and how many times in a row its stride was seen */
+	off_t           last_offset;
+	off_t           last_stride;
+	size_t          last_size;
+	unsigned int    nb_matches;
+
+	/* Pattern being read ahead, and next offset of it which is not staged */
+	off_t           stride;
+	size_t          size;
+	off_t           next_offset;
+
+	/* Number of enlock() calls in progress, no window starts meanwhile */
+	unsigned int    nb_writers;
+
+	int             disabled;
+	int             stop;
+};
+
+
+
+/**
+ * Tell whether a buffer has a piece overlapping the given range
+ */
+static int buffer_overlaps(dis_ra_buffer_t* buffer, off_t offset, size_t size)
+{
+	unsigned int loop = 0;
+
+	for(loop = 0; loop < buffer->nb_extents; loop++)
+	{
+		dis_ra_extent_t* extent = &buffer->extents[loop];
+
+		if(extent->offset < offset + (off_t)size &&
+		   offset < extent->offset + (off_t)extent->size)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/**
+ * Tell whether a caller working on the given range has to wait for the
+ * background thread first, that is if the thread is working on this range
+ * @warning The read-ahead's lock has to be held
+ */
+static int must_wait(dis_readahead_t readahead, off_t offset, size_t size)
+{
+	unsigned int loop = 0;
+
+	for(loop = 0; loop < 2; loop++)
+	{
+		dis_ra_buffer_t* buffer = &readahead->buffers[loop];
+
+		if(buffer->state != DIS_RA_PENDING && buffer->state != DIS_RA_BUSY)
+			continue;
+
+		if(buffer_overlaps(buffer, offset, size))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/**
+ * Main loop of the background thread, decrypting the pending windows
+ *
+ * @param params The read-ahead the thread belongs to
+ */
+static void* readahead_loop(void* params)
+{
+	dis_readahead_t  readahead   = (dis_readahead_t) params;
+	struct _data*    io_data     = readahead->io_data;
+	uint16_t         sector_size = io_data->sector_size;
+	dis_ra_buffer_t* buffer      = NULL;
+	dis_ra_extent_t* last        = NULL;
+	unsigned int     loop        = 0;
+	int              ok          = TRUE;
+
+	pthread_mutex_lock(&readahead->lock);
+
+	while(1)
+	{
+		buffer = NULL;
+
+		while(!readahead->stop)
+		{
+			if(readahead->nb_writers == 0)
+			{
+				if(readahead->buffers[0].state == DIS_RA_PENDING)
+					buffer = &readahead->buffers[0];
+				else if(readahead->buffers[1].state == DIS_RA_PENDING)
+					buffer = &readahead->buffers[1];
+			}
+
+			if(buffer)
+				break;
+
+			pthread_cond_wait(&readahead->work_cond, &readahead->lock);
+		}
+
+		if(readahead->stop)
+			break;
+
+		buffer->state = DIS_RA_BUSY;
+		pthread_mutex_unlock(&readahead->lock);
+
+		/* Have the kernel read the following window while this one is decrypted */
+		last = &buffer->extents[buffer->nb_extents - 1];
+		dis_readahead_advise(
+			io_data,
+			last->offset + (off_t)last->size,
+			DIS_READAHEAD_WINDOW
+		);
+
+		ok = TRUE;
+		for(loop = 0; ok && loop < buffer->nb_extents; loop++)
+			ok = io_data->decrypt_region(
+				io_data,
+				buffer->extents[loop].size / sector_size,
+				sector_size,
+				buffer->extents[loop].offset,
+				buffer->data + buffer->extents[loop].pos
+			);
+
+		pthread_mutex_lock(&readahead->lock);
+
+		if(ok)
+			buffer->state = DIS_RA_READY;
+		else
+		{
+			dis_printf(L_DEBUG, "Read-ahead window failed, dropping it\n");
+			buffer->state      = DIS_RA_FREE;
+			buffer->nb_extents = 0;
+		}
+
+		pthread_cond_broadcast(&readahead->done_cond);
+	}
+
+	pthread_mutex_unlock(&readahead->lock);
+
+	return NULL;
+}
+
+
+/**
+ * Put the next pieces of the pattern in a buffer
+ *
+ * @param readahead The read-ahead to stage the pieces for
+ * @param buffer The buffer to put the pieces into
+ */
+static void stage_window(dis_readahead_t readahead, dis_ra_buffer_t* buffer)
+{
+	uint16_t sector_size = readahead->io_data->sector_size;
+	off_t    volume_end  = (off_t)readahead->io_data->volume_size;
+	off_t    offset      = readahead->next_offset;
+	size_t   pos         = 0;
+	off_t    start       = 0;
+	off_t    end         = 0;
+	dis_ra_extent_t* prev = NULL;
+
+	volume_end = (volume_end + sector_size - 1) / sector_size * sector_size;
+	buffer->nb_extents = 0;
+
+	while(buffer->nb_extents < DIS_READAHEAD_MAX_EXTENTS)
+	{
+		start = offset / sector_size * sector_size;
+		end   = offset + (off_t)readahead->size;
+		end   = (end + sector_size - 1) / sector_size * sector_size;
+
+		if(end > volume_end)
+			end = volume_end;
+		if(start >= end)
+			break;
+
+		prev = buffer->nb_extents ? &buffer->extents[buffer->nb_extents - 1] : NULL;
+
+		if(prev && start <= prev->offset + (off_t)prev->size)
+		{
+			/* Contiguous with the previous piece, extend it */
+			start = prev->offset + (off_t)prev->size;
+			if(end > start)
+			{
+				if(pos + (size_t)(end - start) > DIS_READAHEAD_WINDOW)
+					break;
+				prev->size += (size_t)(end - start);
+				pos        += (size_t)(end - start);
+			}
+		}
+		else
+		{
+			if(pos + (size_t)(end - start) > DIS_READAHEAD_WINDOW)
+				break;
+			buffer->extents[buffer->nb_extents].offset = start;
+			buffer->extents[buffer->nb_extents].size   = (size_t)(end - start);
+			buffer->extents[buffer->nb_extents].pos    = pos;
+			buffer->nb_extents++;
+			pos += (size_t)(end - start);
+		}
+
+		offset += readahead->stride;
+	}
+
+	readahead->next_offset = offset;
+}
+
+
+/**
+ * Stage the next window of the pattern, if a buffer is available for it
+ * @warning The read-ahead's lock has to be held
+ *
+ * @param readahead The read-ahead to schedule a window for
+ * @param offset The offset of the request which has just been served
+ */
+static void schedule_window(dis_readahead_t readahead, off_t offset)
+{
+	dis_ra_buffer_t* buffer = NULL;
+	dis_ra_extent_t* last   = NULL;
+	unsigned int     loop   = 0;
+
+	if(readahead->nb_writers > 0)
+		return;
+
+	/* One window at a time */
+	for(loop = 0; loop < 2; loop++)
+		if(readahead->buffers[loop].state == DIS_RA_PENDING ||
+		   readahead->buffers[loop].state == DIS_RA_BUSY)
+			return;
+
+	/* Take a free buffer, or one which has been read past already */
+	for(loop = 0; loop < 2 && !buffer; loop++)
+		if(readahead->buffers[loop].state == DIS_RA_FREE)
+			buffer = &readahead->buffers[loop];
+
+	for(loop = 0; loop < 2 && !buffer; loop++)
+	{
+		dis_ra_buffer_t* candidate = &readahead->buffers[loop];
+
+		last = &candidate->extents[candidate->nb_extents - 1];
+		if(last->offset + (off_t)last->size <= offset)
+			buffer = candidate;
+	}
+
+	if(!buffer)
+		return;
+
+	if(!buffer->data)
+	{
+		buffer->data = malloc(DIS_READAHEAD_WINDOW);
+		if(!buffer->data)
+			return;
+	}
+
+	if(!readahead->has_thread)
+	{
+		if(pthread_create(&readahead->thread, NULL, readahead_loop, readahead) != 0)
+		{
+			dis_printf(L_WARNING, "Cannot create the read-ahead thread, disabling it\n");
+			readahead->disabled = TRUE;
+			return;
+		}
+		readahead->has_thread = TRUE;
+	}
+
+	stage_window(readahead, buffer);
+
+	if(buffer->nb_extents == 0)
+	{
+		buffer->state = DIS_RA_FREE;
+		return;
+	}
+
+	buffer->state = DIS_RA_PENDING;
+	pthread_cond_signal(&readahead->work_cond);
+}
+
+
+
+/**
+ * Create the read-ahead of a volume. No memory for windows nor thread is used
+ * until a pattern is recognised.
+ *
+ * @param io_data The volume's data, which has to outlive the read-ahead
+ * @return The newly allocated read-ahead
+ */
+dis_readahead_t dis_readahead_new(struct _data* io_data)
+{
+	dis_readahead_t readahead = dis_malloc(sizeof(struct _dis_readahead));
+	memset(readahead, 0, sizeof(struct _dis_readahead));
+
+	readahead->io_data = io_data;
+
+	pthread_mutex_init(&readahead->lock, NULL);
+	pthread_cond_init(&readahead->work_cond, NULL);
+	pthread_cond_init(&readahead->done_cond, NULL);
+
+	return readahead;
+}
+
+
+/**
+ * Try to serve a dislock() request from the windows read ahead. If the request
+ * is in a window being decrypted, this waits for it.
+ *
+ * @param readahead The read-ahead of the volume, may be NULL
+ * @param buffer Where to put the decrypted data
+ * @param offset The offset of the request
+ * @param size The size of the request
+ * @return TRUE if the request has been served, FALSE otherwise
+ */
+int dis_readahead_read(
+	dis_readahead_t readahead,
+	uint8_t* buffer,
+	off_t offset,
+	size_t size)
+{
+	unsigned int loop   = 0;
+	unsigned int loop_e = 0;
+	int          hit    = FALSE;
+
+	if(!readahead)
+		return FALSE;
+
+	pthread_mutex_lock(&readahead->lock);
+
+	while(must_wait(readahead, offset, size))
+		pthread_cond_wait(&readahead->done_cond, &readahead->lock);
+
+	for(loop = 0; loop < 2 && !hit; loop++)
+	{
+		dis_ra_buffer_t* ra_buffer = &readahead->buffers[loop];
+
+		if(ra_buffer->state != DIS_RA_READY)
+			continue;
+
+		for(loop_e = 0; loop_e < ra_buffer->nb_extents && !hit; loop_e++)
+		{
+			dis_ra_extent_t* extent = &ra_buffer->extents[loop_e];
+
+			if(extent->offset <= offset &&
+			   offset + (off_t)size <= extent->offset + (off_t)extent->size)
+			{
+				memcpy(
+					buffer,
+					ra_buffer->data + extent->pos + (offset - extent->offset),
+					size
+				);
+				hit = TRUE;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&readahead->lock);
+
+	return hit;
+}
+
+
+/**
+ * Record a request which has been served, and read the next window ahead if
+ * this request follows the ones before it
+ *
+ * @param readahead The read-ahead of the volume, may be NULL
+ * @param offset The offset of the request
+ * @param size The size of the request
+ */
+void dis_readahead_done(dis_readahead_t readahead, off_t offset, size_t size)
+{
+	off_t stride = 0;
+
+	if(!readahead)
+		return;
+
+	pthread_mutex_lock(&readahead->lock);
+
+	if(readahead->disabled)
+	{
+		pthread_mutex_unlock(&readahead->lock);
+		return;
+	}
+
+	/*
+	 * Sequential requests are requests whose stride is their size. Big requests
+	 * are left alone, they wouldn't gain anything from this, and so are the
+	 * ones smaller than a sector or overlapping each other.
+	 */
+	stride = offset - readahead->last_offset;
+
+	if(size >= readahead->io_data->sector_size &&
+	   size * 2 <= DIS_READAHEAD_WINDOW &&
+	   stride >= (off_t)size &&
+	   stride == readahead->last_stride &&
+	   size == readahead->last_size)
+		readahead->nb_matches++;
+	else
+		readahead->nb_matches = 0;
+
+	readahead->last_offset = offset;
+	readahead->last_stride = stride;
+	readahead->last_size   = size;
+
+	if(readahead->nb_matches >= DIS_READAHEAD_TRIGGER)
+	{
+		/* New pattern, or the caller went past what was read ahead */
+		if(readahead->stride != stride ||
+		   readahead->size   != size   ||
+		   readahead->next_offset < offset + stride)
+		{
+			readahead->stride      = stride;
+			readahead->size        = size;
+			readahead->next_offset = offset + stride;
+		}
+
+		schedule_window(readahead, offset);
+	}
+
+	pthread_mutex_unlock(&readahead->lock);
+}
+
+
+/**
+ * Wait until the volume can be decrypted outside of the read-ahead, that is
+ * until no window is being decrypted if the crypto backend can't be used by
+ * two threads at once
+ *
+ * @param readahead The read-ahead of the volume, may be NULL
+ */
+void dis_readahead_wait(dis_readahead_t readahead)
+{
+	if(!readahead)
+		return;
+
+	pthread_mutex_lock(&readahead->lock);
+
+	while(must_wait(readahead, 0, 0))
+		pthread_cond_wait(&readahead->done_cond, &readahead->lock);
+
+	pthread_mutex_unlock(&readahead->lock);
+}
+
+
+/**
+ * Prepare the read-ahead for an enlock() request: drop what has been read
+ * ahead on the written range, and don't start a window until
+ * dis_readahead_end_write() is called
+ *
+ * @param readahead The read-ahead of the volume, may be NULL
+ * @param offset The offset of the request
+ * @param size The size of the request
+ */
+void dis_readahead_begin_write(
+	dis_readahead_t readahead,
+	off_t offset,
+	size_t size)
+{
+	unsigned int loop = 0;
+
+	if(!readahead)
+		return;
+
+	pthread_mutex_lock(&readahead->lock);
+
+	readahead->nb_writers++;
+
+	for(loop = 0; loop < 2; loop++)
+		if(readahead->buffers[loop].state == DIS_RA_PENDING)
+			readahead->buffers[loop].state = DIS_RA_FREE;
+
+	while(must_wait(readahead, offset, size))
+		pthread_cond_wait(&readahead->done_cond, &readahead->lock);
+
+	for(loop = 0; loop < 2; loop++)
+	{
+		dis_ra_buffer_t* buffer = &readahead->buffers[loop];
+
+		if(buffer->state == DIS_RA_READY && buffer_overlaps(buffer, offset, size))
+			buffer->state = DIS_RA_FREE;
+	}
+
+	/* What the pattern staged next may be gone, stage it again */
+	readahead->next_offset = 0;
+
+	pthread_mutex_unlock(&readahead->lock);
+}
+
+
+/**
+ * Let the read-ahead go on after an enlock() request
+ *
+ * @param readahead The read-ahead of the volume, may be NULL
+ */
+void dis_readahead_end_write(dis_readahead_t readahead)
+{
+	if(!readahead)
+		return;
+
+	pthread_mutex_lock(&readahead->lock);
+	readahead->nb_writers--;
+	pthread_mutex_unlock(&readahead->lock);
+}
+
+
+/**
+ * Ask the kernel to read a part of the volume's ciphertext, without waiting
+ * for it
+ *
+ * @param io_data The volume's data
+ * @param offset The offset, in the volume, of the part to read
+ * @param size The size of the part to read
+ */
+void dis_readahead_advise(struct _data* io_data, off_t offset, off_t size)
+{
+#ifdef POSIX_FADV_WILLNEED
+	off_t volume_size = (off_t)io_data->volume_size;
+
+	/* With direct I/O, there's no page cache to fill */
+	if(io_data->direct || offset >= volume_size || size <= 0)
+		return;
+
+	if(size > volume_size - offset)
+		size = volume_size - offset;
+
+	posix_fadvise(
+		io_data->volume_fd,
+		io_data->part_off + offset,
+		size,
+		POSIX_FADV_WILLNEED
+	);
+#else
+	(void) io_data;
+	(void) offset;
+	(void) size;
+#endif
+}
+
+
+/**
+ * Stop the read-ahead's thread and free it
+ *
+ * @param readahead The read-ahead to destroy
+ */
+void dis_readahead_destroy(dis_readahead_t readahead)
+{
+	unsigned int loop = 0;
+
+	if(!readahead)
+		return;
+
+	pthread_mutex_lock(&readahead->lock);
+	readahead->stop = TRUE;
+	pthread_cond_broadcast(&readahead->work_cond);
+	pthread_mutex_unlock(&readahead->lock);
+
+	if(readahead->has_thread)
+		pthread_join(readahead->thread, NULL);
+
+	for(loop = 0; loop < 2; loop++)
+		free(readahead->buffers[loop].data);
+
+	pthread_cond_destroy(&readahead->done_cond);
+	pthread_cond_destroy(&readahead->work_cond);
+	pthread_mutex_destroy(&readahead->lock);
+
+	dis_free(readahead);
+}
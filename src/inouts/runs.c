@@ -0,0 +1,407 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include "dislocker/common.h"
+#include "dislocker/return_values.h"
+#include "dislocker/metadata/metadata.h"
+#include "dislocker/inouts/inouts.priv.h"
+#include "dislocker/inouts/runs.h"
+
+
+/*
+ * Sector-aligned offsets right below/above the given one
+ */
+#define SECTOR_FLOOR(off, ssize) (((off) / (off_t)(ssize)) * (off_t)(ssize))
+#define SECTOR_CEIL(off, ssize) \
+	((((off) + (off_t)(ssize) - 1) / (off_t)(ssize)) * (off_t)(ssize))
+
+
+
+/**
+ * Lower the limit of a run if the candidate is before it, but still after the
+ * run's start
+ */
+static inline void lower_limit(off_t* limit, off_t start, off_t candidate)
+{
+	if(candidate > start && candidate < *limit)
+		*limit = candidate;
+}
+
+
+/**
+ * Find out how a sector has to be read and up to where the same treatment
+ * applies
+ *
+ * @param io_data The data structure containing volume's information
+ * @param offset The offset of the sector, as presented to the user
+ * @param disk_offset Where to find this sector on the disk
+ * @param limit The offset before which following sectors share the same
+ * treatment. This is conservative: the treatment may not change there.
+ * @return The type of the sector
+ */
+static dis_run_type_e classify_read_sector(
+	dis_iodata_t* io_data,
+	off_t offset,
+	off_t* disk_offset,
+	off_t* limit)
+{
+	uint16_t sector_size = io_data->sector_size;
+	version_t version    = dis_metadata_information_version(io_data->metadata);
+	off_t    enc_size    = (off_t)io_data->encrypted_volume_size;
+	off_t    sector      = offset / sector_size;
+	off_t    edge        = 0;
+	off_t    last        = 0;
+	off_t    backup_end  = 0;
+	dis_run_type_e type  = DIS_RUN_ENCRYPTED;
+
+	*disk_offset = offset;
+	*limit       = INT64_MAX;
+
+
+	/* Metadata areas are presented as zeroes */
+	edge = dis_metadata_next_region_edge(io_data->metadata, offset);
+
+	if(dis_metadata_is_overwritten(io_data->metadata, offset, sector_size)
+	   == DIS_RET_ERROR_METADATA_FILE_OVERWRITE)
+	{
+		if(edge)
+			lower_limit(limit, offset, SECTOR_CEIL(edge, sector_size));
+		type = DIS_RUN_ZEROED;
+	}
+	else
+	{
+		if(edge)
+			lower_limit(limit, offset, SECTOR_FLOOR(edge, sector_size));
+
+		if(version == V_SEVEN)
+		{
+			backup_end = (off_t)io_data->nb_backup_sectors * sector_size;
+
+			if(offset < backup_end)
+			{
+				/*
+				 * The firsts sectors are encrypted in a different place on a
+				 * Windows 7 volume, the real ones are read there
+				 */
+				*disk_offset = offset + (off_t)io_data->backup_sectors_addr;
+				lower_limit(limit, offset, backup_end);
+				lower_limit(
+					limit,
+					offset,
+					SECTOR_CEIL(
+						enc_size - (off_t)io_data->backup_sectors_addr,
+						sector_size
+					)
+				);
+
+				/* If the sector wasn't yet encrypted, don't decrypt it */
+				if(*disk_offset >= enc_size)
+					type = DIS_RUN_PLAINTEXT;
+			}
+			else if(offset >= enc_size)
+			{
+				/* Do not decrypt when there's nothing to */
+				type = DIS_RUN_PLAINTEXT;
+			}
+			else
+				lower_limit(limit, offset, SECTOR_CEIL(enc_size, sector_size));
+		}
+		else if(version == V_VISTA)
+		{
+			/*
+			 * The firsts sectors are not really encrypted on a Vista volume,
+			 * and the first one and the last encrypted one need a fix
+			 */
+			last = enc_size / sector_size - 1;
+
+			if(sector == 0 || sector == last)
+			{
+				type = DIS_RUN_VISTA_VBR;
+				lower_limit(limit, offset, offset + sector_size);
+			}
+			else
+			{
+				if(sector < 16)
+				{
+					type = DIS_RUN_PLAINTEXT;
+					lower_limit(limit, offset, 16 * (off_t)sector_size);
+				}
+
+				lower_limit(limit, offset, last * sector_size);
+			}
+		}
+	}
+
+	/* Make sure each call moves forward */
+	if(*limit < offset + sector_size)
+		*limit = offset + sector_size;
+
+	return type;
+}
+
+
+/**
+ * Find out how a sector has to be written and up to where the same treatment
+ * applies
+ * @see classify_read_sector()
+ */
+static dis_run_type_e classify_write_sector(
+	dis_iodata_t* io_data,
+	off_t offset,
+	off_t* disk_offset,
+	off_t* limit)
+{
+	uint16_t sector_size = io_data->sector_size;
+	version_t version    = dis_metadata_information_version(io_data->metadata);
+	off_t    enc_size    = (off_t)io_data->encrypted_volume_size;
+	off_t    sector      = offset / sector_size;
+	off_t    last        = 0;
+	off_t    virt_size   = 0;
+	dis_run_type_e type  = DIS_RUN_ENCRYPTED;
+
+	*disk_offset = offset;
+	*limit       = INT64_MAX;
+
+	/*
+	 * NOTE: Writes on metadata are refused earlier in the process, see
+	 * dislocker.c:enlock()
+	 */
+	if(version == V_SEVEN)
+	{
+		virt_size = dis_metadata_virtualized_size(io_data->metadata);
+
+		if(offset < virt_size)
+		{
+			/*
+			 * For BitLocker 7's volume, writes to firsts sectors are
+			 * redirected to the backed up ones
+			 */
+			*disk_offset = offset + (off_t)io_data->backup_sectors_addr;
+			lower_limit(limit, offset, SECTOR_CEIL(virt_size, sector_size));
+			lower_limit(
+				limit,
+				offset,
+				SECTOR_CEIL(
+					enc_size - (off_t)io_data->backup_sectors_addr,
+					sector_size
+				)
+			);
+		}
+		else
+			lower_limit(limit, offset, SECTOR_CEIL(enc_size, sector_size));
+
+		/*
+		 * Don't encrypt the sector if it wasn't, as in the
+		 * BitLocker's-volume-encryption-was-paused case
+		 */
+		if(*disk_offset >= enc_size)
+			type = DIS_RUN_PLAINTEXT;
+	}
+	else if(version == V_VISTA)
+	{
+		/* The firsts sectors are not really encrypted on a Vista volume */
+		last = enc_size / sector_size - 1;
+
+		if(sector == 0 || sector == last)
+		{
+			type = DIS_RUN_VISTA_VBR;
+			lower_limit(limit, offset, offset + sector_size);
+		}
+		else
+		{
+			if(sector < 16)
+			{
+				type = DIS_RUN_PLAINTEXT;
+				lower_limit(limit, offset, 16 * (off_t)sector_size);
+			}
+
+			lower_limit(limit, offset, last * sector_size);
+		}
+	}
+
+	/* Make sure each call moves forward */
+	if(*limit < offset + sector_size)
+		*limit = offset + sector_size;
+
+	return type;
+}
+
+
+/**
+ * Split a region into runs using the given classification function
+ */
+static size_t classify(
+	dis_iodata_t* io_data,
+	off_t sector_start,
+	size_t nb_sectors,
+	dis_run_t* runs,
+	size_t max_runs,
+	dis_run_type_e (*classify_sector)(dis_iodata_t*, off_t, off_t*, off_t*))
+{
+	if(!io_data || !runs || max_runs == 0 || io_data->sector_size == 0)
+		return 0;
+
+	uint16_t sector_size = io_data->sector_size;
+	off_t    offset      = sector_start;
+	off_t    end         = sector_start + (off_t)(nb_sectors * sector_size);
+	off_t    disk_offset = 0;
+	off_t    limit       = 0;
+	size_t   nb_runs     = 0;
+	size_t   count       = 0;
+	dis_run_type_e type;
+	dis_run_t* prev      = NULL;
+
+	while(offset < end)
+	{
+		type = classify_sector(io_data, offset, &disk_offset, &limit);
+		if(limit > end)
+			limit = end;
+
+		count = (size_t)((limit - offset) / sector_size);
+
+		/* Merge with the previous run if it's really the same */
+		if(prev && prev->type == type &&
+		   prev->disk_offset - prev->offset == disk_offset - offset)
+		{
+			prev->nb_sectors += count;
+		}
+		else
+		{
+			if(nb_runs == max_runs)
+				break;
+
+			prev = &runs[nb_runs++];
+			prev->type        = type;
+			prev->offset      = offset;
+			prev->disk_offset = disk_offset;
+			prev->nb_sectors  = count;
+		}
+
+		offset = limit;
+	}
+
+	return nb_runs;
+}
+
+
+/**
+ * Split a region to read into runs of contiguous sectors sharing the same
+ * treatment
+ * @warning The sector_start has to be correctly aligned
+ *
+ * @param io_data The data structure containing volume's information
+ * @param sector_start The offset of the first sector to read
+ * @param nb_sectors The number of sectors to read
+ * @param runs The array where to put the runs
+ * @param max_runs The number of entries in the runs array
+ * @return The number of runs put into the array. If the region needs more than
+ * max_runs runs, the returned ones only cover its beginning.
+ */
+size_t dis_runs_classify_read(
+	dis_iodata_t* io_data,
+	off_t sector_start,
+	size_t nb_sectors,
+	dis_run_t* runs,
+	size_t max_runs)
+{
+	return classify(
+		io_data,
+		sector_start,
+		nb_sectors,
+		runs,
+		max_runs,
+		classify_read_sector
+	);
+}
+
+
+/**
+ * Split a region to write into runs of contiguous sectors sharing the same
+ * treatment. W$ 7 virtualized sectors are redirected to where they're backed
+ * up.
+ * @warning The sector_start has to be correctly aligned
+ * @see dis_runs_classify_read()
+ */
+size_t dis_runs_classify_write(
+	dis_iodata_t* io_data,
+	off_t sector_start,
+	size_t nb_sectors,
+	dis_run_t* runs,
+	size_t max_runs)
+{
+	return classify(
+		io_data,
+		sector_start,
+		nb_sectors,
+		runs,
+		max_runs,
+		classify_write_sector
+	);
+}
+
+
+/**
+ * Find the first offset, from the given one, which is read as zeroes because
+ * it's in the metadata, or the first one which isn't
+ *
+ * @param io_data The data structure containing volume's information
+ * @param offset The offset to start looking from
+ * @param zeroed TRUE to look for metadata, FALSE to look for anything else
+ * @return The offset found, or the volume's size if there's none
+ */
+off_t dis_runs_seek_zeroed(dis_iodata_t* io_data, off_t offset, int zeroed)
+{
+	if(!io_data || io_data->sector_size == 0)
+		return offset;
+
+	dis_run_t runs[DIS_RUNS_MAX];
+	uint16_t  sector_size = io_data->sector_size;
+	off_t     end         = (off_t)io_data->volume_size;
+	off_t     start       = SECTOR_FLOOR(offset, sector_size);
+	size_t    nb_runs     = 0;
+	size_t    loop        = 0;
+
+	while(start < end)
+	{
+		nb_runs = dis_runs_classify_read(
+			io_data,
+			start,
+			(size_t)((end - start + sector_size - 1) / sector_size),
+			runs,
+			DIS_RUNS_MAX
+		);
+		if(nb_runs == 0)
+			break;
+
+		for(loop = 0; loop < nb_runs; loop++)
+		{
+			if((runs[loop].type == DIS_RUN_ZEROED) == (zeroed != FALSE))
+				return runs[loop].offset > offset ? runs[loop].offset : offset;
+		}
+
+		start = runs[nb_runs - 1].offset +
+		        (off_t)(runs[nb_runs - 1].nb_sectors * sector_size);
+	}
+
+	return end;
+}
@@ -25,6 +25,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "dislocker/common.h"
 #include "dislocker/return_values.h"
@@ -32,25 +33,21 @@
 #include "dislocker/encryption/encrypt.h"
 #include "dislocker/metadata/metadata.h"
 #include "dislocker/inouts/inouts.priv.h"
+#include "dislocker/inouts/sectors.h"
+#include "dislocker/inouts/workers.h"
+#include "dislocker/inouts/runs.h"
+#include "dislocker/inouts/uring.h"
+#include "dislocker/inouts/direct.h"
 
 
 /*
- * Number of thread you want to run for enc/decryption
- * NOTE: FUSE uses its own threads so the FUSE's functions can be called in
- * parallel. Use the environment variable FUSE_MAX_WORKERS to change the
- * FUSE's threads number.
+ * Struct we pass to the workers for buffer enc/decryption. Each job works on a
+ * contiguous part of the buffer.
  */
-#define NB_THREAD 0
-// Have a look at sysconf(_SC_NPROCESSORS_ONLN)
-// Note: 512*NB_THREAD shouldn't be more than 2^16 (due to used types)
-
-
-/* Struct we pass to a thread for buffer enc/decryption */
 typedef struct _thread_arg
 {
 	size_t   nb_loop;
-	uint16_t nb_threads;
-	unsigned int thread_begin;
+	size_t   nb_jobs;
 
 	uint16_t sector_size;
 	off_t    sector_start;
@@ -58,19 +55,132 @@ typedef struct _thread_arg
 	uint8_t* input;
 	uint8_t* output;
 
+	/* The runs the region is made of */
+	dis_run_t* runs;
+	size_t     nb_runs;
+
+	/* Set by the jobs whose sectors the crypto backend failed on */
+	int        failed;
+
 	dis_iodata_t* io_data;
 } thread_arg_t;
 
 
 
+/*
+ * Struct we pass along the completions of the reads of a region
+ */
+typedef struct _read_arg
+{
+	uint16_t   sector_size;
+	off_t      sector_start;
+	uint8_t*   output;
+
+	/* The part of a run each I/O is about */
+	dis_run_t* pieces;
+	dis_uring_io_t* ios;
+
+	/* Bytes asked and bytes really read */
+	size_t     nb_tried;
+	size_t     nb_got;
+	int        failed;
+
+	dis_iodata_t* io_data;
+} read_arg_t;
+
+
+
+/*
+ * Struct we pass to the workers for the enc/decryption of pieces of several
+ * regions. The jobs share the sectors of all the pieces between them.
+ */
+typedef struct _pieces_arg
+{
+	size_t   nb_loop;
+	size_t   nb_jobs;
+
+	uint16_t sector_size;
+
+	/* The pieces, the I/O buffer of each one being the output */
+	dis_run_t* pieces;
+	dis_uring_io_t* ios;
+	size_t     nb_pieces;
+
+	/* Where the input of each piece is, NULL to work in place */
+	uint8_t**  inputs;
+
+	/* thread_decrypt() or thread_encrypt() */
+	dis_workers_fn_t fn;
+
+	/* Set by the jobs whose sectors the crypto backend failed on */
+	int        failed;
+
+	dis_iodata_t* io_data;
+} pieces_arg_t;
+
+
+
 /** Prototype of functions used internally */
-static void* thread_decrypt(void* args);
-static void* thread_encrypt(void* args);
-static void fix_read_sector_seven(
+static void thread_decrypt(void* args, size_t job);
+static void thread_encrypt(void* args, size_t job);
+static void thread_crypt_pieces(void* args, size_t job);
+static size_t split_runs(
+	dis_run_t* runs,
+	size_t nb_runs,
+	uint16_t sector_size,
+	off_t sector_start,
+	off_t part_off,
+	uint8_t* buffer,
+	int write,
+	dis_uring_io_t* ios,
+	dis_run_t* pieces
+);
+static size_t runs_to_ios(
+	dis_run_t* runs,
+	size_t nb_runs,
+	uint16_t sector_size,
+	off_t sector_start,
+	off_t part_off,
+	uint8_t* buffer,
+	int write,
+	dis_uring_io_t** ios,
+	dis_run_t** pieces
+);
+static dis_run_t* piece_read(read_arg_t* args, dis_uring_io_t* io);
+static void read_completed(void* params, dis_uring_io_t* io);
+static void region_read_completed(void* params, dis_uring_io_t* io);
+static int crypt_pieces(
 	dis_iodata_t* io_data,
-	off_t sector_address,
-	uint8_t *input,
-	uint8_t *output
+	uint16_t sector_size,
+	dis_run_t* pieces,
+	dis_uring_io_t* ios,
+	uint8_t** inputs,
+	size_t nb_pieces,
+	dis_workers_fn_t fn
+);
+static size_t regions_to_ios(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_sector_region_t* regions,
+	size_t nb_regions,
+	uint8_t* output,
+	dis_uring_io_t* ios,
+	dis_run_t* pieces,
+	uint8_t** inputs
+);
+static int decrypt_run(
+	dis_crypt_t crypt,
+	int discard,
+	size_t nb_sectors,
+	uint16_t sector_size,
+	uint8_t* input,
+	off_t disk_offset,
+	uint8_t* output
+);
+static int discard_run(
+	dis_iodata_t* io_data,
+	dis_run_t* run,
+	uint16_t sector_size
 );
 static void fix_read_sector_vista(
 	dis_iodata_t* io_data,
@@ -88,6 +198,8 @@ static void fix_write_sector_vista(
 
 /**
  * Read and decrypt one or more sectors
+ * The encrypted sectors are read straight into the output buffer and decrypted
+ * there, so no intermediate buffer is needed.
  * @warning The sector_start has to be correctly aligned
  *
  * @param io_data The data structure containing volume's information
@@ -110,88 +222,98 @@ int read_decrypt_sectors(
 		return FALSE;
 
 
-	size_t   nb_loop = 0;
-	size_t   size    = nb_read_sector * sector_size;
-	uint8_t* input   = dis_malloc(size);
-	off_t    off     = sector_start + io_data->part_off;
+	size_t    size     = nb_read_sector * sector_size;
+	size_t    nb_done  = 0;
+	size_t    nb_loop  = 0;
+	size_t    nb_runs  = 0;
+	size_t    nb_ios   = 0;
+	size_t    loop     = 0;
+	dis_run_t runs[DIS_RUNS_MAX];
+	read_arg_t arg;
 
-	memset(input , 0, size);
-	memset(output, 0, size);
+	memset(&arg, 0, sizeof(arg));
+	arg.sector_size  = sector_size;
+	arg.sector_start = sector_start;
+	arg.output       = output;
+	arg.io_data      = io_data;
 
-	/* Read the sectors we need */
-	ssize_t read_size = pread(io_data->volume_fd, input, size, off);
-
-	if(read_size <= 0)
+	while(nb_done < nb_read_sector && !arg.failed)
 	{
-		dis_free(input);
-		dis_printf(
-			L_ERROR,
-			"Unable to read %#" F_SIZE_T " bytes from %#" F_OFF_T "\n",
-			size,
-			off
+		/*
+		 * Split the region into runs of sectors needing the same treatment, so
+		 * that each one is read at once and no per-sector check is needed
+		 */
+		nb_runs = dis_runs_classify_read(
+			io_data,
+			sector_start + (off_t)(nb_done * sector_size),
+			nb_read_sector - nb_done,
+			runs,
+			DIS_RUNS_MAX
 		);
-		return FALSE;
-	}
 
+		if(nb_runs == 0)
+			break;
 
-	/*
-	 * We are assuming that we always have a "sector size" multiple disk length
-	 * Can this assumption be wrong? I don't think so :)
-	 */
-	nb_loop = (size_t) read_size / sector_size;
+		/* Zeroed sectors are not even read */
+		nb_loop = 0;
+		for(loop = 0; loop < nb_runs; loop++)
+		{
+			nb_loop += runs[loop].nb_sectors;
 
+			if(runs[loop].type == DIS_RUN_ZEROED)
+				memset(
+					output + (runs[loop].offset - sector_start),
+					0,
+					runs[loop].nb_sectors * sector_size
+				);
+		}
 
-	/* Run threads if compiled with */
-#if NB_THREAD > 0
-	{
-		/* Threads preparations */
-		pthread_t thread[NB_THREAD];
-		thread_arg_t args[NB_THREAD];
-		unsigned int loop = 0;
+		/*
+		 * Submit all the reads at once, each piece being decrypted as soon as
+		 * it's read
+		 */
+		nb_ios = runs_to_ios(
+			runs,
+			nb_runs,
+			sector_size,
+			sector_start,
+			io_data->part_off,
+			output,
+			FALSE,
+			&arg.ios,
+			&arg.pieces
+		);
 
-		for(loop = 0; loop < NB_THREAD; ++loop)
+		if(nb_ios > 0)
 		{
-			args[loop].nb_loop       = nb_loop;
-			args[loop].nb_threads    = NB_THREAD;
-			args[loop].thread_begin  = loop;
-			args[loop].sector_size   = sector_size;
-			args[loop].sector_start  = sector_start;
-			args[loop].input         = input;
-			args[loop].output        = output;
-
-			args[loop].io_data       = io_data;
-
-			pthread_create(
-				&thread[loop],
-				NULL,
-				thread_decrypt,
-				(void*) &args[loop]
-			);
+			if(!dis_direct_run(
+				io_data->direct,
+				io_data->uring,
+				io_data->volume_fd,
+				arg.ios,
+				nb_ios,
+				read_completed,
+				&arg))
+				arg.failed = TRUE;
+
+			dis_free(arg.ios);
+			dis_free(arg.pieces);
 		}
 
-		/* Wait for threads to end */
-		for(loop = 0; loop < NB_THREAD; ++loop)
-			pthread_join(thread[loop], NULL);
-	}
-#else
-	{
-		thread_arg_t arg;
-		arg.nb_loop       = nb_loop;
-		arg.nb_threads    = 1;
-		arg.thread_begin  = 0;
-		arg.sector_size   = sector_size;
-		arg.sector_start  = sector_start;
-		arg.input         = input;
-		arg.output        = output;
-
-		arg.io_data       = io_data;
-
-		thread_decrypt(&arg);
+		nb_done += nb_loop;
 	}
-#endif
 
 
-	dis_free(input);
+	if(arg.failed || (arg.nb_tried > 0 && arg.nb_got == 0))
+	{
+		dis_printf(
+			L_ERROR,
+			"Unable to read %#" F_SIZE_T " bytes from %#" F_OFF_T "\n",
+			size,
+			sector_start + io_data->part_off
+		);
+		return FALSE;
+	}
 
 	return TRUE;
 }
@@ -220,354 +342,1184 @@ int encrypt_write_sectors(
 	if(!io_data || !input)
 		return FALSE;
 
-	uint8_t* output = dis_malloc(nb_write_sector * sector_size);
+	uint8_t*  output   = dis_malloc(nb_write_sector * sector_size);
+	size_t    nb_done  = 0;
+	size_t    nb_loop  = 0;
+	size_t    nb_runs  = 0;
+	size_t    nb_ios   = 0;
+	size_t    loop     = 0;
+	int       ok       = TRUE;
+	dis_run_t runs[DIS_RUNS_MAX];
+	dis_run_t* pieces  = NULL;
+	dis_uring_io_t* ios = NULL;
+
+	while(nb_done < nb_write_sector)
+	{
+		/*
+		 * Split the region into runs of sectors needing the same treatment,
+		 * W$ 7 virtualized sectors being redirected at the same time
+		 */
+		nb_runs = dis_runs_classify_write(
+			io_data,
+			sector_start + (off_t)(nb_done * sector_size),
+			nb_write_sector - nb_done,
+			runs,
+			DIS_RUNS_MAX
+		);
 
-	memset(output , 0, nb_write_sector * sector_size);
+		if(nb_runs == 0)
+			break;
 
-	/* Run threads if compiled with */
-#if NB_THREAD > 0
-	{
-		/* Threads preparations */
-		pthread_t thread[NB_THREAD];
-		thread_arg_t args[NB_THREAD];
-		unsigned int loop = 0;
+		nb_loop = 0;
+		for(loop = 0; loop < nb_runs; loop++)
+			nb_loop += runs[loop].nb_sectors;
 
-		for(loop = 0; loop < NB_THREAD; ++loop)
+		/* Share the work between the workers, if it's worth it */
 		{
-			args[loop].nb_loop       = nb_write_sector;
-			args[loop].nb_threads    = NB_THREAD;
-			args[loop].thread_begin  = loop;
-			args[loop].sector_size   = sector_size;
-			args[loop].sector_start  = sector_start;
-			args[loop].input         = input;
-			args[loop].output        = output;
-
-			args[loop].io_data       = io_data;
-
-			pthread_create(
-				&thread[loop],
+			thread_arg_t arg;
+			arg.nb_loop       = nb_loop;
+			arg.nb_jobs       = dis_workers_jobs_for(
+				io_data->workers,
+				nb_loop * sector_size
+			);
+			arg.sector_size   = sector_size;
+			arg.sector_start  = sector_start;
+			arg.input         = input;
+			arg.output        = output;
+			arg.runs          = runs;
+			arg.nb_runs       = nb_runs;
+			arg.failed        = FALSE;
+
+			arg.io_data       = io_data;
+
+			dis_workers_run(io_data->workers, arg.nb_jobs, thread_encrypt, &arg);
+
+			/* Nothing is written rather than sectors badly encrypted */
+			if(arg.failed)
+			{
+				dis_free(output);
+				return FALSE;
+			}
+		}
+
+		/* Write the sectors we want, all at once */
+		nb_ios = runs_to_ios(
+			runs,
+			nb_runs,
+			sector_size,
+			sector_start,
+			io_data->part_off,
+			output,
+			TRUE,
+			&ios,
+			&pieces
+		);
+
+		if(nb_ios > 0)
+		{
+			ok = dis_direct_run(
+				io_data->direct,
+				io_data->uring,
+				io_data->volume_fd,
+				ios,
+				nb_ios,
 				NULL,
-				thread_encrypt,
-				(void*) &args[loop]
+				NULL
 			);
+
+			for(loop = 0; loop < nb_ios && ok; loop++)
+			{
+				if(ios[loop].result <= 0)
+				{
+					dis_printf(
+						L_ERROR,
+						"Unable to write %#" F_SIZE_T " bytes to %#" F_OFF_T "\n",
+						ios[loop].size,
+						ios[loop].offset
+					);
+					ok = FALSE;
+				}
+			}
+
+			dis_free(ios);
+			dis_free(pieces);
+
+			if(!ok)
+			{
+				dis_free(output);
+				return FALSE;
+			}
 		}
 
-		/* Wait for threads to end */
-		for(loop = 0; loop < NB_THREAD; ++loop)
-			pthread_join(thread[loop], NULL);
+		nb_done += nb_loop;
 	}
-#else
-	{
-		thread_arg_t arg;
-		arg.nb_loop       = nb_write_sector;
-		arg.nb_threads    = 1;
-		arg.thread_begin  = 0;
-		arg.sector_size   = sector_size;
-		arg.sector_start  = sector_start;
-		arg.input         = input;
-		arg.output        = output;
-
-		arg.io_data       = io_data;
-
-		thread_encrypt(&arg);
-	}
-#endif
 
-	/* Write the sectors we want */
-	ssize_t write_size = pwrite(
-		io_data->volume_fd,
-		output,
-		nb_write_sector * sector_size,
-		sector_start + io_data->part_off
+	dis_free(output);
+
+	return TRUE;
+}
+
+
+/**
+ * Read and decrypt several regions of sectors
+ * The reads of all the regions are submitted at once, then the sectors read
+ * are decrypted in place, shared between the workers.
+ * @warning The regions' sector_start have to be correctly aligned
+ *
+ * @param io_data The data structure containing volume's information
+ * @param sector_size The size of one sector
+ * @param regions The regions to read, each one with its output buffer
+ * @param nb_regions The number of regions
+ * @return TRUE if result can be trusted, FALSE otherwise
+ */
+int read_decrypt_regions(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_sector_region_t* regions,
+	size_t nb_regions)
+{
+	// Check parameters
+	if(!io_data || !regions)
+		return FALSE;
+
+	size_t     nb_ios = 0;
+	read_arg_t arg;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.sector_size = sector_size;
+	arg.io_data     = io_data;
+
+	/* Zeroed sectors are cleared while counting, they are not read */
+	nb_ios = regions_to_ios(
+		io_data, sector_size, regions, nb_regions, NULL, NULL, NULL, NULL
 	);
 
-	dis_free(output);
-	if(write_size <= 0)
+	if(nb_ios == 0)
+		return TRUE;
+
+	arg.ios    = dis_malloc(nb_ios * sizeof(dis_uring_io_t));
+	arg.pieces = dis_malloc(nb_ios * sizeof(dis_run_t));
+
+	regions_to_ios(
+		io_data, sector_size, regions, nb_regions, NULL,
+		arg.ios, arg.pieces, NULL
+	);
+
+	if(!dis_direct_run(
+		io_data->direct,
+		io_data->uring,
+		io_data->volume_fd,
+		arg.ios,
+		nb_ios,
+		region_read_completed,
+		&arg))
+		arg.failed = TRUE;
+
+	if(!arg.failed && !crypt_pieces(
+			io_data, sector_size, arg.pieces, arg.ios, NULL, nb_ios,
+			thread_decrypt
+		))
+		arg.failed = TRUE;
+
+	dis_free(arg.ios);
+	dis_free(arg.pieces);
+
+	if(arg.failed || (arg.nb_tried > 0 && arg.nb_got == 0))
+	{
+		dis_printf(
+			L_ERROR,
+			"Unable to read %#" F_SIZE_T " regions of sectors\n",
+			nb_regions
+		);
 		return FALSE;
+	}
 
 	return TRUE;
 }
 
 
 /**
- * Decrypt a sector region according to one or more thread
+ * Encrypt and write several regions of sectors
+ * The sectors of all the regions are encrypted, shared between the workers,
+ * then the writes are submitted at once.
+ * @warning The regions' sector_start have to be correctly aligned
  *
- * @param params The structure used for thread parameters storage
+ * @param io_data The data structure containing volume's information
+ * @param sector_size The size of one sector
+ * @param regions The regions to write, each one with its input buffer
+ * @param nb_regions The number of regions
+ * @return TRUE if result can be trusted, FALSE otherwise
  */
-static void* thread_decrypt(void* params)
+int encrypt_write_regions(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_sector_region_t* regions,
+	size_t nb_regions)
 {
-	if(!params)
-		return NULL;
+	// Check parameters
+	if(!io_data || !regions)
+		return FALSE;
 
-	thread_arg_t* args    = (thread_arg_t*) params;
-	dis_iodata_t* io_data = args->io_data;
+	size_t    nb_ios   = 0;
+	size_t    size     = 0;
+	size_t    loop     = 0;
+	int       ok       = TRUE;
+	uint8_t*  output   = NULL;
+	uint8_t** inputs   = NULL;
+	dis_run_t* pieces  = NULL;
+	dis_uring_io_t* ios = NULL;
 
-	off_t    loop         = args->thread_begin;
-	uint16_t step_unit    = args->nb_threads;
+	/* Sectors are encrypted into a buffer of their own, region after region */
+	for(loop = 0; loop < nb_regions; loop++)
+		size += regions[loop].nb_sectors * sector_size;
 
-	int      hover        = 0;
-	uint16_t version      = dis_metadata_information_version(io_data->metadata);
-	uint16_t sector_size  = args->sector_size;
-	uint16_t step_size    = (uint16_t) (sector_size * step_unit);
-	uint64_t encrypted_volume_total_sectors = io_data->encrypted_volume_size / sector_size;
+	if(size == 0)
+		return TRUE;
 
-	off_t    offset       = args->sector_start + sector_size * loop;
-	uint8_t* loop_input   = args->input + sector_size * loop;
-	uint8_t* loop_output  = args->output + sector_size * loop;
+	output = dis_malloc(size);
 
+	nb_ios = regions_to_ios(
+		io_data, sector_size, regions, nb_regions, output, NULL, NULL, NULL
+	);
 
-	for( ; loop < (off_t)args->nb_loop;
-	       loop        += step_unit,
-	       offset      += step_size,
-	       loop_input  += step_size,
-	       loop_output += step_size)
+	if(nb_ios == 0)
 	{
-		/*
-		 * For BitLocker-encrypted volume with W$ 7/8:
-		 *   - Don't decrypt the firsts sectors whatever might be the case, they
-		 *   are saved elsewhere anyway.
-		 * For these encrypted with W$ Vista:
-		 *   - Change the first sector.
-		 * For both of them:
-		 *   - Zero out the metadata area returned to the user (not the one on
-		 *   the disk, obviously).
-		 *   - Don't decrypt sectors if we're outside the encrypted-volume's
-		 *   size (but still in the volume's size obv). This is needed when the
-		 *   encryption was paused during BitLocker's turn on.
-		 */
+		dis_free(output);
+		return TRUE;
+	}
 
-		off_t sector_offset = args->sector_start / sector_size + loop;
+	inputs = dis_malloc(nb_ios * sizeof(uint8_t*));
+	ios    = dis_malloc(nb_ios * sizeof(dis_uring_io_t));
+	pieces = dis_malloc(nb_ios * sizeof(dis_run_t));
 
-		/* Check for zero out areas */
-		hover = dis_metadata_is_overwritten(
-			io_data->metadata,
-			offset,
-			sector_size);
-		if(hover == DIS_RET_ERROR_METADATA_FILE_OVERWRITE)
-		{
-			memset(loop_output, 0, sector_size);
-			continue;
-		}
+	regions_to_ios(
+		io_data, sector_size, regions, nb_regions, output, ios, pieces, inputs
+	);
+
+	/* Nothing is written rather than sectors badly encrypted */
+	ok = crypt_pieces(
+		io_data, sector_size, pieces, ios, inputs, nb_ios, thread_encrypt
+	);
 
+	if(ok)
+		ok = dis_direct_run(
+			io_data->direct,
+			io_data->uring,
+			io_data->volume_fd,
+			ios,
+			nb_ios,
+			NULL,
+			NULL
+		);
 
-		/* Check for sectors fixing and non-encrypted sectors */
-		if(version == V_SEVEN &&
-		   (uint64_t)sector_offset < io_data->nb_backup_sectors)
+	for(loop = 0; loop < nb_ios && ok; loop++)
+	{
+		if(ios[loop].result <= 0)
 		{
-			/*
-			 * The firsts sectors are encrypted in a different place on a
-			 * Windows 7 volume
-			 */
-			fix_read_sector_seven(
-				io_data,
-				offset,
-				loop_input,
-				loop_output
+			dis_printf(
+				L_ERROR,
+				"Unable to write %#" F_SIZE_T " bytes to %#" F_OFF_T "\n",
+				ios[loop].size,
+				ios[loop].offset
 			);
+			ok = FALSE;
 		}
-		else if(version == V_SEVEN &&
-		       (uint64_t)offset >= io_data->encrypted_volume_size)
+	}
+
+	dis_free(pieces);
+	dis_free(ios);
+	dis_free(inputs);
+	dis_free(output);
+
+	return ok;
+}
+
+
+/**
+ * Deallocate one or more sectors of the volume, so that the storage behind it
+ * can reclaim them. They are read as zeroes afterward, see decrypt_run(), as
+ * long as io_data->discard is set.
+ * W$ 7 virtualized sectors are deallocated where they're backed up and the
+ * metadata sectors are left as they are, they're read as zeroes anyway.
+ * @warning The sector_start has to be correctly aligned
+ *
+ * @param io_data The data structure containing volume's information
+ * @param nb_sectors The number of sectors to deallocate
+ * @param sector_size The size of one sector
+ * @param sector_start The offset of the first sector to deallocate; See the
+ * warning above
+ * @return 0 on success, a negative errno value otherwise (-EOPNOTSUPP if the
+ * volume can't deallocate sectors)
+ */
+int discard_sectors(
+	dis_iodata_t* io_data,
+	size_t nb_sectors,
+	uint16_t sector_size,
+	off_t sector_start)
+{
+	// Check parameter
+	if(!io_data)
+		return -EINVAL;
+
+	size_t    nb_done  = 0;
+	size_t    nb_runs  = 0;
+	size_t    loop     = 0;
+	int       ret      = 0;
+	dis_run_t runs[DIS_RUNS_MAX];
+
+	while(nb_done < nb_sectors && ret == 0)
+	{
+		nb_runs = dis_runs_classify_write(
+			io_data,
+			sector_start + (off_t)(nb_done * sector_size),
+			nb_sectors - nb_done,
+			runs,
+			DIS_RUNS_MAX
+		);
+
+		if(nb_runs == 0)
+			break;
+
+		for(loop = 0; loop < nb_runs && ret == 0; loop++)
 		{
-			/* Do not decrypt when there's nothing to */
-			dis_printf(L_DEBUG,
-				"  > Copying sector from 0x%" F_OFF_T
-				" (%" F_SIZE_T " bytes)\n",
-				offset, sector_size
-			);
-			memcpy(loop_output, loop_input, sector_size);
+			ret = discard_run(io_data, &runs[loop], sector_size);
+			nb_done += runs[loop].nb_sectors;
 		}
-		else if(version == V_VISTA && (sector_offset < 16 || sector_offset + 1 == (off_t) encrypted_volume_total_sectors))
+	}
+
+	return ret;
+}
+
+
+/**
+ * Split regions into I/O, the same way read_decrypt_sectors() and
+ * encrypt_write_sectors() do for one region
+ *
+ * @param io_data The data structure containing volume's information
+ * @param sector_size The size of one sector
+ * @param regions The regions to split
+ * @param nb_regions The number of regions
+ * @param output For writes, the buffer where the regions are encrypted one
+ * after the other. NULL for reads, done in the regions' buffers.
+ * @param ios Where to put the I/O, NULL to only count them
+ * @param pieces Where to put the run's part each I/O is about
+ * @param inputs Where to put the input of each piece for writes
+ * @return The number of I/O
+ */
+static size_t regions_to_ios(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_sector_region_t* regions,
+	size_t nb_regions,
+	uint8_t* output,
+	dis_uring_io_t* ios,
+	dis_run_t* pieces,
+	uint8_t** inputs)
+{
+	dis_sector_region_t* region = NULL;
+	dis_run_t runs[DIS_RUNS_MAX];
+
+	size_t nb_ios   = 0;
+	size_t nb_added = 0;
+	size_t nb_done  = 0;
+	size_t nb_runs  = 0;
+	size_t loop     = 0;
+	size_t loop_r   = 0;
+	size_t pos      = 0;
+	off_t  offset   = 0;
+	int    write    = output != NULL;
+	uint8_t* buffer = NULL;
+
+	for(loop_r = 0; loop_r < nb_regions; loop_r++)
+	{
+		region = &regions[loop_r];
+		buffer = write ? output + pos : region->buffer;
+		pos   += region->nb_sectors * sector_size;
+
+		for(nb_done = 0; nb_done < region->nb_sectors;)
 		{
-			/*
-			 * The firsts sectors are not really encrypted on a Vista volume
-			 */
-			if(sector_offset < 1 || sector_offset + 1 == (off_t) encrypted_volume_total_sectors)
-				fix_read_sector_vista(
-					io_data,
-					loop_input,
-					loop_output
+			offset = region->sector_start + (off_t)(nb_done * sector_size);
+
+			if(write)
+				nb_runs = dis_runs_classify_write(
+					io_data, offset, region->nb_sectors - nb_done,
+					runs, DIS_RUNS_MAX
 				);
 			else
-			{
-				dis_printf(L_DEBUG,
-					"  > Copying sector from 0x%" F_OFF_T
-					" (%" F_SIZE_T " bytes)\n",
-					offset, sector_size
+				nb_runs = dis_runs_classify_read(
+					io_data, offset, region->nb_sectors - nb_done,
+					runs, DIS_RUNS_MAX
 				);
-				memcpy(loop_output, loop_input, sector_size);
+
+			if(nb_runs == 0)
+				break;
+
+			for(loop = 0; loop < nb_runs; loop++)
+			{
+				nb_done += runs[loop].nb_sectors;
+
+				/* Zeroed sectors are not even read */
+				if(!write && runs[loop].type == DIS_RUN_ZEROED)
+					memset(
+						region->buffer + (runs[loop].offset - region->sector_start),
+						0,
+						runs[loop].nb_sectors * sector_size
+					);
 			}
+
+			nb_added = split_runs(
+				runs,
+				nb_runs,
+				sector_size,
+				region->sector_start,
+				io_data->part_off,
+				buffer,
+				write,
+				ios ? ios + nb_ios : NULL,
+				ios ? pieces + nb_ios : NULL
+			);
+
+			/* What's written is encrypted from the region's buffer */
+			if(ios && write)
+				for(loop = nb_ios; loop < nb_ios + nb_added; loop++)
+					inputs[loop] = region->buffer
+					               + (pieces[loop].offset - region->sector_start);
+
+			nb_ios += nb_added;
 		}
-		else
+	}
+
+	return nb_ios;
+}
+
+
+/**
+ * Split runs into I/O of at most DIS_URING_MAX_IO_SIZE bytes, zeroed runs being
+ * left aside
+ *
+ * @param runs The runs to split
+ * @param nb_runs The number of runs
+ * @param sector_size The size of one sector
+ * @param sector_start The offset of the region's first sector
+ * @param part_off Where the partition begins on the volume
+ * @param buffer The region's buffer
+ * @param write TRUE for writes, FALSE for reads
+ * @param ios Where to put the I/O, NULL to only count them
+ * @param pieces Where to put the run's part each I/O is about, NULL to only
+ * count them
+ * @return The number of I/O
+ */
+static size_t split_runs(
+	dis_run_t* runs,
+	size_t nb_runs,
+	uint16_t sector_size,
+	off_t sector_start,
+	off_t part_off,
+	uint8_t* buffer,
+	int write,
+	dis_uring_io_t* ios,
+	dis_run_t* pieces)
+{
+	size_t max_sectors = DIS_URING_MAX_IO_SIZE / sector_size;
+	size_t nb_ios      = 0;
+	size_t loop        = 0;
+	size_t done        = 0;
+	size_t count       = 0;
+	dis_run_t* piece   = NULL;
+
+	if(max_sectors == 0)
+		max_sectors = 1;
+
+	for(loop = 0; loop < nb_runs; loop++)
+	{
+		if(runs[loop].type == DIS_RUN_ZEROED)
+			continue;
+
+		if(!ios || !pieces)
+		{
+			nb_ios += (runs[loop].nb_sectors + max_sectors - 1) / max_sectors;
+			continue;
+		}
+
+		for(done = 0; done < runs[loop].nb_sectors; done += count)
 		{
-			/* Decrypt the sector */
-			if(!decrypt_sector(
-				io_data->crypt,
-				loop_input,
-				offset,
-				loop_output
-			))
-				dis_printf(L_CRITICAL, "Decryption of sector %#" F_OFF_T
-				                    " failed!\n", offset);
+			count = runs[loop].nb_sectors - done;
+			if(count > max_sectors)
+				count = max_sectors;
+
+			piece = &pieces[nb_ios];
+			piece->type        = runs[loop].type;
+			piece->offset      = runs[loop].offset + (off_t)(done * sector_size);
+			piece->disk_offset = runs[loop].disk_offset
+			                     + (off_t)(done * sector_size);
+			piece->nb_sectors  = count;
+
+			ios[nb_ios].write  = write;
+			ios[nb_ios].buffer = buffer + (piece->offset - sector_start);
+			ios[nb_ios].size   = count * sector_size;
+			ios[nb_ios].offset = piece->disk_offset + part_off;
+			ios[nb_ios].result = 0;
+
+			nb_ios++;
 		}
 	}
 
-	return args->output;
+	return nb_ios;
 }
 
 
 /**
- * Encrypt a sector region according to one or more thread
+ * Split runs into I/O of at most DIS_URING_MAX_IO_SIZE bytes, zeroed runs being
+ * left aside
  *
- * @param params The structure used for thread parameters storage
+ * @param runs The runs to split
+ * @param nb_runs The number of runs
+ * @param sector_size The size of one sector
+ * @param sector_start The offset of the region's first sector
+ * @param part_off Where the partition begins on the volume
+ * @param buffer The region's buffer
+ * @param write TRUE for writes, FALSE for reads
+ * @param ios Where to put the allocated I/O array
+ * @param pieces Where to put the allocated array of the run's part each I/O is
+ * about
+ * @return The number of I/O, nothing is allocated if it's 0
  */
-static void* thread_encrypt(void* params)
+static size_t runs_to_ios(
+	dis_run_t* runs,
+	size_t nb_runs,
+	uint16_t sector_size,
+	off_t sector_start,
+	off_t part_off,
+	uint8_t* buffer,
+	int write,
+	dis_uring_io_t** ios,
+	dis_run_t** pieces)
 {
-	if(!params)
+	size_t nb_ios = split_runs(
+		runs, nb_runs, sector_size, sector_start, part_off, buffer, write,
+		NULL, NULL
+	);
+
+	if(nb_ios == 0)
+		return 0;
+
+	*ios    = dis_malloc(nb_ios * sizeof(dis_uring_io_t));
+	*pieces = dis_malloc(nb_ios * sizeof(dis_run_t));
+
+	return split_runs(
+		runs, nb_runs, sector_size, sector_start, part_off, buffer, write,
+		*ios, *pieces
+	);
+}
+
+
+/**
+ * Account for a completed read, zeroing what's after a short one
+ *
+ * @param args The structure used for the reading
+ * @param io The completed read
+ * @return The piece the read is about, NULL if there's nothing to decrypt
+ */
+static dis_run_t* piece_read(read_arg_t* args, dis_uring_io_t* io)
+{
+	dis_run_t* piece       = &args->pieces[io - args->ios];
+	uint16_t   sector_size = args->sector_size;
+
+	args->nb_tried += io->size;
+
+	if(io->result < 0)
+	{
+		dis_printf(
+			L_ERROR,
+			"Unable to read %#" F_SIZE_T " bytes from %#" F_OFF_T ": %s\n",
+			io->size,
+			io->offset,
+			strerror((int) -io->result)
+		);
+		args->failed = TRUE;
 		return NULL;
+	}
+
+	args->nb_got += (size_t) io->result;
+
+	/*
+	 * We are assuming that we always have a "sector size" multiple disk
+	 * length. What's after a short read is zeroed.
+	 */
+	if((size_t) io->result < io->size)
+	{
+		piece->nb_sectors = (size_t) io->result / sector_size;
+		memset(
+			io->buffer + piece->nb_sectors * sector_size,
+			0,
+			io->size - piece->nb_sectors * sector_size
+		);
+	}
 
-	thread_arg_t* args    = (thread_arg_t*)params;
+	return piece->nb_sectors ? piece : NULL;
+}
+
+
+/**
+ * Decrypt the piece of a region which has just been read
+ *
+ * @param params The structure used for the region's reading
+ * @param io The completed read
+ */
+static void read_completed(void* params, dis_uring_io_t* io)
+{
+	read_arg_t*   args    = (read_arg_t*) params;
 	dis_iodata_t* io_data = args->io_data;
+	dis_run_t*    piece   = piece_read(args, io);
+	uint16_t      sector_size = args->sector_size;
+	thread_arg_t  arg;
+
+	if(!piece)
+		return;
+
+	/* Share the work between the workers, if it's worth it */
+	arg.nb_loop       = piece->nb_sectors;
+	arg.nb_jobs       = dis_workers_jobs_for(
+		io_data->workers,
+		piece->nb_sectors * sector_size
+	);
+	arg.sector_size   = sector_size;
+	arg.sector_start  = args->sector_start;
+	arg.input         = args->output;
+	arg.output        = args->output;
+	arg.runs          = piece;
+	arg.nb_runs       = 1;
+	arg.failed        = FALSE;
+
+	arg.io_data       = io_data;
+
+	dis_workers_run(io_data->workers, arg.nb_jobs, thread_decrypt, &arg);
+
+	if(arg.failed)
+		args->failed = TRUE;
+}
+
+
+/**
+ * Account for a read of one of several regions, the decryption being done
+ * once all of them are read
+ *
+ * @param params The structure used for the regions' reading
+ * @param io The completed read
+ */
+static void region_read_completed(void* params, dis_uring_io_t* io)
+{
+	piece_read((read_arg_t*) params, io);
+}
 
-	off_t    loop        = args->thread_begin;
-	uint16_t step_unit   = args->nb_threads;
 
-	uint16_t version     = dis_metadata_information_version(io_data->metadata);
+/**
+ * En/decrypt pieces of several regions, sharing their sectors between the
+ * workers so that small pieces are worked on in parallel too
+ *
+ * @param io_data The data structure containing volume's information
+ * @param sector_size The size of one sector
+ * @param pieces The pieces to work on
+ * @param ios The I/O of the pieces, their buffers being the output
+ * @param inputs The input of each piece, NULL to work in place
+ * @param nb_pieces The number of pieces
+ * @param fn thread_decrypt() or thread_encrypt()
+ * @return FALSE if the crypto backend failed on some sectors, TRUE otherwise
+ */
+static int crypt_pieces(
+	dis_iodata_t* io_data,
+	uint16_t sector_size,
+	dis_run_t* pieces,
+	dis_uring_io_t* ios,
+	uint8_t** inputs,
+	size_t nb_pieces,
+	dis_workers_fn_t fn)
+{
+	pieces_arg_t arg;
+	size_t       loop = 0;
+
+	memset(&arg, 0, sizeof(arg));
+
+	for(loop = 0; loop < nb_pieces; loop++)
+		arg.nb_loop += pieces[loop].nb_sectors;
+
+	if(arg.nb_loop == 0)
+		return TRUE;
+
+	arg.nb_jobs     = dis_workers_jobs_for(
+		io_data->workers,
+		arg.nb_loop * sector_size
+	);
+	arg.sector_size = sector_size;
+	arg.pieces      = pieces;
+	arg.ios         = ios;
+	arg.nb_pieces   = nb_pieces;
+	arg.inputs      = inputs;
+	arg.fn          = fn;
+	arg.io_data     = io_data;
+
+	dis_workers_run(io_data->workers, arg.nb_jobs, thread_crypt_pieces, &arg);
+
+	return !arg.failed;
+}
+
+
+/**
+ * En/decrypt the sectors of the pieces which belong to a job
+ *
+ * @param params The structure shared by the jobs
+ * @param job The index of the job
+ */
+static void thread_crypt_pieces(void* params, size_t job)
+{
+	if(!params)
+		return;
+
+	pieces_arg_t* args   = (pieces_arg_t*) params;
 	uint16_t sector_size = args->sector_size;
-	uint16_t step_size   = (uint16_t) (sector_size * step_unit);
-	uint64_t encrypted_volume_total_sectors = io_data->encrypted_volume_size / sector_size;
 
-	uint8_t* loop_input  = args->input + sector_size * loop;
-	uint8_t* loop_output = args->output + sector_size * loop;
-	off_t    offset      = args->sector_start + sector_size * loop;
+	/* Sectors of this job, relatively to the first piece */
+	size_t job_start = job * args->nb_loop / args->nb_jobs;
+	size_t job_end   = (job + 1) * args->nb_loop / args->nb_jobs;
+	size_t pos       = 0;
+	size_t first     = 0;
+	size_t last      = 0;
+	size_t loop      = 0;
 
+	dis_run_t    run;
+	thread_arg_t arg;
 
-	for( ; loop < (off_t)args->nb_loop;
-	       loop        += step_unit,
-	       offset      += step_size,
-	       loop_input  += step_size,
-	       loop_output += step_size)
+	for(loop = 0; loop < args->nb_pieces && pos < job_end;
+	    pos += args->pieces[loop].nb_sectors, loop++)
 	{
-		/*
-		 * Just encrypt this sector
-		 * Exception: don't encrypt it if the sector wasn't (as in the
-		 * "BitLocker's-volume-encryption-was-paused case described in the
-		 * decryption function above")
-		 */
+		if(pos + args->pieces[loop].nb_sectors <= job_start)
+			continue;
+
+		first = job_start > pos ? job_start - pos : 0;
+		last  = args->pieces[loop].nb_sectors;
+		if(pos + last > job_end)
+			last = job_end - pos;
+
+		/* The part of the piece this job works on, as a run of its own */
+		run              = args->pieces[loop];
+		run.offset      += (off_t)(first * sector_size);
+		run.disk_offset += (off_t)(first * sector_size);
+		run.nb_sectors   = last - first;
+
+		arg.nb_loop      = run.nb_sectors;
+		arg.nb_jobs      = 1;
+		arg.sector_size  = sector_size;
+		arg.sector_start = run.offset;
+		arg.output       = args->ios[loop].buffer + first * sector_size;
+		arg.input        = args->inputs ?
+		                   args->inputs[loop] + first * sector_size :
+		                   arg.output;
+		arg.runs         = &run;
+		arg.nb_runs      = 1;
+		arg.failed       = FALSE;
+		arg.io_data      = args->io_data;
+
+		args->fn(&arg, 0);
+
+		if(arg.failed)
+			__atomic_store_n(&args->failed, TRUE, __ATOMIC_RELAXED);
+	}
+}
+
+
+/**
+ * Get the part of a run which belongs to a job
+ *
+ * @param args The parameters shared by the jobs
+ * @param job The index of the job
+ * @param run The run to look at
+ * @param first Where to put the index, in the run, of the first sector of the
+ * job
+ * @param last Where to put the index, in the run, after the job's last sector
+ * @return -1 if the run is before the job, 1 if it's after, 0 if the job has
+ * to deal with some of its sectors
+ */
+static int job_part_of_run(
+	thread_arg_t* args,
+	size_t job,
+	dis_run_t* run,
+	size_t* first,
+	size_t* last)
+{
+	/* Sectors of this job, relatively to the first run */
+	size_t job_start = job * args->nb_loop / args->nb_jobs;
+	size_t job_end   = (job + 1) * args->nb_loop / args->nb_jobs;
+	size_t run_start = (size_t)(run->offset - args->runs[0].offset)
+	                   / args->sector_size;
+
+	if(run_start >= job_end)
+		return 1;
+
+	*first = job_start > run_start ? job_start - run_start : 0;
+	*last  = run->nb_sectors;
+	if(run_start + *last > job_end)
+		*last = job_end - run_start;
+
+	return *first < *last ? 0 : -1;
+}
+
+
+/**
+ * Decrypt the part of a sector region which belongs to a job
+ *
+ * @param params The structure used for thread parameters storage
+ * @param job The index of the job, telling which part of the region to decrypt
+ */
+static void thread_decrypt(void* params, size_t job)
+{
+	if(!params)
+		return;
+
+	thread_arg_t* args    = (thread_arg_t*) params;
+	dis_iodata_t* io_data = args->io_data;
+	uint16_t sector_size  = args->sector_size;
+
+	size_t   first        = 0;
+	size_t   last         = 0;
+	size_t   loop         = 0;
+	size_t   run_idx      = 0;
+	int      part         = 0;
+	dis_run_t* run        = NULL;
+
+	off_t    offset       = 0;
+	off_t    disk_offset  = 0;
+	uint8_t* loop_input   = NULL;
+	uint8_t* loop_output  = NULL;
+
+
+	for(run_idx = 0; run_idx < args->nb_runs; run_idx++)
+	{
+		run  = &args->runs[run_idx];
+		part = job_part_of_run(args, job, run, &first, &last);
+
+		if(part > 0)
+			break;
+		if(part < 0)
+			continue;
 
-		off_t sector_offset = args->sector_start / sector_size + loop;
+		offset      = run->offset + (off_t)(first * sector_size);
+		disk_offset = run->disk_offset + (off_t)(first * sector_size);
+		loop_input  = args->input + (offset - args->sector_start);
+		loop_output = args->output + (offset - args->sector_start);
 
 		/*
-		 * NOTE: Seven specificities are dealt with earlier in the process
-		 * see dislocker.c:enlock()
+		 * For BitLocker-encrypted volume with W$ 7/8:
+		 *   - The firsts sectors are read where they're backed up.
+		 * For these encrypted with W$ Vista:
+		 *   - Change the first sector.
+		 * For both of them:
+		 *   - Zero out the metadata area returned to the user (not the one on
+		 *   the disk, obviously).
+		 *   - Don't decrypt sectors if we're outside the encrypted-volume's
+		 *   size (but still in the volume's size obv). This is needed when the
+		 *   encryption was paused during BitLocker's turn on.
+		 * See runs.c for the classification.
 		 */
-		if(version == V_VISTA && (sector_offset < 16 || sector_offset + 1 == (off_t) encrypted_volume_total_sectors))
+		switch(run->type)
 		{
-			/*
-			 * The firsts sectors are not really encrypted on a Vista volume
-			 */
-			if(sector_offset < 1 || sector_offset + 1 == (off_t) encrypted_volume_total_sectors)
-				fix_write_sector_vista(
-					io_data,
+			case DIS_RUN_ZEROED:
+				memset(loop_output, 0, (last - first) * sector_size);
+				break;
+
+			case DIS_RUN_PLAINTEXT:
+				dis_printf(L_DEBUG,
+					"  > Copying sectors from 0x%" F_OFF_T
+					" (%" F_SIZE_T " bytes)\n",
+					disk_offset, (last - first) * sector_size
+				);
+				if(loop_output != loop_input)
+					memcpy(loop_output, loop_input, (last - first) * sector_size);
+				break;
+
+			case DIS_RUN_VISTA_VBR:
+				for(loop = first; loop < last; loop++,
+				    loop_input += sector_size, loop_output += sector_size)
+					fix_read_sector_vista(io_data, loop_input, loop_output);
+				break;
+
+			case DIS_RUN_ENCRYPTED:
+			default:
+				if(!decrypt_run(
+					io_data->crypt,
+					io_data->discard,
+					last - first,
+					sector_size,
 					loop_input,
+					disk_offset,
 					loop_output
-				);
-			else
-				memcpy(loop_output, loop_input, sector_size);
-		}
-		else if(version == V_SEVEN &&
-		       (uint64_t)offset >= io_data->encrypted_volume_size)
-		{
-			memcpy(loop_output, loop_input, sector_size);
-		}
-		else
-		{
-			if(!encrypt_sector(
-				io_data->crypt,
-				loop_input,
-				offset,
-				loop_output
-			))
-				dis_printf(L_CRITICAL, "Encryption of sector %#" F_OFF_T
-				                    " failed!\n", offset);
+				))
+				{
+					dis_printf(L_CRITICAL, "Decryption of sectors %#" F_OFF_T
+					           " (%" F_SIZE_T " sectors) failed!\n",
+					           disk_offset, last - first);
+					__atomic_store_n(&args->failed, TRUE, __ATOMIC_RELAXED);
+				}
+				break;
 		}
 	}
-
-	return args->input;
 }
 
 
+/**
+ * Tell whether a sector read from the disk only holds zeroes. If the volume's
+ * sectors are deallocated, such a sector has been, see discard_sectors(), as
+ * an encrypted one is never all zeroes for all practical purposes.
+ */
+static int is_zero_sector(const uint8_t* sector, uint16_t sector_size)
+{
+	uint16_t loop = 0;
 
+	for(loop = 0; loop < sector_size; loop++)
+		if(sector[loop])
+			return FALSE;
 
+	return TRUE;
+}
 
 
 /**
- * "Fix" the firsts sectors of a BitLocker volume encrypted with W$ Seven for
- * read operation
+ * Decrypt consecutive sectors, the deallocated ones being presented as zeroes
  *
- * @param io_data Data needed by the decryption to deal with encrypted data
- * @param sector_address Address of the sector to decrypt
- * @param output The buffer where to put fixed data
+ * @param crypt The crypto structure to use
+ * @param discard TRUE if the volume's sectors are deallocated, FALSE to
+ * decrypt the all-zero sectors too, as BitLocker does
+ * @param nb_sectors The number of sectors
+ * @param sector_size The size of one sector
+ * @param input The sectors as read from the disk
+ * @param disk_offset The address of the first sector
+ * @param output Where to put the decrypted sectors, may be the input
+ * @return TRUE if the decryption went fine, FALSE otherwise
  */
-static void fix_read_sector_seven(
-	dis_iodata_t* io_data,
-	off_t sector_address,
+static int decrypt_run(
+	dis_crypt_t crypt,
+	int discard,
+	size_t nb_sectors,
+	uint16_t sector_size,
 	uint8_t* input,
+	off_t disk_offset,
 	uint8_t* output)
 {
-	// Check parameter
-	if(!output)
-		return;
+	size_t start = 0;
+	size_t end   = 0;
+	int    ok    = TRUE;
 
-	ssize_t read_size;
+	if(!discard)
+		return decrypt_sectors(crypt, nb_sectors, input, disk_offset, output);
 
-	/*
-	 * NTFS's boot sectors are saved into the field "boot_sectors_backup" into
-	 * metadata's header: the information structure. This field should have been
-	 * reported into the "backup_sectors_addr" field of the dis_iodata_t
-	 * structure.
-	 * So we can use them here to give a good NTFS partition's beginning.
-	 */
-	off_t from = sector_address;
-	off_t to   = from + (off_t)io_data->backup_sectors_addr;
-
-	dis_printf(L_DEBUG, "  Fixing sector (7): from %#" F_OFF_T " to %#" F_OFF_T
-	                 "\n", from, to);
+	while(start < nb_sectors)
+	{
+		for(; start < nb_sectors; start++)
+		{
+			if(!is_zero_sector(input + start * sector_size, sector_size))
+				break;
+			memset(output + start * sector_size, 0, sector_size);
+		}
 
-	to += io_data->part_off;
+		for(end = start; end < nb_sectors; end++)
+			if(is_zero_sector(input + end * sector_size, sector_size))
+				break;
 
-	/* Read the real sector we need, at the offset we need it */
-	read_size = pread(io_data->volume_fd, input, io_data->sector_size, to);
+		if(end > start && !decrypt_sectors(
+			crypt,
+			end - start,
+			input + start * sector_size,
+			disk_offset + (off_t)(start * sector_size),
+			output + start * sector_size))
+			ok = FALSE;
 
-	if(read_size <= 0)
-	{
-		dis_printf(
-			L_ERROR,
-			"Unable to read %#" F_SIZE_T " bytes from %#" F_OFF_T "\n",
-			io_data->sector_size,
-			to
-		);
-		return;
+		start = end;
 	}
 
-	to -= io_data->part_off;
+	return ok;
+}
+
 
-	/* If the sector wasn't yet encrypted, don't decrypt it */
-	if((uint64_t)to >= io_data->encrypted_volume_size)
+/**
+ * Deallocate a range of the disk, reading as zeroes afterward
+ *
+ * @param fd The volume's file descriptor
+ * @param offset Where the range begins on the volume
+ * @param size The size of the range
+ * @return 0 on success, a negative errno value otherwise
+ */
+static int punch_hole(int fd, off_t offset, off_t size)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	/* On block devices, this unmaps the sectors if it can be done, only */
+	if(fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0)
+		return 0;
+
+	return -errno;
+#else
+	(void) fd;
+	(void) offset;
+	(void) size;
+	return -EOPNOTSUPP;
+#endif
+}
+
+
+/**
+ * Deallocate the sectors of a run, except the metadata ones
+ * @see discard_sectors()
+ */
+static int discard_run(dis_iodata_t* io_data, dis_run_t* run, uint16_t sector_size)
+{
+	off_t    offset = run->offset;
+	off_t    end    = run->offset + (off_t)(run->nb_sectors * sector_size);
+	off_t    limit  = 0;
+	uint8_t* zeroes = NULL;
+	int      ret    = 0;
+
+	while(offset < end && ret == 0)
 	{
-		memcpy(output, input, io_data->sector_size);
+		limit = dis_metadata_next_region_edge(io_data->metadata, offset);
+		if(limit == 0 || limit > end)
+			limit = end;
+
+		if(dis_metadata_is_overwritten(io_data->metadata, offset, sector_size)
+		   == DIS_RET_ERROR_METADATA_FILE_OVERWRITE)
+		{
+			/* Up to the first sector which is out of the metadata */
+			limit = ((limit + sector_size - 1) / sector_size) * sector_size;
+			if(limit > end)
+				limit = end;
+		}
+		else
+		{
+			/* Up to the last sector which is out of the metadata */
+			limit = (limit / sector_size) * sector_size;
+			if(limit <= offset)
+				limit = offset + sector_size;
+
+			if(run->type == DIS_RUN_VISTA_VBR)
+			{
+				/* Vista's boot sectors are not deallocated, but zeroed */
+				zeroes = calloc(1, (size_t)(limit - offset));
+				if(!zeroes)
+					return -ENOMEM;
+
+				if(!encrypt_write_sectors(
+					io_data,
+					(size_t)(limit - offset) / sector_size,
+					sector_size,
+					offset,
+					zeroes))
+					ret = -EIO;
+
+				free(zeroes);
+			}
+			else
+				ret = punch_hole(
+					io_data->volume_fd,
+					run->disk_offset + (offset - run->offset) + io_data->part_off,
+					limit - offset
+				);
+		}
+
+		offset = limit;
 	}
-	else
+
+	return ret;
+}
+
+
+/**
+ * Encrypt the part of a sector region which belongs to a job
+ *
+ * @param params The structure used for thread parameters storage
+ * @param job The index of the job, telling which part of the region to encrypt
+ */
+static void thread_encrypt(void* params, size_t job)
+{
+	if(!params)
+		return;
+
+	thread_arg_t* args    = (thread_arg_t*) params;
+	dis_iodata_t* io_data = args->io_data;
+	uint16_t sector_size  = args->sector_size;
+
+	size_t   first        = 0;
+	size_t   last         = 0;
+	size_t   loop         = 0;
+	size_t   run_idx      = 0;
+	int      part         = 0;
+	dis_run_t* run        = NULL;
+
+	off_t    offset       = 0;
+	off_t    disk_offset  = 0;
+	uint8_t* loop_input   = NULL;
+	uint8_t* loop_output  = NULL;
+
+
+	for(run_idx = 0; run_idx < args->nb_runs; run_idx++)
 	{
-		decrypt_sector(
-			io_data->crypt,
-			input,
-			to,
-			output
-		);
+		run  = &args->runs[run_idx];
+		part = job_part_of_run(args, job, run, &first, &last);
+
+		if(part > 0)
+			break;
+		if(part < 0)
+			continue;
+
+		offset      = run->offset + (off_t)(first * sector_size);
+		disk_offset = run->disk_offset + (off_t)(first * sector_size);
+		loop_input  = args->input + (offset - args->sector_start);
+		loop_output = args->output + (offset - args->sector_start);
+
+		/*
+		 * Just encrypt these sectors
+		 * Exceptions: don't encrypt them if they weren't (as in the
+		 * "BitLocker's-volume-encryption-was-paused case described in the
+		 * decryption function above") and fix Vista's boot sectors.
+		 * See runs.c for the classification.
+		 */
+		switch(run->type)
+		{
+			case DIS_RUN_ZEROED:
+				/* Never written */
+				break;
+
+			case DIS_RUN_PLAINTEXT:
+				memcpy(loop_output, loop_input, (last - first) * sector_size);
+				break;
+
+			case DIS_RUN_VISTA_VBR:
+				for(loop = first; loop < last; loop++,
+				    loop_input += sector_size, loop_output += sector_size)
+					fix_write_sector_vista(io_data, loop_input, loop_output);
+				break;
+
+			case DIS_RUN_ENCRYPTED:
+			default:
+				if(!encrypt_sectors(
+					io_data->crypt,
+					last - first,
+					loop_input,
+					disk_offset,
+					loop_output
+				))
+				{
+					dis_printf(L_CRITICAL, "Encryption of sectors %#" F_OFF_T
+					           " (%" F_SIZE_T " sectors) failed!\n",
+					           disk_offset, last - first);
+					__atomic_store_n(&args->failed, TRUE, __ATOMIC_RELAXED);
+				}
+				break;
+		}
 	}
 }
 
 
+
+
+
+
 /**
  * "Fix" the firsts sectors of a BitLocker volume encrypted with W$ Vista for
  * read operation
@@ -586,7 +1538,8 @@ static void fix_read_sector_vista(dis_iodata_t* io_data,
 	/*
 	 * Only two fields need to be changed: the NTFS signature and the MFT mirror
 	 */
-	memcpy(output, input, io_data->sector_size);
+	if(output != input)
+		memcpy(output, input, io_data->sector_size);
 
 	dis_metadata_vista_vbr_fve2ntfs(io_data->metadata, output);
 }
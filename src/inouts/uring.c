@@ -0,0 +1,562 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dislocker/common.h"
+#include "dislocker/inouts/uring.h"
+
+#ifdef _HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+
+/*
+ * The ring is driven through the raw system calls, so that no other library is
+ * needed. Only one request uses the ring at a time; concurrent requests fall
+ * back to the classical system calls instead of waiting for it.
+ */
+struct _dis_uring
+{
+	pthread_mutex_t lock;
+
+	/* Set when the kernel refuses our operations */
+	int             broken;
+
+#ifdef _HAVE_IO_URING
+	int             ring_fd;
+	unsigned int    entries;
+
+	/* Submission queue */
+	void*           sq_ptr;
+	size_t          sq_len;
+	unsigned int*   sq_head;
+	unsigned int*   sq_tail;
+	unsigned int*   sq_mask;
+	unsigned int*   sq_array;
+	struct io_uring_sqe* sqes;
+	size_t          sqes_len;
+
+	/* Completion queue */
+	void*           cq_ptr;
+	size_t          cq_len;
+	unsigned int*   cq_head;
+	unsigned int*   cq_tail;
+	unsigned int*   cq_mask;
+	struct io_uring_cqe* cqes;
+#endif
+};
+
+
+
+/**
+ * Do an I/O, or finish it, with the classical system calls
+ *
+ * @param fd The file descriptor to read from or write to
+ * @param io The I/O to do
+ * @param done The number of bytes already transferred
+ */
+static void sync_io(int fd, dis_uring_io_t* io, size_t done)
+{
+	ssize_t ret = 0;
+
+	while(done < io->size)
+	{
+		if(io->write)
+			ret = pwrite(
+				fd,
+				io->buffer + done,
+				io->size - done,
+				io->offset + (off_t)done
+			);
+		else
+			ret = pread(
+				fd,
+				io->buffer + done,
+				io->size - done,
+				io->offset + (off_t)done
+			);
+
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			if(done == 0)
+			{
+				io->result = -errno;
+				return;
+			}
+			break;
+		}
+
+		/* End of the volume */
+		if(ret == 0)
+			break;
+
+		done += (size_t) ret;
+	}
+
+	io->result = (ssize_t) done;
+}
+
+
+/**
+ * Run a batch of I/O with the classical system calls
+ */
+static void sync_run(
+	int fd,
+	dis_uring_io_t* ios,
+	size_t nb_ios,
+	dis_uring_fn_t fn,
+	void* arg)
+{
+	size_t loop = 0;
+
+	for(loop = 0; loop < nb_ios; loop++)
+	{
+		sync_io(fd, &ios[loop], 0);
+		if(fn)
+			fn(arg, &ios[loop]);
+	}
+}
+
+
+
+#ifdef _HAVE_IO_URING
+
+static int uring_setup(unsigned int entries, struct io_uring_params* params)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(
+	int ring_fd,
+	unsigned int to_submit,
+	unsigned int min_complete,
+	unsigned int flags)
+{
+	return (int) syscall(
+		__NR_io_uring_enter,
+		ring_fd,
+		to_submit,
+		min_complete,
+		flags,
+		NULL,
+		0
+	);
+}
+
+
+/**
+ * Map the rings shared with the kernel
+ *
+ * @return TRUE on success, FALSE otherwise
+ */
+static int uring_map(dis_uring_t uring, struct io_uring_params* params)
+{
+	uring->sq_len   = params->sq_off.array
+	                  + params->sq_entries * sizeof(unsigned int);
+	uring->cq_len   = params->cq_off.cqes
+	                  + params->cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_len = params->sq_entries * sizeof(struct io_uring_sqe);
+
+	/* Newer kernels share the same mapping for both rings */
+	if(params->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(uring->cq_len > uring->sq_len)
+			uring->sq_len = uring->cq_len;
+		uring->cq_len = uring->sq_len;
+	}
+
+	uring->sq_ptr = mmap(
+		NULL,
+		uring->sq_len,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		uring->ring_fd,
+		IORING_OFF_SQ_RING
+	);
+	if(uring->sq_ptr == MAP_FAILED)
+	{
+		uring->sq_ptr = NULL;
+		return FALSE;
+	}
+
+	if(params->features & IORING_FEAT_SINGLE_MMAP)
+		uring->cq_ptr = uring->sq_ptr;
+	else
+	{
+		uring->cq_ptr = mmap(
+			NULL,
+			uring->cq_len,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,
+			uring->ring_fd,
+			IORING_OFF_CQ_RING
+		);
+		if(uring->cq_ptr == MAP_FAILED)
+		{
+			uring->cq_ptr = NULL;
+			return FALSE;
+		}
+	}
+
+	uring->sqes = mmap(
+		NULL,
+		uring->sqes_len,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		uring->ring_fd,
+		IORING_OFF_SQES
+	);
+	if(uring->sqes == MAP_FAILED)
+	{
+		uring->sqes = NULL;
+		return FALSE;
+	}
+
+	uring->sq_head  = (unsigned int*)((uint8_t*)uring->sq_ptr + params->sq_off.head);
+	uring->sq_tail  = (unsigned int*)((uint8_t*)uring->sq_ptr + params->sq_off.tail);
+	uring->sq_mask  = (unsigned int*)((uint8_t*)uring->sq_ptr + params->sq_off.ring_mask);
+	uring->sq_array = (unsigned int*)((uint8_t*)uring->sq_ptr + params->sq_off.array);
+
+	uring->cq_head  = (unsigned int*)((uint8_t*)uring->cq_ptr + params->cq_off.head);
+	uring->cq_tail  = (unsigned int*)((uint8_t*)uring->cq_ptr + params->cq_off.tail);
+	uring->cq_mask  = (unsigned int*)((uint8_t*)uring->cq_ptr + params->cq_off.ring_mask);
+	uring->cqes     = (struct io_uring_cqe*)((uint8_t*)uring->cq_ptr + params->cq_off.cqes);
+
+	uring->entries  = params->sq_entries;
+
+	return TRUE;
+}
+
+
+static void uring_unmap(dis_uring_t uring)
+{
+	if(uring->sqes)
+		munmap(uring->sqes, uring->sqes_len);
+	if(uring->cq_ptr && uring->cq_ptr != uring->sq_ptr)
+		munmap(uring->cq_ptr, uring->cq_len);
+	if(uring->sq_ptr)
+		munmap(uring->sq_ptr, uring->sq_len);
+}
+
+
+/**
+ * Put an I/O into the submission queue
+ * @warning The ring's lock has to be held
+ */
+static void uring_queue(
+	dis_uring_t uring,
+	unsigned int* tail,
+	int fd,
+	dis_uring_io_t* io,
+	size_t index)
+{
+	unsigned int idx = *tail & *uring->sq_mask;
+	struct io_uring_sqe* sqe = &uring->sqes[idx];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode    = io->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd        = fd;
+	sqe->off       = (uint64_t) io->offset;
+	sqe->addr      = (uint64_t) (uintptr_t) io->buffer;
+	sqe->len       = (uint32_t) io->size;
+	sqe->user_data = (uint64_t) index;
+
+	uring->sq_array[idx] = idx;
+	(*tail)++;
+}
+
+
+/**
+ * Handle the completions the kernel posted, redoing the failed or short I/O
+ * with the classical system calls
+ * @warning The ring's lock has to be held
+ *
+ * @param inflight The number of I/O in flight, decremented for each completion
+ */
+static void uring_reap(
+	dis_uring_t uring,
+	int fd,
+	dis_uring_io_t* ios,
+	size_t* inflight,
+	dis_uring_fn_t fn,
+	void* arg)
+{
+	unsigned int    head = *uring->cq_head;
+	dis_uring_io_t* io   = NULL;
+	int32_t         res  = 0;
+
+	while(head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		io  = &ios[uring->cqes[head & *uring->cq_mask].user_data];
+		res = uring->cqes[head & *uring->cq_mask].res;
+
+		head++;
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+		(*inflight)--;
+
+		if(res == -EINVAL || res == -EOPNOTSUPP)
+		{
+			/* Too old a kernel, don't bother it anymore */
+			uring->broken = 1;
+			sync_io(fd, io, 0);
+		}
+		else if(res < 0)
+			sync_io(fd, io, 0);
+		else if((size_t) res < io->size && res > 0)
+			sync_io(fd, io, (size_t) res);
+		else
+			io->result = res;
+
+		if(fn)
+			fn(arg, io);
+	}
+}
+
+
+/**
+ * Run a batch of I/O through the ring
+ * @warning The ring's lock has to be held
+ *
+ * @return TRUE if every I/O has been handled, FALSE if the ring failed
+ */
+static int uring_run(
+	dis_uring_t uring,
+	int fd,
+	dis_uring_io_t* ios,
+	size_t nb_ios,
+	dis_uring_fn_t fn,
+	void* arg)
+{
+	size_t       next     = 0;
+	size_t       inflight = 0;
+	unsigned int tail     = *uring->sq_tail;
+	unsigned int pending  = 0;
+	int          ret      = 0;
+
+	while(next < nb_ios || inflight > 0)
+	{
+		/* Fill the submission queue as much as we can */
+		while(next < nb_ios && inflight < uring->entries)
+		{
+			uring_queue(uring, &tail, fd, &ios[next], next);
+			next++;
+			inflight++;
+		}
+		__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+		/* Submit what's left and wait for at least one completion */
+		do
+		{
+			pending = tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+			ret = uring_enter(
+				uring->ring_fd,
+				pending,
+				1,
+				IORING_ENTER_GETEVENTS
+			);
+		} while(ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+		if(ret < 0)
+		{
+			dis_printf(
+				L_ERROR,
+				"io_uring_enter failed: %s\n",
+				strerror(errno)
+			);
+			/* Take back what the kernel didn't get */
+			pending = tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+			tail     -= pending;
+			next     -= pending;
+			inflight -= pending;
+			__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+			uring->broken = 1;
+
+			/*
+			 * The kernel may still be using the buffers of the submitted
+			 * ones, which the caller frees or reuses once we're back
+			 */
+			while(inflight > 0)
+			{
+				ret = uring_enter(
+					uring->ring_fd,
+					0,
+					(unsigned int) inflight,
+					IORING_ENTER_GETEVENTS
+				);
+				if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				{
+					dis_printf(
+						L_ERROR,
+						"Cannot wait for the I/O in flight: %s\n",
+						strerror(errno)
+					);
+					return FALSE;
+				}
+
+				uring_reap(uring, fd, ios, &inflight, fn, arg);
+			}
+
+			sync_run(fd, ios + next, nb_ios - next, fn, arg);
+			return TRUE;
+		}
+
+		/* Handle what's completed */
+		uring_reap(uring, fd, ios, &inflight, fn, arg);
+	}
+
+	return TRUE;
+}
+
+#endif /* _HAVE_IO_URING */
+
+
+
+/**
+ * Create a ring to submit several I/O at once
+ *
+ * @param depth The number of I/O which can be in flight at once
+ * @return The ring, or NULL if it isn't supported, in which case
+ * dis_uring_run() uses the classical system calls
+ */
+dis_uring_t dis_uring_new(unsigned int depth)
+{
+#ifdef _HAVE_IO_URING
+	struct io_uring_params params;
+	dis_uring_t uring = dis_malloc(sizeof(struct _dis_uring));
+
+	memset(uring, 0, sizeof(struct _dis_uring));
+	memset(&params, 0, sizeof(params));
+
+	uring->ring_fd = uring_setup(depth, &params);
+	if(uring->ring_fd < 0)
+	{
+		dis_printf(
+			L_DEBUG,
+			"io_uring not available (%s), using classical I/O\n",
+			strerror(errno)
+		);
+		dis_free(uring);
+		return NULL;
+	}
+
+	if(!uring_map(uring, &params))
+	{
+		dis_printf(
+			L_WARNING,
+			"Cannot map io_uring's rings (%s), using classical I/O\n",
+			strerror(errno)
+		);
+		uring_unmap(uring);
+		close(uring->ring_fd);
+		dis_free(uring);
+		return NULL;
+	}
+
+	pthread_mutex_init(&uring->lock, NULL);
+
+	dis_printf(L_DEBUG, "Using io_uring with %u entries\n", uring->entries);
+
+	return uring;
+#else
+	(void) depth;
+	return NULL;
+#endif
+}
+
+
+/**
+ * Run a batch of I/O, calling a function for each completed one. The I/O are
+ * submitted at once when the ring is available, and completion order isn't
+ * guaranteed. Short transfers are completed before the function is called,
+ * only the end of the volume can make them short.
+ *
+ * @param uring The ring to use, may be NULL to use the classical system calls
+ * @param fd The file descriptor to read from or write to
+ * @param ios The I/O to run
+ * @param nb_ios The number of I/O
+ * @param fn The function called on each completion, may be NULL
+ * @param arg The argument given to fn
+ * @return TRUE if every I/O has been handled, FALSE otherwise
+ */
+int dis_uring_run(
+	dis_uring_t uring,
+	int fd,
+	dis_uring_io_t* ios,
+	size_t nb_ios,
+	dis_uring_fn_t fn,
+	void* arg)
+{
+	if(!ios)
+		return FALSE;
+
+#ifdef _HAVE_IO_URING
+	int ret = TRUE;
+
+	if(uring && !uring->broken && nb_ios > 1 &&
+	   pthread_mutex_trylock(&uring->lock) == 0)
+	{
+		if(!uring->broken)
+			ret = uring_run(uring, fd, ios, nb_ios, fn, arg);
+		else
+			sync_run(fd, ios, nb_ios, fn, arg);
+
+		pthread_mutex_unlock(&uring->lock);
+		return ret;
+	}
+#else
+	(void) uring;
+#endif
+
+	sync_run(fd, ios, nb_ios, fn, arg);
+
+	return TRUE;
+}
+
+
+/**
+ * Release a ring
+ *
+ * @param uring The ring to destroy
+ */
+void dis_uring_destroy(dis_uring_t uring)
+{
+	if(!uring)
+		return;
+
+#ifdef _HAVE_IO_URING
+	uring_unmap(uring);
+	close(uring->ring_fd);
+#endif
+	pthread_mutex_destroy(&uring->lock);
+	dis_free(uring);
+}
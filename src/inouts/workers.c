@@ -0,0 +1,472 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <pthread.h>
+
+#include "dislocker/common.h"
+#include "dislocker/inouts/workers.h"
+
+
+/*
+ * A batch is a set of jobs submitted at once by a caller. The caller works on
+ * its own batch too, so it never waits for a thread which is busy elsewhere
+ * before its batch is done.
+ */
+typedef struct _dis_batch
+{
+	dis_workers_fn_t fn;
+	void*            arg;
+
+	size_t           nb_jobs;
+	/* Index of the next job to give to a thread */
+	size_t           next_job;
+	/* Number of jobs which are over */
+	size_t           nb_done;
+
+	/*
+	 * Set for batches queued by dis_workers_post(), nobody waits for them so
+	 * they are freed by the thread running them
+	 */
+	int                   posted;
+	dis_workers_post_fn_t post_fn;
+	void*                 post_arg;
+
+	struct _dis_batch* next;
+} dis_batch_t;
+
+
+struct _dis_workers
+{
+	pthread_mutex_t lock;
+	/* Signaled when a batch is queued or when the pool is shutting down */
+	pthread_cond_t  work_cond;
+	/* Signaled when the last job of a batch is over */
+	pthread_cond_t  done_cond;
+
+	/* Number of posted batches not over yet */
+	size_t          nb_posted;
+
+	/* Batches which still have jobs to give */
+	dis_batch_t*    head;
+	dis_batch_t*    tail;
+
+	int             stop;
+	int             started;
+
+	/* Background threads, the callers' ones are not counted here */
+	unsigned int    nb_wanted;
+	unsigned int    nb_threads;
+	pthread_t*      threads;
+};
+
+
+
+/**
+ * Remove a batch from the list of batches still having jobs to give
+ * @warning The pool's lock has to be held
+ */
+static void unqueue_batch(dis_workers_t workers, dis_batch_t* batch)
+{
+	dis_batch_t* prev = NULL;
+	dis_batch_t* curr = workers->head;
+
+	while(curr && curr != batch)
+	{
+		prev = curr;
+		curr = curr->next;
+	}
+
+	if(!curr)
+		return;
+
+	if(prev)
+		prev->next = curr->next;
+	else
+		workers->head = curr->next;
+
+	if(workers->tail == curr)
+		workers->tail = prev;
+
+	curr->next = NULL;
+}
+
+
+/**
+ * Get a job's index out of a batch, unqueuing the batch if it was its last one
+ * @warning The pool's lock has to be held
+ */
+static size_t take_job(dis_workers_t workers, dis_batch_t* batch)
+{
+	size_t job = batch->next_job++;
+
+	if(batch->next_job == batch->nb_jobs)
+		unqueue_batch(workers, batch);
+
+	return job;
+}
+
+
+/**
+ * Mark a job as being over, waking up the batch's submitter if needed
+ * @warning The pool's lock has to be held
+ */
+static void end_job(dis_workers_t workers, dis_batch_t* batch)
+{
+	batch->nb_done++;
+
+	if(batch->nb_done == batch->nb_jobs)
+		pthread_cond_broadcast(&workers->done_cond);
+}
+
+
+/**
+ * Job of the batches queued by dis_workers_post()
+ */
+static void run_posted(void* arg, size_t job)
+{
+	(void) job;
+	dis_batch_t* batch = (dis_batch_t*) arg;
+
+	batch->post_fn(batch->post_arg);
+}
+
+
+/**
+ * Main loop of the pool's background threads
+ *
+ * @param params The pool the thread belongs to
+ */
+static void* worker_loop(void* params)
+{
+	dis_workers_t workers = (dis_workers_t) params;
+	dis_batch_t*  batch   = NULL;
+	size_t        job     = 0;
+
+	pthread_mutex_lock(&workers->lock);
+
+	while(1)
+	{
+		while(!workers->stop && !workers->head)
+			pthread_cond_wait(&workers->work_cond, &workers->lock);
+
+		if(workers->stop)
+			break;
+
+		batch = workers->head;
+		job   = take_job(workers, batch);
+
+		pthread_mutex_unlock(&workers->lock);
+		batch->fn(batch->arg, job);
+		pthread_mutex_lock(&workers->lock);
+
+		end_job(workers, batch);
+
+		if(batch->posted)
+		{
+			workers->nb_posted--;
+			if(workers->nb_posted == 0)
+				pthread_cond_broadcast(&workers->done_cond);
+			dis_free(batch);
+		}
+	}
+
+	pthread_mutex_unlock(&workers->lock);
+
+	return NULL;
+}
+
+
+/**
+ * Start the pool's background threads, the first time they are needed. They
+ * are not started by dis_workers_new() so that the pool survives the process
+ * forking in between, as FUSE does when it goes to the background.
+ * @warning The pool's lock has to be held
+ */
+static void start_threads(dis_workers_t workers)
+{
+	if(workers->started)
+		return;
+
+	workers->started = 1;
+
+	for(workers->nb_threads = 0; workers->nb_threads < workers->nb_wanted;
+	    workers->nb_threads++)
+	{
+		if(pthread_create(
+			&workers->threads[workers->nb_threads],
+			NULL,
+			worker_loop,
+			workers) != 0)
+		{
+			dis_printf(
+				L_WARNING,
+				"Cannot create worker thread #%u, going on with %u\n",
+				workers->nb_threads + 1,
+				workers->nb_threads + 1
+			);
+			break;
+		}
+	}
+
+	dis_printf(
+		L_DEBUG,
+		"Worker pool started with %u background thread(s)\n",
+		workers->nb_threads
+	);
+}
+
+
+/**
+ * Create the pool of threads. The threads are started when the pool is first
+ * used.
+ *
+ * @param nb_threads Total number of threads to use for a request, including
+ * the calling one. With 1 or less, every job is run on the calling thread.
+ * @return The newly allocated pool
+ */
+dis_workers_t dis_workers_new(unsigned int nb_threads)
+{
+	dis_workers_t workers = dis_malloc(sizeof(struct _dis_workers));
+	memset(workers, 0, sizeof(struct _dis_workers));
+
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->work_cond, NULL);
+	pthread_cond_init(&workers->done_cond, NULL);
+
+	if(nb_threads > DIS_WORKERS_MAX)
+		nb_threads = DIS_WORKERS_MAX;
+
+	if(nb_threads <= 1)
+		return workers;
+
+	workers->nb_wanted = nb_threads - 1;
+	workers->threads   = dis_malloc(workers->nb_wanted * sizeof(pthread_t));
+
+	return workers;
+}
+
+
+/**
+ * Get the number of threads which can work on the same request, including the
+ * calling one
+ */
+unsigned int dis_workers_count(dis_workers_t workers)
+{
+	if(!workers)
+		return 1;
+
+	return workers->nb_wanted + 1;
+}
+
+
+/**
+ * Compute in how many jobs a request should be split
+ *
+ * @param workers The pool which will run the jobs
+ * @param size The size, in bytes, the request is working on
+ * @return The number of jobs, at least 1
+ */
+size_t dis_workers_jobs_for(dis_workers_t workers, size_t size)
+{
+	size_t nb_jobs = size / DIS_WORKERS_MIN_JOB_SIZE;
+	size_t count   = dis_workers_count(workers);
+
+	if(nb_jobs > count)
+		nb_jobs = count;
+
+	return nb_jobs ? nb_jobs : 1;
+}
+
+
+/**
+ * Run a batch of jobs on the pool and wait for them to be over. The calling
+ * thread runs jobs too.
+ *
+ * @param workers The pool to use, may be NULL to run everything inline
+ * @param nb_jobs The number of jobs to run
+ * @param fn The function called for each job
+ * @param arg The argument given to fn, along with the job's index
+ */
+void dis_workers_run(
+	dis_workers_t workers,
+	size_t nb_jobs,
+	dis_workers_fn_t fn,
+	void* arg)
+{
+	dis_batch_t batch;
+	size_t      job = 0;
+
+	if(!fn || nb_jobs == 0)
+		return;
+
+	/* Nothing to share, don't bother the background threads */
+	if(!workers || workers->nb_wanted == 0 || nb_jobs == 1)
+	{
+		for(job = 0; job < nb_jobs; job++)
+			fn(arg, job);
+		return;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.fn      = fn;
+	batch.arg     = arg;
+	batch.nb_jobs = nb_jobs;
+
+	pthread_mutex_lock(&workers->lock);
+
+	/* If no thread could be started, all the jobs are taken below */
+	start_threads(workers);
+
+	if(workers->tail)
+		workers->tail->next = &batch;
+	else
+		workers->head = &batch;
+	workers->tail = &batch;
+
+	pthread_cond_broadcast(&workers->work_cond);
+
+	/* Take our share of the work */
+	while(batch.next_job < batch.nb_jobs)
+	{
+		job = take_job(workers, &batch);
+
+		pthread_mutex_unlock(&workers->lock);
+		fn(arg, job);
+		pthread_mutex_lock(&workers->lock);
+
+		end_job(workers, &batch);
+	}
+
+	/* Then wait for the jobs other threads took */
+	while(batch.nb_done < batch.nb_jobs)
+		pthread_cond_wait(&workers->done_cond, &workers->lock);
+
+	pthread_mutex_unlock(&workers->lock);
+}
+
+
+/**
+ * Queue a function to be run by one of the pool's threads and return without
+ * waiting for it. If the pool has no background thread, the function is run
+ * on the calling thread before returning.
+ *
+ * @param workers The pool to use, may be NULL to run the function inline
+ * @param fn The function to run
+ * @param arg The argument given to fn
+ */
+void dis_workers_post(
+	dis_workers_t workers,
+	dis_workers_post_fn_t fn,
+	void* arg)
+{
+	dis_batch_t* batch = NULL;
+
+	if(!fn)
+		return;
+
+	if(!workers || workers->nb_wanted == 0)
+	{
+		fn(arg);
+		return;
+	}
+
+	pthread_mutex_lock(&workers->lock);
+	start_threads(workers);
+
+	if(workers->nb_threads == 0)
+	{
+		pthread_mutex_unlock(&workers->lock);
+		fn(arg);
+		return;
+	}
+
+	batch = dis_malloc(sizeof(dis_batch_t));
+	memset(batch, 0, sizeof(dis_batch_t));
+	batch->fn       = run_posted;
+	batch->arg      = batch;
+	batch->nb_jobs  = 1;
+	batch->posted   = 1;
+	batch->post_fn  = fn;
+	batch->post_arg = arg;
+
+	if(workers->tail)
+		workers->tail->next = batch;
+	else
+		workers->head = batch;
+	workers->tail = batch;
+	workers->nb_posted++;
+
+	pthread_cond_signal(&workers->work_cond);
+	pthread_mutex_unlock(&workers->lock);
+}
+
+
+/**
+ * Wait for all the functions queued through dis_workers_post() to be over,
+ * including the ones they queue themselves
+ *
+ * @param workers The pool the functions were queued to
+ */
+void dis_workers_wait(dis_workers_t workers)
+{
+	if(!workers)
+		return;
+
+	pthread_mutex_lock(&workers->lock);
+
+	while(workers->nb_posted > 0)
+		pthread_cond_wait(&workers->done_cond, &workers->lock);
+
+	pthread_mutex_unlock(&workers->lock);
+}
+
+
+/**
+ * Stop the pool's threads and free it
+ *
+ * @param workers The pool to destroy
+ */
+void dis_workers_destroy(dis_workers_t workers)
+{
+	unsigned int loop = 0;
+
+	if(!workers)
+		return;
+
+	pthread_mutex_lock(&workers->lock);
+	workers->stop = 1;
+	pthread_cond_broadcast(&workers->work_cond);
+	pthread_mutex_unlock(&workers->lock);
+
+	for(loop = 0; loop < workers->nb_threads; loop++)
+		pthread_join(workers->threads[loop], NULL);
+
+	if(workers->threads)
+		dis_free(workers->threads);
+
+	pthread_cond_destroy(&workers->done_cond);
+	pthread_cond_destroy(&workers->work_cond);
+	pthread_mutex_destroy(&workers->lock);
+
+	dis_free(workers);
+}
@@ -1307,6 +1307,40 @@ int dis_metadata_is_overwritten(
 }
 
 
+/**
+ * Get the first edge (beginning or end) of a virtualized region which is
+ * located after the given offset
+ *
+ * @param dis_meta The metadata structure
+ * @param offset The offset to start looking from
+ * @return The offset of the edge, or 0 if there's none after offset
+ */
+off_t dis_metadata_next_region_edge(dis_metadata_t dis_meta, off_t offset)
+{
+	if(!dis_meta)
+		return 0;
+
+	off_t  edge      = 0;
+	off_t  candidate = 0;
+	size_t virt_loop = 0;
+
+	for(virt_loop = 0; virt_loop < dis_meta->nb_virt_region; virt_loop++)
+	{
+		if(dis_meta->virt_region[virt_loop].size == 0)
+			continue;
+
+		candidate = (off_t)dis_meta->virt_region[virt_loop].addr;
+		if(candidate <= offset)
+			candidate += (off_t)dis_meta->virt_region[virt_loop].size;
+
+		if(candidate > offset && (edge == 0 || candidate < edge))
+			edge = candidate;
+	}
+
+	return edge;
+}
+
+
 /**
  * Retrieve the volume size from the first sector.
  *
@@ -1401,6 +1435,11 @@ uint32_t dis_metadata_backup_sectors_count(dis_metadata_t dis_meta)
 	return dis_meta->information->nb_backup_sectors;
 }
 
+off_t dis_metadata_virtualized_size(dis_metadata_t dis_meta)
+{
+	return dis_meta->virtualized_size;
+}
+
 int dis_metadata_is_decrypted_state(dis_metadata_t dis_meta) {
 	return dis_meta->information->curr_state == METADATA_STATE_DECRYPTED;
 }
@@ -0,0 +1,551 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "dislocker/common.h"
+#include "dislocker/ntfs/bitmap.h"
+
+
+/* The $Bitmap's record number in the MFT */
+#define NTFS_BITMAP_RECORD 6
+
+/* Records end each of their 512 bytes blocks with an update sequence number */
+#define NTFS_USA_BLOCK_SIZE 512
+
+/* Attribute types */
+#define NTFS_ATTR_DATA 0x80
+#define NTFS_ATTR_END  0xffffffff
+
+/* The bitmap is decrypted by chunks of this size */
+#define NTFS_BITMAP_CHUNK (16 * 1024 * 1024)
+
+
+
+struct _dis_ntfs_bitmap
+{
+	dis_context_t   dis_ctx;
+
+	/* Taken while looking into the bitmap or reading it */
+	pthread_mutex_t lock;
+
+	/* Set when the volume is written, the bitmap is read again then */
+	int             stale;
+	/* Set if the bitmap can't be read, it's not tried again until it's stale */
+	int             failed;
+
+	uint32_t        cluster_size;
+	uint64_t        nb_clusters;
+	/* One bit per cluster, set if the cluster is allocated */
+	uint8_t*        bits;
+};
+
+
+
+/**
+ * Read an unsigned little-endian value of up to 8 bytes
+ */
+static uint64_t read_le(const uint8_t* data, size_t size)
+{
+	uint64_t value = 0;
+
+	while(size > 0)
+	{
+		size--;
+		value = (value << 8) | data[size];
+	}
+
+	return value;
+}
+
+
+/**
+ * Read a signed little-endian value of 1 to 8 bytes
+ */
+static int64_t read_sle(const uint8_t* data, size_t size)
+{
+	uint64_t value = read_le(data, size);
+
+	if(size < 8 && (data[size - 1] & 0x80))
+		value |= UINT64_MAX << (size * 8);
+
+	return (int64_t)value;
+}
+
+
+/**
+ * Decrypt a region of the volume, entirely
+ *
+ * @return TRUE if the region could be decrypted, FALSE otherwise
+ */
+static int read_volume(
+	dis_ntfs_bitmap_t bitmap,
+	uint8_t* buffer,
+	uint64_t offset,
+	size_t size)
+{
+	size_t chunk = 0;
+
+	while(size > 0)
+	{
+		chunk = size < NTFS_BITMAP_CHUNK ? size : NTFS_BITMAP_CHUNK;
+
+		if(offset > INT64_MAX - chunk ||
+		   dislock(bitmap->dis_ctx, buffer, (off_t)offset, chunk) != (int)chunk)
+			return FALSE;
+
+		buffer += chunk;
+		offset += chunk;
+		size   -= chunk;
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Parse the NTFS boot sector of the decrypted volume
+ *
+ * @param bitmap The bitmap whose cluster_size and nb_clusters are set
+ * @param mft_offset Where to put the MFT's offset
+ * @param record_size Where to put the size of the MFT's records
+ * @return TRUE if the volume holds an NTFS filesystem, FALSE otherwise
+ */
+static int read_boot_sector(
+	dis_ntfs_bitmap_t bitmap,
+	uint64_t* mft_offset,
+	uint32_t* record_size)
+{
+	uint8_t  boot[512];
+	uint32_t bytes_per_sector    = 0;
+	uint32_t sectors_per_cluster = 0;
+	uint64_t mft_lcn             = 0;
+	int8_t   clusters_per_record = 0;
+
+	if(!read_volume(bitmap, boot, 0, sizeof(boot)))
+		return FALSE;
+
+	if(memcmp(boot + 3, NTFS_SIGNATURE, NTFS_SIGNATURE_SIZE) != 0)
+	{
+		dis_printf(L_WARNING, "The decrypted volume doesn't hold an NTFS filesystem\n");
+		return FALSE;
+	}
+
+	bytes_per_sector    = (uint32_t)read_le(boot + 0x0b, 2);
+	sectors_per_cluster = boot[0x0d];
+	mft_lcn             = read_le(boot + 0x30, 8);
+	clusters_per_record = (int8_t)boot[0x40];
+
+	/* Clusters bigger than 64k are given as a negative shift, 2^12 at most */
+	if(sectors_per_cluster > 0x80)
+	{
+		if(256 - sectors_per_cluster > 12)
+			return FALSE;
+
+		sectors_per_cluster = 1u << (256 - sectors_per_cluster);
+	}
+
+	if(bytes_per_sector < 256 || bytes_per_sector > 4096 ||
+	   (bytes_per_sector & (bytes_per_sector - 1)) ||
+	   sectors_per_cluster == 0 || sectors_per_cluster > 4096)
+		return FALSE;
+
+	bitmap->cluster_size = bytes_per_sector * sectors_per_cluster;
+	bitmap->nb_clusters  = read_le(boot + 0x28, 8) / sectors_per_cluster;
+
+	if(clusters_per_record > 0)
+		*record_size = (uint32_t)clusters_per_record * bitmap->cluster_size;
+	else if(clusters_per_record >= -16 && clusters_per_record <= -9)
+		*record_size = 1u << -clusters_per_record;
+	else
+		return FALSE;
+
+	if(*record_size < NTFS_USA_BLOCK_SIZE || *record_size > 65536 ||
+	   mft_lcn >= bitmap->nb_clusters)
+		return FALSE;
+
+	*mft_offset = mft_lcn * bitmap->cluster_size;
+
+	return TRUE;
+}
+
+
+/**
+ * Replace the update sequence numbers at the end of each of the record's
+ * blocks by the bytes they stand for
+ *
+ * @return TRUE if the record is consistent, FALSE otherwise
+ */
+static int apply_fixups(uint8_t* record, uint32_t record_size)
+{
+	uint32_t usa_offset = (uint32_t)read_le(record + 4, 2);
+	uint32_t usa_count  = (uint32_t)read_le(record + 6, 2);
+	uint32_t loop       = 0;
+	uint8_t* block_end  = NULL;
+
+	if(memcmp(record, "FILE", 4) != 0 ||
+	   usa_count != record_size / NTFS_USA_BLOCK_SIZE + 1 ||
+	   usa_offset + usa_count * 2 > record_size)
+		return FALSE;
+
+	for(loop = 1; loop < usa_count; loop++)
+	{
+		block_end = record + loop * NTFS_USA_BLOCK_SIZE - 2;
+
+		if(memcmp(block_end, record + usa_offset, 2) != 0)
+			return FALSE;
+
+		memcpy(block_end, record + usa_offset + loop * 2, 2);
+	}
+
+	return TRUE;
+}
+
+
+/**
+ * Decrypt the clusters a non-resident attribute's runlist points to
+ *
+ * @param bitmap The bitmap, whose cluster_size is set
+ * @param runlist The attribute's mapping pairs
+ * @param runlist_size The number of bytes runlist can be read from
+ * @param output Where to put the attribute's data
+ * @param size The number of bytes of data to read
+ * @return TRUE if all the data could be read, FALSE otherwise
+ */
+static int read_runlist(
+	dis_ntfs_bitmap_t bitmap,
+	const uint8_t* runlist,
+	size_t runlist_size,
+	uint8_t* output,
+	uint64_t size)
+{
+	size_t   pos         = 0;
+	size_t   length_size = 0;
+	size_t   lcn_size    = 0;
+	uint64_t length      = 0;
+	int64_t  lcn         = 0;
+	uint64_t filled      = 0;
+	uint64_t chunk       = 0;
+
+	while(filled < size && pos < runlist_size && runlist[pos] != 0)
+	{
+		length_size = runlist[pos] & 0x0f;
+		lcn_size    = runlist[pos] >> 4;
+		pos++;
+
+		if(length_size == 0 || length_size > 8 || lcn_size > 8 ||
+		   pos + length_size + lcn_size > runlist_size)
+			return FALSE;
+
+		length = read_le(runlist + pos, length_size);
+		pos += length_size;
+
+		/* The last run may go past the bitmap's end */
+		chunk = size - filled;
+		if(length <= chunk / bitmap->cluster_size)
+			chunk = length * bitmap->cluster_size;
+
+		/* Runs without an LCN are sparse */
+		if(lcn_size == 0)
+			memset(output + filled, 0, chunk);
+		else
+		{
+			lcn += read_sle(runlist + pos, lcn_size);
+			pos += lcn_size;
+
+			if(lcn < 0 || (uint64_t)lcn >= bitmap->nb_clusters ||
+			   !read_volume(
+			       bitmap,
+			       output + filled,
+			       (uint64_t)lcn * bitmap->cluster_size,
+			       (size_t)chunk))
+				return FALSE;
+		}
+
+		filled += chunk;
+	}
+
+	return filled == size;
+}
+
+
+/**
+ * Find the $Bitmap's unnamed $DATA attribute and read it
+ *
+ * @param bitmap The bitmap to fill
+ * @param record The $Bitmap's record, fixed up
+ * @param record_size The record's size
+ * @return TRUE if the bitmap could be read, FALSE otherwise
+ */
+static int read_data_attribute(
+	dis_ntfs_bitmap_t bitmap,
+	const uint8_t* record,
+	uint32_t record_size)
+{
+	const uint8_t* attr   = NULL;
+	uint32_t offset       = (uint32_t)read_le(record + 0x14, 2);
+	uint32_t type         = 0;
+	uint32_t length       = 0;
+	uint32_t value_offset = 0;
+	uint64_t value_size   = 0;
+	uint64_t size         = (bitmap->nb_clusters + 7) / 8;
+	int      ret          = FALSE;
+
+	while(offset + 0x18 <= record_size)
+	{
+		attr   = record + offset;
+		type   = (uint32_t)read_le(attr, 4);
+		length = (uint32_t)read_le(attr + 4, 4);
+
+		if(type == NTFS_ATTR_END || length < 0x18 ||
+		   length > record_size - offset)
+			break;
+
+		offset += length;
+
+		/* The data is unnamed */
+		if(type != NTFS_ATTR_DATA || attr[9] != 0)
+			continue;
+
+		if(attr[8] == 0)
+		{
+			value_size   = read_le(attr + 0x10, 4);
+			value_offset = (uint32_t)read_le(attr + 0x14, 2);
+			if(value_offset + value_size > length)
+				break;
+		}
+		else
+		{
+			/* A first extent starting further isn't supported */
+			if(length < 0x40 || read_le(attr + 0x10, 8) != 0)
+				break;
+
+			value_size   = read_le(attr + 0x30, 8);
+			value_offset = (uint32_t)read_le(attr + 0x20, 2);
+			if(value_offset >= length)
+				break;
+		}
+
+		if(value_size < size || size == 0 || size > SIZE_MAX)
+			break;
+
+		bitmap->bits = malloc((size_t)size);
+		if(!bitmap->bits)
+			break;
+
+		if(attr[8] == 0)
+		{
+			memcpy(bitmap->bits, attr + value_offset, (size_t)size);
+			ret = TRUE;
+		}
+		else
+			ret = read_runlist(
+				bitmap,
+				attr + value_offset,
+				length - value_offset,
+				bitmap->bits,
+				size
+			);
+
+		break;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Read the bitmap from the decrypted volume
+ * @warning The bitmap's lock has to be held
+ *
+ * @return TRUE if the bitmap could be read, FALSE otherwise
+ */
+static int load_bitmap(dis_ntfs_bitmap_t bitmap)
+{
+	uint8_t* record      = NULL;
+	uint64_t mft_offset  = 0;
+	uint32_t record_size = 0;
+	int      ret         = FALSE;
+
+	if(read_boot_sector(bitmap, &mft_offset, &record_size))
+	{
+		record = dis_malloc(record_size);
+
+		ret = read_volume(
+			bitmap,
+			record,
+			mft_offset + NTFS_BITMAP_RECORD * record_size,
+			record_size
+		);
+
+		if(ret)
+			ret = apply_fixups(record, record_size);
+
+		if(ret)
+			ret = read_data_attribute(bitmap, record, record_size);
+
+		dis_free(record);
+	}
+
+	if(!ret)
+	{
+		free(bitmap->bits);
+		bitmap->bits = NULL;
+		dis_printf(L_WARNING, "Cannot read the NTFS bitmap, its free clusters won't be reported\n");
+		return FALSE;
+	}
+
+	dis_printf(
+		L_DEBUG,
+		"NTFS bitmap read: %" PRIu64 " clusters of %u bytes\n",
+		bitmap->nb_clusters,
+		bitmap->cluster_size
+	);
+
+	return TRUE;
+}
+
+
+/**
+ * Allocate the structure keeping the NTFS bitmap. The bitmap itself is read
+ * on the first search.
+ *
+ * @param dis_ctx The dislocker context, whose decrypted volume holds the
+ * filesystem
+ * @return The new bitmap
+ */
+dis_ntfs_bitmap_t dis_ntfs_bitmap_new(dis_context_t dis_ctx)
+{
+	dis_ntfs_bitmap_t bitmap = dis_malloc(sizeof(struct _dis_ntfs_bitmap));
+
+	memset(bitmap, 0, sizeof(struct _dis_ntfs_bitmap));
+	bitmap->dis_ctx = dis_ctx;
+	pthread_mutex_init(&bitmap->lock, NULL);
+
+	return bitmap;
+}
+
+
+/**
+ * Find the first offset, from the given one, which is in an allocated cluster,
+ * or the first one which is in a free cluster. What's past the filesystem's
+ * clusters is considered allocated, as is everything if the bitmap can't be
+ * read.
+ *
+ * @param bitmap The bitmap to look into
+ * @param offset The offset to start looking from
+ * @param allocated TRUE to look for an allocated cluster, FALSE for a free one
+ * @return The offset found, or -1 if there's no free cluster from offset
+ */
+off_t dis_ntfs_bitmap_seek(dis_ntfs_bitmap_t bitmap, off_t offset, int allocated)
+{
+	uint64_t cluster = 0;
+	uint8_t  skip    = allocated ? 0x00 : 0xff;
+	off_t    found   = -1;
+
+	if(!bitmap || offset < 0)
+		return allocated ? offset : -1;
+
+	pthread_mutex_lock(&bitmap->lock);
+
+	if(__atomic_load_n(&bitmap->stale, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&bitmap->stale, FALSE, __ATOMIC_RELAXED);
+		free(bitmap->bits);
+		bitmap->bits   = NULL;
+		bitmap->failed = FALSE;
+	}
+
+	if(!bitmap->bits && !bitmap->failed)
+		bitmap->failed = !load_bitmap(bitmap);
+
+	if(bitmap->failed)
+	{
+		pthread_mutex_unlock(&bitmap->lock);
+		return allocated ? offset : -1;
+	}
+
+	cluster = (uint64_t)offset / bitmap->cluster_size;
+
+	while(cluster < bitmap->nb_clusters)
+	{
+		/* Whole bytes of clusters not looked for are skipped at once */
+		if(cluster % 8 == 0 && bitmap->bits[cluster / 8] == skip)
+		{
+			cluster += 8;
+			continue;
+		}
+
+		if(((bitmap->bits[cluster / 8] >> (cluster % 8)) & 1) == (allocated != FALSE))
+			break;
+
+		cluster++;
+	}
+
+	if(cluster < bitmap->nb_clusters)
+		found = (off_t)(cluster * bitmap->cluster_size);
+	else if(allocated)
+		found = (off_t)(bitmap->nb_clusters * bitmap->cluster_size);
+
+	pthread_mutex_unlock(&bitmap->lock);
+
+	if(found >= 0 && found < offset)
+		found = offset;
+
+	return found;
+}
+
+
+/**
+ * Tell the bitmap the volume has been written, so that it's read again on the
+ * next search
+ *
+ * @param bitmap The bitmap, NULL is accepted and ignored
+ */
+void dis_ntfs_bitmap_invalidate(dis_ntfs_bitmap_t bitmap)
+{
+	if(!bitmap)
+		return;
+
+	/* Most writes find it already set, don't make them all store it */
+	if(!__atomic_load_n(&bitmap->stale, __ATOMIC_RELAXED))
+		__atomic_store_n(&bitmap->stale, TRUE, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Free the bitmap
+ *
+ * @param bitmap The bitmap, NULL is accepted and ignored
+ */
+void dis_ntfs_bitmap_destroy(dis_ntfs_bitmap_t bitmap)
+{
+	if(!bitmap)
+		return;
+
+	pthread_mutex_destroy(&bitmap->lock);
+	free(bitmap->bits);
+	dis_free(bitmap);
+}
@@ -0,0 +1,364 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2012-2013  Romain Coltel, Hervé Schauer Consultants
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dislocker/return_values.h"
+#include "dislocker/inouts/readahead.h"
+#include "dislocker/dislocker.priv.h"
+
+
+/* Chunk size used when the caller doesn't give one */
+#define DIS_STREAM_DEFAULT_CHUNK  (1024 * 1024)
+/* Number of chunks in flight used when the caller doesn't give one */
+#define DIS_STREAM_DEFAULT_CHUNKS 4
+/* Bounds for the number of chunks in flight */
+#define DIS_STREAM_MAX_CHUNKS     64
+
+
+typedef struct _dis_stream_chunk
+{
+	uint8_t* buffer;
+	size_t   size;
+} dis_stream_chunk_t;
+
+
+/*
+ * The chunks are a ring: a background thread decrypts the volume into the
+ * free ones while the caller consumes the filled ones. The chunk last handed
+ * to the caller stays filled until the next call, so it's never overwritten
+ * while the caller uses it.
+ */
+struct _dis_stream
+{
+	dis_context_t       dis_ctx;
+
+	pthread_t           thread;
+	pthread_mutex_t     lock;
+	/* Signaled when a chunk is filled, or when the producer is over */
+	pthread_cond_t      data_cond;
+	/* Signaled when a chunk is given back, or when the stream is closed */
+	pthread_cond_t      space_cond;
+
+	dis_stream_chunk_t* chunks;
+	unsigned int        nb_chunks;
+	size_t              chunk_size;
+
+	/* Next chunk to give to the caller, and next one to fill */
+	unsigned int        head;
+	unsigned int        tail;
+	/* Number of filled chunks, including the one the caller may hold */
+	unsigned int        nb_filled;
+	int                 held;
+
+	/* Next offset to decrypt, where the stream stops, and up to where */
+	off_t               next_offset;
+	off_t               end;
+	off_t               advised;
+
+	int                 eof;
+	int                 error;
+	int                 stop;
+};
+
+
+
+/**
+ * Tell the kernel which part of the volume we're going to read soon, so that
+ * reading it from the disk overlaps with the decryption of the current chunk
+ *
+ * @param stream The stream reading the volume
+ * @param offset Offset of the chunk about to be decrypted
+ */
+static void stream_read_ahead(dis_stream_t stream, off_t offset)
+{
+	off_t window_end = offset + (off_t)(stream->nb_chunks * stream->chunk_size);
+
+	if(window_end > stream->end)
+		window_end = stream->end;
+
+	if(stream->advised < offset)
+		stream->advised = offset;
+
+	if(stream->advised >= window_end)
+		return;
+
+	dis_readahead_advise(
+		&stream->dis_ctx->io_data,
+		stream->advised,
+		window_end - stream->advised
+	);
+
+	stream->advised = window_end;
+}
+
+
+/**
+ * Background thread decrypting the volume ahead of the caller
+ *
+ * @param params The stream to fill
+ */
+static void* stream_producer(void* params)
+{
+	dis_stream_t        stream = (dis_stream_t) params;
+	dis_stream_chunk_t* chunk  = NULL;
+	off_t               offset = 0;
+	size_t              size   = 0;
+	int                 ret    = 0;
+
+	pthread_mutex_lock(&stream->lock);
+
+	while(1)
+	{
+		while(!stream->stop && stream->nb_filled == stream->nb_chunks)
+			pthread_cond_wait(&stream->space_cond, &stream->lock);
+
+		if(stream->stop)
+			break;
+
+		if(stream->next_offset >= stream->end)
+		{
+			stream->eof = TRUE;
+			break;
+		}
+
+		chunk  = &stream->chunks[stream->tail];
+		offset = stream->next_offset;
+		size   = stream->chunk_size;
+		if((off_t)size > stream->end - offset)
+			size = (size_t)(stream->end - offset);
+
+		pthread_mutex_unlock(&stream->lock);
+
+		stream_read_ahead(stream, offset);
+		ret = dislock(stream->dis_ctx, chunk->buffer, offset, size);
+
+		pthread_mutex_lock(&stream->lock);
+
+		if(ret < 0)
+		{
+			dis_printf(
+				L_ERROR,
+				"Stream: cannot decrypt %#" F_SIZE_T " bytes at %#" F_OFF_T "\n",
+				size,
+				offset
+			);
+			stream->error = ret;
+			break;
+		}
+
+		chunk->size          = size;
+		stream->tail         = (stream->tail + 1) % stream->nb_chunks;
+		stream->nb_filled++;
+		stream->next_offset += (off_t) size;
+
+		pthread_cond_signal(&stream->data_cond);
+	}
+
+	pthread_cond_signal(&stream->data_cond);
+	pthread_mutex_unlock(&stream->lock);
+
+	return NULL;
+}
+
+
+/**
+ * Free a stream's chunks and the stream itself
+ */
+static void stream_free(dis_stream_t stream)
+{
+	unsigned int loop = 0;
+
+	if(stream->chunks)
+	{
+		for(loop = 0; loop < stream->nb_chunks; loop++)
+			free(stream->chunks[loop].buffer);
+		free(stream->chunks);
+	}
+
+	free(stream);
+}
+
+
+dis_stream_t dis_stream_open(
+	dis_context_t dis_ctx,
+	off_t offset,
+	size_t chunk_size,
+	unsigned int nb_chunks)
+{
+	dis_stream_t stream = NULL;
+	uint16_t sector_size;
+	unsigned int loop = 0;
+
+
+	if(!dis_ctx || offset < 0)
+		return NULL;
+
+	if(dis_ctx->curr_state != DIS_STATE_COMPLETE_EVERYTHING)
+	{
+		dis_printf(L_ERROR, "Initialization not completed. Abort.\n");
+		return NULL;
+	}
+
+	sector_size = dis_ctx->io_data.sector_size;
+
+	if(chunk_size == 0)
+		chunk_size = DIS_STREAM_DEFAULT_CHUNK;
+	/*
+	 * Whole sectors are decrypted without a bounce buffer. The largest chunk
+	 * is rounded down, as dislock() refuses anything above INT_MAX.
+	 */
+	if(chunk_size > (size_t)INT_MAX / sector_size * sector_size)
+		chunk_size = (size_t)INT_MAX / sector_size * sector_size;
+	else
+		chunk_size = (chunk_size + sector_size - 1) / sector_size * sector_size;
+
+	if(nb_chunks == 0)
+		nb_chunks = DIS_STREAM_DEFAULT_CHUNKS;
+	if(nb_chunks > DIS_STREAM_MAX_CHUNKS)
+		nb_chunks = DIS_STREAM_MAX_CHUNKS;
+
+
+	/*
+	 * NOTE: DO NOT use dis_malloc() here, a failure is given back to the caller
+	 * instead of exiting
+	 */
+	stream = malloc(sizeof(struct _dis_stream));
+	if(!stream)
+		return NULL;
+
+	memset(stream, 0, sizeof(struct _dis_stream));
+	stream->dis_ctx     = dis_ctx;
+	stream->chunk_size  = chunk_size;
+	stream->nb_chunks   = nb_chunks;
+	stream->next_offset = offset;
+	stream->advised     = offset;
+	stream->end         = (off_t) dis_ctx->io_data.volume_size;
+
+	stream->chunks = calloc(nb_chunks, sizeof(dis_stream_chunk_t));
+	if(!stream->chunks)
+	{
+		stream_free(stream);
+		return NULL;
+	}
+
+	for(loop = 0; loop < nb_chunks; loop++)
+	{
+		stream->chunks[loop].buffer = malloc(chunk_size);
+		if(!stream->chunks[loop].buffer)
+		{
+			dis_printf(L_ERROR, "Cannot allocate stream's chunks, abort.\n");
+			stream_free(stream);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->data_cond, NULL);
+	pthread_cond_init(&stream->space_cond, NULL);
+
+	if(pthread_create(&stream->thread, NULL, stream_producer, stream) != 0)
+	{
+		dis_printf(L_ERROR, "Cannot create the stream's thread, abort.\n");
+		pthread_cond_destroy(&stream->space_cond);
+		pthread_cond_destroy(&stream->data_cond);
+		pthread_mutex_destroy(&stream->lock);
+		stream_free(stream);
+		return NULL;
+	}
+
+	dis_printf(
+		L_DEBUG,
+		"Stream opened at %#" F_OFF_T " with %u chunk(s) of %#" F_SIZE_T " bytes\n",
+		offset,
+		nb_chunks,
+		chunk_size
+	);
+
+	return stream;
+}
+
+
+ssize_t dis_stream_next(dis_stream_t stream, const uint8_t** chunk)
+{
+	ssize_t ret = 0;
+
+	if(!stream || !chunk)
+		return -EINVAL;
+
+	*chunk = NULL;
+
+	pthread_mutex_lock(&stream->lock);
+
+	/* The caller is done with the chunk given last time */
+	if(stream->held)
+	{
+		stream->head = (stream->head + 1) % stream->nb_chunks;
+		stream->nb_filled--;
+		stream->held = FALSE;
+		pthread_cond_signal(&stream->space_cond);
+	}
+
+	while(stream->nb_filled == 0 && !stream->eof && !stream->error)
+		pthread_cond_wait(&stream->data_cond, &stream->lock);
+
+	/* Chunks decrypted before an error are still given */
+	if(stream->nb_filled > 0)
+	{
+		*chunk       = stream->chunks[stream->head].buffer;
+		ret          = (ssize_t) stream->chunks[stream->head].size;
+		stream->held = TRUE;
+	}
+	else
+		ret = stream->error;
+
+	pthread_mutex_unlock(&stream->lock);
+
+	return ret;
+}
+
+
+void dis_stream_close(dis_stream_t stream)
+{
+	if(!stream)
+		return;
+
+	pthread_mutex_lock(&stream->lock);
+	stream->stop = TRUE;
+	pthread_cond_signal(&stream->space_cond);
+	pthread_mutex_unlock(&stream->lock);
+
+	pthread_join(stream->thread, NULL);
+
+	pthread_cond_destroy(&stream->space_cond);
+	pthread_cond_destroy(&stream->data_cond);
+	pthread_mutex_destroy(&stream->lock);
+
+	stream_free(stream);
+}
@@ -242,11 +242,20 @@ int dis_vprintf(DIS_LOGS level, const char* format, va_list ap)
 		return 0;
 
 
+	int    ret          = 0;
 	time_t current_time = time(NULL);
-	char* time2string = ctime(&current_time);
+	char   time2string[32];
+
+	if(!ctime_r(&current_time, time2string))
+		time2string[0] = '\0';
 
 	chomp(time2string);
 
+	/* Threads logging at once don't mix their messages up */
+	flockfile(fds[level]);
 	fprintf(fds[level], "%s [%s] ", time2string, msg_tab[level]);
-	return vfprintf(fds[level], format, ap);
+	ret = vfprintf(fds[level], format, ap);
+	funlockfile(fds[level]);
+
+	return ret;
 }
@@ -0,0 +1,829 @@
+/* -*- coding: utf-8 -*- */
+/* -*- mode: c -*- */
+/*
+ * Dislocker -- enables to read/write on BitLocker encrypted partitions under
+ * Linux
+ * Copyright (C) 2026 Arm Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dislocker/dislocker.priv.h"
+#include "dislocker/inouts/sectors.h"
+
+#include "test.h"
+
+
+#define VOLUME_SIZE   (4 * 1024 * 1024)
+#define SECTOR_SIZE   512
+#define NB_THREADS    8
+#define NB_REQUESTS   1500
+
+/*
+ * Each thread owns stripes of the volume, every NB_THREADS one. They're not
+ * a multiple of a sector, so that threads write on the same sectors.
+ */
+#define STRIPES_START (1024 * 1024)
+#define STRIPE_SIZE   (3 * SECTOR_SIZE + 40)
+#define NB_STRIPES    ((2 * 1024 * 1024) / STRIPE_SIZE)
+
+/* Where the W$ 7 virtualized sectors are backed up, when there are some */
+#define BACKUP_ADDR   (3 * 1024 * 1024)
+#define NB_BACKUP     16
+
+/*
+ * The NTFS filesystem written for the SEEK_HOLE/SEEK_DATA tests: a cluster per
+ * sector, the MFT at cluster 4 and the $Bitmap's two clusters in two runs
+ */
+#define NTFS_MFT_LCN      4
+#define NTFS_RECORD_SIZE  1024
+#define NTFS_NB_CLUSTERS  (VOLUME_SIZE / SECTOR_SIZE - 1)
+#define NTFS_BITMAP_LCN1  200
+#define NTFS_BITMAP_LCN2  150
+
+/* Exit code of the tests if they can't run, see SKIP_RETURN_CODE */
+#define TEST_SKIPPED 77
+
+
+typedef struct _stress
+{
+	dis_context_t dis_ctx;
+	/* What the volume should hold, each thread updating its stripes only */
+	uint8_t*      model;
+	long          nb_mismatches;
+} stress_t;
+
+typedef struct _stress_thread
+{
+	stress_t*    stress;
+	unsigned int id;
+} stress_thread_t;
+
+
+
+/**
+ * Build a context on a volume made of a temporary file, as dis_initialize()
+ * does once the keys are known
+ */
+static dis_context_t new_volume(int fd)
+{
+	static volume_header_t         header;
+	static bitlocker_information_t information;
+	static struct _dis_metadata    metadata;
+	static uint8_t                 fvek[64];
+
+	dis_context_t dis_ctx = calloc(1, sizeof(struct _dis_ctx));
+	dis_iodata_t* io_data = &dis_ctx->io_data;
+	size_t        loop    = 0;
+
+	information.version  = V_SEVEN;
+	metadata.information   = &information;
+	metadata.volume_header = &header;
+
+	for(loop = 0; loop < sizeof(fvek); loop++)
+		fvek[loop] = (uint8_t) (loop * 7 + 1);
+
+	dis_ctx->metadata   = &metadata;
+	dis_ctx->curr_state = DIS_STATE_COMPLETE_EVERYTHING;
+
+	io_data->metadata              = &metadata;
+	io_data->volume_fd             = fd;
+	io_data->sector_size           = SECTOR_SIZE;
+	io_data->volume_size           = VOLUME_SIZE;
+	io_data->encrypted_volume_size = VOLUME_SIZE;
+	io_data->volume_state          = TRUE;
+	io_data->decrypt_region        = read_decrypt_sectors;
+	io_data->encrypt_region        = encrypt_write_sectors;
+
+	io_data->crypt = dis_crypt_new(SECTOR_SIZE, AES_XTS_128);
+	dis_crypt_set_fvekey(io_data->crypt, AES_XTS_128, fvek);
+
+	io_data->workers    = dis_workers_new(4);
+	io_data->cache      = dis_cache_new(SECTOR_SIZE, 256 * 1024);
+	io_data->readahead  = dis_readahead_new(io_data);
+	io_data->write_lock = dis_rangelock_new();
+
+	return dis_ctx;
+}
+
+
+/**
+ * Add a metadata region to the volume, which is then read as zeroes
+ */
+static void add_metadata(dis_context_t dis_ctx, uint64_t addr, uint64_t size)
+{
+	dis_metadata_t metadata = dis_ctx->metadata;
+
+	metadata->virt_region[metadata->nb_virt_region].addr = addr;
+	metadata->virt_region[metadata->nb_virt_region].size = size;
+	metadata->nb_virt_region++;
+}
+
+
+/**
+ * Have the volume's first sectors backed up elsewhere, as on W$ 7 volumes
+ */
+static void add_backup(dis_context_t dis_ctx)
+{
+	add_metadata(dis_ctx, BACKUP_ADDR, NB_BACKUP * SECTOR_SIZE);
+	dis_ctx->metadata->virtualized_size    = NB_BACKUP * SECTOR_SIZE;
+	dis_ctx->io_data.backup_sectors_addr = BACKUP_ADDR;
+	dis_ctx->io_data.nb_backup_sectors   = NB_BACKUP;
+}
+
+
+static void destroy_volume(dis_context_t dis_ctx)
+{
+	dis_iodata_t* io_data = &dis_ctx->io_data;
+
+	/* The metadata is shared by all the volumes */
+	dis_ctx->metadata->nb_virt_region   = 0;
+	dis_ctx->metadata->virtualized_size = 0;
+
+	dis_ntfs_bitmap_destroy(dis_ctx->ntfs_bitmap);
+	dis_readahead_destroy(io_data->readahead);
+	dis_workers_destroy(io_data->workers);
+	dis_uring_destroy(io_data->uring);
+	dis_direct_destroy(io_data->direct);
+	dis_cache_destroy(io_data->cache);
+	dis_rangelock_destroy(io_data->write_lock);
+	dis_crypt_destroy(io_data->crypt);
+	free(dis_ctx);
+}
+
+
+/**
+ * Read and write random parts of the thread's stripes
+ */
+static void* stress_thread(void* params)
+{
+	stress_thread_t* thread = (stress_thread_t*) params;
+	stress_t*        stress = thread->stress;
+	unsigned int     seed   = thread->id + 1;
+	uint8_t          buffer[STRIPE_SIZE];
+	int              loop   = 0;
+	size_t           idx    = 0;
+
+	for(loop = 0; loop < NB_REQUESTS; loop++)
+	{
+		size_t stripe = (size_t) rand_r(&seed) % (NB_STRIPES / NB_THREADS)
+		                * NB_THREADS + thread->id;
+		size_t skip   = (size_t) rand_r(&seed) % STRIPE_SIZE;
+		size_t size   = 1 + (size_t) rand_r(&seed) % (STRIPE_SIZE - skip);
+		off_t  offset = STRIPES_START + (off_t) (stripe * STRIPE_SIZE + skip);
+
+		if(rand_r(&seed) % 2)
+		{
+			for(idx = 0; idx < size; idx++)
+				buffer[idx] = (uint8_t) rand_r(&seed);
+
+			if(enlock(stress->dis_ctx, buffer, offset, size) != (int) size)
+				__sync_fetch_and_add(&stress->nb_mismatches, 1);
+
+			memcpy(stress->model + offset, buffer, size);
+		}
+		else if(dislock(stress->dis_ctx, buffer, offset, size) != (int) size ||
+		        memcmp(buffer, stress->model + offset, size) != 0)
+			__sync_fetch_and_add(&stress->nb_mismatches, 1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Threads reading and writing parts of the same sectors at once don't lose
+ * each other's writes
+ */
+static void test_concurrent_dislock_enlock(void)
+{
+	char            path[] = "/tmp/dislocker-test-XXXXXX";
+	pthread_t       threads[NB_THREADS];
+	stress_thread_t params[NB_THREADS];
+	stress_t        stress;
+	uint8_t*        volume = NULL;
+	long            none   = 0;
+	unsigned int    loop   = 0;
+	int             fd     = mkstemp(path);
+
+	if(fd < 0 || ftruncate(fd, VOLUME_SIZE) != 0)
+	{
+		fprintf(stderr, "Cannot create the volume %s\n", path);
+		_failures++;
+		return;
+	}
+
+	unlink(path);
+
+	memset(&stress, 0, sizeof(stress));
+	stress.dis_ctx = new_volume(fd);
+	stress.model   = malloc(VOLUME_SIZE);
+	volume         = malloc(VOLUME_SIZE);
+
+	dislock(stress.dis_ctx, stress.model, 0, VOLUME_SIZE);
+
+	for(loop = 0; loop < NB_THREADS; loop++)
+	{
+		params[loop].stress = &stress;
+		params[loop].id     = loop;
+		pthread_create(&threads[loop], NULL, stress_thread, &params[loop]);
+	}
+
+	for(loop = 0; loop < NB_THREADS; loop++)
+		pthread_join(threads[loop], NULL);
+
+	dislock(stress.dis_ctx, volume, 0, VOLUME_SIZE);
+
+	destroy_volume(stress.dis_ctx);
+	close(fd);
+
+	CHECK_BUFFERS(&stress.nb_mismatches, &none, sizeof(long), sizeof(long));
+	CHECK_BUFFERS(volume, stress.model, VOLUME_SIZE, VOLUME_SIZE);
+
+	free(volume);
+	free(stress.model);
+}
+
+/**
+ * Fill a buffer with random bytes and put them in the model of the volume
+ */
+static void random_write(
+	unsigned int* seed,
+	uint8_t* model,
+	uint8_t* buffer,
+	off_t offset,
+	size_t size)
+{
+	size_t loop = 0;
+
+	for(loop = 0; loop < size; loop++)
+		buffer[loop] = (uint8_t) rand_r(seed);
+
+	memcpy(model + offset, buffer, size);
+}
+
+
+/**
+ * Check writes which don't respect O_DIRECT's alignment. The I/O of a request
+ * share aligned blocks at each split of a large write and between the regions
+ * of dis_writev(), none of them may write back the others' old data.
+ */
+static void test_direct_unaligned_writes(void)
+{
+	char          path[] = "/tmp/dislocker-test-XXXXXX";
+	dis_context_t dis_ctx = NULL;
+	dis_iovec_t   iov[3];
+	uint8_t*      model   = malloc(VOLUME_SIZE);
+	uint8_t*      volume  = malloc(VOLUME_SIZE);
+	uint8_t*      buffer  = malloc(VOLUME_SIZE);
+	long          errors  = 0;
+	long          none    = 0;
+	unsigned int  seed    = 42;
+	int           pass    = 0;
+	int           tmp     = mkstemp(path);
+	int           fd      = open(path, O_RDWR | O_DIRECT);
+
+	if(tmp < 0 || ftruncate(tmp, VOLUME_SIZE) != 0)
+	{
+		fprintf(stderr, "Cannot create the volume %s\n", path);
+		_failures++;
+		return;
+	}
+
+	unlink(path);
+	close(tmp);
+
+	/* Without io_uring, then with it */
+	for(pass = 0; pass < 2 && fd >= 0; pass++)
+	{
+		dis_ctx = new_volume(fd);
+		dis_ctx->io_data.direct = dis_direct_new(fd);
+		if(pass == 1)
+			dis_ctx->io_data.uring = dis_uring_new(DIS_URING_DEPTH);
+
+		if(!dis_ctx->io_data.direct)
+		{
+			destroy_volume(dis_ctx);
+			break;
+		}
+
+		dislock(dis_ctx, model, 0, VOLUME_SIZE);
+
+		/* Split every DIS_URING_MAX_IO_SIZE bytes, in the middle of blocks */
+		random_write(&seed, model, buffer, 512, 600 * 1024);
+		if(enlock(dis_ctx, buffer, 512, 600 * 1024) != 600 * 1024)
+			errors++;
+
+		/* Sectors 9 and 12 share a block, the third region two other ones */
+		iov[0].offset = 9 * SECTOR_SIZE;
+		iov[0].size   = SECTOR_SIZE;
+		iov[1].offset = 12 * SECTOR_SIZE + 100;
+		iov[1].size   = 200;
+		iov[2].offset = 2 * 1024 * 1024 + 3000;
+		iov[2].size   = 3000;
+		iov[0].buffer = buffer;
+		iov[1].buffer = buffer + SECTOR_SIZE;
+		iov[2].buffer = buffer + 2 * SECTOR_SIZE;
+
+		random_write(&seed, model, iov[0].buffer, iov[0].offset, iov[0].size);
+		random_write(&seed, model, iov[1].buffer, iov[1].offset, iov[1].size);
+		random_write(&seed, model, iov[2].buffer, iov[2].offset, iov[2].size);
+		if(dis_writev(dis_ctx, iov, 3) != 3712)
+			errors++;
+
+		dislock(dis_ctx, volume, 0, VOLUME_SIZE);
+		if(memcmp(volume, model, VOLUME_SIZE) != 0)
+			errors++;
+
+		destroy_volume(dis_ctx);
+	}
+
+	if(fd >= 0)
+		close(fd);
+	else
+		fprintf(stderr, "O_DIRECT isn't supported in /tmp, not tested\n");
+
+	free(buffer);
+	free(volume);
+	free(model);
+
+	CHECK_BUFFERS(&errors, &none, sizeof(long), sizeof(long));
+}
+
+
+/**
+ * Tell whether a buffer only holds zeroes
+ */
+static int is_zeroes(const uint8_t* buffer, size_t size)
+{
+	size_t loop = 0;
+
+	for(loop = 0; loop < size; loop++)
+		if(buffer[loop])
+			return FALSE;
+
+	return TRUE;
+}
+
+
+/**
+ * Discard ranges around the metadata and the W$ 7 virtualized sectors. They're
+ * read as zeroes afterward, the rest of the volume being left as it was.
+ */
+static void test_discard(void)
+{
+	char          path[]  = "/tmp/dislocker-test-XXXXXX";
+	dis_context_t dis_ctx = NULL;
+	uint8_t*      model   = malloc(VOLUME_SIZE);
+	uint8_t*      volume  = malloc(VOLUME_SIZE);
+	uint8_t       pattern[5000];
+	uint8_t       raw[5000];
+	long          errors  = 0;
+	long          none    = 0;
+	unsigned int  seed    = 7;
+	size_t        loop    = 0;
+	off_t         offset  = 0;
+	int           ret     = 0;
+	int           fd      = mkstemp(path);
+
+	if(fd < 0 || ftruncate(fd, VOLUME_SIZE) != 0)
+	{
+		fprintf(stderr, "Cannot create the volume %s\n", path);
+		_failures++;
+		return;
+	}
+
+	unlink(path);
+
+	dis_ctx = new_volume(fd);
+	add_metadata(dis_ctx, 1024 * 1024 + 100, sizeof(pattern));
+	add_backup(dis_ctx);
+
+	/* Unless asked for, nothing is deallocated and zeroes are decrypted */
+	if(dis_discard(dis_ctx, 0, VOLUME_SIZE) != -EOPNOTSUPP)
+		errors++;
+	if(dislock(dis_ctx, volume, 2 * 1024 * 1024, SECTOR_SIZE) != SECTOR_SIZE ||
+	   is_zeroes(volume, SECTOR_SIZE))
+		errors++;
+
+	dis_ctx->io_data.discard = TRUE;
+
+	for(offset = 0; offset < VOLUME_SIZE; offset += SECTOR_SIZE)
+	{
+		if(dis_metadata_is_overwritten(dis_ctx->metadata, offset, SECTOR_SIZE)
+		   != DIS_RET_SUCCESS)
+			continue;
+
+		random_write(&seed, model, volume, offset, SECTOR_SIZE);
+		if(enlock(dis_ctx, volume, offset, SECTOR_SIZE) != SECTOR_SIZE)
+			errors++;
+	}
+
+	dislock(dis_ctx, model, 0, VOLUME_SIZE);
+
+	for(loop = 0; loop < sizeof(pattern); loop++)
+		pattern[loop] = (uint8_t) rand_r(&seed);
+	if(pwrite(fd, pattern, sizeof(pattern), 1024 * 1024 + 100) != sizeof(pattern))
+		errors++;
+
+	ret = dis_discard(dis_ctx, 2 * 1024 * 1024, 64 * 1024);
+	if(ret == -EOPNOTSUPP)
+	{
+		fprintf(stderr, "Punching holes isn't supported in /tmp, not tested\n");
+		destroy_volume(dis_ctx);
+		close(fd);
+		free(volume);
+		free(model);
+		return;
+	}
+	if(ret != 0)
+		errors++;
+	memset(model + 2 * 1024 * 1024, 0, 64 * 1024);
+
+	/* The virtualized sectors are deallocated where they're backed up */
+	if(dis_discard(dis_ctx, 0, 3 * SECTOR_SIZE + 7) != 0)
+		errors++;
+	memset(model, 0, 3 * SECTOR_SIZE + 7);
+
+	/* Both ends are parts of sectors, the metadata is in the middle */
+	if(dis_discard(dis_ctx, 1024 * 1024 - 300, 8000) != 0)
+		errors++;
+	memset(model + 1024 * 1024 - 300, 0, 8000);
+
+	/* Whole sectors are deallocated, the partial ones rewritten */
+	if(pread(fd, raw, 3 * SECTOR_SIZE, BACKUP_ADDR) != 3 * SECTOR_SIZE ||
+	   !is_zeroes(raw, 3 * SECTOR_SIZE))
+		errors++;
+	if(pread(fd, raw, SECTOR_SIZE, BACKUP_ADDR + 3 * SECTOR_SIZE) != SECTOR_SIZE ||
+	   is_zeroes(raw, SECTOR_SIZE))
+		errors++;
+	if(pread(fd, raw, SECTOR_SIZE, 2 * 1024 * 1024) != SECTOR_SIZE ||
+	   !is_zeroes(raw, SECTOR_SIZE))
+		errors++;
+
+	/* The metadata is left as it is */
+	if(pread(fd, raw, sizeof(raw), 1024 * 1024 + 100) != sizeof(raw) ||
+	   memcmp(raw, pattern, sizeof(raw)) != 0)
+		errors++;
+
+	dislock(dis_ctx, volume, 0, VOLUME_SIZE);
+
+	destroy_volume(dis_ctx);
+	close(fd);
+
+	CHECK_BUFFERS(&errors, &none, sizeof(long), sizeof(long));
+	CHECK_BUFFERS(volume, model, VOLUME_SIZE, VOLUME_SIZE);
+
+	free(volume);
+	free(model);
+}
+
+
+/**
+ * Check what dis_seek() finds, counting the mismatches
+ */
+static void check_seek(
+	dis_context_t dis_ctx,
+	off_t offset,
+	int whence,
+	off_t expected,
+	long* errors)
+{
+	off_t found = dis_seek(dis_ctx, offset, whence);
+
+	if(found == expected)
+		return;
+
+	fprintf(
+		stderr,
+		"Seeking %s from %#llx: got %#llx (%lld), expected %#llx\n",
+		whence == SEEK_DATA ? "data" : "a hole",
+		(long long) offset,
+		(long long) found,
+		(long long) found,
+		(long long) expected
+	);
+	(*errors)++;
+}
+
+
+/**
+ * Write the NTFS $Bitmap's data, whose two halves are in clusters apart
+ */
+static int write_ntfs_bitmap(dis_context_t dis_ctx, uint8_t* bits)
+{
+	size_t half = (NTFS_NB_CLUSTERS + 7) / 8 / 2;
+
+	return enlock(dis_ctx, bits, NTFS_BITMAP_LCN1 * SECTOR_SIZE, half) == (int) half &&
+	       enlock(dis_ctx, bits + half, NTFS_BITMAP_LCN2 * SECTOR_SIZE, half) == (int) half;
+}
+
+
+/**
+ * Write the parts of an NTFS filesystem the bitmap is read from: its boot
+ * sector, the MFT record of $Bitmap and the bitmap itself. The runlist goes
+ * backward, and over the end of the record's first sector, whose bytes are
+ * then in the update sequence array.
+ */
+static int write_ntfs(dis_context_t dis_ctx, uint8_t* bits)
+{
+	static const uint8_t runlist[] = {
+		0x21, 0x01, NTFS_BITMAP_LCN1, 0x00,
+		0x21, 0x01, (uint8_t) (NTFS_BITMAP_LCN2 - NTFS_BITMAP_LCN1), 0xff,
+		0x00
+	};
+
+	uint8_t  boot[SECTOR_SIZE];
+	uint8_t  record[NTFS_RECORD_SIZE];
+	uint8_t* attr     = record + 0x1b8;
+	uint64_t value    = 0;
+
+	memset(boot, 0, sizeof(boot));
+	memcpy(boot + 3, "NTFS    ", 8);
+	boot[0x0b] = SECTOR_SIZE & 0xff;
+	boot[0x0c] = SECTOR_SIZE >> 8;
+	boot[0x0d] = 1;
+	value = NTFS_NB_CLUSTERS;
+	memcpy(boot + 0x28, &value, sizeof(value));
+	value = NTFS_MFT_LCN;
+	memcpy(boot + 0x30, &value, sizeof(value));
+	/* Records of 2^10 bytes */
+	boot[0x40] = 0xf6;
+	boot[510]  = 0x55;
+	boot[511]  = 0xaa;
+
+	memset(record, 0, sizeof(record));
+	memcpy(record, "FILE", 4);
+	record[0x04] = 0x30;
+	record[0x06] = NTFS_RECORD_SIZE / SECTOR_SIZE + 1;
+	record[0x14] = 0x38;
+
+	/* A $STANDARD_INFORMATION attribute comes first */
+	record[0x38] = 0x10;
+	record[0x3c] = 0x80;
+	record[0x3d] = 0x01;
+	record[0x48] = 0x48;
+	record[0x4c] = 0x18;
+
+	/* The unnamed, non-resident, $DATA attribute */
+	attr[0x00] = 0x80;
+	attr[0x04] = 0x50;
+	attr[0x08] = 1;
+	attr[0x20] = 0x40;
+	value = (NTFS_NB_CLUSTERS + 7) / 8;
+	memcpy(attr + 0x30, &value, sizeof(value));
+	memcpy(attr + 0x40, runlist, sizeof(runlist));
+	memset(attr + 0x50, 0xff, 4);
+
+	/* The update sequence number 1 ends both sectors of the record */
+	record[0x30] = 1;
+	memcpy(record + 0x32, record + SECTOR_SIZE - 2, 2);
+	memcpy(record + 0x34, record + NTFS_RECORD_SIZE - 2, 2);
+	memcpy(record + SECTOR_SIZE - 2, record + 0x30, 2);
+	memcpy(record + NTFS_RECORD_SIZE - 2, record + 0x30, 2);
+
+	return enlock(dis_ctx, boot, 0, sizeof(boot)) == sizeof(boot) &&
+	       enlock(
+	           dis_ctx,
+	           record,
+	           NTFS_MFT_LCN * SECTOR_SIZE + 6 * NTFS_RECORD_SIZE,
+	           sizeof(record)
+	       ) == sizeof(record) &&
+	       write_ntfs_bitmap(dis_ctx, bits);
+}
+
+
+static void set_clusters(uint8_t* bits, size_t first, size_t end)
+{
+	for(; first < end; first++)
+		bits[first / 8] |= (uint8_t) (1 << (first % 8));
+}
+
+
+/**
+ * The metadata is found as holes, and the NTFS free clusters too when they're
+ * reported, both kinds of holes being skipped together when looking for data
+ */
+static void test_seek(void)
+{
+	char          path[]  = "/tmp/dislocker-test-XXXXXX";
+	dis_context_t dis_ctx = NULL;
+	uint8_t       bits[(NTFS_NB_CLUSTERS + 7) / 8];
+	uint8_t       boot[SECTOR_SIZE];
+	long          errors  = 0;
+	long          none    = 0;
+	int           fd      = mkstemp(path);
+
+	if(fd < 0 || ftruncate(fd, VOLUME_SIZE) != 0)
+	{
+		fprintf(stderr, "Cannot create the volume %s\n", path);
+		_failures++;
+		return;
+	}
+
+	unlink(path);
+
+	/* Sectors 2048 to 2059, in two adjacent regions, and the backup */
+	dis_ctx = new_volume(fd);
+	add_metadata(dis_ctx, 1024 * 1024 + 100, 5000);
+	add_metadata(dis_ctx, 2058 * SECTOR_SIZE, 2 * SECTOR_SIZE);
+	add_backup(dis_ctx);
+
+	check_seek(dis_ctx, 0, SEEK_HOLE, 2048 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 100, SEEK_DATA, 100, &errors);
+	check_seek(dis_ctx, 2048 * SECTOR_SIZE, SEEK_DATA, 2060 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 2050 * SECTOR_SIZE + 3, SEEK_HOLE, 2050 * SECTOR_SIZE + 3, &errors);
+	check_seek(dis_ctx, 2060 * SECTOR_SIZE, SEEK_HOLE, BACKUP_ADDR, &errors);
+	check_seek(dis_ctx, BACKUP_ADDR, SEEK_DATA, BACKUP_ADDR + NB_BACKUP * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, BACKUP_ADDR + NB_BACKUP * SECTOR_SIZE, SEEK_HOLE, VOLUME_SIZE, &errors);
+	check_seek(dis_ctx, VOLUME_SIZE - 1, SEEK_DATA, VOLUME_SIZE - 1, &errors);
+
+	/* Nothing is found at the end or after it, nor before the start */
+	check_seek(dis_ctx, VOLUME_SIZE, SEEK_DATA, -ENXIO, &errors);
+	check_seek(dis_ctx, VOLUME_SIZE, SEEK_HOLE, -ENXIO, &errors);
+	check_seek(dis_ctx, VOLUME_SIZE + 4096, SEEK_DATA, -ENXIO, &errors);
+	check_seek(dis_ctx, -1, SEEK_HOLE, -ENXIO, &errors);
+	check_seek(dis_ctx, 0, SEEK_END, -EINVAL, &errors);
+
+	/* The free clusters 2000 to 2099 surround the metadata */
+	memset(bits, 0, sizeof(bits));
+	set_clusters(bits, 0, 300);
+	set_clusters(bits, 1000, 2000);
+	set_clusters(bits, 2100, 2200);
+	set_clusters(bits, 5000, 5001);
+	if(!write_ntfs(dis_ctx, bits))
+		errors++;
+
+	dis_ctx->cfg.flags   |= DIS_FLAG_NTFS_HOLES;
+	dis_ctx->ntfs_bitmap  = dis_ntfs_bitmap_new(dis_ctx);
+
+	check_seek(dis_ctx, 0, SEEK_HOLE, 300 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 299 * SECTOR_SIZE + 5, SEEK_DATA, 299 * SECTOR_SIZE + 5, &errors);
+	check_seek(dis_ctx, 300 * SECTOR_SIZE, SEEK_DATA, 1000 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 1000 * SECTOR_SIZE + 7, SEEK_HOLE, 2000 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 2000 * SECTOR_SIZE, SEEK_DATA, 2100 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 2100 * SECTOR_SIZE, SEEK_HOLE, 2200 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 2200 * SECTOR_SIZE, SEEK_DATA, 5000 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 5000 * SECTOR_SIZE, SEEK_HOLE, 5001 * SECTOR_SIZE, &errors);
+
+	/* What's past the filesystem's clusters is data */
+	check_seek(dis_ctx, 5001 * SECTOR_SIZE, SEEK_DATA, NTFS_NB_CLUSTERS * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, NTFS_NB_CLUSTERS * SECTOR_SIZE, SEEK_HOLE, VOLUME_SIZE, &errors);
+
+	/* The bitmap is read again once it's written */
+	set_clusters(bits, 400, 401);
+	if(!write_ntfs_bitmap(dis_ctx, bits))
+		errors++;
+
+	check_seek(dis_ctx, 300 * SECTOR_SIZE, SEEK_DATA, 400 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 400 * SECTOR_SIZE, SEEK_HOLE, 401 * SECTOR_SIZE, &errors);
+
+	/* Clusters of 2^32 sectors aren't trusted, their shift mustn't wrap */
+	if(dislock(dis_ctx, boot, 0, sizeof(boot)) != sizeof(boot))
+		errors++;
+	boot[0x0d] = 0xe0;
+	if(enlock(dis_ctx, boot, 0, sizeof(boot)) != sizeof(boot))
+		errors++;
+
+	check_seek(dis_ctx, 0, SEEK_HOLE, 2048 * SECTOR_SIZE, &errors);
+
+	/* Without a filesystem, only the metadata is reported */
+	memset(boot, 0, sizeof(boot));
+	if(enlock(dis_ctx, boot, 0, sizeof(boot)) != sizeof(boot))
+		errors++;
+
+	check_seek(dis_ctx, 0, SEEK_HOLE, 2048 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 2000 * SECTOR_SIZE, SEEK_DATA, 2000 * SECTOR_SIZE, &errors);
+	check_seek(dis_ctx, 2048 * SECTOR_SIZE, SEEK_DATA, 2060 * SECTOR_SIZE, &errors);
+
+	destroy_volume(dis_ctx);
+	close(fd);
+
+	CHECK_BUFFERS(&errors, &none, sizeof(long), sizeof(long));
+}
+
+
+/* What the volume read by the cache tests holds, changed to see stale sectors */
+static uint8_t cached_version = 0;
+
+static int version_region(
+	dis_iodata_t* io_data,
+	size_t nb_read_sector,
+	uint16_t sector_size,
+	off_t sector_start,
+	uint8_t* output)
+{
+	(void) io_data;
+	(void) sector_start;
+
+	memset(output, cached_version, nb_read_sector * sector_size);
+
+	return TRUE;
+}
+
+
+/**
+ * Invalidated sectors are read again, whether the region is smaller than the
+ * cache or larger, the other ones being still taken from the cache
+ */
+static void test_cache_invalidate(void)
+{
+	/* Four sectors per shard */
+	dis_cache_t  cache   = dis_cache_new(SECTOR_SIZE, 4 * DIS_CACHE_SHARDS * SECTOR_SIZE);
+	dis_iodata_t io_data;
+	uint8_t      buffer[8 * SECTOR_SIZE];
+	long         errors  = 0;
+	long         none    = 0;
+
+	memset(&io_data, 0, sizeof(io_data));
+	io_data.decrypt_region = version_region;
+
+	cached_version = 1;
+	dis_cache_decrypt_region(cache, &io_data, 8, SECTOR_SIZE, 0, buffer);
+	dis_cache_decrypt_region(cache, &io_data, 8, SECTOR_SIZE, 100 * SECTOR_SIZE, buffer);
+	cached_version = 2;
+
+	/* A sector, then more sectors than the cache holds */
+	dis_cache_invalidate(cache, 3 * SECTOR_SIZE + 10, 20);
+	dis_cache_invalidate(cache, 90 * SECTOR_SIZE, 1000 * SECTOR_SIZE);
+
+	dis_cache_decrypt_region(cache, &io_data, 8, SECTOR_SIZE, 0, buffer);
+	if(buffer[2 * SECTOR_SIZE] != 1 || buffer[3 * SECTOR_SIZE] != 2 ||
+	   buffer[4 * SECTOR_SIZE] != 1)
+		errors++;
+
+	dis_cache_decrypt_region(cache, &io_data, 8, SECTOR_SIZE, 100 * SECTOR_SIZE, buffer);
+	if(buffer[0] != 2 || buffer[7 * SECTOR_SIZE] != 2)
+		errors++;
+
+	dis_cache_destroy(cache);
+
+	CHECK_BUFFERS(&errors, &none, sizeof(long), sizeof(long));
+}
+
+/**
+ * Tell whether the crypto backend works here, AF_ALG needing the kernel's
+ */
+static int backend_works(void)
+{
+	uint8_t     fvek[64];
+	dis_crypt_t crypt = dis_crypt_new(SECTOR_SIZE, AES_XTS_128);
+	int         ret   = 0;
+	size_t      loop  = 0;
+
+	/* XTS refuses the same data and tweak keys */
+	for(loop = 0; loop < sizeof(fvek); loop++)
+		fvek[loop] = (uint8_t) loop;
+
+	ret = dis_crypt_set_fvekey(crypt, AES_XTS_128, fvek);
+
+	dis_crypt_destroy(crypt);
+
+	return ret != DIS_RET_ERROR_CRYPTO_INIT;
+}
+
+int main(void)
+{
+	if(!backend_works())
+	{
+		printf("The crypto backend can't be used, skipped\n");
+		return TEST_SKIPPED;
+	}
+
+	ADD_TEST(test_concurrent_dislock_enlock);
+	ADD_TEST(test_direct_unaligned_writes);
+	ADD_TEST(test_discard);
+	ADD_TEST(test_seek);
+	ADD_TEST(test_cache_invalidate);
+
+	printf("--- Statistics ---\n");
+	printf("Total: %d\n", _tests);
+	printf("Pass:  %d\n", _tests - _failures);
+	printf("Fail:  %d\n", _failures);
+	printf("-------------------\n");
+
+	return _failures & 0xFF;
+}
@@ -20,15 +20,26 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
  * USA.
  */
+#include <errno.h>
 #include <setjmp.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include "ssl_bindings.h"
+#include "dislocker/encryption/aes-ni.h"
+#include "dislocker/encryption/aes-vaes.h"
+#include "dislocker/encryption/diffuser.h"
 
 #include "test.h"
 #include "test_vectors.h"
 
+
+/* Exit code of a test which couldn't run, see SKIP_RETURN_CODE */
+#define TEST_SKIPPED 77
+
 static void test_ecb_encrypt_128(void)
 {
 	AES_CONTEXT ctx = {0};
@@ -52,6 +63,28 @@ static void test_ecb_encrypt_128(void)
 	AES_FREE(&ctx);
 }
 
+static void test_ecb_encrypt_192(void) {
+	AES_CONTEXT ctx = {0};
+
+	NEW_ARRAY_FROM(unsigned char, buf, orig_16);
+
+	/* Test AES ECB 192 Encryption */
+	AES_SETENC_KEY(&ctx, key_aes_192, sizeof(key_aes_192) * 8);
+
+	AES_ECB_ENC(&ctx, AES_ENCRYPT, buf, buf);
+
+	CHECK_STATIC_BUFFERS(buf, expected_aes_ecb_192);
+
+	/* Test AES ECB 192 Decryption */
+	AES_SETDEC_KEY(&ctx, key_aes_192, sizeof(key_aes_192) * 8);
+
+	AES_ECB_ENC(&ctx, AES_DECRYPT, buf, buf);
+
+	CHECK_STATIC_BUFFERS(buf, orig_16);
+
+	AES_FREE(&ctx);
+}
+
 static void test_ecb_encrypt_256(void) {
 	AES_CONTEXT ctx = {0};
 
@@ -109,6 +142,33 @@ static void test_cbc_encrypt_128(void) {
 	AES_FREE(&ctx);
 }
 
+static void test_cbc_encrypt_192(void) {
+	AES_CONTEXT ctx = {0};
+
+	NEW_ARRAY_FROM(unsigned char, buf, orig_512);
+
+	/* mbedtls requires a mutable IV */
+	NEW_ARRAY_FROM(unsigned char, iv, static_iv);
+
+	/* Test AES CBC 192 Encryption */
+	AES_SETENC_KEY(&ctx, key_aes_192, sizeof(key_aes_192) * 8);
+
+	AES_CBC(&ctx, AES_ENCRYPT, sizeof(buf), iv, buf, buf);
+
+	CHECK_STATIC_BUFFERS(buf, expected_cbc_192);
+
+	/* Test AES CBC 192 Decryption */
+	memcpy(iv, static_iv, sizeof(iv));
+
+	AES_SETDEC_KEY(&ctx, key_aes_192, sizeof(key_aes_192) * 8);
+
+	AES_CBC(&ctx, AES_DECRYPT, sizeof(expected_cbc_192), iv, expected_cbc_192, buf);
+
+	CHECK_STATIC_BUFFERS(buf, orig_512);
+
+	AES_FREE(&ctx);
+}
+
 static void test_cbc_encrypt_256(void) {
 	AES_CONTEXT ctx = {0};
 
@@ -256,19 +316,438 @@ static void test_xts_encrypt_256(void) {
 	AES_FREE(&tweak_ctx);
 }
 
+#ifdef DIS_BUILTIN_LANES
+/* OpenSSL and mbedtls have no XTS-AES-192 */
+static void test_xts_encrypt_192(void) {
+	AES_CONTEXT ctx = {0};
+	AES_CONTEXT tweak_ctx = {0};
+
+	NEW_ARRAY_FROM(unsigned char, buf, orig_16);
+
+	NEW_ARRAY_FROM(unsigned char, iv, static_iv);
+
+	/* Test AES XTS 192 Encryption */
+	AES_SETENC_KEY(&ctx, key_aes_192, sizeof(key_aes_192) * 8);
+	AES_SETENC_KEY(&tweak_ctx, key_aes_tweak_192, sizeof(key_aes_tweak_192) * 8);
+
+	AES_XTS(&ctx, &tweak_ctx, AES_ENCRYPT, sizeof(buf), iv, buf, buf);
+
+	CHECK_STATIC_BUFFERS(buf, expected_xts_192);
+
+	/* Test AES XTS 192 Decryption */
+	memcpy(iv, static_iv, sizeof(iv));
+
+	AES_SETDEC_KEY(&ctx, key_aes_192, sizeof(key_aes_192) * 8);
+
+	AES_XTS(&ctx, &tweak_ctx, AES_DECRYPT, sizeof(buf), iv, buf, buf);
+
+	CHECK_STATIC_BUFFERS(buf, orig_16);
+
+	AES_FREE(&ctx);
+	AES_FREE(&tweak_ctx);
+}
+
+/*
+ * Under DIS_BUILTIN_AES_ENV=portable, the tests above must not have run on
+ * the AES-NI or VAES kernels
+ */
+static void test_builtin_portable(void) {
+	AES_CONTEXT  ctx      = {0};
+	const char*  aes      = getenv(DIS_BUILTIN_AES_ENV);
+	int          portable = aes && strcmp(aes, "portable") == 0;
+	unsigned int used_ni  = 0;
+	unsigned int want_ni  = !portable && dis_aesni_available();
+
+	AES_SETENC_KEY(&ctx, key_aes_256, sizeof(key_aes_256) * 8);
+	used_ni = ctx.ni.nb_rounds != 0;
+	AES_FREE(&ctx);
+
+	CHECK_BUFFERS(&used_ni, &want_ni, sizeof(used_ni), sizeof(want_ni));
+}
+#endif
+
+static void test_xts_aesni(
+	const char *key,
+	const char *tweak_key,
+	unsigned int key_bits,
+	const char *expected,
+	size_t expected_size)
+{
+	AES_CONTEXT ctx = {0};
+	AES_CONTEXT tweak_ctx = {0};
+	dis_aesni_key_t enc_key;
+	dis_aesni_key_t dec_key;
+	dis_aesni_key_t tweak_enc_key;
+
+	NEW_ARRAY_FROM(unsigned char, buf, orig_16);
+	NEW_ARRAY_FROM(unsigned char, big, orig_512);
+	NEW_ARRAY_FROM(unsigned char, ref, orig_512);
+	NEW_ARRAY_FROM(unsigned char, iv, static_iv);
+
+	/* Nothing to test if the CPU can't run the kernel */
+	if(!dis_aesni_available())
+		return;
+
+	dis_aesni_set_key(&enc_key, &dec_key, (const uint8_t *)key, key_bits);
+	dis_aesni_set_key(&tweak_enc_key, NULL, (const uint8_t *)tweak_key, key_bits);
+
+	/* Same vectors as the backend's */
+	dis_aesni_crypt_xts(&enc_key, &tweak_enc_key, 1, sizeof(buf), iv, buf, buf);
+
+	CHECK_BUFFERS(buf, expected, sizeof(buf), expected_size);
+
+	dis_aesni_crypt_xts(&dec_key, &tweak_enc_key, 0, sizeof(buf), iv, buf, buf);
+
+	CHECK_STATIC_BUFFERS(buf, orig_16);
+
+	/* A whole sector goes through the pipelined path */
+	AES_SETENC_KEY(&ctx, (const unsigned char *)key, key_bits);
+	AES_SETENC_KEY(&tweak_ctx, (const unsigned char *)tweak_key, key_bits);
+
+	AES_XTS(&ctx, &tweak_ctx, AES_ENCRYPT, sizeof(ref), iv, ref, ref);
+
+	memcpy(iv, static_iv, sizeof(iv));
+	dis_aesni_crypt_xts(&enc_key, &tweak_enc_key, 1, sizeof(big), iv, big, big);
+
+	CHECK_STATIC_BUFFERS(big, ref);
+
+	dis_aesni_crypt_xts(&dec_key, &tweak_enc_key, 0, sizeof(big), iv, big, big);
+
+	CHECK_STATIC_BUFFERS(big, orig_512);
+
+	/* Ciphertext stealing, the first blocks being left as they are */
+	dis_aesni_crypt_xts(&enc_key, &tweak_enc_key, 1, sizeof(big) - 7, iv, big, big);
+
+	CHECK_BUFFERS(big, ref, sizeof(big) - 32, sizeof(ref) - 32);
+
+	dis_aesni_crypt_xts(&dec_key, &tweak_enc_key, 0, sizeof(big) - 7, iv, big, big);
+
+	CHECK_STATIC_BUFFERS(big, orig_512);
+
+	AES_FREE(&ctx);
+	AES_FREE(&tweak_ctx);
+}
+
+static void test_xts_aesni_128(void) {
+	test_xts_aesni(
+		key_aes_128,
+		key_aes_tweak_128,
+		sizeof(key_aes_128) * 8,
+		expected_xts_128,
+		sizeof(expected_xts_128)
+	);
+}
+
+static void test_xts_aesni_256(void) {
+	test_xts_aesni(
+		key_aes_256,
+		key_aes_tweak_256,
+		sizeof(key_aes_256) * 8,
+		expected_xts_256,
+		sizeof(expected_xts_256)
+	);
+}
+
+static void test_cbc_aesni(
+	const char *key,
+	unsigned int key_bits,
+	const char *expected_ecb,
+	const char *expected_cbc,
+	size_t expected_cbc_size)
+{
+	dis_aesni_key_t enc_key;
+	dis_aesni_key_t dec_key;
+
+	NEW_ARRAY_FROM(unsigned char, block, orig_16);
+	unsigned char buf[sizeof(orig_512)];
+	size_t loop;
+
+	/* Nothing to test if the CPU can't run the kernel */
+	if(!dis_aesni_available())
+		return;
+
+	dis_aesni_set_key(&enc_key, &dec_key, (const uint8_t *)key, key_bits);
+
+	/* The IVs are computed one block at a time */
+	dis_aesni_crypt_block(&enc_key, 1, block, block);
+
+	CHECK_BUFFERS(block, expected_ecb, sizeof(block), sizeof(orig_16));
+
+	dis_aesni_crypt_block(&dec_key, 0, block, block);
+
+	CHECK_STATIC_BUFFERS(block, orig_16);
+
+	/* Same vectors as the backend's */
+	dis_aesni_decrypt_cbc(&dec_key, expected_cbc_size, static_iv,
+		(const uint8_t *)expected_cbc, buf);
+
+	CHECK_STATIC_BUFFERS(buf, orig_512);
+
+	/* In place, the last blocks not filling the pipeline */
+	memcpy(buf, expected_cbc, sizeof(buf));
+	dis_aesni_decrypt_cbc(&dec_key, sizeof(buf) - 48, static_iv, buf, buf);
+
+	CHECK_BUFFERS(buf, orig_512, sizeof(buf) - 48, sizeof(orig_512) - 48);
+
+	/* ECB on eleven blocks: a full pipeline, a pair and a lone one */
+	memcpy(buf, orig_512, sizeof(buf));
+	dis_aesni_crypt_ecb(&enc_key, 1, 11, buf, buf);
+
+	for(loop = 0; loop < 11; loop++)
+	{
+		memcpy(block, orig_512 + loop * 16, sizeof(block));
+		dis_aesni_crypt_block(&enc_key, 1, block, block);
+		CHECK_BUFFERS(buf + loop * 16, block, sizeof(block), sizeof(block));
+	}
+
+	dis_aesni_crypt_ecb(&dec_key, 0, 11, buf, buf);
+
+	CHECK_BUFFERS(buf, orig_512, 11 * 16, 11 * 16);
+}
+
+static void test_cbc_aesni_128(void) {
+	test_cbc_aesni(
+		key_aes_128,
+		sizeof(key_aes_128) * 8,
+		aes_ecb_128_expected,
+		expected_cbc_128,
+		sizeof(expected_cbc_128)
+	);
+}
+
+static void test_cbc_aesni_256(void) {
+	test_cbc_aesni(
+		key_aes_256,
+		sizeof(key_aes_256) * 8,
+		expected_aes_ecb_256,
+		expected_cbc_256,
+		sizeof(expected_cbc_256)
+	);
+}
+
+#define VAES_NB_SECTORS 6
+#define VAES_FIRST_SECTOR 0x2a
+
+static void set_sector_iv(unsigned char *iv, uint64_t value)
+{
+	size_t loop;
+
+	memset(iv, 0, 16);
+	for(loop = 0; loop < 8; loop++)
+		iv[loop] = (unsigned char)(value >> (loop * 8));
+}
+
+static void test_vaes_sectors(
+	const char *key,
+	const char *tweak_key,
+	unsigned int key_bits)
+{
+	AES_CONTEXT ctx = {0};
+	AES_CONTEXT tweak_ctx = {0};
+	dis_aesni_key_t enc_key;
+	dis_aesni_key_t dec_key;
+	dis_aesni_key_t tweak_enc_key;
+	unsigned char sectors[VAES_NB_SECTORS * sizeof(orig_512)];
+	unsigned char ref[sizeof(sectors)];
+	unsigned char iv[16];
+	const size_t ss = sizeof(orig_512);
+	const uint64_t address = VAES_FIRST_SECTOR * ss;
+	unsigned int width;
+	size_t loop;
+
+	/* Nothing to test if the CPU can't run the kernels */
+	if(dis_vaes_width() == DIS_VAES_NONE)
+		return;
+
+	dis_aesni_set_key(&enc_key, &dec_key, (const uint8_t *)key, key_bits);
+	dis_aesni_set_key(&tweak_enc_key, NULL, (const uint8_t *)tweak_key, key_bits);
+	AES_SETENC_KEY(&ctx, (const unsigned char *)key, key_bits);
+	AES_SETENC_KEY(&tweak_ctx, (const unsigned char *)tweak_key, key_bits);
+
+	for(loop = 0; loop < VAES_NB_SECTORS; loop++)
+		memcpy(sectors + loop * ss, orig_512, ss);
+
+	/* XTS, each sector's tweak being its number */
+	for(loop = 0; loop < VAES_NB_SECTORS; loop++)
+	{
+		set_sector_iv(iv, VAES_FIRST_SECTOR + loop);
+		AES_XTS(&ctx, &tweak_ctx, AES_ENCRYPT, ss, iv, sectors + loop * ss, ref + loop * ss);
+	}
+
+	for(width = dis_vaes_width(); width >= DIS_VAES_256; width /= 2)
+	{
+		dis_vaes_crypt_xts_sectors(width, &enc_key, &tweak_enc_key, 1, ss,
+			VAES_NB_SECTORS, VAES_FIRST_SECTOR, sectors, sectors);
+
+		CHECK_STATIC_BUFFERS(sectors, ref);
+
+		dis_vaes_crypt_xts_sectors(width, &dec_key, &tweak_enc_key, 0, ss,
+			VAES_NB_SECTORS, VAES_FIRST_SECTOR, sectors, sectors);
+
+		for(loop = 0; loop < VAES_NB_SECTORS; loop++)
+			CHECK_BUFFERS(sectors + loop * ss, orig_512, ss, sizeof(orig_512));
+	}
+
+	/* CBC, each sector's IV being its encrypted address */
+	for(loop = 0; loop < VAES_NB_SECTORS; loop++)
+	{
+		set_sector_iv(iv, address + loop * ss);
+		AES_ECB_ENC(&ctx, AES_ENCRYPT, iv, iv);
+		AES_CBC(&ctx, AES_ENCRYPT, ss, iv, sectors + loop * ss, ref + loop * ss);
+	}
+
+	for(width = dis_vaes_width(); width >= DIS_VAES_256; width /= 2)
+	{
+		dis_vaes_encrypt_cbc_sectors(width, &enc_key, ss,
+			VAES_NB_SECTORS, address, sectors, sectors);
+
+		CHECK_STATIC_BUFFERS(sectors, ref);
+
+		dis_vaes_decrypt_cbc_sectors(width, &dec_key, &enc_key, ss,
+			VAES_NB_SECTORS, address, sectors, sectors);
+
+		for(loop = 0; loop < VAES_NB_SECTORS; loop++)
+			CHECK_BUFFERS(sectors + loop * ss, orig_512, ss, sizeof(orig_512));
+	}
+
+	AES_FREE(&ctx);
+	AES_FREE(&tweak_ctx);
+}
+
+static void test_vaes_sectors_128(void) {
+	test_vaes_sectors(
+		key_aes_128,
+		key_aes_tweak_128,
+		sizeof(key_aes_128) * 8
+	);
+}
+
+static void test_vaes_sectors_256(void) {
+	test_vaes_sectors(
+		key_aes_256,
+		key_aes_tweak_256,
+		sizeof(key_aes_256) * 8
+	);
+}
+
+#define DIFFUSER_NB_SECTORS 11
+
+static void test_diffuser_sectors(void) {
+	unsigned char sectors[DIFFUSER_NB_SECTORS * sizeof(orig_512)];
+	unsigned char ref[sizeof(sectors)];
+	unsigned char orig[sizeof(sectors)];
+	const uint16_t ss = sizeof(orig_512);
+	size_t loop;
+
+	/* Different sectors, so that mixing lanes up would show */
+	for(loop = 0; loop < sizeof(orig); loop++)
+		orig[loop] = orig_512[loop % ss] ^ (unsigned char)(loop / ss);
+
+	memcpy(sectors, orig, sizeof(sectors));
+	memcpy(ref, orig, sizeof(ref));
+
+	/* The batched diffusers give what the per-sector ones do */
+	diffuser_encrypt_sectors(sectors, ss, DIFFUSER_NB_SECTORS);
+	for(loop = 0; loop < DIFFUSER_NB_SECTORS; loop++)
+	{
+		diffuserA_encrypt(ref + loop * ss, ss, (uint32_t *)(ref + loop * ss));
+		diffuserB_encrypt(ref + loop * ss, ss, (uint32_t *)(ref + loop * ss));
+	}
+
+	CHECK_STATIC_BUFFERS(sectors, ref);
+
+	diffuser_decrypt_sectors(sectors, ss, DIFFUSER_NB_SECTORS);
+	for(loop = 0; loop < DIFFUSER_NB_SECTORS; loop++)
+	{
+		diffuserB_decrypt(ref + loop * ss, ss, (uint32_t *)(ref + loop * ss));
+		diffuserA_decrypt(ref + loop * ss, ss, (uint32_t *)(ref + loop * ss));
+	}
+
+	CHECK_STATIC_BUFFERS(sectors, ref);
+	CHECK_STATIC_BUFFERS(sectors, orig);
+}
+
+static void test_diffuser_known_answer(void) {
+	unsigned char sectors[DIFFUSER_NB_SECTORS * sizeof(orig_512)];
+	unsigned char single[sizeof(orig_512)];
+	unsigned char expected[sizeof(sectors)];
+	unsigned char keyed[sizeof(sectors)];
+	const uint16_t ss = sizeof(orig_512);
+	size_t loop;
+
+	for(loop = 0; loop < sizeof(keyed); loop++)
+		keyed[loop] = orig_512[loop % ss] ^ diffuser_sector_key[loop % 32];
+	for(loop = 0; loop < sizeof(expected); loop++)
+		expected[loop] = expected_diffuser_512[loop % ss];
+
+	/* Per sector */
+	memcpy(single, keyed, ss);
+	diffuserA_encrypt(single, ss, (uint32_t *)single);
+	diffuserB_encrypt(single, ss, (uint32_t *)single);
+
+	CHECK_BUFFERS(single, expected_diffuser_512, ss, sizeof(expected_diffuser_512));
+
+	diffuserB_decrypt(single, ss, (uint32_t *)single);
+	diffuserA_decrypt(single, ss, (uint32_t *)single);
+
+	CHECK_BUFFERS(single, keyed, ss, ss);
+
+	/* Batched, the same sector in every lane */
+	memcpy(sectors, keyed, sizeof(sectors));
+	diffuser_encrypt_sectors(sectors, ss, DIFFUSER_NB_SECTORS);
+
+	CHECK_STATIC_BUFFERS(sectors, expected);
+
+	diffuser_decrypt_sectors(sectors, ss, DIFFUSER_NB_SECTORS);
+
+	CHECK_STATIC_BUFFERS(sectors, keyed);
+}
+
 int main(int argc, char *argv[])
 {
+#ifdef DIS_AFALG_CIPHER_ECB
+	/* Passing must mean the kernel's AES has been tested */
+	int afalg = socket(AF_ALG, SOCK_SEQPACKET, 0);
+	if(afalg < 0 && errno == EAFNOSUPPORT)
+	{
+		printf("The kernel doesn't have AF_ALG, skipped\n");
+		return TEST_SKIPPED;
+	}
+	if(afalg >= 0)
+		close(afalg);
+#endif
+
 	ADD_TEST(test_ecb_encrypt_128);
+	ADD_TEST(test_ecb_encrypt_192);
 	ADD_TEST(test_ecb_encrypt_256);
 
 	ADD_TEST(test_cbc_encrypt_128);
+	ADD_TEST(test_cbc_encrypt_192);
 	ADD_TEST(test_cbc_encrypt_256);
 
 	ADD_TEST(test_xex_encrypt_128);
 	ADD_TEST(test_xex_encrypt_256);
 
 	ADD_TEST(test_xts_encrypt_128);
+#ifdef DIS_BUILTIN_LANES
+	ADD_TEST(test_xts_encrypt_192);
+#endif
 	ADD_TEST(test_xts_encrypt_256);
+#ifdef DIS_BUILTIN_LANES
+	ADD_TEST(test_builtin_portable);
+#endif
+
+	ADD_TEST(test_xts_aesni_128);
+	ADD_TEST(test_xts_aesni_256);
+
+	ADD_TEST(test_cbc_aesni_128);
+	ADD_TEST(test_cbc_aesni_256);
+
+	ADD_TEST(test_vaes_sectors_128);
+	ADD_TEST(test_vaes_sectors_256);
+
+	ADD_TEST(test_diffuser_sectors);
+	ADD_TEST(test_diffuser_known_answer);
 
 	printf("--- Statistics ---\n");
 	printf("Total: %d\n", _tests);
@@ -28,6 +28,12 @@ static const char key_aes_128[] = {
 	'8', '9', '0', '1', '2', '3', '4', '5'
 };
 
+static const char key_aes_192[] = {
+	'0', '1', '2', '3', '4', '5', '6', '7',
+	'8', '9', '0', '1', '2', '3', '4', '5',
+	'0', '1', '2', '3', '4', '5', '6', '7'
+};
+
 static const char key_aes_256[] = {
 	'0', '1', '2', '3', '4', '5', '6', '7',
 	'8', '9', '0', '1', '2', '3', '4', '5',
@@ -40,6 +46,12 @@ static const char key_aes_tweak_128[] = {
 	'7', '6', '5', '4', '3', '2', '1', '0'
 };
 
+static const char key_aes_tweak_192[] = {
+	'5', '4', '3', '2', '1', '0', '9', '8',
+	'7', '6', '5', '4', '3', '2', '1', '0',
+	'5', '4', '3', '2', '1', '0', '9', '8'
+};
+
 static const char key_aes_tweak_256[] = {
 	'5', '4', '3', '2', '1', '0', '9', '8',
 	'7', '6', '5', '4', '3', '2', '1', '0',
@@ -66,6 +78,11 @@ static const char aes_ecb_128_expected[] = {
 	0x6F, 0xA7, 0xF8, 0x92
 };
 
+static const char expected_aes_ecb_192[] = {
+	0x60, 0x7F, 0x9C, 0x3E, 0x17, 0x31, 0x68, 0xEA,
+	0xD7, 0xD0, 0xFC, 0xBF, 0x54, 0xDC, 0x2D, 0x09
+};
+
 static const char expected_aes_ecb_256[] = {
     0xB5, 0x73, 0x10, 0xBB,
     0x6B, 0xC2, 0xFE, 0x09,
@@ -207,6 +224,73 @@ static const char expected_cbc_128[] = {
 	0x7B, 0xDA, 0x80, 0x52, 0xD9, 0x4D, 0xF5, 0xD1
 };
 
+static const char expected_cbc_192[] = {
+	0xF9, 0xA6, 0xC1, 0x30, 0xD0, 0x74, 0x94, 0x15,
+	0xD4, 0x9B, 0x12, 0x83, 0x8E, 0x83, 0xBD, 0xA7,
+	0xEB, 0xC9, 0x62, 0xA4, 0xA8, 0x69, 0x68, 0xBE,
+	0x59, 0x01, 0x10, 0xCD, 0x99, 0x7B, 0x8F, 0x1F,
+	0x79, 0xBD, 0xE5, 0xEC, 0xC4, 0xFF, 0x37, 0xF2,
+	0xED, 0x2B, 0x9E, 0x87, 0xDF, 0xC1, 0x84, 0xCC,
+	0xB3, 0xB2, 0xA3, 0xA2, 0x78, 0x85, 0x2A, 0x7C,
+	0xA7, 0xB0, 0x98, 0xB7, 0x88, 0x28, 0x68, 0x4F,
+	0x1B, 0x35, 0x1C, 0x35, 0x43, 0xC9, 0x25, 0xDD,
+	0x21, 0x40, 0xB1, 0x56, 0xD6, 0x53, 0xC3, 0xCD,
+	0x34, 0xA1, 0x54, 0x17, 0x5B, 0xB1, 0xC6, 0xAF,
+	0x61, 0xCA, 0xC7, 0xAF, 0x66, 0xBA, 0x8B, 0x43,
+	0xF1, 0x46, 0x52, 0xC1, 0x27, 0x59, 0xDE, 0xBF,
+	0xA3, 0x36, 0xA1, 0x1B, 0x56, 0x1C, 0x48, 0x4A,
+	0xCB, 0x2F, 0xB2, 0x2E, 0xFD, 0x01, 0x0D, 0x7F,
+	0xFD, 0x90, 0x42, 0x2B, 0x15, 0x69, 0x45, 0x78,
+	0x94, 0xC5, 0x2E, 0xE1, 0x81, 0x4F, 0xF4, 0x40,
+	0x5E, 0x80, 0xB9, 0xF0, 0x57, 0xC3, 0xD5, 0x6B,
+	0x31, 0x80, 0x92, 0xBB, 0x98, 0xF9, 0x8E, 0xCD,
+	0xB3, 0xA0, 0x85, 0xD8, 0xBF, 0xF0, 0xC2, 0xA7,
+	0x05, 0xC9, 0x64, 0xE0, 0x6D, 0x9A, 0xA0, 0xAF,
+	0x71, 0x3A, 0x4E, 0x72, 0xA9, 0x18, 0x84, 0x2B,
+	0xD1, 0xA9, 0xF0, 0xF4, 0xED, 0x5D, 0xBF, 0x77,
+	0x1B, 0xB8, 0x43, 0x1C, 0x76, 0x56, 0x70, 0xAE,
+	0xA9, 0x64, 0xC8, 0x93, 0xD0, 0x69, 0x66, 0xC8,
+	0x1C, 0xFA, 0xBF, 0xB5, 0xAF, 0x6F, 0xAA, 0xDD,
+	0x9B, 0xDA, 0x9E, 0x57, 0x19, 0xBD, 0x72, 0x0F,
+	0xF0, 0x8E, 0x3D, 0xE1, 0xFD, 0x11, 0x7D, 0xA3,
+	0x19, 0x8A, 0xAC, 0x1E, 0xC9, 0xF5, 0x9C, 0x2D,
+	0x2E, 0x19, 0x18, 0x74, 0x3B, 0xA8, 0x12, 0xDE,
+	0x46, 0x67, 0x74, 0x4C, 0xBB, 0x2B, 0x69, 0x86,
+	0x34, 0x61, 0x12, 0x15, 0x90, 0x72, 0x6F, 0x60,
+	0xBC, 0x7E, 0x0C, 0xE1, 0x80, 0xFB, 0xF1, 0xF5,
+	0x2F, 0x10, 0xEB, 0x27, 0x46, 0xEA, 0xF6, 0x33,
+	0xBD, 0x12, 0x13, 0x73, 0x3D, 0xF9, 0xFD, 0x08,
+	0x68, 0x8A, 0xB4, 0xDD, 0xDF, 0xF3, 0xDF, 0xF6,
+	0x05, 0xE7, 0xA6, 0x58, 0xAB, 0xB2, 0x0C, 0x85,
+	0xE4, 0xEB, 0x13, 0x92, 0x27, 0x8D, 0x03, 0x14,
+	0x90, 0xEF, 0xC9, 0xAE, 0x16, 0xD9, 0x45, 0xE9,
+	0x16, 0xD3, 0x26, 0x97, 0x1F, 0x40, 0x98, 0x4A,
+	0x57, 0xAE, 0x61, 0x63, 0xF2, 0x5D, 0xBE, 0x78,
+	0x8F, 0x5A, 0x7E, 0x3B, 0x8C, 0x13, 0x45, 0xFF,
+	0x28, 0xF7, 0xA8, 0x97, 0x04, 0xFA, 0x7B, 0xE0,
+	0x02, 0x0B, 0x5F, 0x48, 0x42, 0x6C, 0xF8, 0xFF,
+	0xC4, 0x37, 0x03, 0x1D, 0x65, 0x1C, 0x74, 0x61,
+	0xFC, 0xFC, 0xF3, 0xED, 0x01, 0x44, 0x5C, 0xE0,
+	0x9B, 0xF5, 0x73, 0xAB, 0x42, 0x85, 0xF0, 0x97,
+	0xCF, 0x9E, 0x13, 0xC6, 0x67, 0xAC, 0x7B, 0x8A,
+	0xE3, 0xC6, 0x0A, 0x2C, 0x71, 0xD2, 0x3B, 0xB5,
+	0xCF, 0x2D, 0x1D, 0xCB, 0xEC, 0xDD, 0x0E, 0xF4,
+	0x0B, 0x6F, 0xBB, 0xCD, 0x44, 0xD6, 0xFF, 0xB3,
+	0x4C, 0xFB, 0xEF, 0x69, 0xB3, 0x07, 0xFA, 0x4D,
+	0xF6, 0xEA, 0x4B, 0x02, 0xF1, 0x35, 0x70, 0x26,
+	0xE5, 0x3F, 0xD4, 0x84, 0x8C, 0xE9, 0x11, 0x73,
+	0xBB, 0x05, 0x4C, 0xD3, 0xAF, 0x57, 0xB0, 0x5A,
+	0xD8, 0xC3, 0x82, 0xE9, 0x8D, 0x59, 0x3C, 0x85,
+	0xDA, 0x7F, 0x92, 0x42, 0x31, 0x1B, 0x59, 0xF7,
+	0x3B, 0xFA, 0xC3, 0xAE, 0xE3, 0xBC, 0x15, 0x70,
+	0xF0, 0xA9, 0x8C, 0xEB, 0x6B, 0x19, 0xAB, 0x66,
+	0xE1, 0x54, 0xC1, 0x57, 0x68, 0xE7, 0x65, 0xF0,
+	0x4D, 0x40, 0x92, 0x2F, 0xC2, 0x03, 0x15, 0x38,
+	0xB3, 0x72, 0x1C, 0xE1, 0x83, 0x5A, 0xA9, 0x98,
+	0xD4, 0xC6, 0xA6, 0xCF, 0x49, 0xE1, 0xCF, 0x0F,
+	0x60, 0xD7, 0x37, 0xE2, 0xAB, 0xDA, 0x2D, 0x12
+};
+
 static const char expected_cbc_256[] = {
 	0xD0, 0x6B, 0x93, 0x3B, 0x8F, 0xE0, 0x67, 0x2E, 0x8F, 0xE2, 0x75, 0xDD, 0x90, 0x1D, 0xFE, 0xD9,
 	0xA0, 0x67, 0xDB, 0x2F, 0xE9, 0x99, 0xEF, 0x9D, 0xD0, 0x25, 0x9F, 0x87, 0xFD, 0xE7, 0x53, 0xFA,
@@ -257,9 +341,92 @@ static const char expected_xts_128[] = {
 	0xD9, 0x5A, 0xC6, 0x49, 0x6D, 0xA5, 0x21, 0xDC
 };
 
+static const char expected_xts_192[] = {
+	0x5F, 0x0A, 0x5B, 0x31, 0x1A, 0x74, 0x66, 0xFD,
+	0x1F, 0x38, 0x29, 0x04, 0xC9, 0xA1, 0x6C, 0xEB
+};
+
 static const char expected_xts_256[] = {
 	0x0D, 0x77, 0x51, 0xB6, 0x7E, 0xD1, 0xAE, 0x57,
 	0xFE, 0xBA, 0x0C, 0xD2, 0x64, 0x33, 0x9C, 0x96
 };
 
+/*
+ * A sector key, and orig_512 once XORed with it and through the diffusers A
+ * then B, as the original per-sector diffuser code gives it
+ */
+static const char diffuser_sector_key[] = {
+	0x3C, 0x91, 0x5E, 0x07, 0xA4, 0xD2, 0x68, 0x1F,
+	0xB9, 0x4A, 0xE3, 0x72, 0x0D, 0xC6, 0x85, 0x2B,
+	0x57, 0xF0, 0x19, 0xAE, 0x63, 0x8D, 0x34, 0xCB,
+	0x02, 0x7E, 0xD5, 0x48, 0x9F, 0x16, 0xBA, 0xE1
+};
+
+static const char expected_diffuser_512[] = {
+	0xF4, 0x24, 0xBA, 0xE9, 0x44, 0x38, 0x02, 0x33,
+	0x7E, 0xAC, 0x87, 0x0A, 0x19, 0x6F, 0x7C, 0xD5,
+	0xA1, 0xCB, 0xD2, 0x97, 0xFC, 0x39, 0xDB, 0x14,
+	0x3D, 0x40, 0x7D, 0x0F, 0xCE, 0xB0, 0xE3, 0x4F,
+	0x0E, 0x60, 0x57, 0x04, 0x59, 0x9E, 0x70, 0xDC,
+	0x43, 0x8B, 0xEE, 0x7F, 0x32, 0xD8, 0xAE, 0x1B,
+	0xF9, 0x2F, 0x27, 0xF1, 0xD4, 0x81, 0xF0, 0xE2,
+	0x6A, 0x4C, 0x33, 0xC0, 0x5A, 0x49, 0x77, 0x5F,
+	0x6B, 0x6E, 0x33, 0xF8, 0x83, 0x84, 0x7F, 0xBE,
+	0x0A, 0x87, 0x6D, 0x09, 0x59, 0x7E, 0x8B, 0xE0,
+	0x3D, 0x90, 0x50, 0x57, 0x06, 0x4D, 0x13, 0xB5,
+	0x5B, 0x11, 0xA6, 0x1E, 0xF9, 0x86, 0xD8, 0x37,
+	0xEF, 0xBD, 0x7D, 0xB8, 0x55, 0x5B, 0xBA, 0xC9,
+	0x0E, 0x6D, 0x27, 0x0E, 0xA0, 0x96, 0xE8, 0x8B,
+	0x97, 0x45, 0x1B, 0xEC, 0xD8, 0x41, 0x3F, 0x52,
+	0x23, 0x14, 0x0E, 0x89, 0x02, 0xB0, 0x17, 0xC9,
+	0x9B, 0x01, 0x5C, 0x34, 0x09, 0x11, 0x3A, 0x12,
+	0x39, 0x56, 0x1B, 0xD6, 0x3B, 0x01, 0xCA, 0xC1,
+	0xA9, 0x12, 0x19, 0xF0, 0x4F, 0xF9, 0xD6, 0x37,
+	0x80, 0xB6, 0xE3, 0xB6, 0x7B, 0xC0, 0x13, 0x57,
+	0x8F, 0xB9, 0x74, 0xF2, 0x02, 0x48, 0xF3, 0xC7,
+	0x16, 0x44, 0x7A, 0x7A, 0xD7, 0x60, 0x85, 0x63,
+	0x91, 0xE8, 0xFB, 0x8F, 0xB8, 0xE7, 0xB7, 0x8A,
+	0x69, 0x86, 0xEE, 0x2F, 0x63, 0xA5, 0x64, 0x1F,
+	0x2D, 0x1A, 0xB6, 0x73, 0xF3, 0x04, 0xA4, 0x4F,
+	0x3B, 0x62, 0x49, 0x6E, 0x49, 0x48, 0xB0, 0x42,
+	0x6E, 0x26, 0x83, 0x8F, 0x40, 0x4A, 0xAD, 0xD4,
+	0xB8, 0xBB, 0x8A, 0x8C, 0x18, 0x46, 0xB1, 0xF2,
+	0xE7, 0xDB, 0x5B, 0x7B, 0x6A, 0x50, 0x7E, 0xFF,
+	0xC9, 0x46, 0x34, 0xE5, 0x12, 0x2F, 0xA3, 0xED,
+	0x8B, 0xBC, 0x60, 0x17, 0x35, 0x75, 0xE1, 0xD1,
+	0x2C, 0x1A, 0x39, 0xAD, 0x06, 0x54, 0xAC, 0x45,
+	0x44, 0x97, 0x2C, 0xFB, 0xFA, 0xE5, 0x09, 0x80,
+	0xA9, 0xB8, 0x12, 0xCE, 0xB3, 0xB7, 0x69, 0x83,
+	0xB9, 0x15, 0x4F, 0x95, 0x91, 0xDA, 0xEB, 0x11,
+	0x82, 0x29, 0x7C, 0x89, 0xA9, 0x3F, 0xB2, 0x94,
+	0x5D, 0x99, 0xBB, 0x9F, 0x65, 0xD5, 0xF6, 0xD8,
+	0xCE, 0x92, 0x1C, 0x82, 0x55, 0x7D, 0x0C, 0x99,
+	0xF2, 0x77, 0x09, 0x28, 0xC1, 0xA4, 0x90, 0xF8,
+	0x51, 0x94, 0xEB, 0x54, 0xC9, 0xFF, 0xA8, 0xE8,
+	0xA3, 0x6B, 0x15, 0x91, 0x65, 0x0A, 0x65, 0x10,
+	0x19, 0x90, 0xAF, 0x61, 0xC4, 0x16, 0x90, 0x49,
+	0xCD, 0x9C, 0x05, 0x8A, 0x8F, 0x42, 0x66, 0xAA,
+	0x9B, 0x3D, 0x5A, 0x21, 0xE9, 0xCA, 0x1F, 0x7F,
+	0x57, 0xCE, 0x05, 0xAF, 0xA4, 0x52, 0xD7, 0x7C,
+	0x98, 0xF2, 0x87, 0x29, 0xBB, 0xFA, 0xCB, 0x7B,
+	0x36, 0x09, 0x00, 0x12, 0x7A, 0x2D, 0x6C, 0x85,
+	0xC9, 0xAB, 0xEE, 0xB6, 0xD4, 0x60, 0xF4, 0x46,
+	0x74, 0x2F, 0xE2, 0xF0, 0xD4, 0xEB, 0x0E, 0x25,
+	0x69, 0x8C, 0xB9, 0x25, 0x31, 0xBA, 0x07, 0x1E,
+	0x10, 0x0B, 0x38, 0x3D, 0xCB, 0xB4, 0xD7, 0x0C,
+	0x1A, 0xA0, 0x58, 0x04, 0x53, 0x58, 0xDE, 0x6F,
+	0xB2, 0xB6, 0xE7, 0xD2, 0x79, 0x08, 0xFA, 0xE4,
+	0xEE, 0xDA, 0xE4, 0x2A, 0x6E, 0xFE, 0x81, 0x81,
+	0x78, 0x10, 0xA5, 0xC7, 0x8D, 0x65, 0xF8, 0x09,
+	0xE6, 0x0F, 0xE6, 0x6E, 0xA5, 0x45, 0x7E, 0x56,
+	0x3C, 0x53, 0x5F, 0x72, 0x60, 0xCD, 0x0C, 0xC3,
+	0xD3, 0xC1, 0xCA, 0xE7, 0x5E, 0xCD, 0x58, 0x71,
+	0x8E, 0xDD, 0x6B, 0x96, 0xDD, 0x1C, 0x54, 0xF8,
+	0x64, 0x6B, 0x21, 0x7C, 0x26, 0x2C, 0x0A, 0xA4,
+	0xFA, 0x2F, 0xB6, 0xAE, 0xA6, 0x99, 0xCF, 0x87,
+	0x5F, 0x4F, 0x9C, 0x71, 0x30, 0x60, 0x1C, 0xFE,
+	0x19, 0x09, 0xC3, 0x3C, 0x1E, 0x65, 0x5A, 0x84,
+	0xC7, 0x5C, 0xA8, 0x81, 0x03, 0x26, 0x28, 0xA6
+};
+
 #endif /* TEST_VECTORS_H_ */